@@ -0,0 +1,85 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * AST Arena - Flat, index-based storage for syntax trees
+ *
+ * All nodes of a tree live in one growable array and refer to each other
+ * by 32-bit NodeId instead of by pointer, so a tree is a handful of large
+ * allocations rather than one per node, string and child array. Child
+ * lists are built on a scratch stack while they are parsed and then copied
+ * into a single shared list array. Names and literals are interned
+ * Symbols, so nodes hold no strings of their own. The whole tree is
+ * released with one free_ast() call.
+ */
+
+#include "flipscript.h"
+#include "flipscript_types.h"
+
+#define AST_INITIAL_NODES 256
+#define AST_INITIAL_LISTS 256
+
+static void* grow_array(void* data, uint32_t* capacity, uint32_t needed, size_t element_size) {
+    if (needed <= *capacity) return data;
+    uint32_t new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < needed) new_capacity *= 2;
+    data = realloc(data, (size_t)new_capacity * element_size);
+    if (!data) {
+        fprintf(stderr, "Error: Out of memory while building the AST\n");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return data;
+}
+
+// Create an empty arena. Node 0 is reserved so that NULL_NODE never
+// refers to a real node.
+Ast* create_ast(void) {
+    Ast* ast = (Ast*)calloc(1, sizeof(Ast));
+    ast->nodes = (ASTNode*)grow_array(NULL, &ast->node_capacity, AST_INITIAL_NODES, sizeof(ASTNode));
+    memset(&ast->nodes[0], 0, sizeof(ASTNode));
+    ast->node_count = 1;
+    ast->lists = (NodeId*)grow_array(NULL, &ast->list_capacity, AST_INITIAL_LISTS, sizeof(NodeId));
+    ast->root = NULL_NODE;
+    return ast;
+}
+
+// Release the arena together with every node and list in it
+void free_ast(Ast* ast) {
+    if (ast == NULL) return;
+    free(ast->nodes);
+    free(ast->lists);
+    free(ast->scratch);
+    free(ast);
+}
+
+// Append a zeroed node and return its id. Invalidates ASTNode pointers.
+NodeId create_node(Ast* ast, NodeType type) {
+    ast->nodes = (ASTNode*)grow_array(ast->nodes, &ast->node_capacity, ast->node_count + 1, sizeof(ASTNode));
+    NodeId id = ast->node_count++;
+    memset(&ast->nodes[id], 0, sizeof(ASTNode));
+    ast->nodes[id].type = type;
+    return id;
+}
+
+// Start a child list. Lists nest: an inner list must be ended before the
+// outer one continues.
+uint32_t ast_list_begin(Ast* ast) {
+    return ast->scratch_count;
+}
+
+void ast_list_push(Ast* ast, NodeId node) {
+    ast->scratch = (NodeId*)grow_array(ast->scratch, &ast->scratch_capacity, ast->scratch_count + 1, sizeof(NodeId));
+    ast->scratch[ast->scratch_count++] = node;
+}
+
+// Move the children pushed since `mark` into the shared list array
+NodeList ast_list_end(Ast* ast, uint32_t mark) {
+    NodeList list;
+    list.start = ast->list_count;
+    list.count = ast->scratch_count - mark;
+    if (list.count == 0) return list;
+    ast->lists = (NodeId*)grow_array(ast->lists, &ast->list_capacity, ast->list_count + list.count, sizeof(NodeId));
+    memcpy(&ast->lists[list.start], &ast->scratch[mark], list.count * sizeof(NodeId));
+    ast->list_count += list.count;
+    ast->scratch_count = mark;
+    return list;
+}
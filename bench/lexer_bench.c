@@ -0,0 +1,116 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * Lexer Microbenchmark - Bulk character scanning vs. the byte-at-a-time loops
+ *
+ * Build and run with `make bench`. Each case scans a synthetic buffer of
+ * runs separated by a terminator byte, once with the ctype-based loop the
+ * lexer used to have and once with the charclass.c scanner, and reports
+ * throughput in MB/s.
+ */
+
+#include <time.h>
+#include "../flipscript.h"
+
+#define BUFFER_SIZE (16 * 1024 * 1024)
+#define ITERATIONS 8
+
+typedef size_t (*ScanFunction)(const char* source, size_t pos, size_t length);
+
+// The loops the lexer used before charclass.c
+static size_t ctype_identifier(const char* source, size_t pos, size_t length) {
+    while (pos < length &&
+           (isalnum((unsigned char)source[pos]) || source[pos] == '_' ||
+            isdigit((unsigned char)source[pos]) || source[pos] == '.')) {
+        pos++;
+    }
+    return pos;
+}
+
+static size_t ctype_spaces(const char* source, size_t pos, size_t length) {
+    while (pos < length && (source[pos] == ' ' || source[pos] == '\t' || source[pos] == '\r')) pos++;
+    return pos;
+}
+
+static size_t ctype_line_end(const char* source, size_t pos, size_t length) {
+    while (pos < length && source[pos] != '\n') pos++;
+    return pos;
+}
+
+static size_t ctype_string_body(const char* source, size_t pos, size_t length) {
+    while (pos < length && source[pos] != '"' && source[pos] != '\\') pos++;
+    return pos;
+}
+
+static size_t simd_string_body(const char* source, size_t pos, size_t length) {
+    return scan_string_body(source, pos, length, '"');
+}
+
+// Fill the buffer with runs of `alphabet` of random length in [1, max_run],
+// each followed by `terminator`
+static void fill_runs(char* buffer, const char* alphabet, char terminator, int max_run) {
+    size_t alphabet_length = strlen(alphabet);
+    size_t pos = 0;
+    srand(42);
+    while (pos < BUFFER_SIZE) {
+        int run = 1 + rand() % max_run;
+        for (int i = 0; i < run && pos < BUFFER_SIZE; i++) buffer[pos++] = alphabet[rand() % alphabet_length];
+        if (pos < BUFFER_SIZE) buffer[pos++] = terminator;
+    }
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Scan the whole buffer run by run; returns MB/s
+static double measure(ScanFunction scan, const char* buffer, size_t* checksum) {
+    double start = now_seconds();
+    for (int iteration = 0; iteration < ITERATIONS; iteration++) {
+        size_t pos = 0;
+        while (pos < BUFFER_SIZE) {
+            size_t end = scan(buffer, pos, BUFFER_SIZE);
+            *checksum += end;
+            pos = end + 1;
+        }
+    }
+    double elapsed = now_seconds() - start;
+    return (double)BUFFER_SIZE * ITERATIONS / elapsed / (1024.0 * 1024.0);
+}
+
+static void run_case(const char* name, char* buffer, const char* alphabet, char terminator,
+                     int max_run, ScanFunction scalar, ScanFunction simd) {
+    size_t scalar_checksum = 0, simd_checksum = 0;
+    fill_runs(buffer, alphabet, terminator, max_run);
+    double scalar_rate = measure(scalar, buffer, &scalar_checksum);
+    double simd_rate = measure(simd, buffer, &simd_checksum);
+    printf("%-22s run<=%-4d %9.1f MB/s %9.1f MB/s  %5.2fx%s\n", name, max_run,
+           scalar_rate, simd_rate, simd_rate / scalar_rate,
+           scalar_checksum == simd_checksum ? "" : "  MISMATCH");
+}
+
+int main(void) {
+    char* buffer = (char*)malloc(BUFFER_SIZE);
+    if (!buffer) return 1;
+
+#if defined(__AVX2__)
+    const char* path = "AVX2";
+#elif defined(__SSE2__)
+    const char* path = "SSE2";
+#else
+    const char* path = "scalar table";
+#endif
+    printf("FlipScript lexer scan benchmark (%s path)\n", path);
+    printf("%-22s %-9s %14s %14s  %s\n", "case", "", "ctype loop", "charclass", "speedup");
+
+    const char* ident = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.";
+    run_case("identifiers", buffer, ident, '(', 12, ctype_identifier, scan_identifier);
+    run_case("identifiers", buffer, ident, '(', 40, ctype_identifier, scan_identifier);
+    run_case("indentation", buffer, " ", 'x', 16, ctype_spaces, scan_spaces);
+    run_case("comments", buffer, ident, '\n', 80, ctype_line_end, scan_line_end);
+    run_case("string literals", buffer, ident, '"', 32, ctype_string_body, simd_string_body);
+
+    free(buffer);
+    return 0;
+}
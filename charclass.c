@@ -0,0 +1,173 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * Character Classification - Bulk scanning helpers for the lexer
+ *
+ * Every scan_* function starts at `pos` and returns the position of the
+ * first byte that does not belong to the run (or `length`). On x86-64 the
+ * runs are classified 16 bytes at a time with SSE2, or 32 at a time when
+ * the compiler targets AVX2 (-mavx2); the remaining bytes, and every byte
+ * on other targets, go through the 256-entry char_class table. Unlike
+ * isalpha()/isdigit() the classes do not depend on the current locale.
+ */
+
+#include "flipscript.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define RANGE(lo, hi, bits) [lo ... hi] = (bits)
+
+const unsigned char char_class[256] = {
+    [' '] = CHAR_SPACE,
+    ['\t'] = CHAR_SPACE,
+    ['\r'] = CHAR_SPACE,
+    RANGE('a', 'z', CHAR_IDENT_START | CHAR_IDENT),
+    RANGE('A', 'Z', CHAR_IDENT_START | CHAR_IDENT),
+    ['_'] = CHAR_IDENT_START | CHAR_IDENT,
+    RANGE('0', '9', CHAR_IDENT | CHAR_DIGIT | CHAR_NUMBER),
+    ['.'] = CHAR_IDENT | CHAR_NUMBER,
+};
+
+#undef RANGE
+
+// Scalar fallback: advance while the class table matches `mask`
+static size_t scan_table(const char* source, size_t pos, size_t length, unsigned char mask) {
+    while (pos < length && (char_class[(unsigned char)source[pos]] & mask)) pos++;
+    return pos;
+}
+
+#if defined(__SSE2__)
+// Bytes of `v` within [lo, hi]. Only used for ASCII ranges, so bytes with
+// the high bit set (negative as signed chars) never match.
+static inline __m128i in_range_16(__m128i v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((char)(lo - 1))),
+                         _mm_cmpgt_epi8(_mm_set1_epi8((char)(hi + 1)), v));
+}
+
+static inline __m128i ident_16(__m128i v) {
+    __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i match = _mm_or_si128(in_range_16(folded, 'a', 'z'), in_range_16(v, '0', '9'));
+    match = _mm_or_si128(match, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    return _mm_or_si128(match, _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+}
+
+static inline __m128i space_16(__m128i v) {
+    __m128i match = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    match = _mm_or_si128(match, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+    return _mm_or_si128(match, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+}
+
+static inline __m128i number_16(__m128i v) {
+    return _mm_or_si128(in_range_16(v, '0', '9'), _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+}
+#endif
+
+#if defined(__AVX2__)
+static inline __m256i in_range_32(__m256i v, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8((char)(lo - 1))),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(hi + 1)), v));
+}
+
+static inline __m256i ident_32(__m256i v) {
+    __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i match = _mm256_or_si256(in_range_32(folded, 'a', 'z'), in_range_32(v, '0', '9'));
+    match = _mm256_or_si256(match, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+    return _mm256_or_si256(match, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')));
+}
+
+static inline __m256i space_32(__m256i v) {
+    __m256i match = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    match = _mm256_or_si256(match, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+    return _mm256_or_si256(match, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+}
+
+static inline __m256i number_32(__m256i v) {
+    return _mm256_or_si256(in_range_32(v, '0', '9'), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')));
+}
+#endif
+
+// Vector loops shared by the scan functions. MATCH16/MATCH32 yield a byte
+// mask of the bytes that continue the run; the loop stops at the first
+// byte that does not. INVERT flips the sense for "scan until" searches.
+#if defined(__AVX2__)
+#define SCAN_LOOP_32(MATCH32, INVERT) \
+    while (pos + 32 <= length) { \
+        __m256i v = _mm256_loadu_si256((const __m256i*)(source + pos)); \
+        unsigned int stop = (unsigned int)_mm256_movemask_epi8(MATCH32(v)); \
+        if (!(INVERT)) stop = ~stop; \
+        if (stop) return pos + (size_t)__builtin_ctz(stop); \
+        pos += 32; \
+    }
+#else
+#define SCAN_LOOP_32(MATCH32, INVERT)
+#endif
+
+#if defined(__SSE2__)
+#define SCAN_LOOP_16(MATCH16, INVERT) \
+    while (pos + 16 <= length) { \
+        __m128i v = _mm_loadu_si128((const __m128i*)(source + pos)); \
+        unsigned int stop = (unsigned int)_mm_movemask_epi8(MATCH16(v)); \
+        if (!(INVERT)) stop = ~stop & 0xFFFFu; \
+        if (stop) return pos + (size_t)__builtin_ctz(stop); \
+        pos += 16; \
+    }
+#else
+#define SCAN_LOOP_16(MATCH16, INVERT)
+#endif
+
+// End of a run of spaces, tabs and carriage returns
+size_t scan_spaces(const char* source, size_t pos, size_t length) {
+    SCAN_LOOP_32(space_32, 0)
+    SCAN_LOOP_16(space_16, 0)
+    return scan_table(source, pos, length, CHAR_SPACE);
+}
+
+// End of an identifier body (letters, digits, '_' and '.')
+size_t scan_identifier(const char* source, size_t pos, size_t length) {
+    SCAN_LOOP_32(ident_32, 0)
+    SCAN_LOOP_16(ident_16, 0)
+    return scan_table(source, pos, length, CHAR_IDENT);
+}
+
+// End of a number literal (digits and '.')
+size_t scan_number(const char* source, size_t pos, size_t length) {
+    SCAN_LOOP_32(number_32, 0)
+    SCAN_LOOP_16(number_16, 0)
+    return scan_table(source, pos, length, CHAR_NUMBER);
+}
+
+// Position of the next newline, used to skip comments
+size_t scan_line_end(const char* source, size_t pos, size_t length) {
+#if defined(__AVX2__)
+#define NEWLINE_32(v) _mm256_cmpeq_epi8((v), _mm256_set1_epi8('\n'))
+#endif
+#if defined(__SSE2__)
+#define NEWLINE_16(v) _mm_cmpeq_epi8((v), _mm_set1_epi8('\n'))
+#endif
+    SCAN_LOOP_32(NEWLINE_32, 1)
+    SCAN_LOOP_16(NEWLINE_16, 1)
+    while (pos < length && source[pos] != '\n') pos++;
+    return pos;
+}
+
+// Position of the next closing `quote` or backslash inside a string literal
+size_t scan_string_body(const char* source, size_t pos, size_t length, char quote) {
+#if defined(__AVX2__)
+    __m256i quote_32 = _mm256_set1_epi8(quote);
+#define STRING_STOP_32(v) _mm256_or_si256(_mm256_cmpeq_epi8((v), quote_32), \
+                                          _mm256_cmpeq_epi8((v), _mm256_set1_epi8('\\')))
+#endif
+#if defined(__SSE2__)
+    __m128i quote_16 = _mm_set1_epi8(quote);
+#define STRING_STOP_16(v) _mm_or_si128(_mm_cmpeq_epi8((v), quote_16), \
+                                       _mm_cmpeq_epi8((v), _mm_set1_epi8('\\')))
+#endif
+    SCAN_LOOP_32(STRING_STOP_32, 1)
+    SCAN_LOOP_16(STRING_STOP_16, 1)
+    while (pos < length && source[pos] != quote && source[pos] != '\\') pos++;
+    return pos;
+}
@@ -5,123 +5,42 @@
 
 #include "flipscript.h"
 #include "flipscript_types.h"
+#include "trace.h"
 #include <stdint.h> // Include for intptr_t
 #include <ctype.h>  // Include for isdigit
 
 // Forward declarations
-void generate_c_from_ast(ASTNode* node, FILE* file, int indent_level);
-void generate_string_expression(ASTNode* node, FILE* file);
-void preprocess_ast_for_functions(ASTNode* node);
-void generate_render_function(ASTNode* func_node, FILE* file);
-void generate_input_function(ASTNode* func_node, FILE* file);
-void extract_app_state_def(ASTNode* node);
-void generate_c_header(FILE* file);
-void generate_app_template(FILE* file);
 void generate_string_utilities(FILE* file);
 
-// Track app state definition
-static char* app_state_definition = NULL;
-static int has_main_function = 0;
+// What the application template needs to know about the program. Kept per
+// program rather than in globals so that files can be generated in parallel.
+typedef struct {
+    char* app_state_definition;     // AppState struct fields, or NULL
+    int has_main_function;
+} ProgramInfo;
 
+static void generate_c_header(FILE* file, const ProgramInfo* info);
+static void generate_app_template(FILE* file, const ProgramInfo* info);
 
-const char* get_actual_c_function_name(const char* binding_name) {
-    if (strcmp(binding_name, "display_draw_frame") == 0) return "canvas_draw_frame";
-    if (strcmp(binding_name, "display_draw_str") == 0) return "canvas_draw_str";
-    if (strcmp(binding_name, "display_clear") == 0) return "canvas_clear";
-    if (strcmp(binding_name, "display_draw_circle") == 0) return "canvas_draw_circle";
-    if (strcmp(binding_name, "display_draw_box") == 0) return "canvas_draw_box";
-    if (strcmp(binding_name, "display_draw_disk") == 0) return "canvas_draw_disk";
-    if (strcmp(binding_name, "delay_ms") == 0) return "furi_delay_ms";
-    return binding_name;
-}
-
-void preprocess_ast_for_functions(ASTNode* node) {
-    if (node == NULL) return;
-    
-    if (node->type == NODE_FUNCTION_DEF && strcmp(node->data.function_def.name, "main") == 0) {
-        has_main_function = 1;
-    }
-    
-    if (node->type == NODE_BLOCK || node->type == NODE_PROGRAM) {
-        for (size_t i = 0; i < node->data.block.statement_count; i++) {
-            preprocess_ast_for_functions(node->data.block.statements[i]);
-        }
-    }
-}
-
-void extract_app_state_def(ASTNode* node) {
-    if (node == NULL) return;
-    
-    if (node->type == NODE_CLASS_DEF && strcmp(node->data.class_def.name, "AppState") == 0) {
-        int capacity = 1024;
-        char* fields = (char*)malloc(capacity);
-        fields[0] = '\0';
-        int len = 0;
-        
-        for (size_t i = 0; i < node->data.class_def.body->data.block.statement_count; i++) {
-            ASTNode* field = node->data.class_def.body->data.block.statements[i];
-            
-            if (field->type == NODE_ASSIGNMENT) {
-                const char* field_name = field->data.assignment.name;
-                ASTNode* field_value = field->data.assignment.value;
-                const char* field_type = "int";
-                
-                if (field_value->type == NODE_LITERAL || field_value->type == NODE_IDENTIFIER) {
-                    const char* value = (field_value->type == NODE_LITERAL) ? field_value->data.literal.value : field_value->data.identifier.name;
-                    if (value[0] == '"' || value[0] == '\'') field_type = "char*";
-                    else if (strcmp(value, "True") == 0 || strcmp(value, "False") == 0) field_type = "bool";
-                }
-                
-                int required = snprintf(NULL, 0, "    %s %s;\n", field_type, field_name);
-                if (len + required + 1 > capacity) {
-                    capacity *= 2;
-                    fields = (char*)realloc(fields, capacity);
-                }
-                len += snprintf(fields + len, capacity - len, "    %s %s;\n", field_type, field_name);
-            }
-        }
-        app_state_definition = fields;
-    }
-    
-    if (node->type == NODE_BLOCK || node->type == NODE_PROGRAM) {
-        for (size_t i = 0; i < node->data.block.statement_count; i++) {
-            extract_app_state_def(node->data.block.statements[i]);
-        }
-    }
-}
 
-void generate_render_function(ASTNode* func_node, FILE* file) {
-    if (func_node->type != NODE_FUNCTION_DEF) return;
-    fprintf(file, "// User-defined render function\nvoid render(Canvas* canvas, AppState* app) {\n");
-    for (size_t i = 0; i < func_node->data.function_def.body->data.block.statement_count; i++) {
-        generate_c_from_ast(func_node->data.function_def.body->data.block.statements[i], file, 1);
+const char* get_actual_c_function_name(Symbol binding_name) {
+    switch (binding_name) {
+        case SYM_DISPLAY_DRAW_FRAME: return "canvas_draw_frame";
+        case SYM_DISPLAY_DRAW_STR: return "canvas_draw_str";
+        case SYM_DISPLAY_CLEAR: return "canvas_clear";
+        case SYM_DISPLAY_DRAW_CIRCLE: return "canvas_draw_circle";
+        case SYM_DISPLAY_DRAW_BOX: return "canvas_draw_box";
+        case SYM_DISPLAY_DRAW_DISK: return "canvas_draw_disk";
+        case SYM_DELAY_MS: return "furi_delay_ms";
+        default: return symbol_name(binding_name);
     }
-    fprintf(file, "}\n\n");
 }
 
-void generate_input_function(ASTNode* func_node, FILE* file) {
-    if (func_node->type != NODE_FUNCTION_DEF) return;
-    fprintf(file, "// User-defined input handler function\nvoid input(InputKey key, InputType type, AppState* app) {\n");
-    for (size_t i = 0; i < func_node->data.function_def.body->data.block.statement_count; i++) {
-        generate_c_from_ast(func_node->data.function_def.body->data.block.statements[i], file, 1);
-    }
-    fprintf(file, "}\n\n");
+static void generate_c_header(FILE* file, const ProgramInfo* info) {
+    generate_app_template(file, info);
 }
 
-void generate_main_function(ASTNode* func_node, FILE* file) {
-    if (func_node->type != NODE_FUNCTION_DEF) return;
-    fprintf(file, "// User-defined main function\nvoid user_main(AppState* app) {\n");
-    for (size_t i = 0; i < func_node->data.function_def.body->data.block.statement_count; i++) {
-        generate_c_from_ast(func_node->data.function_def.body->data.block.statements[i], file, 1);
-    }
-    fprintf(file, "}\n\n");
-}
-
-void generate_c_header(FILE* file) {
-    generate_app_template(file);
-}
-
-void generate_app_template(FILE* file) {
+static void generate_app_template(FILE* file, const ProgramInfo* info) {
     fprintf(file, "#include <furi.h>\n");
     fprintf(file, "#include <furi_hal.h>\n");
     fprintf(file, "#include <gui/gui.h>\n");
@@ -139,7 +58,7 @@ void generate_app_template(FILE* file) {
     fprintf(file, "typedef enum { EventTypeTick, EventTypeKey } EventType;\n\n");
     fprintf(file, "typedef struct { EventType type; InputEvent input; } PluginEvent;\n\n");
     fprintf(file, "typedef struct AppState {\n");
-    if (app_state_definition) fprintf(file, "%s", app_state_definition);
+    if (info->app_state_definition) fprintf(file, "%s", info->app_state_definition);
     else fprintf(file, "    int dummy;\n");
     fprintf(file, "} AppState;\n\n");
     fprintf(file, "typedef struct { FuriMutex* mutex; AppState* app; } AppContext;\n\n");
@@ -152,7 +71,7 @@ void generate_app_template(FILE* file) {
     fprintf(file, "int print(const char* message);\n\n");
 }
 
-void generate_application_structure(FILE* file) {
+static void generate_application_structure(FILE* file, const ProgramInfo* info) {
     fprintf(file, "static void render_callback(Canvas* const canvas, void* ctx) {\n    AppContext* context = (AppContext*)ctx; furi_mutex_acquire(context->mutex, FuriWaitForever); render(canvas, context->app); furi_mutex_release(context->mutex); \n}\n\n");
     fprintf(file, "static void input_callback(InputEvent* input_event, void* ctx) {\n    FuriMessageQueue* event_queue = (FuriMessageQueue*)ctx; furi_assert(event_queue); PluginEvent event = {.type = EventTypeKey, .input = *input_event}; furi_message_queue_put(event_queue, &event, FuriWaitForever);\n}\n\n");
     
@@ -166,7 +85,7 @@ void generate_application_structure(FILE* file) {
     fprintf(file, "    Gui* gui = furi_record_open(\"gui\");\n    gui_add_view_port(gui, view_port, GuiLayerFullscreen);\n\n");
     
     fprintf(file, "    PluginEvent event;\n    bool running = true;\n    while(running) {\n        if(furi_message_queue_get(event_queue, &event, 100) == FuriStatusOk) {\n            furi_mutex_acquire(app_mutex, FuriWaitForever);\n            if(event.type == EventTypeKey) {\n                input(event.input.key, event.input.type, app);\n                if(event.input.key == InputKeyBack && event.input.type == InputTypePress) running = false;\n            }\n            furi_mutex_release(app_mutex);\n        }\n");
-    if (has_main_function) fprintf(file, "        furi_mutex_acquire(app_mutex, FuriWaitForever); user_main(app); furi_mutex_release(app_mutex);\n");
+    if (info->has_main_function) fprintf(file, "        furi_mutex_acquire(app_mutex, FuriWaitForever); user_main(app); furi_mutex_release(app_mutex);\n");
     fprintf(file, "        view_port_update(view_port);\n    }\n\n");
     
     fprintf(file, "    view_port_enabled_set(view_port, false);\n    gui_remove_view_port(gui, view_port);\n    furi_record_close(\"gui\");\n    view_port_free(view_port);\n    furi_message_queue_free(event_queue);\n    furi_mutex_free(app_mutex);\n    free(app);\n\n    return 0;\n}\n");
@@ -182,302 +101,653 @@ void generate_string_utilities(FILE* file) {
     fprintf(file, "int print(const char* message) { FURI_LOG_I(\"FlipScript\", \"%%s\", message); return 0; }\n\n");
 }
 
-void generate_string_expression(ASTNode* node, FILE* file) {
-    if(node == NULL) {
-        fprintf(file, "strdup(\"\")");
-        return;
-    }
 
-    if (node->type == NODE_FUNCTION_CALL && strcmp(node->data.function_call.name, "str") == 0) {
-        generate_c_from_ast(node, file, 0);
-        return;
-    }
+// --- C from the IR ---
+//
+// Each function's blocks are turned back into structured code: a branch
+// becomes an if/else whose arms run up to the block where they meet again,
+// which lower_to_ir() recorded as the branch's join. A value optimize_ir()
+// left inside the expression of its user is printed there; one it keeps
+// becomes a C local, and a phi is a local the arms assign.
+
+// C type of a printed value. Values of no single type are intptr_t, which
+// also holds what script functions return.
+typedef enum { C_INT, C_BOOL, C_STRING } CType;
 
-    if (node->type == NODE_LITERAL) {
-         if (node->data.literal.value[0] == '"' || node->data.literal.value[0] == '\'') {
-            fprintf(file, "strdup(%s)", node->data.literal.value);
-         } else {
-            fprintf(file, "strdup(\"%s\")", node->data.literal.value);
-         }
+typedef struct {
+    const IrProgram* program;
+    const IrFunction* function;
+    FILE* file;
+    int entry_point;            // main, render or input: void, with a fixed signature
+    const char* const* parameter_names;
+    int* temp_strings;          // Value -> string temporary it was hoisted to, or -1
+    uint32_t* hoisted;          // Values in temp_strings, in evaluation order
+    int hoisted_count;
+} CEmitter;
+
+static void emit_expression(CEmitter* emitter, uint32_t value, int statement_level);
+
+static CType ctype_of(IrType type) {
+    return type == IR_TYPE_STRING ? C_STRING : type == IR_TYPE_BOOL ? C_BOOL : C_INT;
+}
+
+static CType global_ctype(const IrProgram* program, Symbol name) {
+    int index = symbol_index_get(&program->global_index, name);
+    return index >= 0 ? ctype_of(program->globals[index].type) : C_INT;
+}
+
+static void print_indent(FILE* file, int indent_level) {
+    for (int i = 0; i < indent_level; i++) fputs("    ", file);
+}
+
+// Local holding a kept value: its variable's name, if it has one
+static void print_value_name(const CEmitter* emitter, uint32_t value) {
+    Symbol variable = emitter->function->instructions[value].variable;
+    if (variable == NO_SYMBOL) {
+        fprintf(emitter->file, "t%u", value);
         return;
     }
-    
-    if (node->type == NODE_BINARY_OP && node->data.binary_op.operator == TOKEN_PLUS) {
-        fprintf(file, "str_concat(");
-        generate_string_expression(node->data.binary_op.left, file);
-        fprintf(file, ", ");
-        generate_string_expression(node->data.binary_op.right, file);
-        fprintf(file, ")");
-        return;
+    for (const char* c = symbol_name(variable); *c; c++) fputc(*c == '.' ? '_' : *c, emitter->file);
+    fprintf(emitter->file, "_%u", value);
+}
+
+static void print_temp_string(FILE* file, int temp) {
+    if (temp == 0) fprintf(file, "temp_str");
+    else fprintf(file, "temp_str_%d", temp);
+}
+
+static int is_pointer_parameter(Symbol name) {
+    return name == SYM_CANVAS || name == SYM_APP;
+}
+
+static void print_constant(FILE* file, const IrInstruction* instruction) {
+    const char* text = symbol_name(instruction->symbol);
+    if (instruction->kind == TOKEN_STRING) {
+        // The text between the quotes, which may have been single quotes
+        fputc('"', file);
+        for (const char* c = text; *c; c++) {
+            if (*c == '\\' && c[1]) {
+                fputc(*c++, file);
+            } else if (*c == '"') {
+                fputc('\\', file);
+            }
+            fputc(*c, file);
+        }
+        fputc('"', file);
+    } else if (instruction->symbol == SYM_TRUE) {
+        fprintf(file, "true");
+    } else if (instruction->symbol == SYM_FALSE) {
+        fprintf(file, "false");
+    } else if (instruction->symbol == SYM_NONE) {
+        fprintf(file, "0");
+    } else {
+        fprintf(file, "%s", text);
     }
+}
 
-    fprintf(file, "int_to_str((long)(");
-    generate_c_from_ast(node, file, 0);
-    fprintf(file, "))");
+// Does the value allocate a new string?
+static int is_owned_string(const IrFunction* function, const IrInstruction* instruction) {
+    if (instruction->op == IR_BINARY) return instruction->type == IR_TYPE_STRING;
+    return instruction->op == IR_TO_STRING &&
+           function->instructions[IR_OPERAND(function, instruction, 0)].type != IR_TYPE_STRING;
 }
 
+// Does evaluating the value where it is used call anything?
+static int has_call(const IrFunction* function, uint32_t value) {
+    const IrInstruction* instruction = &function->instructions[value];
+    if (instruction->op == IR_CALL || instruction->op == IR_CALL_NATIVE) return 1;
+    if (instruction->op != IR_COPY && !instruction->inlined) return 0;
+    for (uint32_t i = 0; i < instruction->operand_count; i++) {
+        if (has_call(function, IR_OPERAND(function, instruction, i))) return 1;
+    }
+    return 0;
+}
 
-void generate_c_from_ast(ASTNode* node, FILE* file, int indent_level) {
-    if (node == NULL) return;
+// Print a value as `target`
+static void emit_converted(CEmitter* emitter, uint32_t value, CType target) {
+    CType type = ctype_of(emitter->function->instructions[value].type);
+    if (target == C_STRING && type != C_STRING) {
+        fprintf(emitter->file, "(char*)(intptr_t)(");
+    } else if (target != C_STRING && type == C_STRING) {
+        fprintf(emitter->file, "(intptr_t)(");
+    } else {
+        emit_expression(emitter, value, 1);
+        return;
+    }
+    emit_expression(emitter, value, 1);
+    fprintf(emitter->file, ")");
+}
 
-    if (node->type == NODE_IMPORT) return;
-    
-    char indent[100] = "";
-    for (int i = 0; i < indent_level; i++) strcat(indent, "    ");
-    
-    switch (node->type) {
-        case NODE_PROGRAM: {
-            preprocess_ast_for_functions(node);
-            extract_app_state_def(node);
-            generate_c_header(file);
-            
-            // FIX: Generate string utilities FIRST to prevent implicit declaration errors.
-            generate_string_utilities(file);
-            
-            ASTNode* render_function = NULL, *input_function = NULL, *main_function = NULL;
-            for (size_t i = 0; i < node->data.block.statement_count; i++) {
-                if (node->data.block.statements[i] && node->data.block.statements[i]->type == NODE_FUNCTION_DEF) {
-                    const char* func_name = node->data.block.statements[i]->data.function_def.name;
-                    if (strcmp(func_name, "render") == 0) render_function = node->data.block.statements[i];
-                    else if (strcmp(func_name, "input") == 0) input_function = node->data.block.statements[i];
-                    else if (strcmp(func_name, "main") == 0) main_function = node->data.block.statements[i];
-                }
-            }
-            
-            for (size_t i = 0; i < node->data.block.statement_count; i++) {
-                if (node->data.block.statements[i] && node->data.block.statements[i]->type == NODE_FUNCTION_DEF) {
-                    const char* func_name = node->data.block.statements[i]->data.function_def.name;
-                    if (strcmp(func_name, "render") != 0 && strcmp(func_name, "input") != 0 && strcmp(func_name, "main") != 0) {
-                        generate_c_from_ast(node->data.block.statements[i], file, indent_level);
-                    }
-                }
-            }
-            if(main_function) generate_main_function(main_function, file);
-            
-            if (render_function) generate_render_function(render_function, file);
-            else fprintf(file, "void render(Canvas* canvas, AppState* app) { UNUSED(canvas); UNUSED(app); }\n\n");
-            
-            if (input_function) generate_input_function(input_function, file);
-            else fprintf(file, "void input(InputKey key, InputType type, AppState* app) { UNUSED(key); UNUSED(type); UNUSED(app); }\n\n");
-            
-            fprintf(file, "static void initialize_app_state(AppState* app) {\n");
-            fprintf(file, "    memset(app, 0, sizeof(AppState));\n");
-
-            ASTNode* app_state_class = NULL;
-            for (size_t i = 0; i < node->data.block.statement_count; i++) {
-                if (node->data.block.statements[i] && node->data.block.statements[i]->type == NODE_CLASS_DEF && strcmp(node->data.block.statements[i]->data.class_def.name, "AppState") == 0) {
-                    app_state_class = node->data.block.statements[i];
-                    break;
-                }
-            }
+static void emit_arguments(CEmitter* emitter, const IrInstruction* instruction, const IrFunction* callee) {
+    const IrFunction* function = emitter->function;
+    FILE* file = emitter->file;
+    for (uint32_t i = 0; i < instruction->operand_count; i++) {
+        if (i > 0) fprintf(file, ", ");
+        uint32_t argument = IR_OPERAND(function, instruction, i);
+        // Script functions take void*, except the canvas and the app
+        if (callee && !is_pointer_parameter(callee->parameters[i])) {
+            fprintf(file, "(void*)(intptr_t)(");
+            emit_expression(emitter, argument, 1);
+            fprintf(file, ")");
+        } else {
+            emit_expression(emitter, argument, 1);
+        }
+    }
+}
 
-            if(app_state_class) {
-                ASTNode* class_body = app_state_class->data.class_def.body;
-                for (size_t i = 0; i < class_body->data.block.statement_count; i++) {
-                    ASTNode* field_assignment = class_body->data.block.statements[i];
-                    if(field_assignment && field_assignment->type == NODE_ASSIGNMENT) {
-                        fprintf(file, "    app->%s = ", field_assignment->data.assignment.name);
-                        generate_c_from_ast(field_assignment->data.assignment.value, file, 0);
-                        fprintf(file, ";\n");
-                    }
-                }
-            }
-            
-            for (size_t i = 0; i < node->data.block.statement_count; i++) {
-                ASTNode* stmt = node->data.block.statements[i];
-                if (stmt && stmt->type != NODE_FUNCTION_DEF && stmt->type != NODE_C_BINDING && stmt->type != NODE_IMPORT && stmt->type != NODE_CLASS_DEF) {
-                    generate_c_from_ast(stmt, file, 1);
-                }
-            }
-            fprintf(file, "}\n\n");
-            generate_application_structure(file);
+// Print the operation that computes a value. `statement_level` is 0
+// inside an expression, where binary operations are parenthesized, 1 for a
+// whole expression and 2 for an expression statement, whose value is
+// unused.
+static void emit_operation(CEmitter* emitter, uint32_t value, int statement_level) {
+    const IrProgram* program = emitter->program;
+    const IrFunction* function = emitter->function;
+    const IrInstruction* instruction = &function->instructions[value];
+    FILE* file = emitter->file;
+    switch (instruction->op) {
+        case IR_CONST:
+            print_constant(file, instruction);
             break;
-        }
-        case NODE_FUNCTION_DEF: {
-            const char* func_name = node->data.function_def.name;
-
-            if (strcmp(func_name, "render") == 0 || strcmp(func_name, "input") == 0) break;
-            
-            fprintf(file, "void* %s(", func_name);
-            for (size_t i = 0; i < node->data.function_def.parameter_count; i++) {
-                if(strcmp(node->data.function_def.parameters[i], "canvas") == 0) {
-                    fprintf(file, "Canvas* canvas");
-                } else if(strcmp(node->data.function_def.parameters[i], "app") == 0) {
-                    fprintf(file, "AppState* app");
-                } else {
-                    fprintf(file, "void* %s", node->data.function_def.parameters[i]);
-                }
-                if (i < node->data.function_def.parameter_count - 1) fprintf(file, ", ");
-            }
-            fprintf(file, ") {\n");
-            
-            for (size_t i = 0; i < node->data.function_def.body->data.block.statement_count; i++) {
-                generate_c_from_ast(node->data.function_def.body->data.block.statements[i], file, indent_level + 1);
-            }
-            
-            int has_return = 0;
-            if (node->data.function_def.body->data.block.statement_count > 0) {
-                 ASTNode* last_stmt = node->data.function_def.body->data.block.statements[node->data.function_def.body->data.block.statement_count - 1];
-                if(last_stmt && last_stmt->type == NODE_RETURN) has_return = 1;
+        case IR_PARAM: {
+            Symbol name = function->parameters[instruction->kind];
+            if (emitter->entry_point) {
+                fprintf(file, "%s", emitter->parameter_names[instruction->kind]);
+            } else if (is_pointer_parameter(name)) {
+                fprintf(file, "%s", symbol_name(name));
+            } else {
+                fprintf(file, "(intptr_t)%s", symbol_name(name));
             }
-            if (!has_return) fprintf(file, "%sreturn NULL;\n", indent);
-            fprintf(file, "}\n\n");
             break;
         }
-        case NODE_BLOCK:
-            for (size_t i = 0; i < node->data.block.statement_count; i++) {
-                generate_c_from_ast(node->data.block.statements[i], file, indent_level);
-            }
+        case IR_LOAD_GLOBAL:
+            fprintf(file, "%s", symbol_name(instruction->symbol));
             break;
-        
-        case NODE_IF:
-            fprintf(file, "%sif (", indent);
-            generate_c_from_ast(node->data.if_statement.condition, file, 0);
-            fprintf(file, ") {\n");
-            generate_c_from_ast(node->data.if_statement.if_block, file, indent_level + 1);
-            fprintf(file, "%s}", indent);
-            for (size_t i = 0; i < node->data.if_statement.elif_count; i++) {
-                fprintf(file, " else if (");
-                generate_c_from_ast(node->data.if_statement.elif_clauses[i].condition, file, 0);
-                fprintf(file, ") {\n");
-                generate_c_from_ast(node->data.if_statement.elif_clauses[i].block, file, indent_level + 1);
-                fprintf(file, "%s}", indent);
-            }
-            if (node->data.if_statement.else_block) {
-                fprintf(file, " else {\n");
-                generate_c_from_ast(node->data.if_statement.else_block, file, indent_level + 1);
-                fprintf(file, "%s}", indent);
-            }
-            fprintf(file, "\n");
+        case IR_LOAD_FIELD:
+            fprintf(file, "app->%s", symbol_name(instruction->symbol) + 4);
             break;
-        case NODE_WHILE:
-            fprintf(file, "%swhile (", indent);
-            generate_c_from_ast(node->data.while_loop.condition, file, 0);
-            fprintf(file, ") {\n");
-            generate_c_from_ast(node->data.while_loop.block, file, indent_level + 1);
-            fprintf(file, "%s}\n", indent);
+        case IR_COPY:
+            emit_expression(emitter, IR_OPERAND(function, instruction, 0), statement_level);
             break;
-        case NODE_ASSIGNMENT: {
-            if (strncmp(node->data.assignment.name, "app.", 4) == 0) {
-                fprintf(file, "%sapp->%s = ", indent, node->data.assignment.name + 4);
-                generate_c_from_ast(node->data.assignment.value, file, 0);
-                fprintf(file, ";\n");
-            } else {
-                fprintf(file, "%sintptr_t %s = (intptr_t)", indent, node->data.assignment.name);
-                generate_c_from_ast(node->data.assignment.value, file, 0);
-                fprintf(file, ";\n");
+        case IR_BINARY: {
+            uint32_t left = IR_OPERAND(function, instruction, 0);
+            uint32_t right = IR_OPERAND(function, instruction, 1);
+            if (instruction->type == IR_TYPE_STRING) {
+                fprintf(file, "str_concat(");
+                emit_expression(emitter, left, 1);
+                fprintf(file, ", ");
+                emit_expression(emitter, right, 1);
+                fprintf(file, ")");
+                break;
+            }
+            const char* op;
+            switch (instruction->kind) {
+                case TOKEN_PLUS: op = " + "; break;
+                case TOKEN_MINUS: op = " - "; break;
+                case TOKEN_MULTIPLY: op = " * "; break;
+                case TOKEN_DIVIDE: op = " / "; break;
+                case TOKEN_EQUAL: op = " == "; break;
+                case TOKEN_NOT_EQUAL: op = " != "; break;
+                case TOKEN_GREATER: op = " > "; break;
+                default: op = " < "; break;
+            }
+            if (function->instructions[left].type == IR_TYPE_STRING && function->instructions[right].type == IR_TYPE_STRING) {
+                // Strings compare by their text
+                fprintf(file, statement_level ? "strcmp(" : "(strcmp(");
+                emit_expression(emitter, left, 1);
+                fprintf(file, ", ");
+                emit_expression(emitter, right, 1);
+                fprintf(file, ")%s0", op);
+                if (!statement_level) fprintf(file, ")");
+                break;
             }
+            // Only one side is a string here, compared as a pointer
+            if (!statement_level) fprintf(file, "(");
+            if (function->instructions[left].type == IR_TYPE_STRING) emit_converted(emitter, left, C_INT);
+            else emit_expression(emitter, left, 0);
+            fprintf(file, "%s", op);
+            if (function->instructions[right].type == IR_TYPE_STRING) emit_converted(emitter, right, C_INT);
+            else emit_expression(emitter, right, 0);
+            if (!statement_level) fprintf(file, ")");
             break;
         }
-        case NODE_FUNCTION_CALL: {
-            const char* func_name = node->data.function_call.name;
-
-            if (strcmp(func_name, "print") == 0) {
-                fprintf(file, "%s{\n", indent); 
-                fprintf(file, "%s    char* temp_str = ", indent);
-                if (node->data.function_call.argument_count > 0) {
-                    generate_string_expression(node->data.function_call.arguments[0], file);
-                } else {
-                    fprintf(file, "strdup(\"\")");
-                }
-                fprintf(file, ";\n");
-                fprintf(file, "%s    print(temp_str);\n", indent);
-                fprintf(file, "%s    free(temp_str);\n", indent);
-                fprintf(file, "%s}\n", indent);
+        case IR_TO_STRING: {
+            uint32_t operand = IR_OPERAND(function, instruction, 0);
+            if (function->instructions[operand].type == IR_TYPE_STRING) {
+                emit_expression(emitter, operand, statement_level);
+                break;
             }
-            else if (strcmp(func_name, "display_draw_str") == 0 || strcmp(func_name, "canvas_draw_str") == 0) {
-                fprintf(file, "%s{\n", indent); 
-                fprintf(file, "%s    char* text_to_draw = ", indent);
-                generate_string_expression(node->data.function_call.arguments[3], file);
-                fprintf(file, ";\n");
-                
-                fprintf(file, "%s    canvas_draw_str(", indent);
-                for (size_t i = 0; i < 3; ++i) {
-                    generate_c_from_ast(node->data.function_call.arguments[i], file, 0);
-                    fprintf(file, ", ");
-                }
-                fprintf(file, "text_to_draw);\n");
-                fprintf(file, "%s    free(text_to_draw);\n", indent);
-                fprintf(file, "%s}\n", indent);
-            } else if (strcmp(func_name, "str") == 0) {
-                 fprintf(file, "%sint_to_str(", indent);
-                 generate_c_from_ast(node->data.function_call.arguments[0], file, 0);
-                 fprintf(file, ")");
+            fprintf(file, "int_to_str((long)(");
+            emit_expression(emitter, operand, 1);
+            fprintf(file, "))");
+            break;
+        }
+        case IR_CALL: {
+            const IrFunction* callee = &program->functions[instruction->kind];
+            if (callee->name == SYM_MAIN) {
+                fprintf(file, "user_main(");
+                emit_arguments(emitter, instruction, NULL);
+            } else if (callee->name == SYM_RENDER || callee->name == SYM_INPUT) {
+                fprintf(file, "%s(", symbol_name(callee->name));
+                emit_arguments(emitter, instruction, NULL);
             } else {
-                fprintf(file, "%s%s(", indent, get_actual_c_function_name(func_name));
-                for (size_t i = 0; i < node->data.function_call.argument_count; i++) {
-                    generate_c_from_ast(node->data.function_call.arguments[i], file, 0);
-                    if (i < node->data.function_call.argument_count - 1) fprintf(file, ", ");
-                }
-                fprintf(file, ")");
-                if(indent_level > 0 && node->type != NODE_ASSIGNMENT) fprintf(file, ";\n");
+                // Their void* result is used as an integer
+                fprintf(file, statement_level == 2 ? "%s(" : "(intptr_t)%s(", symbol_name(callee->name));
+                emit_arguments(emitter, instruction, callee);
             }
+            fprintf(file, ")");
             break;
         }
-        case NODE_BINARY_OP:
-            fprintf(file, "(");
-            generate_c_from_ast(node->data.binary_op.left, file, 0);
-            switch(node->data.binary_op.operator) {
-                case TOKEN_PLUS: fprintf(file, " + "); break;
-                case TOKEN_MINUS: fprintf(file, " - "); break;
-                case TOKEN_MULTIPLY: fprintf(file, " * "); break;
-                case TOKEN_DIVIDE: fprintf(file, " / "); break;
-                case TOKEN_MODULO: fprintf(file, " %% "); break;
-                case TOKEN_EQUAL: fprintf(file, " == "); break;
-                case TOKEN_NOT_EQUAL: fprintf(file, " != "); break;
-                case TOKEN_GREATER: fprintf(file, " > "); break;
-                case TOKEN_LESS: fprintf(file, " < "); break;
-                default: break;
-            }
-            generate_c_from_ast(node->data.binary_op.right, file, 0);
+        case IR_CALL_NATIVE:
+            fprintf(file, "%s(", get_actual_c_function_name(program->natives[instruction->kind].c_name));
+            emit_arguments(emitter, instruction, NULL);
             fprintf(file, ")");
             break;
-        case NODE_LITERAL: {
-            const char* value = node->data.literal.value;
-            if (strcmp(value, "True") == 0) {
-                fprintf(file, "true");
-            } else if (strcmp(value, "False") == 0) {
-                fprintf(file, "false");
-            } else {
-                fprintf(file, "%s", value);
-            }
+        default:
             break;
+    }
+}
+
+static void emit_expression(CEmitter* emitter, uint32_t value, int statement_level) {
+    if (emitter->temp_strings[value] >= 0) {
+        print_temp_string(emitter->file, emitter->temp_strings[value]);
+    } else if (ir_keeps_value(&emitter->function->instructions[value])) {
+        print_value_name(emitter, value);
+    } else {
+        emit_operation(emitter, value, statement_level);
+    }
+}
+
+// Strings allocated only to be passed to a native function are computed
+// into temporaries first, so that they can be freed after the statement
+static void hoist_strings(CEmitter* emitter, uint32_t value) {
+    const IrFunction* function = emitter->function;
+    const IrInstruction* instruction = &function->instructions[value];
+    for (uint32_t i = 0; i < instruction->operand_count; i++) {
+        uint32_t operand = IR_OPERAND(function, instruction, i);
+        const IrInstruction* definition = &function->instructions[operand];
+        if (!definition->inlined) continue;
+        hoist_strings(emitter, operand);
+        if (instruction->op == IR_CALL_NATIVE && is_owned_string(function, definition)) {
+            emitter->temp_strings[operand] = emitter->hoisted_count;
+            emitter->hoisted[emitter->hoisted_count++] = operand;
         }
-        case NODE_IDENTIFIER: {
-            const char* name = node->data.identifier.name;
-            if (strcmp(name, "True") == 0) {
-                fprintf(file, "true");
-            } else if (strcmp(name, "False") == 0) {
-                fprintf(file, "false");
-            }
-            else if (strncmp(name, "app.", 4) == 0) {
-                 fprintf(file, "app->%s", name + 4);
+    }
+}
+
+static void begin_statement(CEmitter* emitter, uint32_t value, int indent_level) {
+    hoist_strings(emitter, value);
+    if (emitter->hoisted_count == 0) return;
+    FILE* file = emitter->file;
+    print_indent(file, indent_level);
+    fprintf(file, "{\n");
+    for (int i = 0; i < emitter->hoisted_count; i++) {
+        uint32_t temp = emitter->hoisted[i];
+        print_indent(file, indent_level + 1);
+        fprintf(file, "char* ");
+        print_temp_string(file, i);
+        fprintf(file, " = ");
+        emit_operation(emitter, temp, 1);
+        fprintf(file, ";\n");
+    }
+}
+
+static void end_statement(CEmitter* emitter, int indent_level) {
+    if (emitter->hoisted_count == 0) return;
+    FILE* file = emitter->file;
+    for (int i = 0; i < emitter->hoisted_count; i++) {
+        print_indent(file, indent_level + 1);
+        fprintf(file, "free(");
+        print_temp_string(file, i);
+        fprintf(file, ");\n");
+        emitter->temp_strings[emitter->hoisted[i]] = -1;
+    }
+    print_indent(file, indent_level);
+    fprintf(file, "}\n");
+    emitter->hoisted_count = 0;
+}
+
+static void emit_statement(CEmitter* emitter, uint32_t value, int indent_level) {
+    const IrFunction* function = emitter->function;
+    const IrInstruction* instruction = &function->instructions[value];
+    FILE* file = emitter->file;
+    int kept = ir_keeps_value(instruction);
+    if (instruction->op == IR_RESULT) {
+        // Only the effects of the script's result matter here
+        value = IR_OPERAND(function, instruction, 0);
+        if (ir_keeps_value(&function->instructions[value])) return;
+        instruction = &function->instructions[value];
+    }
+    if (!kept && instruction->op != IR_STORE_GLOBAL && instruction->op != IR_STORE_FIELD &&
+        !has_call(function, value)) {
+        return;
+    }
+
+    begin_statement(emitter, value, indent_level);
+    int indent = indent_level + (emitter->hoisted_count > 0);
+    print_indent(file, indent);
+    switch (instruction->op) {
+        case IR_STORE_GLOBAL:
+            fprintf(file, "%s = ", symbol_name(instruction->symbol));
+            emit_converted(emitter, IR_OPERAND(function, instruction, 0), global_ctype(emitter->program, instruction->symbol));
+            break;
+        case IR_STORE_FIELD:
+            fprintf(file, "app->%s = ", symbol_name(instruction->symbol) + 4);
+            emit_converted(emitter, IR_OPERAND(function, instruction, 0), global_ctype(emitter->program, instruction->symbol));
+            break;
+        default:
+            if (kept) {
+                print_value_name(emitter, value);
+                fprintf(file, " = ");
+                emit_operation(emitter, value, 1);
+            } else if (instruction->op == IR_CALL || instruction->op == IR_CALL_NATIVE) {
+                emit_operation(emitter, value, 2);
             } else {
-                 fprintf(file, "%s", name);
+                // Computed only for the calls inside it
+                fprintf(file, "(void)(");
+                emit_operation(emitter, value, 1);
+                fprintf(file, ")");
             }
             break;
+    }
+    fprintf(file, ";\n");
+    end_statement(emitter, indent_level);
+}
+
+// Assign the phis of `target` their values for the edge from `block`
+static void emit_phi_copies(CEmitter* emitter, uint32_t block, uint32_t target, int indent_level) {
+    const IrFunction* function = emitter->function;
+    const IrBlock* successor = &function->blocks[target];
+    uint32_t edge = 0;
+    while (successor->predecessors[edge] != block) edge++;
+    for (uint32_t i = 0; i < successor->code_count; i++) {
+        const IrInstruction* phi = &function->instructions[successor->code[i]];
+        if (phi->op != IR_PHI) break;
+        print_indent(emitter->file, indent_level);
+        print_value_name(emitter, successor->code[i]);
+        fprintf(emitter->file, " = ");
+        emit_converted(emitter, IR_OPERAND(function, phi, edge), ctype_of(phi->type));
+        fprintf(emitter->file, ";\n");
+    }
+}
+
+static int has_phis(const IrFunction* function, uint32_t block) {
+    const IrBlock* b = &function->blocks[block];
+    return b->code_count > 0 && function->instructions[b->code[0]].op == IR_PHI;
+}
+
+// Does the block do nothing but end in its terminator?
+static int only_terminator(const IrFunction* function, const IrBlock* block) {
+    for (uint32_t i = 0; i + 1 < block->code_count; i++) {
+        const IrInstruction* instruction = &function->instructions[block->code[i]];
+        if (!instruction->inlined && !instruction->rematerialized) return 0;
+    }
+    return block->code_count > 0;
+}
+
+// Would the arm starting at `arm` print nothing?
+static int is_empty_arm(const IrFunction* function, uint32_t arm, uint32_t join) {
+    if (has_phis(function, join)) return 0;
+    if (arm == join) return 1;
+    const IrBlock* b = &function->blocks[arm];
+    return only_terminator(function, b) && function->instructions[b->code[b->code_count - 1]].op == IR_JUMP &&
+           b->successors[0] == join;
+}
+
+// Is the else arm another branch to the same join, printed as `else if`?
+static int is_else_if(const IrFunction* function, uint32_t arm, uint32_t join) {
+    const IrBlock* b = &function->blocks[arm];
+    return arm != join && only_terminator(function, b) &&
+           function->instructions[b->code[b->code_count - 1]].op == IR_BRANCH && b->join == join;
+}
+
+static void emit_region(CEmitter* emitter, uint32_t block, uint32_t stop, int indent_level);
+
+static void emit_arm(CEmitter* emitter, uint32_t block, uint32_t arm, uint32_t join, int indent_level) {
+    if (arm == join) emit_phi_copies(emitter, block, join, indent_level);
+    else emit_region(emitter, arm, join, indent_level);
+}
+
+// if/else for the branch ending `block`; `chained` when it follows an else
+static void emit_if(CEmitter* emitter, uint32_t block, int indent_level, int chained) {
+    const IrFunction* function = emitter->function;
+    const IrBlock* b = &function->blocks[block];
+    FILE* file = emitter->file;
+    if (!chained) print_indent(file, indent_level);
+    fprintf(file, "if (");
+    emit_expression(emitter, IR_OPERAND(function, &function->instructions[b->code[b->code_count - 1]], 0), 1);
+    fprintf(file, ") {\n");
+    emit_arm(emitter, block, b->successors[0], b->join, indent_level + 1);
+    print_indent(file, indent_level);
+    uint32_t else_arm = b->successors[1];
+    if (is_empty_arm(function, else_arm, b->join)) {
+        fprintf(file, "}\n");
+    } else if (is_else_if(function, else_arm, b->join)) {
+        fprintf(file, "} else ");
+        emit_if(emitter, else_arm, indent_level, 1);
+    } else {
+        fprintf(file, "} else {\n");
+        emit_arm(emitter, block, else_arm, b->join, indent_level + 1);
+        print_indent(file, indent_level);
+        fprintf(file, "}\n");
+    }
+}
+
+// Print the code from `block` up to `stop`
+static void emit_region(CEmitter* emitter, uint32_t block, uint32_t stop, int indent_level) {
+    const IrFunction* function = emitter->function;
+    FILE* file = emitter->file;
+    while (block != stop && block != IR_NO_BLOCK && !function->blocks[block].dead) {
+        const IrBlock* b = &function->blocks[block];
+        for (uint32_t i = 0; i + 1 < b->code_count; i++) {
+            const IrInstruction* instruction = &function->instructions[b->code[i]];
+            if (instruction->inlined || instruction->rematerialized || instruction->op == IR_PHI) continue;
+            emit_statement(emitter, b->code[i], indent_level);
         }
-        case NODE_RETURN:
-            fprintf(file, "%sreturn ", indent);
-            if (node->data.return_statement.value) {
-                if (node->data.return_statement.value->type == NODE_LITERAL) {
-                    char* val = node->data.return_statement.value->data.literal.value;
-                    if(val && (isdigit(val[0]) || (val[0] == '-' && isdigit(val[1])))) {
-                         fprintf(file, "(void*)(intptr_t)");
+        if (b->code_count == 0) return;
+        const IrInstruction* terminator = &function->instructions[b->code[b->code_count - 1]];
+        switch (terminator->op) {
+            case IR_JUMP:
+                emit_phi_copies(emitter, block, b->successors[0], indent_level);
+                block = b->successors[0];
+                break;
+            case IR_BRANCH:
+                emit_if(emitter, block, indent_level, 0);
+                block = b->join;
+                break;
+            case IR_RETURN: {
+                uint32_t value = IR_OPERAND(function, terminator, 0);
+                const IrInstruction* result = &function->instructions[value];
+                int none = result->op == IR_CONST && result->symbol == SYM_NONE && !ir_keeps_value(result);
+                if (emitter->entry_point || function->name == NO_SYMBOL) {
+                    // The function's last statement needs no return
+                    if (indent_level > 1) {
+                        print_indent(file, indent_level);
+                        fprintf(file, "return;\n");
                     }
+                } else if (none) {
+                    print_indent(file, indent_level);
+                    fprintf(file, "return NULL;\n");
+                } else {
+                    begin_statement(emitter, value, indent_level);
+                    int indent = indent_level + (emitter->hoisted_count > 0);
+                    print_indent(file, indent);
+                    fprintf(file, "return (void*)(intptr_t)(");
+                    emit_expression(emitter, value, 1);
+                    fprintf(file, ");\n");
+                    end_statement(emitter, indent_level);
                 }
-                generate_c_from_ast(node->data.return_statement.value, file, 0);
-            } else {
-                fprintf(file, "NULL");
+                return;
             }
-            fprintf(file, ";\n");
-            break;
-        case NODE_CLASS_DEF:
-        case NODE_C_BINDING:
-        case NODE_FOR:
-            break; // Not implemented for generation yet
-        default:
-            fprintf(stderr, "Error: Unhandled node type %d in C generation\n", node->type);
-            break;
+            default:
+                // IR_HALT
+                return;
+        }
+    }
+}
+
+// Declare the locals for the function's kept values
+static void emit_locals(CEmitter* emitter) {
+    const IrFunction* function = emitter->function;
+    static const char* const local_types[] = {[C_INT] = "intptr_t", [C_BOOL] = "bool", [C_STRING] = "char*"};
+    for (uint32_t i = 1; i < function->instruction_count; i++) {
+        const IrInstruction* instruction = &function->instructions[i];
+        if (!ir_keeps_value(instruction) || function->blocks[instruction->block].dead) continue;
+        fprintf(emitter->file, "    %s ", local_types[ctype_of(instruction->type)]);
+        print_value_name(emitter, i);
+        fprintf(emitter->file, ";\n");
+    }
+}
+
+static void emit_body(CEmitter* emitter, const IrFunction* function, int entry_point, const char* const* parameter_names) {
+    emitter->function = function;
+    emitter->entry_point = entry_point;
+    emitter->parameter_names = parameter_names;
+    emitter->temp_strings = (int*)malloc(function->instruction_count * sizeof(int));
+    emitter->hoisted = (uint32_t*)malloc(function->instruction_count * sizeof(uint32_t));
+    emitter->hoisted_count = 0;
+    for (uint32_t i = 0; i < function->instruction_count; i++) emitter->temp_strings[i] = -1;
+    emit_locals(emitter);
+    emit_region(emitter, 0, IR_NO_BLOCK, 1);
+    free(emitter->temp_strings);
+    free(emitter->hoisted);
+}
+
+// `void* name(...)` for a script function other than the entry points
+static void print_function_signature(FILE* file, const IrFunction* function) {
+    fprintf(file, "void* %s(", symbol_name(function->name));
+    for (uint32_t i = 0; i < function->parameter_count; i++) {
+        Symbol parameter = function->parameters[i];
+        if (i > 0) fprintf(file, ", ");
+        if (parameter == SYM_CANVAS) fprintf(file, "Canvas* canvas");
+        else if (parameter == SYM_APP) fprintf(file, "AppState* app");
+        else fprintf(file, "void* %s", symbol_name(parameter));
+    }
+    if (function->parameter_count == 0) fprintf(file, "void");
+    fprintf(file, ")");
+}
+
+static int is_entry_point(Symbol name) {
+    return name == SYM_MAIN || name == SYM_RENDER || name == SYM_INPUT;
+}
+
+// Entry point with its fixed signature, its parameters named as the
+// script names them
+static void generate_entry_point(CEmitter* emitter, const IrFunction* function) {
+    static const char* const main_parameters[] = {"app"};
+    static const char* const render_parameters[] = {"canvas", "app"};
+    static const char* const input_parameters[] = {"key", "type", "app"};
+    const char* names[3];
+    const char* const* defaults;
+    size_t count;
+    FILE* file = emitter->file;
+    if (function->name == SYM_MAIN) {
+        defaults = main_parameters;
+        count = 1;
+    } else if (function->name == SYM_RENDER) {
+        defaults = render_parameters;
+        count = 2;
+    } else {
+        defaults = input_parameters;
+        count = 3;
+    }
+    for (size_t i = 0; i < count; i++) {
+        names[i] = i < function->parameter_count ? symbol_name(function->parameters[i]) : defaults[i];
+    }
+
+    if (function->name == SYM_MAIN) {
+        fprintf(file, "// User-defined main function\nvoid user_main(AppState* %s) {\n", names[0]);
+    } else if (function->name == SYM_RENDER) {
+        fprintf(file, "// User-defined render function\nvoid render(Canvas* %s, AppState* %s) {\n", names[0], names[1]);
+    } else {
+        fprintf(file, "// User-defined input handler function\nvoid input(InputKey %s, InputType %s, AppState* %s) {\n",
+                names[0], names[1], names[2]);
+    }
+    emit_body(emitter, function, 1, names);
+    fprintf(file, "}\n\n");
+}
+
+// AppState fields, typed by the values the script gives them
+static char* app_state_definition(const IrProgram* ir) {
+    static const char* const field_types[] = {[C_INT] = "int", [C_BOOL] = "bool", [C_STRING] = "char*"};
+    if (ir->field_count == 0) return NULL;
+    size_t capacity = 1024, length = 0;
+    char* fields = (char*)malloc(capacity);
+    for (uint32_t i = 0; i < ir->field_count; i++) {
+        const char* type = field_types[global_ctype(ir, ir->fields[i])];
+        const char* name = symbol_name(ir->fields[i]) + 4;      // After "app."
+        size_t required = (size_t)snprintf(NULL, 0, "    %s %s;\n", type, name);
+        if (length + required + 1 > capacity) {
+            capacity = (length + required + 1) * 2;
+            fields = (char*)realloc(fields, capacity);
+        }
+        length += (size_t)snprintf(fields + length, capacity - length, "    %s %s;\n", type, name);
     }
+    return fields;
+}
+
+void generate_c_from_ir(const IrProgram* ir, FILE* file) {
+    if (ir == NULL) return;     // Loaded from bytecode
+    TRACE(TRACE_CODEGEN, 1, "generating C for %u functions", ir->function_count);
+    ProgramInfo info = {0};
+    info.app_state_definition = app_state_definition(ir);
+    const IrFunction* entry_points[3] = {NULL, NULL, NULL};    // main, render, input
+    for (uint32_t i = 1; i < ir->function_count; i++) {
+        Symbol name = ir->functions[i].name;
+        if (name == SYM_MAIN) entry_points[0] = &ir->functions[i];
+        else if (name == SYM_RENDER) entry_points[1] = &ir->functions[i];
+        else if (name == SYM_INPUT) entry_points[2] = &ir->functions[i];
+    }
+    info.has_main_function = entry_points[0] != NULL;
+    generate_c_header(file, &info);
+
+    // FIX: Generate string utilities FIRST to prevent implicit declaration errors.
+    generate_string_utilities(file);
+
+    // Script globals, other than the AppState fields
+    static const char* const global_types[] = {[C_INT] = "intptr_t", [C_BOOL] = "bool", [C_STRING] = "char*"};
+    int declared = 0;
+    for (uint32_t i = 0; i < ir->global_count; i++) {
+        const IrGlobal* global = &ir->globals[i];
+        if (strncmp(symbol_name(global->name), "app.", 4) == 0) continue;
+        fprintf(file, "static %s %s;\n", global_types[ctype_of(global->type)], symbol_name(global->name));
+        declared = 1;
+    }
+    if (declared) fprintf(file, "\n");
+
+    CEmitter emitter;
+    memset(&emitter, 0, sizeof(emitter));
+    emitter.program = ir;
+    emitter.file = file;
+    declared = 0;
+    for (uint32_t i = 1; i < ir->function_count; i++) {
+        if (is_entry_point(ir->functions[i].name)) continue;
+        print_function_signature(file, &ir->functions[i]);
+        fprintf(file, ";\n");
+        declared = 1;
+    }
+    if (declared) fprintf(file, "\n");
+    for (uint32_t i = 1; i < ir->function_count; i++) {
+        const IrFunction* function = &ir->functions[i];
+        if (is_entry_point(function->name)) continue;
+        TRACE(TRACE_CODEGEN, 2, "generating function %s", symbol_name(function->name));
+        print_function_signature(file, function);
+        fprintf(file, " {\n");
+        emit_body(&emitter, function, 0, NULL);
+        fprintf(file, "}\n\n");
+    }
+    if (entry_points[0]) generate_entry_point(&emitter, entry_points[0]);
+
+    if (entry_points[1]) generate_entry_point(&emitter, entry_points[1]);
+    else fprintf(file, "void render(Canvas* canvas, AppState* app) { UNUSED(canvas); UNUSED(app); }\n\n");
+
+    if (entry_points[2]) generate_entry_point(&emitter, entry_points[2]);
+    else fprintf(file, "void input(InputKey key, InputType type, AppState* app) { UNUSED(key); UNUSED(type); UNUSED(app); }\n\n");
+
+    // The top-level code, the AppState class body included
+    fprintf(file, "static void initialize_app_state(AppState* app) {\n");
+    fprintf(file, "    memset(app, 0, sizeof(AppState));\n");
+    emit_body(&emitter, &ir->functions[0], 0, NULL);
+    fprintf(file, "}\n\n");
+    generate_application_structure(file, &info);
+    free(info.app_state_definition);
 }
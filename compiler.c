@@ -1,88 +1,214 @@
 /**
  * FlipScript - A Python-like language for Flipper Zero with C library binding
- * Compiler Implementation - Translates AST to bytecode
+ * Compiler Implementation - Translates the IR to stack and register bytecode
  */
 
+#include <errno.h>
 #include "flipscript.h"
 #include "flipscript_types.h"
+#include "trace.h"
 
 // Forward declarations
-void compile_ast(Compiler* compiler, ASTNode* node);
-int add_c_function(Compiler* compiler, char* name);
+int add_c_function(Compiler* compiler, Symbol name);
+static CompiledFunction* add_function(Compiler* compiler, Symbol name, FunctionType type, int arity, size_t address);
 
 // Initialize compiler
-Compiler* init_compiler(ASTNode* ast) {
+Compiler* init_compiler(Ast* ast) {
     Compiler* compiler = (Compiler*)malloc(sizeof(Compiler));
     compiler->ast = ast;
     compiler->bytecode = (Instruction*)malloc(1000 * sizeof(Instruction));
     compiler->bytecode_size = 0;
     compiler->bytecode_capacity = 1000;
-    compiler->constants = (char**)malloc(100 * sizeof(char*));
-    compiler->constant_count = 0;
-    compiler->names = (char**)malloc(100 * sizeof(char*));
-    compiler->name_count = 0;
-    compiler->c_functions = (char**)malloc(100 * sizeof(char*));
-    compiler->c_function_count = 0;
+    memset(&compiler->constants, 0, sizeof(ConstantPool));
+    memset(&compiler->names, 0, sizeof(SymbolPool));
+    memset(&compiler->c_functions, 0, sizeof(SymbolPool));
 
     // Initialize unified function table
     compiler->function_capacity = 20;
     compiler->functions = (CompiledFunction*)malloc(compiler->function_capacity * sizeof(CompiledFunction));
     compiler->function_count = 0;
+    memset(&compiler->function_index, 0, sizeof(SymbolIndex));
+    compiler->top_level_locals = 0;
 
     // Pre-register built-in native functions like str()
-    CompiledFunction* str_func = &compiler->functions[compiler->function_count++];
-    str_func->name = strdup("str");
-    str_func->type = FUNC_NATIVE;
-    str_func->arity = 1;
     // The address here is the index in the c_functions array that the runtime will use.
     // We map it to a C function named "int_to_str" which is provided by codegen.c
-    str_func->address = add_c_function(compiler, "int_to_str");
+    add_function(compiler, SYM_STR, FUNC_NATIVE, 1, add_c_function(compiler, SYM_INT_TO_STR));
 
     // Pre-register the built-in 'print' function
-    CompiledFunction* print_func = &compiler->functions[compiler->function_count++];
-    print_func->name = strdup("print");
-    print_func->type = FUNC_NATIVE;
-    print_func->arity = 1;
     // Map it to the 'print' C function provided by codegen.c
-    print_func->address = add_c_function(compiler, "print");
-
+    add_function(compiler, SYM_PRINT, FUNC_NATIVE, 1, add_c_function(compiler, SYM_PRINT));
 
+    compiler->errors = stderr;
+    compiler->error_count = 0;
+    compiler->peephole_removed = 0;
+    compiler->ir = NULL;
+    memset(&compiler->registers, 0, sizeof(RegisterProgram));
     return compiler;
 }
 
-// Add a constant to the constant pool
-int add_constant(Compiler* compiler, char* value) {
-    for (size_t i = 0; i < compiler->constant_count; i++) {
-        if (strcmp(compiler->constants[i], value) == 0) return i;
+// Release a compiler together with its AST
+void free_compiler(Compiler* compiler) {
+    if (compiler == NULL) return;
+    free_ast(compiler->ast);
+    free(compiler->bytecode);
+    free_constant_pool(&compiler->constants);
+    free_symbol_pool(&compiler->names);
+    free_symbol_pool(&compiler->c_functions);
+    free(compiler->functions);
+    free(compiler->function_index.slots);
+    free_ir(compiler->ir);
+    free(compiler->registers.code);
+    free(compiler->registers.functions);
+    free(compiler);
+}
+
+static uint32_t symbol_hash(Symbol key) {
+    uint32_t hash = key * 0x9E3779B1u;
+    return hash ^ (hash >> 16);
+}
+
+// Position stored for `key`, or -1
+int symbol_index_get(const SymbolIndex* index, Symbol key) {
+    if (index->slots == NULL) return -1;
+    uint32_t slot = symbol_hash(key) & index->slot_mask;
+    while (index->slots[slot].key != NO_SYMBOL) {
+        if (index->slots[slot].key == key) return (int)index->slots[slot].value;
+        slot = (slot + 1) & index->slot_mask;
     }
-    compiler->constants[compiler->constant_count] = strdup(value);
-    return compiler->constant_count++;
+    return -1;
 }
 
-// Add a name to the name pool
-int add_name(Compiler* compiler, char* name) {
-    for (size_t i = 0; i < compiler->name_count; i++) {
-        if (strcmp(compiler->names[i], name) == 0) return i;
+static void symbol_index_insert(SymbolIndex* index, Symbol key, uint32_t value) {
+    uint32_t slot = symbol_hash(key) & index->slot_mask;
+    while (index->slots[slot].key != NO_SYMBOL && index->slots[slot].key != key) {
+        slot = (slot + 1) & index->slot_mask;
+    }
+    if (index->slots[slot].key == NO_SYMBOL) index->count++;
+    index->slots[slot].key = key;
+    index->slots[slot].value = value;
+}
+
+// Map `key` to `value`, replacing any previous value
+void symbol_index_put(SymbolIndex* index, Symbol key, uint32_t value) {
+    // Keep the load factor at or below one half
+    if ((index->count + 1) * 2 > (index->slots ? index->slot_mask + 1 : 0)) {
+        SymbolIndexSlot* old_slots = index->slots;
+        uint32_t old_slot_count = old_slots ? index->slot_mask + 1 : 0;
+        uint32_t slot_count = old_slot_count ? old_slot_count * 2 : 64;
+        index->slots = (SymbolIndexSlot*)calloc(slot_count, sizeof(SymbolIndexSlot));
+        index->slot_mask = slot_count - 1;
+        index->count = 0;
+        for (uint32_t i = 0; i < old_slot_count; i++) {
+            if (old_slots[i].key != NO_SYMBOL) symbol_index_insert(index, old_slots[i].key, old_slots[i].value);
+        }
+        free(old_slots);
     }
-    compiler->names[compiler->name_count] = strdup(name);
-    return compiler->name_count++;
+    symbol_index_insert(index, key, value);
+}
+
+// Find a symbol in a pool, or append it. Returns its position.
+int symbol_pool_add(SymbolPool* pool, Symbol symbol) {
+    int existing = symbol_index_get(&pool->index, symbol);
+    if (existing >= 0) return existing;
+    if (pool->count >= pool->capacity) {
+        pool->capacity = pool->capacity ? pool->capacity * 2 : 64;
+        pool->strings = (char**)realloc(pool->strings, pool->capacity * sizeof(char*));
+        pool->symbols = (Symbol*)realloc(pool->symbols, pool->capacity * sizeof(Symbol));
+    }
+    pool->strings[pool->count] = (char*)symbol_name(symbol);
+    pool->symbols[pool->count] = symbol;
+    symbol_index_put(&pool->index, symbol, (uint32_t)pool->count);
+    return (int)pool->count++;
+}
+
+// Pool strings belong to the symbol table and are not freed
+void free_symbol_pool(SymbolPool* pool) {
+    free(pool->strings);
+    free(pool->symbols);
+    free(pool->index.slots);
+}
+
+void free_constant_pool(ConstantPool* pool) {
+    free(pool->entries);
+    free(pool->string_index.slots);
+    free(pool->literal_index.slots);
+}
+
+// Classify a literal and decode its value. `kind` is TOKEN_STRING,
+// TOKEN_NUMBER, or TOKEN_IDENTIFIER for True, False and None.
+static Constant decode_constant(TokenType kind, Symbol text) {
+    Constant constant;
+    if (kind == TOKEN_STRING) {
+        constant.type = CONST_STRING;
+        constant.as.string = text;
+    } else if (text == SYM_TRUE || text == SYM_FALSE) {
+        constant.type = CONST_BOOL;
+        constant.as.integer = text == SYM_TRUE;
+    } else if (text == SYM_NONE) {
+        constant.type = CONST_NONE;
+        constant.as.integer = 0;
+    } else {
+        // Integers unless they have a fraction or do not fit a long
+        const char* digits = symbol_name(text);
+        char* end;
+        errno = 0;
+        long integer = strtol(digits, &end, 10);
+        if (*end == '\0' && errno == 0) {
+            constant.type = CONST_INT;
+            constant.as.integer = integer;
+        } else {
+            constant.type = CONST_FLOAT;
+            constant.as.number = strtod(digits, NULL);
+        }
+    }
+    return constant;
+}
+
+// Add a literal to the constant pool, decoding it on first use
+int add_constant(Compiler* compiler, TokenType kind, Symbol text) {
+    ConstantPool* pool = &compiler->constants;
+    SymbolIndex* index = kind == TOKEN_STRING ? &pool->string_index : &pool->literal_index;
+    int existing = symbol_index_get(index, text);
+    if (existing >= 0) return existing;
+    if (pool->count >= pool->capacity) {
+        pool->capacity = pool->capacity ? pool->capacity * 2 : 64;
+        pool->entries = (Constant*)realloc(pool->entries, pool->capacity * sizeof(Constant));
+    }
+    pool->entries[pool->count] = decode_constant(kind, text);
+    symbol_index_put(index, text, (uint32_t)pool->count);
+    return (int)pool->count++;
+}
+
+// Add a name to the name pool
+int add_name(Compiler* compiler, Symbol name) {
+    return symbol_pool_add(&compiler->names, name);
 }
 
 // Find a function in the unified function table
-int find_function(Compiler* compiler, const char* name) {
-    for (size_t i = 0; i < compiler->function_count; i++) {
-        if (strcmp(compiler->functions[i].name, name) == 0) return i;
+int find_function(Compiler* compiler, Symbol name) {
+    return symbol_index_get(&compiler->function_index, name);
+}
+
+// Append a function to the unified function table
+static CompiledFunction* add_function(Compiler* compiler, Symbol name, FunctionType type, int arity, size_t address) {
+    if (compiler->function_count >= compiler->function_capacity) {
+        compiler->function_capacity *= 2;
+        compiler->functions = (CompiledFunction*)realloc(compiler->functions, compiler->function_capacity * sizeof(CompiledFunction));
     }
-    return -1; // Not found
+    CompiledFunction* func = &compiler->functions[compiler->function_count];
+    func->name = name;
+    func->type = type;
+    func->arity = arity;
+    func->address = address;
+    func->local_count = 0;
+    symbol_index_put(&compiler->function_index, name, (uint32_t)compiler->function_count++);
+    return func;
 }
 
 // Add a C function name to the pool, returning its index
-int add_c_function(Compiler* compiler, char* name) {
-    for (size_t i = 0; i < compiler->c_function_count; i++) {
-        if (strcmp(compiler->c_functions[i], name) == 0) return i;
-    }
-    compiler->c_functions[compiler->c_function_count] = strdup(name);
-    return compiler->c_function_count++;
+int add_c_function(Compiler* compiler, Symbol name) {
+    return symbol_pool_add(&compiler->c_functions, name);
 }
 
 // Emit bytecode instruction
@@ -91,147 +217,540 @@ void emit_byte(Compiler* compiler, OpCode opcode, int operand) {
         compiler->bytecode_capacity *= 2;
         compiler->bytecode = (Instruction*)realloc(compiler->bytecode, compiler->bytecode_capacity * sizeof(Instruction));
     }
+    TRACE(TRACE_COMPILER, 2, "%4zu: opcode %d operand %d", compiler->bytecode_size, opcode, operand);
     compiler->bytecode[compiler->bytecode_size].opcode = opcode;
     compiler->bytecode[compiler->bytecode_size].operand = operand;
     compiler->bytecode_size++;
 }
 
-// Compile AST to bytecode
-void compile_ast(Compiler* compiler, ASTNode* node) {
-    if (node == NULL) return;
+// --- Stack bytecode ---
+//
+// Blocks are emitted in order, each instruction's value computed where
+// optimize_ir() left it: inside the expression of its user, again at each
+// use, or once into a variable. The variables are frame slots after the
+// parameters; the top-level code has a frame too, at the bottom of the
+// stack. A phi's variable is assigned by the jumps into its block.
 
-    switch (node->type) {
-        case NODE_PROGRAM: {
-            // Pass 1: Register all functions and C bindings first
-            for (size_t i = 0; i < node->data.block.statement_count; i++) {
-                ASTNode* stmt = node->data.block.statements[i];
-                if (!stmt) continue;
-
-                if (compiler->function_count >= compiler->function_capacity) {
-                    compiler->function_capacity *= 2;
-                    compiler->functions = realloc(compiler->functions, compiler->function_capacity * sizeof(CompiledFunction));
-                }
+typedef struct {
+    Compiler* compiler;
+    const IrFunction* function;
+    int* slots;                 // Value -> variable, or -1
+    int slot_count;
+    size_t* block_addresses;
+    size_t* jumps;              // Jump instructions to patch...
+    uint32_t* jump_targets;     // ...with the address of these blocks
+    size_t jump_count;
+    size_t jump_capacity;
+} StackEmitter;
 
-                if (stmt->type == NODE_FUNCTION_DEF) {
-                    if (find_function(compiler, stmt->data.function_def.name) != -1) continue; // Already seen
-                    CompiledFunction* func = &compiler->functions[compiler->function_count++];
-                    func->name = strdup(stmt->data.function_def.name);
-                    func->type = FUNC_SCRIPT;
-                    func->arity = stmt->data.function_def.parameter_count;
-                    func->address = 0; // Placeholder for now
-                } else if (stmt->type == NODE_C_BINDING) {
-                    if (find_function(compiler, stmt->data.c_binding.name) != -1) continue; // Already seen
-                    CompiledFunction* func = &compiler->functions[compiler->function_count++];
-                    func->name = strdup(stmt->data.c_binding.name);
-                    func->type = FUNC_NATIVE;
-                    func->arity = stmt->data.c_binding.parameter_count;
-                    func->address = add_c_function(compiler, stmt->data.c_binding.c_function_name);
-                }
-            }
-            
-            // Pass 2: Compile the rest of the program
-            for (size_t i = 0; i < node->data.block.statement_count; i++) {
-                compile_ast(compiler, node->data.block.statements[i]);
-            }
-            break;
-        }
-        case NODE_FUNCTION_DEF: {
-            // Function definitions are now handled on the first pass
-            // Here we just compile the body and would handle more complex scoping
-            int func_index = find_function(compiler, node->data.function_def.name);
-            if(func_index != -1) {
-                // In a real compiler, we would jump over the function body
-                // For this simple version, we can just compile it.
-                // A better approach would use a jump to skip this code during main execution.
-                compile_ast(compiler, node->data.function_def.body);
-                emit_byte(compiler, OP_RETURN_VALUE, 0); // Implicit return
-            }
-            break;
-        }
-        case NODE_C_BINDING:
-            // Handled in the first pass, do nothing here.
-            break;
-        
-        case NODE_FUNCTION_CALL: {
-            // Compile arguments first
-            for(int i = node->data.function_call.argument_count - 1; i >= 0; i--) {
-                compile_ast(compiler, node->data.function_call.arguments[i]);
-            }
+static void emit_value(StackEmitter* emitter, uint32_t value);
 
-            int func_index = find_function(compiler, node->data.function_call.name);
-            if (func_index == -1) {
-                fprintf(stderr, "Compile Error: Function '%s' not defined.\n", node->data.function_call.name);
-                exit(1);
-            }
+static void emit_slot(StackEmitter* emitter, int slot, int store) {
+    emit_byte(emitter->compiler, store ? OP_STORE_LOCAL : OP_LOAD_LOCAL, (int)emitter->function->parameter_count + slot);
+}
 
-            CompiledFunction* func = &compiler->functions[func_index];
-            if (func->type == FUNC_NATIVE) {
-                emit_byte(compiler, OP_CALL_C_FUNCTION, func->address);
-            } else {
-                emit_byte(compiler, OP_CALL_FUNCTION, func_index);
-            }
-            break;
-        }
-        
-        // FIX: Handle NODE_CLASS_DEF to prevent "Unhandled node type" error
-        case NODE_CLASS_DEF:
-            // Class definitions are used by the C code generator,
-            // but for bytecode compilation, we can simply ignore them.
-            break;
+// Address of a native function's C function
+static int native_address(Compiler* compiler, Symbol name) {
+    return (int)compiler->functions[find_function(compiler, name)].address;
+}
 
-        // --- Other Cases (largely unchanged) ---
-        case NODE_BLOCK:
-            for (size_t i = 0; i < node->data.block.statement_count; i++) {
-                compile_ast(compiler, node->data.block.statements[i]);
-            }
-            break;
-        case NODE_LITERAL:
-            emit_byte(compiler, OP_LOAD_CONST, add_constant(compiler, node->data.literal.value));
+// Compute an instruction's value onto the stack
+static void emit_operation(StackEmitter* emitter, uint32_t value) {
+    Compiler* compiler = emitter->compiler;
+    const IrFunction* function = emitter->function;
+    const IrInstruction* instruction = &function->instructions[value];
+    for (uint32_t i = 0; i < instruction->operand_count && instruction->op != IR_PHI; i++) {
+        emit_value(emitter, IR_OPERAND(function, instruction, i));
+    }
+    switch (instruction->op) {
+        case IR_CONST:
+            emit_byte(compiler, OP_LOAD_CONST, add_constant(compiler, (TokenType)instruction->kind, instruction->symbol));
             break;
-        case NODE_IDENTIFIER:
-            emit_byte(compiler, OP_LOAD_NAME, add_name(compiler, node->data.identifier.name));
+        case IR_PARAM:
+            emit_byte(compiler, OP_LOAD_LOCAL, instruction->kind);
             break;
-        case NODE_ASSIGNMENT:
-            compile_ast(compiler, node->data.assignment.value);
-            emit_byte(compiler, OP_STORE_NAME, add_name(compiler, node->data.assignment.name));
+        case IR_LOAD_GLOBAL:
+        case IR_LOAD_FIELD:
+            emit_byte(compiler, OP_LOAD_NAME, add_name(compiler, instruction->symbol));
             break;
-        case NODE_BINARY_OP:
-            compile_ast(compiler, node->data.binary_op.left);
-            compile_ast(compiler, node->data.binary_op.right);
-            switch (node->data.binary_op.operator) {
+        case IR_BINARY:
+            switch (instruction->kind) {
                 case TOKEN_PLUS:      emit_byte(compiler, OP_BINARY_ADD, 0); break;
                 case TOKEN_MINUS:     emit_byte(compiler, OP_BINARY_SUB, 0); break;
-                // ... other binary ops
+                case TOKEN_MULTIPLY:  emit_byte(compiler, OP_BINARY_MUL, 0); break;
+                case TOKEN_DIVIDE:    emit_byte(compiler, OP_BINARY_DIV, 0); break;
+                case TOKEN_EQUAL:     emit_byte(compiler, OP_COMPARE_EQ, 0); break;
+                case TOKEN_NOT_EQUAL: emit_byte(compiler, OP_COMPARE_NEQ, 0); break;
+                case TOKEN_GREATER:   emit_byte(compiler, OP_COMPARE_GT, 0); break;
+                case TOKEN_LESS:      emit_byte(compiler, OP_COMPARE_LT, 0); break;
                 default: break;
             }
             break;
-        case NODE_IF:
-            compile_ast(compiler, node->data.if_statement.condition);
-            int jump_else = compiler->bytecode_size;
-            emit_byte(compiler, OP_JUMP_IF_FALSE, 0); // Placeholder
-            compile_ast(compiler, node->data.if_statement.if_block);
-            int jump_end = compiler->bytecode_size;
-            emit_byte(compiler, OP_JUMP, 0); // Placeholder
-            compiler->bytecode[jump_else].operand = compiler->bytecode_size;
-            if(node->data.if_statement.else_block) {
-                compile_ast(compiler, node->data.if_statement.else_block);
-            }
-            compiler->bytecode[jump_end].operand = compiler->bytecode_size;
+        case IR_TO_STRING:
+            emit_byte(compiler, OP_CALL_C_FUNCTION, native_address(compiler, SYM_STR));
             break;
-        case NODE_IMPORT:
-             // Imports are now just markers, processed by the parser.
-             // The compiler can ignore them.
+        case IR_CALL:
+            emit_byte(compiler, OP_CALL_FUNCTION, find_function(compiler, instruction->symbol));
             break;
-        case NODE_RETURN:
-            if(node->data.return_statement.value) {
-                compile_ast(compiler, node->data.return_statement.value);
-            } else {
-                emit_byte(compiler, OP_LOAD_CONST, add_constant(compiler, "None"));
-            }
-            emit_byte(compiler, OP_RETURN_VALUE, 0);
+        case IR_CALL_NATIVE:
+            emit_byte(compiler, OP_CALL_C_FUNCTION, native_address(compiler, instruction->symbol));
             break;
         default:
-            fprintf(stderr, "Error: Unhandled node type %d in compilation\n", node->type);
+            // IR_COPY: the operand is the value
             break;
     }
-}
\ No newline at end of file
+}
+
+// Push a value where it is used
+static void emit_value(StackEmitter* emitter, uint32_t value) {
+    if (emitter->slots[value] >= 0) {
+        emit_slot(emitter, emitter->slots[value], 0);
+    } else {
+        emit_operation(emitter, value);
+    }
+}
+
+static void emit_jump_to(StackEmitter* emitter, OpCode opcode, uint32_t block) {
+    if (emitter->jump_count >= emitter->jump_capacity) {
+        emitter->jump_capacity = emitter->jump_capacity ? emitter->jump_capacity * 2 : 16;
+        emitter->jumps = (size_t*)realloc(emitter->jumps, emitter->jump_capacity * sizeof(size_t));
+        emitter->jump_targets = (uint32_t*)realloc(emitter->jump_targets, emitter->jump_capacity * sizeof(uint32_t));
+    }
+    emitter->jumps[emitter->jump_count] = emitter->compiler->bytecode_size;
+    emitter->jump_targets[emitter->jump_count++] = block;
+    emit_byte(emitter->compiler, opcode, 0);    // Patched once the block is placed
+}
+
+// Assign the phis of `target` their values for the edge from `block`.
+// The graph has no cycles, so no phi reads another phi of its block and
+// they can be assigned one by one.
+static void emit_phi_copies(StackEmitter* emitter, uint32_t block, uint32_t target) {
+    const IrFunction* function = emitter->function;
+    const IrBlock* successor = &function->blocks[target];
+    uint32_t edge = 0;
+    while (successor->predecessors[edge] != block) edge++;
+    for (uint32_t i = 0; i < successor->code_count; i++) {
+        const IrInstruction* phi = &function->instructions[successor->code[i]];
+        if (phi->op != IR_PHI) break;
+        emit_value(emitter, IR_OPERAND(function, phi, edge));
+        emit_slot(emitter, emitter->slots[successor->code[i]], 1);
+    }
+}
+
+static uint32_t next_live_block(const IrFunction* function, uint32_t block) {
+    do block++; while (block < function->block_count && function->blocks[block].dead);
+    return block;
+}
+
+static void emit_block(StackEmitter* emitter, uint32_t block_index) {
+    Compiler* compiler = emitter->compiler;
+    const IrFunction* function = emitter->function;
+    const IrBlock* block = &function->blocks[block_index];
+    uint32_t next = next_live_block(function, block_index);
+    for (uint32_t i = 0; i < block->code_count; i++) {
+        uint32_t value = block->code[i];
+        const IrInstruction* instruction = &function->instructions[value];
+        if (instruction->inlined || instruction->rematerialized || instruction->op == IR_PHI) continue;
+        switch (instruction->op) {
+            case IR_STORE_GLOBAL:
+            case IR_STORE_FIELD:
+                emit_value(emitter, IR_OPERAND(function, instruction, 0));
+                emit_byte(compiler, OP_STORE_NAME, add_name(compiler, instruction->symbol));
+                break;
+            case IR_RESULT:
+                // Left on the stack as the script's result
+                emit_value(emitter, IR_OPERAND(function, instruction, 0));
+                break;
+            case IR_JUMP:
+                emit_phi_copies(emitter, block_index, block->successors[0]);
+                if (block->successors[0] != next) emit_jump_to(emitter, OP_JUMP, block->successors[0]);
+                break;
+            case IR_BRANCH:
+                // Neither arm of a branch has phis: each has only this block
+                // as predecessor
+                emit_value(emitter, IR_OPERAND(function, instruction, 0));
+                emit_jump_to(emitter, OP_JUMP_IF_FALSE, block->successors[1]);
+                if (block->successors[0] != next) emit_jump_to(emitter, OP_JUMP, block->successors[0]);
+                break;
+            case IR_RETURN:
+                emit_value(emitter, IR_OPERAND(function, instruction, 0));
+                emit_byte(compiler, OP_RETURN_VALUE, 0);
+                break;
+            case IR_HALT:
+                emit_byte(compiler, OP_HALT, 0);
+                break;
+            default:
+                emit_operation(emitter, value);
+                // An unused value (a call made for its effect) stays on the
+                // stack, which the function's return discards
+                if (emitter->slots[value] >= 0) emit_slot(emitter, emitter->slots[value], 1);
+                break;
+        }
+    }
+}
+
+// Emit one function at the current address. Returns its local slot count.
+static size_t emit_function(Compiler* compiler, const IrFunction* function) {
+    StackEmitter emitter;
+    memset(&emitter, 0, sizeof(emitter));
+    emitter.compiler = compiler;
+    emitter.function = function;
+    emitter.slots = (int*)malloc(function->instruction_count * sizeof(int));
+    for (uint32_t i = 0; i < function->instruction_count; i++) {
+        emitter.slots[i] = ir_keeps_value(&function->instructions[i]) ? emitter.slot_count++ : -1;
+    }
+    emitter.block_addresses = (size_t*)calloc(function->block_count, sizeof(size_t));
+
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        if (function->blocks[b].dead) continue;
+        emitter.block_addresses[b] = compiler->bytecode_size;
+        emit_block(&emitter, b);
+    }
+    for (size_t i = 0; i < emitter.jump_count; i++) {
+        compiler->bytecode[emitter.jumps[i]].operand = (int)emitter.block_addresses[emitter.jump_targets[i]];
+    }
+
+    free(emitter.slots);
+    free(emitter.block_addresses);
+    free(emitter.jumps);
+    free(emitter.jump_targets);
+    return function->parameter_count + (size_t)emitter.slot_count;
+}
+
+// Compile compiler->ir to stack bytecode: the top-level code at address
+// 0, then the script functions
+void compile_ir(Compiler* compiler) {
+    const IrProgram* ir = compiler->ir;
+    for (uint32_t i = 1; i < ir->function_count; i++) {
+        add_function(compiler, ir->functions[i].name, FUNC_SCRIPT, (int)ir->functions[i].parameter_count, 0);
+    }
+    for (uint32_t i = 0; i < ir->native_count; i++) {
+        // print() is registered by init_compiler()
+        if (find_function(compiler, ir->natives[i].name) != -1) continue;
+        add_function(compiler, ir->natives[i].name, FUNC_NATIVE, ir->natives[i].arity,
+                     add_c_function(compiler, ir->natives[i].c_name));
+    }
+
+    compiler->top_level_locals = emit_function(compiler, &ir->functions[0]);
+    for (uint32_t i = 1; i < ir->function_count; i++) {
+        CompiledFunction* func = &compiler->functions[find_function(compiler, ir->functions[i].name)];
+        func->address = compiler->bytecode_size;
+        func->local_count = emit_function(compiler, &ir->functions[i]);
+    }
+    TRACE(TRACE_COMPILER, 1, "compiled %zu instructions, %zu constants, %zu names, %zu functions",
+          compiler->bytecode_size, compiler->constants.count, compiler->names.count, compiler->function_count);
+}
+
+// --- Register VM lowering ---
+//
+// Each frame is a window of registers. A function's comes in three parts:
+// its parameters, in order; one register for each value optimize_ir()
+// keeps in a variable and each phi; then temporaries. The top-level frame
+// starts with every global name in register (name index), then the result
+// register, so `a = b + c` there is the single instruction ADD a, b, c.
+// Function bodies reach globals through GET_GLOBAL and SET_GLOBAL.
+// Temporaries are handed out like a stack and released after each
+// statement.
+
+typedef struct {
+    Compiler* compiler;
+    RegisterProgram* program;
+    const IrFunction* function;
+    int top_level;
+    int* registers;             // Value -> its own register, or -1
+    int first_temp;
+    int next_temp;
+    int max_registers;
+} RegLowering;
+
+static size_t emit_register(RegLowering* lowering, RegOpCode opcode, int a, int b, int c) {
+    RegisterProgram* program = lowering->program;
+    if (program->size >= program->capacity) {
+        program->capacity = program->capacity ? program->capacity * 2 : 256;
+        program->code = (RegInstruction*)realloc(program->code, program->capacity * sizeof(RegInstruction));
+    }
+    TRACE(TRACE_COMPILER, 2, "%4zu: reg opcode %d %d %d %d", program->size, opcode, a, b, c);
+    RegInstruction* instruction = &program->code[program->size];
+    instruction->opcode = opcode;
+    instruction->a = a;
+    instruction->b = b;
+    instruction->c = c;
+    return program->size++;
+}
+
+static int new_temp(RegLowering* lowering) {
+    int reg = lowering->next_temp++;
+    if (lowering->next_temp > lowering->max_registers) lowering->max_registers = lowering->next_temp;
+    return reg;
+}
+
+static int use_value(RegLowering* lowering, uint32_t value, int target);
+
+static void lower_into(RegLowering* lowering, uint32_t value, int target) {
+    int reg = use_value(lowering, value, target);
+    if (reg != target) emit_register(lowering, REG_MOVE, target, reg, 0);
+}
+
+// Does evaluating the value's expression call a script function, which
+// could assign any global?
+static int calls_script(const IrFunction* function, uint32_t value) {
+    const IrInstruction* instruction = &function->instructions[value];
+    if (!instruction->inlined) return 0;
+    if (instruction->op == IR_CALL) return 1;
+    for (uint32_t i = 0; i < instruction->operand_count; i++) {
+        if (calls_script(function, IR_OPERAND(function, instruction, i))) return 1;
+    }
+    return 0;
+}
+
+// Register holding operand `index` of an instruction. At top level a
+// global is read straight from its register, unless a call evaluated
+// after it, for a later operand, could change it first.
+static int lower_operand(RegLowering* lowering, const IrInstruction* instruction, uint32_t index) {
+    const IrFunction* function = lowering->function;
+    uint32_t operand = IR_OPERAND(function, instruction, index);
+    int reg = use_value(lowering, operand, -1);
+    const IrInstruction* definition = &function->instructions[operand];
+    if (lowering->top_level && lowering->registers[operand] < 0 &&
+        (definition->op == IR_LOAD_GLOBAL || definition->op == IR_LOAD_FIELD)) {
+        for (uint32_t i = index + 1; i < instruction->operand_count; i++) {
+            if (!calls_script(function, IR_OPERAND(function, instruction, i))) continue;
+            int temp = new_temp(lowering);
+            emit_register(lowering, REG_MOVE, temp, reg, 0);
+            return temp;
+        }
+    }
+    return reg;
+}
+
+// Call with the arguments in consecutive temporaries
+static int lower_call(RegLowering* lowering, const IrInstruction* instruction, RegOpCode opcode, int callee, int target) {
+    const IrFunction* function = lowering->function;
+    int mark = lowering->next_temp;
+    int first = lowering->next_temp;
+    for (uint32_t i = 0; i < instruction->operand_count; i++) new_temp(lowering);
+    for (uint32_t i = 0; i < instruction->operand_count; i++) {
+        lower_into(lowering, IR_OPERAND(function, instruction, i), first + (int)i);
+    }
+    lowering->next_temp = mark;
+    int dest = target >= 0 ? target : new_temp(lowering);
+    emit_register(lowering, opcode, dest, callee, first);
+    return dest;
+}
+
+// Compute a value, preferring `target` (-1 for any) as its register.
+// Returns the register that holds it, which for a parameter or a
+// top-level global is its own register.
+static int lower_value(RegLowering* lowering, uint32_t value, int target) {
+    Compiler* compiler = lowering->compiler;
+    const IrInstruction* instruction = &lowering->function->instructions[value];
+    switch (instruction->op) {
+        case IR_PARAM:
+            return instruction->kind;
+        case IR_COPY:
+            return use_value(lowering, IR_OPERAND(lowering->function, instruction, 0), target);
+        case IR_LOAD_GLOBAL:
+        case IR_LOAD_FIELD: {
+            if (lowering->top_level) return add_name(compiler, instruction->symbol);
+            int dest = target >= 0 ? target : new_temp(lowering);
+            emit_register(lowering, REG_GET_GLOBAL, dest, add_name(compiler, instruction->symbol), 0);
+            return dest;
+        }
+        case IR_CONST: {
+            int dest = target >= 0 ? target : new_temp(lowering);
+            emit_register(lowering, REG_LOAD_CONST, dest, add_constant(compiler, (TokenType)instruction->kind, instruction->symbol), 0);
+            return dest;
+        }
+        case IR_BINARY: {
+            RegOpCode opcode;
+            switch (instruction->kind) {
+                case TOKEN_PLUS:      opcode = REG_ADD; break;
+                case TOKEN_MINUS:     opcode = REG_SUB; break;
+                case TOKEN_MULTIPLY:  opcode = REG_MUL; break;
+                case TOKEN_DIVIDE:    opcode = REG_DIV; break;
+                case TOKEN_EQUAL:     opcode = REG_EQ; break;
+                case TOKEN_NOT_EQUAL: opcode = REG_NEQ; break;
+                case TOKEN_GREATER:   opcode = REG_GT; break;
+                default:              opcode = REG_LT; break;
+            }
+            int left = lower_operand(lowering, instruction, 0);
+            int right = lower_operand(lowering, instruction, 1);
+            int dest = target >= 0 ? target : new_temp(lowering);
+            emit_register(lowering, opcode, dest, left, right);
+            return dest;
+        }
+        case IR_TO_STRING:
+            return lower_call(lowering, instruction, REG_CALL_NATIVE, native_address(compiler, SYM_STR), target);
+        case IR_CALL:
+            return lower_call(lowering, instruction, REG_CALL, find_function(compiler, instruction->symbol), target);
+        case IR_CALL_NATIVE:
+            return lower_call(lowering, instruction, REG_CALL_NATIVE, native_address(compiler, instruction->symbol), target);
+        default:
+            // Phis always have a register
+            return lowering->registers[value];
+    }
+}
+
+// Register holding a value where it is used
+static int use_value(RegLowering* lowering, uint32_t value, int target) {
+    if (lowering->registers[value] >= 0) return lowering->registers[value];
+    return lower_value(lowering, value, target);
+}
+
+static void lower_phi_copies(RegLowering* lowering, uint32_t block, uint32_t target) {
+    const IrFunction* function = lowering->function;
+    const IrBlock* successor = &function->blocks[target];
+    uint32_t edge = 0;
+    while (successor->predecessors[edge] != block) edge++;
+    for (uint32_t i = 0; i < successor->code_count; i++) {
+        const IrInstruction* phi = &function->instructions[successor->code[i]];
+        if (phi->op != IR_PHI) break;
+        lower_into(lowering, IR_OPERAND(function, phi, edge), lowering->registers[successor->code[i]]);
+    }
+}
+
+static void lower_block(RegLowering* lowering, uint32_t block_index, size_t* block_addresses,
+                        size_t* jumps, uint32_t* jump_targets, size_t* jump_count) {
+    Compiler* compiler = lowering->compiler;
+    const IrFunction* function = lowering->function;
+    const IrBlock* block = &function->blocks[block_index];
+    uint32_t next = next_live_block(function, block_index);
+    block_addresses[block_index] = lowering->program->size;
+    for (uint32_t i = 0; i < block->code_count; i++) {
+        uint32_t value = block->code[i];
+        const IrInstruction* instruction = &function->instructions[value];
+        if (instruction->inlined || instruction->rematerialized || instruction->op == IR_PHI) continue;
+        switch (instruction->op) {
+            case IR_STORE_GLOBAL:
+            case IR_STORE_FIELD: {
+                int name = add_name(compiler, instruction->symbol);
+                if (lowering->top_level) {
+                    lower_into(lowering, IR_OPERAND(function, instruction, 0), name);
+                } else {
+                    int reg = use_value(lowering, IR_OPERAND(function, instruction, 0), -1);
+                    emit_register(lowering, REG_SET_GLOBAL, name, reg, 0);
+                }
+                break;
+            }
+            case IR_RESULT:
+                lowering->program->result_register = (int)compiler->names.count;
+                lower_into(lowering, IR_OPERAND(function, instruction, 0), lowering->program->result_register);
+                break;
+            case IR_JUMP:
+                lower_phi_copies(lowering, block_index, block->successors[0]);
+                if (block->successors[0] != next) {
+                    jump_targets[*jump_count] = block->successors[0];
+                    jumps[(*jump_count)++] = emit_register(lowering, REG_JUMP, 0, 0, 0);
+                }
+                break;
+            case IR_BRANCH: {
+                int condition = use_value(lowering, IR_OPERAND(function, instruction, 0), -1);
+                jump_targets[*jump_count] = block->successors[1];
+                jumps[(*jump_count)++] = emit_register(lowering, REG_JUMP_IF_FALSE, condition, 0, 0);
+                if (block->successors[0] != next) {
+                    jump_targets[*jump_count] = block->successors[0];
+                    jumps[(*jump_count)++] = emit_register(lowering, REG_JUMP, 0, 0, 0);
+                }
+                break;
+            }
+            case IR_RETURN:
+                emit_register(lowering, REG_RETURN, use_value(lowering, IR_OPERAND(function, instruction, 0), -1), 0, 0);
+                break;
+            case IR_HALT:
+                emit_register(lowering, REG_HALT, 0, 0, 0);
+                break;
+            default: {
+                // Parameters and top-level globals come back in their own
+                // register
+                int reg = lower_value(lowering, value, lowering->registers[value]);
+                if (lowering->registers[value] >= 0 && reg != lowering->registers[value]) {
+                    emit_register(lowering, REG_MOVE, lowering->registers[value], reg, 0);
+                }
+                break;
+            }
+        }
+        lowering->next_temp = lowering->first_temp;
+    }
+}
+
+// Lower one function; `first_register` is where its value registers start.
+// Returns its register count.
+static int lower_function(RegLowering* lowering, const IrFunction* function, int first_register) {
+    lowering->function = function;
+    lowering->registers = (int*)malloc(function->instruction_count * sizeof(int));
+    int next_register = first_register;
+    for (uint32_t i = 0; i < function->instruction_count; i++) {
+        lowering->registers[i] = ir_keeps_value(&function->instructions[i]) ? next_register++ : -1;
+    }
+    lowering->first_temp = next_register;
+    lowering->next_temp = next_register;
+    lowering->max_registers = next_register;
+
+    // Every block ends in at most two jumps
+    size_t* block_addresses = (size_t*)calloc(function->block_count, sizeof(size_t));
+    size_t* jumps = (size_t*)malloc(function->block_count * 2 * sizeof(size_t));
+    uint32_t* jump_targets = (uint32_t*)malloc(function->block_count * 2 * sizeof(uint32_t));
+    size_t jump_count = 0;
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        if (!function->blocks[b].dead) lower_block(lowering, b, block_addresses, jumps, jump_targets, &jump_count);
+    }
+    for (size_t i = 0; i < jump_count; i++) {
+        RegInstruction* jump = &lowering->program->code[jumps[i]];
+        if (jump->opcode == REG_JUMP) jump->a = (int32_t)block_addresses[jump_targets[i]];
+        else jump->b = (int32_t)block_addresses[jump_targets[i]];
+    }
+    free(block_addresses);
+    free(jumps);
+    free(jump_targets);
+    free(lowering->registers);
+    return lowering->max_registers;
+}
+
+// Lower compiler->ir to register code in compiler->registers. compile_ir()
+// must have registered the functions. Returns the number of errors
+// reported.
+int lower_to_registers(Compiler* compiler) {
+    const IrProgram* ir = compiler->ir;
+    RegisterProgram* program = &compiler->registers;
+    int errors_before = compiler->error_count;
+
+    // Give every name in the program its global register up front, so the
+    // top-level registers can start after them
+    for (uint32_t f = 0; f < ir->function_count; f++) {
+        const IrFunction* function = &ir->functions[f];
+        for (uint32_t i = 1; i < function->instruction_count; i++) {
+            const IrInstruction* instruction = &function->instructions[i];
+            if (instruction->dead) continue;
+            if (instruction->op == IR_LOAD_GLOBAL || instruction->op == IR_LOAD_FIELD ||
+                instruction->op == IR_STORE_GLOBAL || instruction->op == IR_STORE_FIELD) {
+                add_name(compiler, instruction->symbol);
+            }
+        }
+    }
+
+    program->functions = (RegFunction*)calloc(compiler->function_count ? compiler->function_count : 1, sizeof(RegFunction));
+    for (size_t i = 0; i < compiler->function_count; i++) {
+        if (compiler->functions[i].type == FUNC_NATIVE) program->functions[i].address = compiler->functions[i].address;
+    }
+    program->result_register = -1;
+
+    RegLowering lowering;
+    memset(&lowering, 0, sizeof(lowering));
+    lowering.compiler = compiler;
+    lowering.program = program;
+    lowering.top_level = 1;
+    // After the result register
+    program->main_registers = lower_function(&lowering, &ir->functions[0], (int)compiler->names.count + 1);
+
+    lowering.top_level = 0;
+    for (uint32_t i = 1; i < ir->function_count; i++) {
+        const IrFunction* function = &ir->functions[i];
+        RegFunction* func = &program->functions[find_function(compiler, function->name)];
+        func->address = program->size;
+        func->register_count = lower_function(&lowering, function, (int)function->parameter_count);
+    }
+
+    TRACE(TRACE_COMPILER, 1, "lowered to %zu register instructions, %d top-level registers",
+          program->size, program->main_registers);
+    return compiler->error_count - errors_before;
+}
@@ -10,14 +10,26 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include "value.h"
 
 // Forward declarations of main structures
 typedef struct Lexer Lexer;
 typedef struct Token Token;
 typedef struct Parser Parser;
 typedef struct ASTNode ASTNode;
+typedef struct Ast Ast;
 typedef struct Compiler Compiler;
 typedef struct Runtime Runtime;
+typedef struct SourceBuffer SourceBuffer;
+typedef struct TokenStream TokenStream;
+typedef struct NativeBinding NativeBinding;
+typedef struct HostFunction HostFunction;
+typedef struct SymbolIndex SymbolIndex;
+typedef struct SymbolPool SymbolPool;
+typedef struct ConstantPool ConstantPool;
+typedef struct IrProgram IrProgram;
+typedef struct IrInstruction IrInstruction;
 
 // Token types for lexical analysis
 typedef enum {
@@ -98,32 +110,245 @@ typedef enum {
     OP_CALL_FUNCTION,
     OP_RETURN_VALUE,
     OP_CALL_C_FUNCTION,
+    OP_DUP,
+    OP_LOAD_LOCAL,                  // Operand: frame slot
+    OP_STORE_LOCAL,
+    OP_HALT,
+    // Superinstructions, formed by the peephole optimizer
+    OP_LOAD_NAME_LOAD_CONST,        // Packed operand: name, constant
+    OP_COMPARE_EQ_JUMP_IF_FALSE,
+    OP_COMPARE_LT_JUMP_IF_FALSE,
+    OP_INC_NAME,                    // name = name + constant; packed operand
+    OP_LOAD_NAME_RETURN,
+    OP_COUNT                        // Number of opcodes, not an instruction
 } OpCode;
 
-// C function pointer type for binding
-typedef void* (*CFunctionPtr)(void**);
+// Superinstructions with two operands pack them into one: the first in
+// the low 16 bits, the second in the high 16 bits
+#define PACKED_OPERAND_LIMIT 0x10000
+#define PACK_OPERANDS(first, second) ((int)((uint32_t)(first) | ((uint32_t)(second) << 16)))
+#define PACKED_FIRST(operand) ((uint32_t)(operand) & 0xFFFF)
+#define PACKED_SECOND(operand) ((uint32_t)(operand) >> 16)
+
+// Register VM instruction types. Operands a, b and c name registers of
+// the current frame unless noted.
+typedef enum {
+    REG_LOAD_CONST,     // a = constants[b]
+    REG_MOVE,           // a = b
+    REG_GET_GLOBAL,     // a = global register b
+    REG_SET_GLOBAL,     // global register a = b
+    REG_ADD,            // a = b + c
+    REG_SUB,            // a = b - c
+    REG_MUL,            // a = b * c
+    REG_DIV,            // a = b / c
+    REG_EQ,             // a = b == c
+    REG_NEQ,            // a = b != c
+    REG_GT,             // a = b > c
+    REG_LT,             // a = b < c
+    REG_JUMP,           // pc = a
+    REG_JUMP_IF_FALSE,  // if not a: pc = b
+    REG_CALL,           // a = script function b(c, c+1, ...)
+    REG_CALL_NATIVE,    // a = C function b(c, c+1, ...)
+    REG_RETURN,         // return a
+    REG_HALT,
+} RegOpCode;
+
+// Mid-level IR operations (see ir.c). Each instruction's index in its
+// function names the value it produces.
+typedef enum {
+    IR_CONST,           // Literal `symbol` of token kind `kind`
+    IR_PARAM,           // Parameter number `kind`
+    IR_PHI,             // One operand per predecessor block, in order
+    IR_COPY,            // operand 0; removed by copy propagation
+    IR_LOAD_GLOBAL,     // Global variable `symbol`
+    IR_STORE_GLOBAL,    // symbol = operand 0
+    IR_LOAD_FIELD,      // AppState field `symbol`, spelled "app.x"
+    IR_STORE_FIELD,     // symbol = operand 0
+    IR_BINARY,          // operand 0 `kind` operand 1; kind is the operator token
+    IR_TO_STRING,       // str(operand 0)
+    IR_CALL,            // Script function `symbol` (functions[kind]) of the operands
+    IR_CALL_NATIVE,     // Native function `symbol` (natives[kind]) of the operands
+    IR_RESULT,          // Top-level expression statement with value operand 0
+    // Terminators, the last instruction of every block
+    IR_JUMP,            // To successors[0]
+    IR_BRANCH,          // successors[0] if operand 0 is true, else successors[1]
+    IR_RETURN,          // Return operand 0
+    IR_HALT,            // End of the top-level code
+} IrOp;
+
+// Static type of an IR value. ANY is anything, including the types below.
+typedef enum {
+    IR_TYPE_ANY,
+    IR_TYPE_INT,
+    IR_TYPE_BOOL,
+    IR_TYPE_STRING,
+    IR_TYPE_NONE,
+} IrType;
+
+// Interned string handle; 0 means "no symbol"
+typedef uint32_t Symbol;
+#define NO_SYMBOL 0
+
+// Names the compiler and code generator test for. They are interned
+// first, so SYM_<id> is their Symbol.
+#define WELL_KNOWN_SYMBOLS(X) \
+    X(MAIN, "main") \
+    X(RENDER, "render") \
+    X(INPUT, "input") \
+    X(APP_STATE, "AppState") \
+    X(PRINT, "print") \
+    X(STR, "str") \
+    X(INT_TO_STR, "int_to_str") \
+    X(NONE, "None") \
+    X(TRUE, "True") \
+    X(FALSE, "False") \
+    X(CANVAS, "canvas") \
+    X(APP, "app") \
+    X(GUI, "gui") \
+    X(FURI, "furi") \
+    X(NOTIFICATION, "notification") \
+    X(CANVAS_DRAW_STR, "canvas_draw_str") \
+    X(DISPLAY_DRAW_FRAME, "display_draw_frame") \
+    X(DISPLAY_DRAW_STR, "display_draw_str") \
+    X(DISPLAY_CLEAR, "display_clear") \
+    X(DISPLAY_DRAW_CIRCLE, "display_draw_circle") \
+    X(DISPLAY_DRAW_BOX, "display_draw_box") \
+    X(DISPLAY_DRAW_DISK, "display_draw_disk") \
+    X(DELAY_MS, "delay_ms")
+
+enum {
+    SYM_NO_SYMBOL = NO_SYMBOL,
+#define SYMBOL_ENUM(id, text) SYM_##id,
+    WELL_KNOWN_SYMBOLS(SYMBOL_ENUM)
+#undef SYMBOL_ENUM
+    SYM_WELL_KNOWN_COUNT
+};
+
+// Index of a node in an Ast arena; 0 means "no node"
+typedef uint32_t NodeId;
+#define NULL_NODE 0
+
+// A run of `count` child NodeIds starting at `start` in Ast.lists
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+} NodeList;
+
+// Native (C) functions are stored as a generic pointer and called through
+// the trampoline for their signature, which casts it back (see native.c)
+typedef void (*NativeFunction)(void);
+typedef Value (*NativeTrampoline)(NativeFunction function, const Value* args);
 
 // Function declarations
 
+// Source loading functions
+SourceBuffer* load_source(const char* filename);
+void free_source(SourceBuffer* buffer);
+
+// Character classes for the lexer's char_class table
+enum {
+    CHAR_SPACE = 1 << 0,        // ' ', '\t', '\r' (not newline)
+    CHAR_IDENT_START = 1 << 1,  // letters and '_'
+    CHAR_IDENT = 1 << 2,        // identifier body: letters, digits, '_', '.'
+    CHAR_DIGIT = 1 << 3,        // '0'-'9'
+    CHAR_NUMBER = 1 << 4,       // number body: digits and '.'
+};
+extern const unsigned char char_class[256];
+
+// Bulk scanning helpers (SIMD where available)
+size_t scan_spaces(const char* source, size_t pos, size_t length);
+size_t scan_identifier(const char* source, size_t pos, size_t length);
+size_t scan_number(const char* source, size_t pos, size_t length);
+size_t scan_line_end(const char* source, size_t pos, size_t length);
+size_t scan_string_body(const char* source, size_t pos, size_t length, char quote);
+
+// Symbol table functions
+Symbol intern_string(const char* text, size_t length);
+Symbol intern_cstring(const char* text);
+const char* symbol_name(Symbol symbol);
+size_t symbol_length(Symbol symbol);
+
 // Lexer functions
-Lexer* init_lexer(char* source);
+Lexer* init_lexer(const char* source, size_t length);
 Token get_next_token(Lexer* lexer);
+const char* token_start(Lexer* lexer, Token token);
+char* token_strdup(Lexer* lexer, Token token);
+TokenStream* tokenize_all(Lexer* lexer);
+TokenStream* tokenize_parallel(Lexer* lexer, int jobs);
+TokenStream* create_token_stream(size_t source_len);
+void token_stream_push(TokenStream* stream, Token token);
+Token token_stream_get(const TokenStream* stream, size_t index);
+void free_token_stream(TokenStream* stream);
 
 // Parser functions
 Parser* init_parser(Lexer* lexer);
-ASTNode* parse_program(Parser* parser);
-ASTNode* parse_statement(Parser* parser);
-ASTNode* parse_expression(Parser* parser);
+Parser* init_parser_with_tokens(Lexer* lexer, TokenStream* tokens);
+void free_parser(Parser* parser);
+Token peek_token(Parser* parser, size_t offset);
+size_t report_syntax_errors(const Parser* parser, const char* filename, FILE* out);
+Ast* parse_program(Parser* parser);
+NodeId parse_statement(Parser* parser);
+NodeId parse_expression(Parser* parser);
+
+// AST arena functions
+Ast* create_ast(void);
+void free_ast(Ast* ast);
+NodeId create_node(Ast* ast, NodeType type);
+uint32_t ast_list_begin(Ast* ast);
+void ast_list_push(Ast* ast, NodeId node);
+NodeList ast_list_end(Ast* ast, uint32_t mark);
+
+// AST optimizer (constant folding and simplification)
+void optimize_ast(Ast* ast, int level);
+int integer_literal_value(Symbol text, long* value);
+int fold_operation(TokenType op, long left, long right, long* result);
+
+// Native module registry
+int load_module_descriptor(const char* filename);
+const NativeBinding* find_native_binding(Symbol module, Symbol name);
+int is_native_module(Symbol module);
+void link_native_bindings(Ast* ast);
+
+// Native call trampolines
+NativeTrampoline find_trampoline(const char* signature);
+const char* generic_signature(int arity);
+int signature_arity(const char* signature);
+int bind_host_function(HostFunction* host, const char* name, const char* signature, NativeFunction function);
+int check_native_arguments(const HostFunction* host, const Value* args);
+int register_host_function(const char* name, const char* signature, NativeFunction function);
+int resolve_host_function(const char* name, int arity, HostFunction* host);
+
+// Language server (incremental diagnostics over stdin/stdout)
+int run_language_server(FILE* in, FILE* out);
 
 // Compiler functions
-Compiler* init_compiler(ASTNode* ast);
-void compile_ast(Compiler* compiler, ASTNode* node);
+Compiler* init_compiler(Ast* ast);
+void free_compiler(Compiler* compiler);
+int symbol_index_get(const SymbolIndex* index, Symbol key);
+void symbol_index_put(SymbolIndex* index, Symbol key, uint32_t value);
+int symbol_pool_add(SymbolPool* pool, Symbol symbol);
+void free_symbol_pool(SymbolPool* pool);
+void free_constant_pool(ConstantPool* pool);
+void compile_ir(Compiler* compiler);
+int lower_to_registers(Compiler* compiler);
+
+// Mid-level IR: lowering from the AST and optimization
+int lower_to_ir(Compiler* compiler);
+void optimize_ir(IrProgram* ir, int level);
+void free_ir(IrProgram* ir);
+int ir_keeps_value(const IrInstruction* instruction);
+
+// Bytecode peephole optimizer
+size_t optimize_bytecode(Compiler* compiler, int level);
 
 // C code generation functions
-void generate_c_from_ast(ASTNode* node, FILE* file, int indent_level);
+void generate_c_from_ir(const IrProgram* ir, FILE* file);
 
 // Runtime functions
 Runtime* init_runtime(Compiler* compiler);
-void execute_bytecode(Runtime* runtime);
+void free_runtime(Runtime* runtime);
+int execute_bytecode(Runtime* runtime);
+int execute_registers(Runtime* runtime);
+void print_value(FILE* file, Value value);
 
 #endif /* FLIPSCRIPT_H */
\ No newline at end of file
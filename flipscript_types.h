@@ -6,129 +6,209 @@
 #ifndef FLIPSCRIPT_TYPES_H
 #define FLIPSCRIPT_TYPES_H
 
+#include <setjmp.h>
 #include "flipscript.h"
 
-// Token structure
+// Script source held in memory: a read-only file mapping or a heap
+// buffer. Not NUL-terminated; always use `length`.
+struct SourceBuffer {
+    const char* data;
+    size_t length;
+    int is_mapped;
+};
+
+// Token structure. A token does not own its text: it is a span
+// (start, length) into the lexer's source buffer. Identifiers, numbers
+// and strings also carry the Symbol of their text.
 typedef struct Token {
     TokenType type;
-    char* value;
+    size_t start;
+    size_t length;
     int line;
     int column;
+    Symbol symbol;
 } Token;
 
+// Whole-file token stream in struct-of-arrays layout, produced by
+// tokenize_all(). Offsets, lengths and positions are 32-bit to keep the
+// arrays dense, which limits a single source to 4 GiB.
+struct TokenStream {
+    uint8_t* types;     // TokenType of each token
+    uint32_t* starts;   // Span start in the source buffer
+    uint32_t* lengths;  // Span length
+    uint32_t* lines;
+    uint32_t* columns;
+    Symbol* symbols;    // Interned text, or NO_SYMBOL for punctuation
+    size_t count;
+    size_t capacity;
+};
+
 // Lexer structure
 typedef struct Lexer {
-    char* source;
+    const char* source;
     size_t source_len;
     size_t pos;
     size_t line;
     size_t column;
     int indent_level;
+    int line_indent;  // Indentation level of the line most recently started
     Token current_token;
 } Lexer;
 
-// AST node structure
+// AST node structure. Nodes live in an Ast arena and refer to each other
+// by NodeId; variable-length children (block statements, arguments,
+// parameters, elif clauses) are NodeLists into the arena's shared list
+// array. Names and literal text are interned Symbols.
 struct ASTNode {
     NodeType type;
     union {
         // For literals (numbers, strings)
         struct {
-            char* value;
+            Symbol value;
+            TokenType kind;         // TOKEN_NUMBER or TOKEN_STRING
         } literal;
         
         // For identifiers
         struct {
-            char* name;
+            Symbol name;
         } identifier;
         
         // For binary operations
         struct {
-            ASTNode* left;
+            NodeId left;
             TokenType operator;
-            ASTNode* right;
+            NodeId right;
         } binary_op;
         
         // For unary operations
         struct {
             TokenType operator;
-            ASTNode* operand;
+            NodeId operand;
         } unary_op;
         
         // For variable assignment
         struct {
-            char* name;
-            ASTNode* value;
+            Symbol name;
+            NodeId value;
         } assignment;
         
-        // For blocks of code
+        // For blocks of code (and the program)
         struct {
-            ASTNode** statements;
-            size_t statement_count;
+            NodeList statements;
         } block;
         
         struct {
-            ASTNode* condition;
-            ASTNode* if_block;
-            // Add support for multiple elif blocks
-            struct {
-                ASTNode* condition;
-                ASTNode* block;
-            } *elif_clauses;
-            size_t elif_count;
-            ASTNode* else_block;
+            NodeId condition;
+            NodeId if_block;
+            // Each elif clause is a NODE_IF with only condition and if_block
+            NodeList elif_clauses;
+            NodeId else_block;
         } if_statement;
         
         // For while loops
         struct {
-            ASTNode* condition;
-            ASTNode* block;
+            NodeId condition;
+            NodeId block;
         } while_loop;
         
-        // For function definitions
+        // For function definitions; parameters are NODE_IDENTIFIERs
         struct {
-            char* name;
-            char** parameters;
-            size_t parameter_count;
-            ASTNode* body;
+            Symbol name;
+            NodeList parameters;
+            NodeId body;
         } function_def;
         
         // For function calls
         struct {
-            char* name;
-            ASTNode** arguments;
-            size_t argument_count;
+            Symbol name;
+            NodeList arguments;
         } function_call;
         
         // For return statements
         struct {
-            ASTNode* value;
+            NodeId value;
         } return_statement;
         
         // For import statements
         struct {
-            char* module_name;
+            Symbol module_name;
         } import;
         
-        // For C function bindings
+        // For C function bindings; parameters are NODE_IDENTIFIERs
         struct {
-            char* name;
-            char* c_function_name;
-            char** parameters;
-            char** parameter_types;
-            size_t parameter_count;
+            Symbol name;
+            Symbol c_function_name;
+            NodeList parameters;
         } c_binding;
 
         struct {
-            char* name;
-            ASTNode* body;
+            Symbol name;
+            NodeId body;
         } class_def;
     } data;
 };
 
+// Arena holding a whole syntax tree. Node 0 is reserved as NULL_NODE.
+// Everything is released by a single free_ast() call.
+struct Ast {
+    ASTNode* nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+    NodeId* lists;              // Shared child-list storage
+    uint32_t list_count;
+    uint32_t list_capacity;
+    NodeId* scratch;            // Stack for lists under construction
+    uint32_t scratch_count;
+    uint32_t scratch_capacity;
+    NodeId root;
+};
+
+// Node accessors. Pointers returned by AST_NODE are invalidated when a
+// node is added, so re-fetch them after creating children.
+#define AST_NODE(ast, id) (&(ast)->nodes[(id)])
+#define AST_LIST_GET(ast, list, i) ((ast)->lists[(list).start + (i)])
+
+// Native function a module makes importable
+typedef struct NativeBinding {
+    Symbol module;
+    Symbol name;          // Name called from scripts
+    Symbol c_name;        // C function it binds to
+    const char* signature;  // e.g. "n(viis)", see native.c
+    int arity;
+} NativeBinding;
+
+// A C function the VM can call
+typedef struct HostFunction {
+    const char* name;
+    const char* signature;
+    NativeFunction function;
+    NativeTrampoline trampoline;
+    int arity;
+    int typed;              // Some parameter is not a plain Value, so
+                            // argument types are checked per call
+} HostFunction;
+
+// Syntax error found while parsing
+typedef struct {
+    int line;
+    int column;
+    char message[256];
+} ParseDiagnostic;
+
 // Parser structure
 typedef struct Parser {
     Lexer* lexer;
+    Ast* ast;             // Arena the parsed tree is built in
+    TokenStream* tokens;  // Entire token stream, lexed up front
+    size_t index;         // Index of current_token in `tokens`
     Token current_token;
+
+    // Error recovery. A syntax error records a diagnostic and longjmps to
+    // the innermost statement being parsed, which skips ahead and carries on.
+    jmp_buf* error_jmp;
+    ParseDiagnostic* diagnostics;
+    size_t diagnostic_count;
+    size_t diagnostic_capacity;
 } Parser;
 
 // Bytecode instruction
@@ -145,48 +225,265 @@ typedef enum {
 
 // A unified representation for any callable function
 typedef struct {
-    char* name;
+    Symbol name;
     FunctionType type;
     size_t arity;
     // For SCRIPT: the starting address in the bytecode
     // For NATIVE: the index in the runtime's C function table
     size_t address; 
+    size_t local_count;     // SCRIPT: frame slots, parameters first
 } CompiledFunction;
 
 
+// Open-addressing map from Symbol to a small index. Empty slots have
+// key NO_SYMBOL.
+typedef struct {
+    Symbol key;
+    uint32_t value;
+} SymbolIndexSlot;
+
+typedef struct SymbolIndex {
+    SymbolIndexSlot* slots;
+    uint32_t slot_mask;
+    uint32_t count;
+} SymbolIndex;
+
+// Distinct symbols in first-use order, as written to bytecode. Strings
+// point into the symbol table and are not owned.
+typedef struct SymbolPool {
+    char** strings;
+    Symbol* symbols;
+    size_t count;
+    size_t capacity;
+    SymbolIndex index;          // Symbol -> position in the pool
+} SymbolPool;
+
+// Kind of value in the constant pool
+typedef enum {
+    CONST_NONE,
+    CONST_BOOL,
+    CONST_INT,
+    CONST_FLOAT,
+    CONST_STRING
+} ConstantType;
+
+// Literal classified and decoded at compile time
+typedef struct {
+    ConstantType type;
+    union {
+        long integer;           // CONST_INT; CONST_BOOL as 0 or 1
+        double number;          // CONST_FLOAT
+        Symbol string;          // CONST_STRING, without the quotes
+    } as;
+} Constant;
+
+// Distinct constants in first-use order. Strings and the other literals
+// are indexed separately because a string may have the same text as a
+// number ("5" and 5).
+typedef struct ConstantPool {
+    Constant* entries;
+    size_t count;
+    size_t capacity;
+    SymbolIndex string_index;   // String text -> entry
+    SymbolIndex literal_index;  // Number, True, False or None text -> entry
+} ConstantPool;
+
+// --- Mid-level IR ---
+
+#define IR_NO_BLOCK UINT32_MAX
+
+// One IR instruction. Its index in IrFunction.instructions is the value it
+// defines; index 0 is unused, so 0 means "no value".
+struct IrInstruction {
+    IrOp op;
+    IrType type;
+    int kind;                   // Per IrOp: literal token kind, operator,
+                                // parameter number or callee index
+    Symbol symbol;              // Literal text, variable or callee name
+    Symbol variable;            // Local variable that holds the value, if any
+    uint32_t block;
+    uint32_t first_operand;     // Operands are operands[first_operand...]
+    uint32_t operand_count;
+    // Set by optimize_ir() for the back ends
+    uint32_t use_count;
+    uint8_t dead;
+    uint8_t inlined;            // Evaluated inside the expression of its only user
+    uint8_t rematerialized;     // Evaluated again at each use
+};
+
+// Basic block. `code` lists its live instructions, phis first and the
+// terminator last.
+typedef struct IrBlock {
+    uint32_t* code;
+    uint32_t code_count;
+    uint32_t code_capacity;
+    uint32_t* predecessors;     // In phi operand order
+    uint32_t predecessor_count;
+    uint32_t predecessor_capacity;
+    uint32_t successors[2];
+    uint32_t successor_count;
+    uint32_t join;              // BRANCH blocks: where the arms meet again
+    uint8_t dead;
+} IrBlock;
+
+// A script function, or the top-level code. Blocks are numbered so that
+// every block comes after its predecessors, starting with the entry.
+typedef struct IrFunction {
+    Symbol name;                // NO_SYMBOL for the top-level code
+    Symbol* parameters;
+    uint32_t parameter_count;
+    IrInstruction* instructions;
+    uint32_t instruction_count;
+    uint32_t instruction_capacity;
+    uint32_t* operands;
+    uint32_t operand_count;
+    uint32_t operand_capacity;
+    IrBlock* blocks;
+    uint32_t block_count;
+    uint32_t block_capacity;
+} IrFunction;
+
+// Native function the program calls
+typedef struct {
+    Symbol name;
+    Symbol c_name;
+    int arity;
+} IrNative;
+
+// Global variable or AppState field the program assigns, typed by every
+// value assigned to it
+typedef struct {
+    Symbol name;
+    IrType type;
+} IrGlobal;
+
+// Operand i of an instruction of `function`
+#define IR_OPERAND(function, instruction, i) ((function)->operands[(instruction)->first_operand + (i)])
+
+// Output of lower_to_ir()
+struct IrProgram {
+    IrFunction* functions;      // [0] is the top-level code
+    uint32_t function_count;
+    uint32_t function_capacity;
+    IrNative* natives;
+    uint32_t native_count;
+    uint32_t native_capacity;
+    IrGlobal* globals;          // In first-assignment order
+    uint32_t global_count;
+    uint32_t global_capacity;
+    SymbolIndex global_index;   // Name -> position in `globals`
+    Symbol* fields;             // AppState fields in declaration order
+    uint32_t field_count;
+    uint32_t field_capacity;
+};
+
 // Compiler structure
+// Three-address instruction for the register VM
+typedef struct RegInstruction {
+    RegOpCode opcode;
+    int32_t a;
+    int32_t b;
+    int32_t c;
+} RegInstruction;
+
+// Register VM view of an entry in the unified function table
+typedef struct {
+    size_t address;             // SCRIPT: entry point; NATIVE: C function index
+    int register_count;         // SCRIPT: frame size, parameters first
+} RegFunction;
+
+// Output of lower_to_registers(). Top-level code starts at 0 and its
+// frame doubles as the globals: register i holds name i.
+typedef struct RegisterProgram {
+    RegInstruction* code;
+    size_t size;
+    size_t capacity;
+    RegFunction* functions;     // Parallel to Compiler.functions
+    int main_registers;         // Frame size of the top-level code
+    int result_register;        // Holds the last top-level expression, or -1
+} RegisterProgram;
+
 typedef struct Compiler {
-    ASTNode* ast;
+    Ast* ast;
     Instruction* bytecode;
     size_t bytecode_size;
     size_t bytecode_capacity;
-    char** constants;
-    size_t constant_count;
-    char** names;
-    size_t name_count;
-    char** c_functions;
-    size_t c_function_count;
+    ConstantPool constants;
+    SymbolPool names;
+    SymbolPool c_functions;
 
     // A unified table for all functions
     CompiledFunction* functions;
     size_t function_count;
     size_t function_capacity;
+    SymbolIndex function_index;     // Name -> position in `functions`
+    size_t top_level_locals;        // Frame slots of the top-level code
+
+    FILE* errors;               // Compile errors are reported here
+    int error_count;
+    size_t peephole_removed;    // Instructions optimize_bytecode() removed
+
+    IrProgram* ir;              // Lowered program; NULL when loaded from bytecode
+    RegisterProgram registers;  // Empty unless lowered for the register VM
 } Compiler;
 
+// Instruction pre-decoded for threaded dispatch: the address of its
+// opcode's handler in the interpreter loop
+typedef struct ThreadedInstruction {
+    const void* handler;
+    OpCode opcode;
+    int operand;
+} ThreadedInstruction;
+
+// Call frame for script function calls
+typedef struct CallFrame {
+    size_t return_address;
+    size_t base;                // The caller's frame base
+    // The caller's local slot count (stack VM) or window size (register
+    // VM), and where the register VM puts the result
+    size_t frame_size;
+    int result_register;
+} CallFrame;
+
 // Runtime structure
 typedef struct Runtime {
     Instruction* bytecode;
     size_t bytecode_size;
-    char** constants;
+    Value* constants;           // Boxed form of each constant
     size_t constant_count;
-    void** variables;
+    Value* variables;
     size_t variable_count;
-    CFunctionPtr* c_functions;
+    HostFunction* c_functions;
     size_t c_function_count;
-    void** stack;
+    Value* stack;
     size_t stack_size;
     size_t stack_capacity;
+    size_t top_level_locals;    // The top-level frame, at the stack bottom
     size_t pc; // Program counter
+    ThreadedInstruction* threaded_code;     // NULL with switch dispatch
+
+    // Call frames for script functions
+    CallFrame* call_frames;
+    size_t frame_count;
+    size_t frame_capacity;
+
+    // Reference to the compiler's unified function table
+    CompiledFunction* functions;
+    size_t function_count_ref;
+
+    // Opcode pair counts, [previous * OP_COUNT + current]; only while the
+    // VM is traced
+    size_t* opcode_pairs;
+
+    // Register VM state; register_program is NULL for the stack VM
+    const RegisterProgram* register_program;
+    Value* registers;
+    size_t register_capacity;
+
+    // Strings created while running (concatenation results)
+    char** strings;
+    size_t string_count;
+    size_t string_capacity;
 } Runtime;
 
 #endif /* FLIPSCRIPT_TYPES_H */
@@ -0,0 +1,180 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * Symbol Table - Process-wide string interning
+ *
+ * Every distinct identifier and literal text is stored once and named by
+ * a small integer Symbol, handed out when the token is lexed. Later phases
+ * compare and hash Symbols instead of strings. Symbols are never freed, so
+ * the text returned by symbol_name() stays valid for the whole process.
+ *
+ * The names the compiler and code generator look for (main, render,
+ * AppState, ...) are interned first, in WELL_KNOWN_SYMBOLS order, so their
+ * Symbols are the compile-time constants SYM_*.
+ *
+ * The table is shared by all compiler threads. Interning takes a lock;
+ * symbol_name() does not, because entries live in fixed pages that never
+ * move once written, and a thread can only hold a Symbol that was handed
+ * out under the lock.
+ */
+
+#include <pthread.h>
+#include "flipscript.h"
+
+#define SYMBOL_INITIAL_SLOTS 1024
+#define SYMBOL_BLOCK_SIZE (16 * 1024)
+#define SYMBOL_PAGE_BITS 12
+#define SYMBOL_PAGE_SIZE (1u << SYMBOL_PAGE_BITS)
+#define SYMBOL_MAX_PAGES 4096       // Up to 16M symbols
+
+typedef struct {
+    const char* text;
+    uint32_t length;
+    uint32_t hash;
+} SymbolEntry;
+
+// Block of interned text
+typedef struct SymbolBlock {
+    struct SymbolBlock* next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} SymbolBlock;
+
+static SymbolEntry* symbol_pages[SYMBOL_MAX_PAGES];    // Indexed by Symbol; entry 0 unused
+static uint32_t symbol_count = 0;
+static Symbol* slots = NULL;            // Open-addressing table of Symbols
+static uint32_t slot_mask = 0;
+static SymbolBlock* blocks = NULL;
+static pthread_once_t symbols_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t symbols_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define SYMBOL_ENTRY(symbol) (&symbol_pages[(symbol) >> SYMBOL_PAGE_BITS][(symbol) & (SYMBOL_PAGE_SIZE - 1)])
+
+static const char* const well_known_names[] = {
+#define SYMBOL_NAME(id, text) text,
+    WELL_KNOWN_SYMBOLS(SYMBOL_NAME)
+#undef SYMBOL_NAME
+};
+
+// FNV-1a
+static uint32_t hash_text(const char* text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void* symbol_alloc(size_t size) {
+    void* data = malloc(size);
+    if (!data) {
+        fprintf(stderr, "Error: Out of memory in the symbol table\n");
+        exit(1);
+    }
+    return data;
+}
+
+// Copy symbol text into block storage, which never moves
+static const char* store_text(const char* text, size_t length) {
+    if (!blocks || blocks->capacity - blocks->used < length + 1) {
+        size_t capacity = length + 1 > SYMBOL_BLOCK_SIZE ? length + 1 : SYMBOL_BLOCK_SIZE;
+        SymbolBlock* block = (SymbolBlock*)symbol_alloc(sizeof(SymbolBlock) + capacity);
+        block->next = blocks;
+        block->used = 0;
+        block->capacity = capacity;
+        blocks = block;
+    }
+    char* copy = blocks->data + blocks->used;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    blocks->used += length + 1;
+    return copy;
+}
+
+// Double the slot table and reinsert every symbol
+static void grow_slots(void) {
+    uint32_t slot_count = slot_mask ? (slot_mask + 1) * 2 : SYMBOL_INITIAL_SLOTS;
+    free(slots);
+    slots = (Symbol*)calloc(slot_count, sizeof(Symbol));
+    if (!slots) {
+        fprintf(stderr, "Error: Out of memory in the symbol table\n");
+        exit(1);
+    }
+    slot_mask = slot_count - 1;
+    for (Symbol symbol = 1; symbol < symbol_count; symbol++) {
+        uint32_t slot = SYMBOL_ENTRY(symbol)->hash & slot_mask;
+        while (slots[slot] != NO_SYMBOL) slot = (slot + 1) & slot_mask;
+        slots[slot] = symbol;
+    }
+}
+
+static Symbol insert_symbol(const char* text, size_t length, uint32_t hash, uint32_t slot) {
+    Symbol symbol = symbol_count;
+    uint32_t page = symbol >> SYMBOL_PAGE_BITS;
+    if (page >= SYMBOL_MAX_PAGES) {
+        fprintf(stderr, "Error: Too many symbols\n");
+        exit(1);
+    }
+    if (!symbol_pages[page]) symbol_pages[page] = (SymbolEntry*)symbol_alloc(SYMBOL_PAGE_SIZE * sizeof(SymbolEntry));
+    SymbolEntry* entry = SYMBOL_ENTRY(symbol);
+    entry->text = store_text(text, length);
+    entry->length = (uint32_t)length;
+    entry->hash = hash;
+    symbol_count++;
+    slots[slot] = symbol;
+    // Keep the load factor at or below one half
+    if (symbol_count * 2 > slot_mask + 1) grow_slots();
+    return symbol;
+}
+
+static Symbol lookup_or_insert(const char* text, size_t length) {
+    uint32_t hash = hash_text(text, length);
+    uint32_t slot = hash & slot_mask;
+    for (;;) {
+        Symbol symbol = slots[slot];
+        if (symbol == NO_SYMBOL) return insert_symbol(text, length, hash, slot);
+        const SymbolEntry* entry = SYMBOL_ENTRY(symbol);
+        if (entry->hash == hash && entry->length == length && memcmp(entry->text, text, length) == 0) {
+            return symbol;
+        }
+        slot = (slot + 1) & slot_mask;
+    }
+}
+
+// Set up the table and pre-intern the well-known names
+static void init_symbols(void) {
+    grow_slots();
+    symbol_pages[0] = (SymbolEntry*)symbol_alloc(SYMBOL_PAGE_SIZE * sizeof(SymbolEntry));
+    symbol_pages[0][0].text = "";   // Symbol 0 is NO_SYMBOL
+    symbol_pages[0][0].length = 0;
+    symbol_pages[0][0].hash = 0;
+    symbol_count = 1;
+    for (size_t i = 0; i < sizeof(well_known_names) / sizeof(well_known_names[0]); i++) {
+        lookup_or_insert(well_known_names[i], strlen(well_known_names[i]));
+    }
+}
+
+// Intern text[0, length), which need not be NUL-terminated
+Symbol intern_string(const char* text, size_t length) {
+    pthread_once(&symbols_once, init_symbols);
+    pthread_mutex_lock(&symbols_lock);
+    Symbol symbol = lookup_or_insert(text, length);
+    pthread_mutex_unlock(&symbols_lock);
+    return symbol;
+}
+
+Symbol intern_cstring(const char* text) {
+    return intern_string(text, strlen(text));
+}
+
+// NUL-terminated text of a symbol
+const char* symbol_name(Symbol symbol) {
+    pthread_once(&symbols_once, init_symbols);
+    return SYMBOL_ENTRY(symbol)->text;
+}
+
+size_t symbol_length(Symbol symbol) {
+    pthread_once(&symbols_once, init_symbols);
+    return SYMBOL_ENTRY(symbol)->length;
+}
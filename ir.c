@@ -0,0 +1,725 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * IR Lowering - Translates the AST into the typed, SSA-form mid-level IR
+ *
+ * lower_to_ir() walks the tree once. Everything the back ends used to work
+ * out from the AST on their own is decided here:
+ *   - calls are resolved to a script function, a native function or the
+ *     str() builtin, and their argument counts checked
+ *   - names starting with "app." are AppState fields; the AppState class
+ *     body becomes stores of their initial values
+ *   - the argument of print() and the text argument of canvas_draw_str()
+ *     are converted to strings, `+` with a string side concatenating
+ *   - top-level expression statements become IR_RESULT, the script's value
+ *
+ * Each function is a graph of basic blocks. Its parameters and the names
+ * it assigns are locals in SSA form: every assignment defines a new value,
+ * and where control flow merges a phi picks the value of the block it came
+ * from (Braun et al., "Simple and Efficient Construction of Static Single
+ * Assignment Form"). The language has no loops, so every block's
+ * predecessors are complete before its code is lowered and no phi is ever
+ * incomplete. Top-level names are globals the functions share and stay
+ * loads and stores.
+ *
+ * optimize_ir() (iropt.c) then works on the result, and compile_ir(),
+ * lower_to_registers() and generate_c_from_ir() consume it.
+ */
+
+#include "flipscript.h"
+#include "flipscript_types.h"
+#include "trace.h"
+
+typedef enum {
+    CALLEE_TO_STRING,           // The str() builtin
+    CALLEE_SCRIPT,              // functions[index]
+    CALLEE_NATIVE,              // natives[index]
+} CalleeKind;
+
+typedef struct {
+    CalleeKind kind;
+    uint32_t index;
+    uint32_t arity;
+} Callee;
+
+typedef struct {
+    Compiler* compiler;
+    IrProgram* program;
+    Callee* callees;
+    uint32_t callee_count;
+    uint32_t callee_capacity;
+    SymbolIndex callee_index;   // Name -> position in `callees`
+    uint32_t function;          // Function being lowered
+    uint32_t block;             // Block code is appended to
+    // Locals of the function being lowered; none at top level
+    SymbolIndex locals;
+    uint32_t local_count;
+    uint32_t* definitions;      // [block * local_count + local]: current value, 0 if unknown
+    uint32_t definition_blocks; // Blocks `definitions` has room for
+} IrLowering;
+
+static void lower_statement(IrLowering* lowering, NodeId id);
+static uint32_t lower_expression(IrLowering* lowering, NodeId id);
+
+static IrFunction* current_function(IrLowering* lowering) {
+    return &lowering->program->functions[lowering->function];
+}
+
+static int is_field(Symbol name) {
+    return strncmp(symbol_name(name), "app.", 4) == 0;
+}
+
+// Static type of a literal
+static IrType constant_type(TokenType kind, Symbol text) {
+    if (kind == TOKEN_STRING) return IR_TYPE_STRING;
+    if (text == SYM_TRUE || text == SYM_FALSE) return IR_TYPE_BOOL;
+    if (text == SYM_NONE) return IR_TYPE_NONE;
+    // Numbers the VM keeps as small integers
+    char* end;
+    long value = strtol(symbol_name(text), &end, 10);
+    return *end == '\0' && value >= VALUE_INT_MIN && value <= VALUE_INT_MAX ? IR_TYPE_INT : IR_TYPE_ANY;
+}
+
+// --- Building blocks ---
+
+static uint32_t new_block(IrLowering* lowering) {
+    IrFunction* function = current_function(lowering);
+    if (function->block_count >= function->block_capacity) {
+        function->block_capacity = function->block_capacity ? function->block_capacity * 2 : 8;
+        function->blocks = (IrBlock*)realloc(function->blocks, function->block_capacity * sizeof(IrBlock));
+    }
+    IrBlock* block = &function->blocks[function->block_count];
+    memset(block, 0, sizeof(IrBlock));
+    block->join = IR_NO_BLOCK;
+
+    if (lowering->local_count > 0 && function->block_count >= lowering->definition_blocks) {
+        uint32_t old_blocks = lowering->definition_blocks;
+        lowering->definition_blocks = old_blocks ? old_blocks * 2 : 8;
+        lowering->definitions = (uint32_t*)realloc(lowering->definitions,
+                                                   (size_t)lowering->definition_blocks * lowering->local_count * sizeof(uint32_t));
+        memset(lowering->definitions + (size_t)old_blocks * lowering->local_count, 0,
+               (size_t)(lowering->definition_blocks - old_blocks) * lowering->local_count * sizeof(uint32_t));
+    }
+    return function->block_count++;
+}
+
+static void push_index(uint32_t** items, uint32_t* count, uint32_t* capacity, uint32_t item) {
+    if (*count >= *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 8;
+        *items = (uint32_t*)realloc(*items, *capacity * sizeof(uint32_t));
+    }
+    (*items)[(*count)++] = item;
+}
+
+static void add_edge(IrFunction* function, uint32_t from, uint32_t to) {
+    IrBlock* source = &function->blocks[from];
+    source->successors[source->successor_count++] = to;
+    IrBlock* target = &function->blocks[to];
+    push_index(&target->predecessors, &target->predecessor_count, &target->predecessor_capacity, from);
+}
+
+// Create an instruction outside any block. Returns its value.
+static uint32_t new_instruction(IrFunction* function, IrOp op, IrType type, int kind, Symbol symbol,
+                                const uint32_t* operands, uint32_t operand_count) {
+    if (function->instruction_count >= function->instruction_capacity) {
+        function->instruction_capacity = function->instruction_capacity ? function->instruction_capacity * 2 : 16;
+        function->instructions = (IrInstruction*)realloc(function->instructions,
+                                                         function->instruction_capacity * sizeof(IrInstruction));
+    }
+    if (function->operand_count + operand_count > function->operand_capacity) {
+        while (function->operand_count + operand_count > function->operand_capacity) {
+            function->operand_capacity = function->operand_capacity ? function->operand_capacity * 2 : 16;
+        }
+        function->operands = (uint32_t*)realloc(function->operands, function->operand_capacity * sizeof(uint32_t));
+    }
+    uint32_t value = function->instruction_count++;
+    IrInstruction* instruction = &function->instructions[value];
+    memset(instruction, 0, sizeof(IrInstruction));
+    instruction->op = op;
+    instruction->type = type;
+    instruction->kind = kind;
+    instruction->symbol = symbol;
+    instruction->block = IR_NO_BLOCK;
+    instruction->first_operand = function->operand_count;
+    instruction->operand_count = operand_count;
+    if (operand_count > 0) memcpy(function->operands + function->operand_count, operands, operand_count * sizeof(uint32_t));
+    function->operand_count += operand_count;
+    return value;
+}
+
+// Put an instruction into `block` at `position`
+static void insert_instruction(IrFunction* function, uint32_t block_index, uint32_t position, uint32_t value) {
+    IrBlock* block = &function->blocks[block_index];
+    push_index(&block->code, &block->code_count, &block->code_capacity, value);
+    memmove(block->code + position + 1, block->code + position, (block->code_count - 1 - position) * sizeof(uint32_t));
+    block->code[position] = value;
+    function->instructions[value].block = block_index;
+}
+
+// Append an instruction to the current block
+static uint32_t emit(IrLowering* lowering, IrOp op, IrType type, int kind, Symbol symbol,
+                     const uint32_t* operands, uint32_t operand_count) {
+    IrFunction* function = current_function(lowering);
+    uint32_t value = new_instruction(function, op, type, kind, symbol, operands, operand_count);
+    insert_instruction(function, lowering->block, function->blocks[lowering->block].code_count, value);
+    return value;
+}
+
+static uint32_t emit_constant(IrLowering* lowering, TokenType kind, Symbol text) {
+    return emit(lowering, IR_CONST, constant_type(kind, text), kind, text, NULL, 0);
+}
+
+static IrType value_type(IrLowering* lowering, uint32_t value) {
+    return current_function(lowering)->instructions[value].type;
+}
+
+// --- Locals in SSA form ---
+
+// Value of local `local` on entry to the end of `block`. Blocks without a
+// definition ask their predecessors; a block with several gets a phi.
+static uint32_t read_local(IrLowering* lowering, uint32_t local, uint32_t block) {
+    uint32_t* definition = &lowering->definitions[(size_t)block * lowering->local_count + local];
+    if (*definition != 0) return *definition;
+
+    IrFunction* function = current_function(lowering);
+    uint32_t predecessor_count = function->blocks[block].predecessor_count;
+    uint32_t value;
+    if (predecessor_count == 0) {
+        // The entry block, where locals not yet assigned are None, or code
+        // after a return, which never runs
+        value = new_instruction(function, IR_CONST, IR_TYPE_NONE, TOKEN_IDENTIFIER, SYM_NONE, NULL, 0);
+        insert_instruction(function, block, 0, value);
+    } else if (predecessor_count == 1) {
+        value = read_local(lowering, local, function->blocks[block].predecessors[0]);
+    } else {
+        // Reading the predecessors may create phis (and operands) of its
+        // own, so collect this phi's operands first
+        uint32_t* operands = (uint32_t*)malloc(predecessor_count * sizeof(uint32_t));
+        for (uint32_t i = 0; i < predecessor_count; i++) {
+            operands[i] = read_local(lowering, local, current_function(lowering)->blocks[block].predecessors[i]);
+        }
+        function = current_function(lowering);
+        IrType type = function->instructions[operands[0]].type;
+        for (uint32_t i = 1; i < predecessor_count; i++) {
+            if (function->instructions[operands[i]].type != type) type = IR_TYPE_ANY;
+        }
+        value = new_instruction(function, IR_PHI, type, 0, NO_SYMBOL, operands, predecessor_count);
+        free(operands);
+        // After the block's other phis
+        uint32_t position = 0;
+        const IrBlock* target = &function->blocks[block];
+        while (position < target->code_count && function->instructions[target->code[position]].op == IR_PHI) position++;
+        insert_instruction(function, block, position, value);
+    }
+    lowering->definitions[(size_t)block * lowering->local_count + local] = value;
+    return value;
+}
+
+static void write_local(IrLowering* lowering, uint32_t local, Symbol name, uint32_t value) {
+    IrInstruction* instruction = &current_function(lowering)->instructions[value];
+    if (instruction->variable == NO_SYMBOL) instruction->variable = name;
+    lowering->definitions[(size_t)lowering->block * lowering->local_count + local] = value;
+}
+
+static int local_index(const IrLowering* lowering, Symbol name) {
+    return lowering->local_count > 0 ? symbol_index_get(&lowering->locals, name) : -1;
+}
+
+static void collect_assigned(IrLowering* lowering, NodeId id) {
+    if (id == NULL_NODE) return;
+    const Ast* ast = lowering->compiler->ast;
+    const ASTNode* node = AST_NODE(ast, id);
+    switch (node->type) {
+        case NODE_BLOCK:
+            for (uint32_t i = 0; i < node->data.block.statements.count; i++) {
+                collect_assigned(lowering, AST_LIST_GET(ast, node->data.block.statements, i));
+            }
+            break;
+        case NODE_ASSIGNMENT:
+            if (!is_field(node->data.assignment.name) && symbol_index_get(&lowering->locals, node->data.assignment.name) < 0) {
+                symbol_index_put(&lowering->locals, node->data.assignment.name, lowering->local_count++);
+            }
+            break;
+        case NODE_IF:
+            collect_assigned(lowering, node->data.if_statement.if_block);
+            for (uint32_t i = 0; i < node->data.if_statement.elif_clauses.count; i++) {
+                collect_assigned(lowering, AST_LIST_GET(ast, node->data.if_statement.elif_clauses, i));
+            }
+            collect_assigned(lowering, node->data.if_statement.else_block);
+            break;
+        case NODE_WHILE:
+            collect_assigned(lowering, node->data.while_loop.block);
+            break;
+        default:
+            break;
+    }
+}
+
+// --- Globals ---
+
+static void note_global(IrProgram* program, Symbol name) {
+    if (symbol_index_get(&program->global_index, name) >= 0) return;
+    if (program->global_count >= program->global_capacity) {
+        program->global_capacity = program->global_capacity ? program->global_capacity * 2 : 16;
+        program->globals = (IrGlobal*)realloc(program->globals, program->global_capacity * sizeof(IrGlobal));
+    }
+    program->globals[program->global_count].name = name;
+    program->globals[program->global_count].type = IR_TYPE_ANY;
+    symbol_index_put(&program->global_index, name, program->global_count++);
+}
+
+static void store_name(IrLowering* lowering, Symbol name, uint32_t value) {
+    int local = local_index(lowering, name);
+    if (local >= 0) {
+        write_local(lowering, (uint32_t)local, name, value);
+        return;
+    }
+    note_global(lowering->program, name);
+    emit(lowering, is_field(name) ? IR_STORE_FIELD : IR_STORE_GLOBAL, IR_TYPE_ANY, 0, name, &value, 1);
+}
+
+// --- Expressions ---
+
+static uint32_t lower_error_value(IrLowering* lowering) {
+    lowering->compiler->error_count++;
+    return emit_constant(lowering, TOKEN_IDENTIFIER, SYM_NONE);
+}
+
+static IrType binary_type(TokenType op, IrType left, IrType right) {
+    switch (op) {
+        case TOKEN_EQUAL:
+        case TOKEN_NOT_EQUAL:
+        case TOKEN_GREATER:
+        case TOKEN_LESS:
+            return IR_TYPE_BOOL;
+        case TOKEN_PLUS:
+            if (left == IR_TYPE_STRING || right == IR_TYPE_STRING) return IR_TYPE_STRING;
+            // Fall through
+        default:
+            return left == IR_TYPE_INT && right == IR_TYPE_INT ? IR_TYPE_INT : IR_TYPE_ANY;
+    }
+}
+
+static const Callee* find_callee(const IrLowering* lowering, Symbol name) {
+    int index = symbol_index_get(&lowering->callee_index, name);
+    return index >= 0 ? &lowering->callees[index] : NULL;
+}
+
+// Is the expression certainly a string, so that `+` involving it
+// concatenates? String literals, str() and `+` of such.
+static int is_string_expression(const IrLowering* lowering, NodeId id) {
+    const Ast* ast = lowering->compiler->ast;
+    const ASTNode* node = AST_NODE(ast, id);
+    switch (node->type) {
+        case NODE_LITERAL:
+            return node->data.literal.kind == TOKEN_STRING;
+        case NODE_FUNCTION_CALL: {
+            const Callee* callee = find_callee(lowering, node->data.function_call.name);
+            return callee && callee->kind == CALLEE_TO_STRING;
+        }
+        case NODE_BINARY_OP:
+            return node->data.binary_op.operator == TOKEN_PLUS &&
+                   (is_string_expression(lowering, node->data.binary_op.left) ||
+                    is_string_expression(lowering, node->data.binary_op.right));
+        default:
+            return 0;
+    }
+}
+
+// Lower an expression whose value is wanted as a string: in a string
+// `+`, the other operands are converted with str()
+static uint32_t lower_string(IrLowering* lowering, NodeId id) {
+    const ASTNode* node = AST_NODE(lowering->compiler->ast, id);
+    if (node->type == NODE_BINARY_OP && is_string_expression(lowering, id)) {
+        uint32_t operands[2];
+        operands[0] = lower_string(lowering, node->data.binary_op.left);
+        operands[1] = lower_string(lowering, node->data.binary_op.right);
+        return emit(lowering, IR_BINARY, IR_TYPE_STRING, TOKEN_PLUS, NO_SYMBOL, operands, 2);
+    }
+    uint32_t value = lower_expression(lowering, id);
+    if (value_type(lowering, value) == IR_TYPE_STRING) return value;
+    return emit(lowering, IR_TO_STRING, IR_TYPE_STRING, 0, NO_SYMBOL, &value, 1);
+}
+
+// Arguments that are passed as text whatever the script computes
+static int is_text_argument(const IrProgram* program, const Callee* callee, Symbol name, uint32_t argument) {
+    if (callee->kind != CALLEE_NATIVE) return 0;
+    const IrNative* native = &program->natives[callee->index];
+    if (native->name == SYM_PRINT) return argument == 0;
+    int draws_string = name == SYM_CANVAS_DRAW_STR || name == SYM_DISPLAY_DRAW_STR ||
+                       native->c_name == SYM_CANVAS_DRAW_STR;
+    return draws_string && argument == 3;
+}
+
+static uint32_t lower_call(IrLowering* lowering, const ASTNode* node) {
+    Compiler* compiler = lowering->compiler;
+    const Ast* ast = compiler->ast;
+    Symbol name = node->data.function_call.name;
+    NodeList arguments = node->data.function_call.arguments;
+
+    const Callee* callee = find_callee(lowering, name);
+    if (callee == NULL) {
+        fprintf(compiler->errors, "Compile Error: Function '%s' not defined.\n", symbol_name(name));
+        return lower_error_value(lowering);
+    }
+    if (arguments.count != callee->arity) {
+        fprintf(compiler->errors, "Compile Error: Function '%s' takes %zu arguments but %u were given.\n",
+                symbol_name(name), (size_t)callee->arity, arguments.count);
+        return lower_error_value(lowering);
+    }
+
+    uint32_t* operands = (uint32_t*)malloc((arguments.count ? arguments.count : 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < arguments.count; i++) {
+        NodeId argument = AST_LIST_GET(ast, arguments, i);
+        operands[i] = is_text_argument(lowering->program, callee, name, i) ? lower_string(lowering, argument)
+                                                                           : lower_expression(lowering, argument);
+    }
+    uint32_t value;
+    switch (callee->kind) {
+        case CALLEE_TO_STRING:
+            value = value_type(lowering, operands[0]) == IR_TYPE_STRING
+                        ? operands[0]
+                        : emit(lowering, IR_TO_STRING, IR_TYPE_STRING, 0, NO_SYMBOL, operands, 1);
+            break;
+        case CALLEE_SCRIPT:
+            value = emit(lowering, IR_CALL, IR_TYPE_ANY, (int)callee->index, name, operands, arguments.count);
+            break;
+        default:
+            value = emit(lowering, IR_CALL_NATIVE, IR_TYPE_ANY, (int)callee->index, name, operands, arguments.count);
+            break;
+    }
+    free(operands);
+    return value;
+}
+
+static uint32_t lower_expression(IrLowering* lowering, NodeId id) {
+    Compiler* compiler = lowering->compiler;
+    const ASTNode* node = AST_NODE(compiler->ast, id);
+    switch (node->type) {
+        case NODE_LITERAL:
+            return emit_constant(lowering, node->data.literal.kind, node->data.literal.value);
+        case NODE_IDENTIFIER: {
+            Symbol name = node->data.identifier.name;
+            if (name == SYM_TRUE || name == SYM_FALSE || name == SYM_NONE) {
+                return emit_constant(lowering, TOKEN_IDENTIFIER, name);
+            }
+            int local = local_index(lowering, name);
+            if (local >= 0) return read_local(lowering, (uint32_t)local, lowering->block);
+            return emit(lowering, is_field(name) ? IR_LOAD_FIELD : IR_LOAD_GLOBAL, IR_TYPE_ANY, 0, name, NULL, 0);
+        }
+        case NODE_BINARY_OP: {
+            TokenType op = node->data.binary_op.operator;
+            switch (op) {
+                case TOKEN_PLUS:
+                case TOKEN_MINUS:
+                case TOKEN_MULTIPLY:
+                case TOKEN_DIVIDE:
+                case TOKEN_EQUAL:
+                case TOKEN_NOT_EQUAL:
+                case TOKEN_GREATER:
+                case TOKEN_LESS:
+                    break;
+                default:
+                    fprintf(compiler->errors, "Error: Unsupported operator in compilation\n");
+                    return lower_error_value(lowering);
+            }
+            uint32_t operands[2];
+            operands[0] = lower_expression(lowering, node->data.binary_op.left);
+            operands[1] = lower_expression(lowering, node->data.binary_op.right);
+            IrType type = binary_type(op, value_type(lowering, operands[0]), value_type(lowering, operands[1]));
+            return emit(lowering, IR_BINARY, type, op, NO_SYMBOL, operands, 2);
+        }
+        case NODE_FUNCTION_CALL:
+            return lower_call(lowering, node);
+        default:
+            fprintf(compiler->errors, "Error: Unhandled node type %d in compilation\n", node->type);
+            return lower_error_value(lowering);
+    }
+}
+
+// --- Statements ---
+
+static void lower_block(IrLowering* lowering, NodeId id) {
+    if (id == NULL_NODE) return;
+    const Ast* ast = lowering->compiler->ast;
+    const ASTNode* node = AST_NODE(ast, id);
+    for (uint32_t i = 0; i < node->data.block.statements.count; i++) {
+        lower_statement(lowering, AST_LIST_GET(ast, node->data.block.statements, i));
+    }
+}
+
+// End the current block with a jump to `target`
+static void emit_jump(IrLowering* lowering, uint32_t target) {
+    emit(lowering, IR_JUMP, IR_TYPE_ANY, 0, NO_SYMBOL, NULL, 0);
+    add_edge(current_function(lowering), lowering->block, target);
+}
+
+// if / elif / else: each test branches to its body or to the block holding
+// the next test (or the else body). Every body then jumps to one join block.
+static void lower_if(IrLowering* lowering, const ASTNode* node) {
+    const Ast* ast = lowering->compiler->ast;
+    NodeList elifs = node->data.if_statement.elif_clauses;
+    uint32_t* branches = (uint32_t*)malloc((elifs.count + 1) * sizeof(uint32_t));
+    uint32_t* arm_ends = (uint32_t*)malloc((elifs.count + 2) * sizeof(uint32_t));
+    uint32_t arm_count = 0;
+
+    const ASTNode* clause = node;
+    for (uint32_t i = 0; i <= elifs.count; i++) {
+        if (i > 0) clause = AST_NODE(ast, AST_LIST_GET(ast, elifs, i - 1));
+        uint32_t condition = lower_expression(lowering, clause->data.if_statement.condition);
+        emit(lowering, IR_BRANCH, IR_TYPE_ANY, 0, NO_SYMBOL, &condition, 1);
+        branches[i] = lowering->block;
+        uint32_t then_block = new_block(lowering);
+        uint32_t other_block = new_block(lowering);
+        add_edge(current_function(lowering), lowering->block, then_block);
+        add_edge(current_function(lowering), lowering->block, other_block);
+
+        lowering->block = then_block;
+        lower_block(lowering, clause->data.if_statement.if_block);
+        arm_ends[arm_count++] = lowering->block;
+        lowering->block = other_block;
+    }
+    lower_block(lowering, node->data.if_statement.else_block);
+    arm_ends[arm_count++] = lowering->block;
+
+    // Created last, so that it is numbered after everything that reaches it
+    uint32_t join = new_block(lowering);
+    for (uint32_t i = 0; i < arm_count; i++) {
+        lowering->block = arm_ends[i];
+        emit_jump(lowering, join);
+    }
+    for (uint32_t i = 0; i <= elifs.count; i++) current_function(lowering)->blocks[branches[i]].join = join;
+    lowering->block = join;
+    free(branches);
+    free(arm_ends);
+}
+
+static void emit_return(IrLowering* lowering, uint32_t value) {
+    emit(lowering, IR_RETURN, IR_TYPE_ANY, 0, NO_SYMBOL, &value, 1);
+    // Anything after the return goes to a block nothing reaches
+    lowering->block = new_block(lowering);
+}
+
+// class AppState: its assignments give the fields their initial values
+static void lower_class(IrLowering* lowering, const ASTNode* node) {
+    if (node->data.class_def.name != SYM_APP_STATE || lowering->function != 0) return;
+    const Ast* ast = lowering->compiler->ast;
+    IrProgram* program = lowering->program;
+    NodeList body = AST_NODE(ast, node->data.class_def.body)->data.block.statements;
+    for (uint32_t i = 0; i < body.count; i++) {
+        const ASTNode* field = AST_NODE(ast, AST_LIST_GET(ast, body, i));
+        if (field->type != NODE_ASSIGNMENT) continue;
+        char name[256];
+        snprintf(name, sizeof(name), "app.%s", symbol_name(field->data.assignment.name));
+        Symbol field_name = intern_cstring(name);
+        int declared = 0;
+        for (uint32_t j = 0; j < program->field_count; j++) declared |= program->fields[j] == field_name;
+        if (!declared) push_index(&program->fields, &program->field_count, &program->field_capacity, field_name);
+        store_name(lowering, field_name, lower_expression(lowering, field->data.assignment.value));
+    }
+}
+
+static void lower_statement(IrLowering* lowering, NodeId id) {
+    const ASTNode* node = AST_NODE(lowering->compiler->ast, id);
+    switch (node->type) {
+        case NODE_BLOCK:
+            lower_block(lowering, id);
+            break;
+        case NODE_ASSIGNMENT:
+            store_name(lowering, node->data.assignment.name, lower_expression(lowering, node->data.assignment.value));
+            break;
+        case NODE_IF:
+            lower_if(lowering, node);
+            break;
+        case NODE_RETURN: {
+            uint32_t value = node->data.return_statement.value
+                                 ? lower_expression(lowering, node->data.return_statement.value)
+                                 : emit_constant(lowering, TOKEN_IDENTIFIER, SYM_NONE);
+            emit_return(lowering, value);
+            break;
+        }
+        case NODE_CLASS_DEF:
+            lower_class(lowering, node);
+            break;
+        case NODE_FUNCTION_DEF:
+            // Lowered as functions of their own by lower_to_ir()
+        case NODE_C_BINDING:
+        case NODE_IMPORT:
+            break;
+        case NODE_WHILE:
+        case NODE_FOR:
+            fprintf(lowering->compiler->errors, "Error: Unhandled node type %d in compilation\n", node->type);
+            lowering->compiler->error_count++;
+            break;
+        default: {
+            // Expression statement. At top level its value is kept as the
+            // script's result.
+            uint32_t value = lower_expression(lowering, id);
+            if (lowering->function == 0) emit(lowering, IR_RESULT, IR_TYPE_ANY, 0, NO_SYMBOL, &value, 1);
+            break;
+        }
+    }
+}
+
+// --- Program ---
+
+static uint32_t add_ir_function(IrProgram* program, Symbol name) {
+    if (program->function_count >= program->function_capacity) {
+        program->function_capacity = program->function_capacity ? program->function_capacity * 2 : 8;
+        program->functions = (IrFunction*)realloc(program->functions, program->function_capacity * sizeof(IrFunction));
+    }
+    IrFunction* function = &program->functions[program->function_count];
+    memset(function, 0, sizeof(IrFunction));
+    function->name = name;
+    // Instruction 0 is "no value"
+    new_instruction(function, IR_CONST, IR_TYPE_NONE, TOKEN_IDENTIFIER, SYM_NONE, NULL, 0);
+    return program->function_count++;
+}
+
+static void add_callee(IrLowering* lowering, Symbol name, CalleeKind kind, uint32_t index, uint32_t arity) {
+    if (symbol_index_get(&lowering->callee_index, name) >= 0) return;  // The first definition wins
+    if (lowering->callee_count >= lowering->callee_capacity) {
+        lowering->callee_capacity = lowering->callee_capacity ? lowering->callee_capacity * 2 : 16;
+        lowering->callees = (Callee*)realloc(lowering->callees, lowering->callee_capacity * sizeof(Callee));
+    }
+    lowering->callees[lowering->callee_count].kind = kind;
+    lowering->callees[lowering->callee_count].index = index;
+    lowering->callees[lowering->callee_count].arity = arity;
+    symbol_index_put(&lowering->callee_index, name, lowering->callee_count++);
+}
+
+static void add_native(IrLowering* lowering, Symbol name, Symbol c_name, uint32_t arity) {
+    if (symbol_index_get(&lowering->callee_index, name) >= 0) return;
+    IrProgram* program = lowering->program;
+    if (program->native_count >= program->native_capacity) {
+        program->native_capacity = program->native_capacity ? program->native_capacity * 2 : 8;
+        program->natives = (IrNative*)realloc(program->natives, program->native_capacity * sizeof(IrNative));
+    }
+    program->natives[program->native_count].name = name;
+    program->natives[program->native_count].c_name = c_name;
+    program->natives[program->native_count].arity = (int)arity;
+    add_callee(lowering, name, CALLEE_NATIVE, program->native_count++, arity);
+}
+
+// Start lowering function `index` at a fresh entry block
+static void begin_function(IrLowering* lowering, uint32_t index) {
+    lowering->function = index;
+    lowering->block = new_block(lowering);
+}
+
+static void lower_function(IrLowering* lowering, uint32_t index, const ASTNode* node) {
+    const Ast* ast = lowering->compiler->ast;
+    NodeList parameters = node->data.function_def.parameters;
+    IrFunction* function = &lowering->program->functions[index];
+    function->parameter_count = parameters.count;
+    function->parameters = (Symbol*)malloc((parameters.count ? parameters.count : 1) * sizeof(Symbol));
+
+    // Locals: the parameters, then every other name the body assigns (as in
+    // Python, assigning a name anywhere in a function makes it local)
+    memset(&lowering->locals, 0, sizeof(SymbolIndex));
+    lowering->local_count = 0;
+    for (uint32_t i = 0; i < parameters.count; i++) {
+        Symbol name = AST_NODE(ast, AST_LIST_GET(ast, parameters, i))->data.identifier.name;
+        function->parameters[i] = name;
+        // A repeated parameter name is the last argument
+        if (symbol_index_get(&lowering->locals, name) < 0) symbol_index_put(&lowering->locals, name, lowering->local_count++);
+    }
+    collect_assigned(lowering, node->data.function_def.body);
+    lowering->definition_blocks = 0;
+
+    begin_function(lowering, index);
+    for (uint32_t i = 0; i < parameters.count; i++) {
+        Symbol name = current_function(lowering)->parameters[i];
+        write_local(lowering, (uint32_t)local_index(lowering, name), name,
+                    emit(lowering, IR_PARAM, IR_TYPE_ANY, (int)i, name, NULL, 0));
+    }
+    lower_block(lowering, node->data.function_def.body);
+    // Implicit return None
+    uint32_t none = emit_constant(lowering, TOKEN_IDENTIFIER, SYM_NONE);
+    emit(lowering, IR_RETURN, IR_TYPE_ANY, 0, NO_SYMBOL, &none, 1);
+
+    free(lowering->locals.slots);
+    free(lowering->definitions);
+    memset(&lowering->locals, 0, sizeof(SymbolIndex));
+    lowering->local_count = 0;
+    lowering->definitions = NULL;
+    lowering->definition_blocks = 0;
+}
+
+// Lower the compiler's AST to compiler->ir. Returns the number of errors
+// reported.
+int lower_to_ir(Compiler* compiler) {
+    Ast* ast = compiler->ast;
+    int errors_before = compiler->error_count;
+    IrProgram* program = (IrProgram*)calloc(1, sizeof(IrProgram));
+    compiler->ir = program;
+
+    IrLowering lowering;
+    memset(&lowering, 0, sizeof(lowering));
+    lowering.compiler = compiler;
+    lowering.program = program;
+    add_ir_function(program, NO_SYMBOL);
+
+    // Every callable name, so calls can come before definitions. The
+    // builtins come first and cannot be redefined.
+    add_callee(&lowering, SYM_STR, CALLEE_TO_STRING, 0, 1);
+    add_native(&lowering, SYM_PRINT, SYM_PRINT, 1);
+    NodeList statements = ast->root ? AST_NODE(ast, ast->root)->data.block.statements : (NodeList){0, 0};
+    for (uint32_t i = 0; i < statements.count; i++) {
+        const ASTNode* stmt = AST_NODE(ast, AST_LIST_GET(ast, statements, i));
+        if (stmt->type == NODE_FUNCTION_DEF) {
+            Symbol name = stmt->data.function_def.name;
+            if (symbol_index_get(&lowering.callee_index, name) >= 0) continue;
+            add_callee(&lowering, name, CALLEE_SCRIPT, add_ir_function(program, name), stmt->data.function_def.parameters.count);
+        } else if (stmt->type == NODE_C_BINDING) {
+            add_native(&lowering, stmt->data.c_binding.name, stmt->data.c_binding.c_function_name,
+                       stmt->data.c_binding.parameters.count);
+        }
+    }
+
+    // The top-level code
+    begin_function(&lowering, 0);
+    for (uint32_t i = 0; i < statements.count; i++) lower_statement(&lowering, AST_LIST_GET(ast, statements, i));
+    emit(&lowering, IR_HALT, IR_TYPE_ANY, 0, NO_SYMBOL, NULL, 0);
+
+    // Function bodies; the first definition of a name wins
+    for (uint32_t i = 0; i < statements.count; i++) {
+        const ASTNode* stmt = AST_NODE(ast, AST_LIST_GET(ast, statements, i));
+        if (stmt->type != NODE_FUNCTION_DEF) continue;
+        const Callee* callee = find_callee(&lowering, stmt->data.function_def.name);
+        if (callee->kind != CALLEE_SCRIPT || program->functions[callee->index].block_count > 0) continue;
+        lower_function(&lowering, callee->index, stmt);
+    }
+
+    size_t instruction_count = 0, block_count = 0;
+    for (uint32_t i = 0; i < program->function_count; i++) {
+        instruction_count += program->functions[i].instruction_count - 1;
+        block_count += program->functions[i].block_count;
+    }
+    TRACE(TRACE_COMPILER, 1, "lowered to IR: %u functions, %zu blocks, %zu instructions",
+          program->function_count, block_count, instruction_count);
+
+    free(lowering.callees);
+    free(lowering.callee_index.slots);
+    return compiler->error_count - errors_before;
+}
+
+void free_ir(IrProgram* ir) {
+    if (ir == NULL) return;
+    for (uint32_t i = 0; i < ir->function_count; i++) {
+        IrFunction* function = &ir->functions[i];
+        for (uint32_t b = 0; b < function->block_count; b++) {
+            free(function->blocks[b].code);
+            free(function->blocks[b].predecessors);
+        }
+        free(function->blocks);
+        free(function->instructions);
+        free(function->operands);
+        free(function->parameters);
+    }
+    free(ir->functions);
+    free(ir->natives);
+    free(ir->globals);
+    free(ir->global_index.slots);
+    free(ir->fields);
+    free(ir);
+}
@@ -0,0 +1,885 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * IR Optimizer - Optimizations on the SSA-form IR, and back end preparation
+ *
+ * Runs on each function of lower_to_ir()'s output. Unreachable blocks are
+ * always removed. At -O1 and above, the following rounds repeat until
+ * nothing changes:
+ *   - constant propagation: operations on integer constants are folded
+ *     (with the AST optimizer's rules), as are `+` of two string constants,
+ *     str() of a constant, and phis whose operands are one constant; a
+ *     branch on a constant becomes a jump and the arm not taken goes away
+ *   - block-local load forwarding: a global or field loaded again, or
+ *     loaded after storing a constant to it, with no store or call in
+ *     between, reuses the earlier value
+ *   - copy propagation: copies, and phis whose operands are all one value,
+ *     are replaced by that value
+ *   - common-subexpression elimination over the dominator tree: an
+ *     operation computed by a dominating instruction is reused. Not for
+ *     string concatenation, which allocates in the generated C.
+ * followed by dead-code elimination of everything whose value is unused
+ * and that has no effect, with operations that may fail at run time (such
+ * as `/` by something that may be zero) kept.
+ *
+ * Then, at every level, it prepares the IR for the back ends:
+ *   - types are inferred, including each global's type from every value
+ *     stored to it
+ *   - each value is marked as evaluated inside its only user's expression
+ *     (inlined), evaluated again at each use (rematerialized: constants,
+ *     parameters and loads nothing can change before their uses), or, when
+ *     neither is possible, kept in a variable
+ * The inlining follows stack discipline: an instruction can take in the
+ * values computed just before it, innermost last, which is the order a
+ * stack machine evaluates an expression tree.
+ */
+
+#include "flipscript.h"
+#include "flipscript_types.h"
+#include "trace.h"
+
+typedef struct {
+    IrProgram* program;
+    IrFunction* function;
+    uint32_t* forward;          // Value -> value replacing it, or 0
+    size_t folded;
+    size_t branches_folded;
+    size_t loads_forwarded;
+    size_t copies_propagated;
+    size_t common_subexpressions;
+    size_t dead_instructions;
+    size_t unreachable_blocks;
+} IrOptimizer;
+
+#define INSTRUCTION(optimizer, value) (&(optimizer)->function->instructions[(value)])
+
+static int defines_value(IrOp op) {
+    switch (op) {
+        case IR_STORE_GLOBAL:
+        case IR_STORE_FIELD:
+        case IR_RESULT:
+        case IR_JUMP:
+        case IR_BRANCH:
+        case IR_RETURN:
+        case IR_HALT:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+static int is_load(IrOp op) {
+    return op == IR_LOAD_GLOBAL || op == IR_LOAD_FIELD;
+}
+
+static int is_call(IrOp op) {
+    return op == IR_CALL || op == IR_CALL_NATIVE;
+}
+
+// Value `value` stands for once replacements are applied
+static uint32_t resolve(const IrOptimizer* optimizer, uint32_t value) {
+    while (optimizer->forward[value] != 0) value = optimizer->forward[value];
+    return value;
+}
+
+static void replace_value(IrOptimizer* optimizer, uint32_t value, uint32_t replacement) {
+    IrInstruction* old = INSTRUCTION(optimizer, value);
+    IrInstruction* new = INSTRUCTION(optimizer, replacement);
+    if (new->variable == NO_SYMBOL) new->variable = old->variable;
+    optimizer->forward[value] = replacement;
+    old->dead = 1;
+}
+
+// Point every operand at its replacement
+static void apply_replacements(IrOptimizer* optimizer) {
+    IrFunction* function = optimizer->function;
+    for (uint32_t i = 1; i < function->instruction_count; i++) {
+        IrInstruction* instruction = &function->instructions[i];
+        if (instruction->dead) continue;
+        for (uint32_t j = 0; j < instruction->operand_count; j++) {
+            IR_OPERAND(function, instruction, j) = resolve(optimizer, IR_OPERAND(function, instruction, j));
+        }
+    }
+}
+
+// Drop dead instructions from the blocks' code lists
+static void compact_blocks(IrFunction* function) {
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        IrBlock* block = &function->blocks[b];
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < block->code_count; i++) {
+            if (!function->instructions[block->code[i]].dead) block->code[kept++] = block->code[i];
+        }
+        block->code_count = kept;
+    }
+}
+
+// --- Control flow ---
+
+// Forget the edge from `from` to `to`, with the phi operands for it
+static void remove_predecessor(IrFunction* function, uint32_t to, uint32_t from) {
+    IrBlock* block = &function->blocks[to];
+    uint32_t position = 0;
+    while (position < block->predecessor_count && block->predecessors[position] != from) position++;
+    if (position == block->predecessor_count) return;
+    memmove(block->predecessors + position, block->predecessors + position + 1,
+            (block->predecessor_count - position - 1) * sizeof(uint32_t));
+    block->predecessor_count--;
+    for (uint32_t i = 0; i < block->code_count; i++) {
+        IrInstruction* phi = &function->instructions[block->code[i]];
+        if (phi->op != IR_PHI) break;
+        uint32_t* operands = &function->operands[phi->first_operand];
+        memmove(operands + position, operands + position + 1, (phi->operand_count - position - 1) * sizeof(uint32_t));
+        phi->operand_count--;
+    }
+}
+
+// Remove the blocks the entry block no longer reaches. Blocks are numbered
+// after their predecessors, so one pass in order finds them.
+static void remove_unreachable(IrOptimizer* optimizer) {
+    IrFunction* function = optimizer->function;
+    uint8_t* reachable = (uint8_t*)calloc(function->block_count, 1);
+    reachable[0] = 1;
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        IrBlock* block = &function->blocks[b];
+        if (reachable[b]) {
+            for (uint32_t i = 0; i < block->successor_count; i++) reachable[block->successors[i]] = 1;
+            continue;
+        }
+        if (block->dead) continue;
+        block->dead = 1;
+        optimizer->unreachable_blocks++;
+        for (uint32_t i = 0; i < block->code_count; i++) function->instructions[block->code[i]].dead = 1;
+        for (uint32_t i = 0; i < block->successor_count; i++) remove_predecessor(function, block->successors[i], b);
+        block->code_count = 0;
+        block->successor_count = 0;
+    }
+    free(reachable);
+}
+
+// --- Constant propagation ---
+
+static int integer_constant(const IrInstruction* instruction, long* value) {
+    return instruction->op == IR_CONST && instruction->kind == TOKEN_NUMBER &&
+           integer_literal_value(instruction->symbol, value);
+}
+
+static void make_constant(IrOptimizer* optimizer, IrInstruction* instruction, TokenType kind, Symbol text, IrType type) {
+    instruction->op = IR_CONST;
+    instruction->kind = kind;
+    instruction->symbol = text;
+    instruction->type = type;
+    instruction->operand_count = 0;
+    optimizer->folded++;
+}
+
+static void make_integer(IrOptimizer* optimizer, IrInstruction* instruction, long value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%ld", value);
+    make_constant(optimizer, instruction, TOKEN_NUMBER, intern_cstring(text), IR_TYPE_INT);
+}
+
+// String constant with the contents of `text`. Like the lexer's, string
+// symbols are the text between the quotes, escapes left as written.
+static void make_string(IrOptimizer* optimizer, IrInstruction* instruction, const char* text) {
+    make_constant(optimizer, instruction, TOKEN_STRING, intern_cstring(text), IR_TYPE_STRING);
+}
+
+static void fold_binary(IrOptimizer* optimizer, IrInstruction* instruction) {
+    IrFunction* function = optimizer->function;
+    const IrInstruction* left = &function->instructions[IR_OPERAND(function, instruction, 0)];
+    const IrInstruction* right = &function->instructions[IR_OPERAND(function, instruction, 1)];
+    TokenType op = (TokenType)instruction->kind;
+    long a, b, result;
+    if (integer_constant(left, &a) && integer_constant(right, &b)) {
+        if (!fold_operation(op, a, b, &result)) return;
+        if (op == TOKEN_EQUAL || op == TOKEN_NOT_EQUAL || op == TOKEN_GREATER || op == TOKEN_LESS) {
+            make_constant(optimizer, instruction, TOKEN_IDENTIFIER, result ? SYM_TRUE : SYM_FALSE, IR_TYPE_BOOL);
+        } else if (result >= VALUE_INT_MIN && result <= VALUE_INT_MAX) {
+            // Larger results are floats in the VM
+            make_integer(optimizer, instruction, result);
+        }
+        return;
+    }
+    if (op == TOKEN_PLUS && left->op == IR_CONST && left->kind == TOKEN_STRING &&
+        right->op == IR_CONST && right->kind == TOKEN_STRING) {
+        // An escape never spans the two halves, so the texts concatenate
+        size_t left_length = symbol_length(left->symbol);
+        size_t right_length = symbol_length(right->symbol);
+        char* text = (char*)malloc(left_length + right_length + 1);
+        memcpy(text, symbol_name(left->symbol), left_length);
+        memcpy(text + left_length, symbol_name(right->symbol), right_length);
+        text[left_length + right_length] = '\0';
+        make_string(optimizer, instruction, text);
+        free(text);
+    }
+}
+
+static void fold_to_string(IrOptimizer* optimizer, IrInstruction* instruction) {
+    IrFunction* function = optimizer->function;
+    const IrInstruction* operand = &function->instructions[IR_OPERAND(function, instruction, 0)];
+    long value;
+    if (operand->type == IR_TYPE_STRING) {
+        // Already a string: str() returns it unchanged
+        instruction->op = IR_COPY;
+        optimizer->folded++;
+    } else if (integer_constant(operand, &value)) {
+        char text[32];
+        snprintf(text, sizeof(text), "%ld", value);
+        make_string(optimizer, instruction, text);
+    } else if (operand->op == IR_CONST && operand->kind == TOKEN_IDENTIFIER) {
+        // True, False or None
+        make_string(optimizer, instruction, symbol_name(operand->symbol));
+    }
+}
+
+// A phi whose operands are all the same constant is that constant.
+// Returns 1 if it was folded.
+static int fold_phi(IrOptimizer* optimizer, IrInstruction* phi) {
+    IrFunction* function = optimizer->function;
+    if (phi->operand_count == 0) return 0;
+    const IrInstruction* first = &function->instructions[IR_OPERAND(function, phi, 0)];
+    if (first->op != IR_CONST) return 0;
+    for (uint32_t i = 1; i < phi->operand_count; i++) {
+        const IrInstruction* operand = &function->instructions[IR_OPERAND(function, phi, i)];
+        if (operand->op != IR_CONST || operand->kind != first->kind || operand->symbol != first->symbol) return 0;
+    }
+    make_constant(optimizer, phi, (TokenType)first->kind, first->symbol, first->type);
+    return 1;
+}
+
+// Move the phis of a block back in front of its other instructions, where
+// remove_predecessor() and the back ends look for them, after some were
+// folded to constants in place
+static void move_phis_first(IrFunction* function, IrBlock* block) {
+    uint32_t phi_count = 0;
+    for (uint32_t i = 0; i < block->code_count; i++) {
+        uint32_t value = block->code[i];
+        if (function->instructions[value].op != IR_PHI) continue;
+        memmove(block->code + phi_count + 1, block->code + phi_count, (i - phi_count) * sizeof(uint32_t));
+        block->code[phi_count++] = value;
+    }
+}
+
+// Truth value of a constant, as the VM tests it
+static int constant_truth(const IrInstruction* instruction, int* truth) {
+    long value;
+    if (instruction->op != IR_CONST) return 0;
+    if (instruction->kind == TOKEN_STRING) {
+        *truth = symbol_length(instruction->symbol) > 0;
+    } else if (instruction->kind == TOKEN_IDENTIFIER) {
+        *truth = instruction->symbol == SYM_TRUE;
+    } else if (integer_constant(instruction, &value)) {
+        *truth = value != 0;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static void fold_branch(IrOptimizer* optimizer, uint32_t block_index, IrInstruction* branch) {
+    IrFunction* function = optimizer->function;
+    int truth;
+    if (!constant_truth(&function->instructions[IR_OPERAND(function, branch, 0)], &truth)) return;
+    IrBlock* block = &function->blocks[block_index];
+    uint32_t taken = block->successors[truth ? 0 : 1];
+    uint32_t skipped = block->successors[truth ? 1 : 0];
+    remove_predecessor(function, skipped, block_index);
+    block->successors[0] = taken;
+    block->successor_count = 1;
+    block->join = IR_NO_BLOCK;
+    branch->op = IR_JUMP;
+    branch->operand_count = 0;
+    optimizer->branches_folded++;
+}
+
+// Returns 1 if any branch was folded
+static int propagate_constants(IrOptimizer* optimizer) {
+    IrFunction* function = optimizer->function;
+    size_t branches_before = optimizer->branches_folded;
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        IrBlock* block = &function->blocks[b];
+        int phis_folded = 0;
+        for (uint32_t i = 0; i < block->code_count; i++) {
+            IrInstruction* instruction = &function->instructions[block->code[i]];
+            if (instruction->dead) continue;
+            switch (instruction->op) {
+                case IR_BINARY:    fold_binary(optimizer, instruction); break;
+                case IR_TO_STRING: fold_to_string(optimizer, instruction); break;
+                case IR_PHI:       phis_folded |= fold_phi(optimizer, instruction); break;
+                case IR_BRANCH:    fold_branch(optimizer, b, instruction); break;
+                default:           break;
+            }
+        }
+        // Branches only remove edges into later blocks, so the phis are
+        // back in front before the next removal can reach this block
+        if (phis_folded) move_phis_first(function, block);
+    }
+    return optimizer->branches_folded != branches_before;
+}
+
+// --- Load forwarding and copy propagation ---
+
+// Variables whose value is known at the current point of a block: name
+// -> value, or 0 when unknown
+typedef struct {
+    SymbolIndex values;
+    Symbol* names;              // The names with a value, for forgetting them all
+    uint32_t name_count;
+} KnownValues;
+
+static void know_value(KnownValues* known, Symbol name, uint32_t value) {
+    if (value != 0 && symbol_index_get(&known->values, name) <= 0) known->names[known->name_count++] = name;
+    symbol_index_put(&known->values, name, value);
+}
+
+static void forget_values(KnownValues* known) {
+    for (uint32_t i = 0; i < known->name_count; i++) symbol_index_put(&known->values, known->names[i], 0);
+    known->name_count = 0;
+}
+
+static void forward_loads(IrOptimizer* optimizer) {
+    IrFunction* function = optimizer->function;
+    KnownValues known;
+    memset(&known, 0, sizeof(known));
+    known.names = (Symbol*)malloc(function->instruction_count * sizeof(Symbol));
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        const IrBlock* block = &function->blocks[b];
+        forget_values(&known);
+        for (uint32_t i = 0; i < block->code_count; i++) {
+            uint32_t value = block->code[i];
+            IrInstruction* instruction = &function->instructions[value];
+            if (instruction->dead) continue;
+            if (is_load(instruction->op)) {
+                int previous = symbol_index_get(&known.values, instruction->symbol);
+                if (previous > 0) {
+                    replace_value(optimizer, value, (uint32_t)previous);
+                    optimizer->loads_forwarded++;
+                } else {
+                    know_value(&known, instruction->symbol, value);
+                }
+            } else if (instruction->op == IR_STORE_GLOBAL || instruction->op == IR_STORE_FIELD) {
+                // Forwarding other values would keep them alive longer
+                // than the variable they were stored to
+                uint32_t stored = resolve(optimizer, IR_OPERAND(function, instruction, 0));
+                IrOp op = function->instructions[stored].op;
+                know_value(&known, instruction->symbol, op == IR_CONST || op == IR_PARAM ? stored : 0);
+            } else if (is_call(instruction->op)) {
+                // Script functions may assign any global
+                forget_values(&known);
+            }
+        }
+    }
+    free(known.values.slots);
+    free(known.names);
+}
+
+static void propagate_copies(IrOptimizer* optimizer) {
+    IrFunction* function = optimizer->function;
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        const IrBlock* block = &function->blocks[b];
+        for (uint32_t i = 0; i < block->code_count; i++) {
+            uint32_t value = block->code[i];
+            IrInstruction* instruction = &function->instructions[value];
+            if (instruction->dead) continue;
+            if (instruction->op == IR_COPY) {
+                replace_value(optimizer, value, resolve(optimizer, IR_OPERAND(function, instruction, 0)));
+                optimizer->copies_propagated++;
+            } else if (instruction->op == IR_PHI) {
+                uint32_t same = 0;
+                int trivial = 1;
+                for (uint32_t j = 0; j < instruction->operand_count && trivial; j++) {
+                    uint32_t operand = resolve(optimizer, IR_OPERAND(function, instruction, j));
+                    if (operand == value || operand == same) continue;
+                    if (same != 0) trivial = 0;
+                    same = operand;
+                }
+                if (trivial && same != 0) {
+                    replace_value(optimizer, value, same);
+                    optimizer->copies_propagated++;
+                }
+            }
+        }
+    }
+}
+
+// --- Common subexpressions ---
+
+typedef struct {
+    uint32_t* slots;            // Values, 0 = empty
+    uint32_t slot_mask;
+    uint32_t* inserted;         // Slots filled, in order, for undoing scopes
+    uint32_t inserted_count;
+    uint32_t** children;        // Dominator tree
+    uint32_t* child_counts;
+} CseTable;
+
+static int is_commutative(const IrFunction* function, const IrInstruction* instruction) {
+    switch (instruction->kind) {
+        case TOKEN_MULTIPLY:
+        case TOKEN_EQUAL:
+        case TOKEN_NOT_EQUAL:
+            return 1;
+        case TOKEN_PLUS:
+            // Not string concatenation
+            return function->instructions[IR_OPERAND(function, instruction, 0)].type == IR_TYPE_INT &&
+                   function->instructions[IR_OPERAND(function, instruction, 1)].type == IR_TYPE_INT;
+        default:
+            return 0;
+    }
+}
+
+// What makes two instructions compute the same value: the operator and
+// operands of a binary operation, the literal of a constant
+typedef struct {
+    int tag;                    // Operator, or -1 for a constant
+    uint32_t left;
+    uint32_t right;
+} CseKey;
+
+static int cse_key(const IrFunction* function, const IrInstruction* instruction, CseKey* key) {
+    if (instruction->op == IR_CONST) {
+        key->tag = -1;
+        key->left = instruction->symbol;
+        key->right = (uint32_t)instruction->kind;
+        return 1;
+    }
+    // String concatenations each allocate their own string
+    if (instruction->op != IR_BINARY || instruction->type == IR_TYPE_STRING) return 0;
+    key->tag = instruction->kind;
+    key->left = IR_OPERAND(function, instruction, 0);
+    key->right = IR_OPERAND(function, instruction, 1);
+    if (key->left > key->right && is_commutative(function, instruction)) {
+        uint32_t swap = key->left;
+        key->left = key->right;
+        key->right = swap;
+    }
+    return 1;
+}
+
+static uint32_t cse_hash(const CseKey* key) {
+    uint32_t hash = (uint32_t)key->tag * 0x9E3779B1u ^ key->left * 0x85EBCA77u ^ key->right * 0xC2B2AE3Du;
+    return hash ^ (hash >> 15);
+}
+
+static void eliminate_in_block(IrOptimizer* optimizer, CseTable* table, uint32_t block_index) {
+    IrFunction* function = optimizer->function;
+    const IrBlock* block = &function->blocks[block_index];
+    uint32_t scope = table->inserted_count;
+    for (uint32_t i = 0; i < block->code_count; i++) {
+        uint32_t value = block->code[i];
+        IrInstruction* instruction = &function->instructions[value];
+        CseKey key;
+        if (instruction->dead || !cse_key(function, instruction, &key)) continue;
+        uint32_t slot = cse_hash(&key) & table->slot_mask;
+        for (;;) {
+            uint32_t existing = table->slots[slot];
+            if (existing == 0) {
+                table->slots[slot] = value;
+                table->inserted[table->inserted_count++] = slot;
+                break;
+            }
+            CseKey existing_key;
+            cse_key(function, &function->instructions[existing], &existing_key);
+            if (existing_key.tag == key.tag && existing_key.left == key.left && existing_key.right == key.right) {
+                replace_value(optimizer, value, existing);
+                optimizer->common_subexpressions++;
+                break;
+            }
+            slot = (slot + 1) & table->slot_mask;
+        }
+    }
+    for (uint32_t i = 0; i < table->child_counts[block_index]; i++) {
+        eliminate_in_block(optimizer, table, table->children[block_index][i]);
+    }
+    // Leave the scope, latest entries first so probing stays valid
+    while (table->inserted_count > scope) table->slots[table->inserted[--table->inserted_count]] = 0;
+}
+
+static void eliminate_common_subexpressions(IrOptimizer* optimizer) {
+    IrFunction* function = optimizer->function;
+    // Immediate dominators (Cooper, Harvey and Kennedy): predecessors are
+    // numbered lower, so one pass in block order suffices
+    uint32_t* idom = (uint32_t*)malloc(function->block_count * sizeof(uint32_t));
+    idom[0] = 0;
+    for (uint32_t b = 1; b < function->block_count; b++) {
+        const IrBlock* block = &function->blocks[b];
+        idom[b] = IR_NO_BLOCK;
+        if (block->dead) continue;
+        for (uint32_t i = 0; i < block->predecessor_count; i++) {
+            uint32_t other = block->predecessors[i];
+            if (idom[b] == IR_NO_BLOCK) {
+                idom[b] = other;
+                continue;
+            }
+            uint32_t current = idom[b];
+            while (current != other) {
+                if (current > other) current = idom[current];
+                else other = idom[other];
+            }
+            idom[b] = current;
+        }
+    }
+
+    CseTable table;
+    uint32_t slot_count = 64;
+    while (slot_count < function->instruction_count * 2) slot_count *= 2;
+    table.slots = (uint32_t*)calloc(slot_count, sizeof(uint32_t));
+    table.slot_mask = slot_count - 1;
+    table.inserted = (uint32_t*)malloc(function->instruction_count * sizeof(uint32_t));
+    table.inserted_count = 0;
+    table.children = (uint32_t**)calloc(function->block_count, sizeof(uint32_t*));
+    table.child_counts = (uint32_t*)calloc(function->block_count, sizeof(uint32_t));
+    uint32_t* child_capacities = (uint32_t*)calloc(function->block_count, sizeof(uint32_t));
+    for (uint32_t b = 1; b < function->block_count; b++) {
+        if (idom[b] == IR_NO_BLOCK) continue;
+        uint32_t parent = idom[b];
+        if (table.child_counts[parent] >= child_capacities[parent]) {
+            child_capacities[parent] = child_capacities[parent] ? child_capacities[parent] * 2 : 4;
+            table.children[parent] = (uint32_t*)realloc(table.children[parent], child_capacities[parent] * sizeof(uint32_t));
+        }
+        table.children[parent][table.child_counts[parent]++] = b;
+    }
+
+    eliminate_in_block(optimizer, &table, 0);
+
+    for (uint32_t b = 0; b < function->block_count; b++) free(table.children[b]);
+    free(table.children);
+    free(table.child_counts);
+    free(child_capacities);
+    free(table.slots);
+    free(table.inserted);
+    free(idom);
+}
+
+// --- Dead code ---
+
+static void count_uses(IrFunction* function) {
+    for (uint32_t i = 0; i < function->instruction_count; i++) function->instructions[i].use_count = 0;
+    for (uint32_t i = 1; i < function->instruction_count; i++) {
+        const IrInstruction* instruction = &function->instructions[i];
+        if (instruction->dead) continue;
+        for (uint32_t j = 0; j < instruction->operand_count; j++) {
+            function->instructions[IR_OPERAND(function, instruction, j)].use_count++;
+        }
+    }
+}
+
+// Can the operation stop the VM with an error? Comparisons for equality
+// never do, nor does integer arithmetic other than division by zero.
+static int may_fail(const IrFunction* function, const IrInstruction* instruction) {
+    if (instruction->op != IR_BINARY) return 0;
+    if (instruction->kind == TOKEN_EQUAL || instruction->kind == TOKEN_NOT_EQUAL) return 0;
+    const IrInstruction* left = &function->instructions[IR_OPERAND(function, instruction, 0)];
+    const IrInstruction* right = &function->instructions[IR_OPERAND(function, instruction, 1)];
+    if (left->type != IR_TYPE_INT || right->type != IR_TYPE_INT) return 1;
+    long divisor;
+    return instruction->kind == TOKEN_DIVIDE && (!integer_constant(right, &divisor) || divisor == 0);
+}
+
+static int has_effect(const IrFunction* function, const IrInstruction* instruction) {
+    return !defines_value(instruction->op) || is_call(instruction->op) || may_fail(function, instruction);
+}
+
+static void eliminate_dead_code(IrOptimizer* optimizer) {
+    IrFunction* function = optimizer->function;
+    count_uses(function);
+    uint32_t* worklist = (uint32_t*)malloc(function->instruction_count * sizeof(uint32_t));
+    uint32_t pending = 0;
+    for (uint32_t i = 1; i < function->instruction_count; i++) {
+        const IrInstruction* instruction = &function->instructions[i];
+        if (!instruction->dead && instruction->use_count == 0 && !has_effect(function, instruction)) worklist[pending++] = i;
+    }
+    while (pending > 0) {
+        IrInstruction* instruction = &function->instructions[worklist[--pending]];
+        if (instruction->dead) continue;
+        instruction->dead = 1;
+        optimizer->dead_instructions++;
+        for (uint32_t j = 0; j < instruction->operand_count; j++) {
+            uint32_t operand = IR_OPERAND(function, instruction, j);
+            IrInstruction* definition = &function->instructions[operand];
+            if (--definition->use_count == 0 && !definition->dead && !has_effect(function, definition)) {
+                worklist[pending++] = operand;
+            }
+        }
+    }
+    free(worklist);
+    compact_blocks(function);
+}
+
+// --- Types ---
+
+static IrType join_types(IrType a, IrType b) {
+    return a == b ? a : IR_TYPE_ANY;
+}
+
+// Infer every value's type. Loads get their global's type when
+// `load_types` is set, and are untyped otherwise.
+static void infer_function_types(IrProgram* program, IrFunction* function, int load_types) {
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        const IrBlock* block = &function->blocks[b];
+        for (uint32_t i = 0; i < block->code_count; i++) {
+            IrInstruction* instruction = &function->instructions[block->code[i]];
+            const IrInstruction* first = instruction->operand_count > 0
+                                             ? &function->instructions[IR_OPERAND(function, instruction, 0)]
+                                             : NULL;
+            switch (instruction->op) {
+                case IR_PHI:
+                    instruction->type = first ? first->type : IR_TYPE_ANY;
+                    for (uint32_t j = 1; j < instruction->operand_count; j++) {
+                        instruction->type = join_types(instruction->type,
+                                                       function->instructions[IR_OPERAND(function, instruction, j)].type);
+                    }
+                    break;
+                case IR_COPY:
+                    instruction->type = first->type;
+                    break;
+                case IR_LOAD_GLOBAL:
+                case IR_LOAD_FIELD: {
+                    int global = symbol_index_get(&program->global_index, instruction->symbol);
+                    instruction->type = load_types && global >= 0 ? program->globals[global].type : IR_TYPE_ANY;
+                    break;
+                }
+                case IR_BINARY: {
+                    IrType left = first->type;
+                    IrType right = function->instructions[IR_OPERAND(function, instruction, 1)].type;
+                    if (instruction->kind == TOKEN_EQUAL || instruction->kind == TOKEN_NOT_EQUAL ||
+                        instruction->kind == TOKEN_GREATER || instruction->kind == TOKEN_LESS) {
+                        instruction->type = IR_TYPE_BOOL;
+                    } else if (instruction->kind == TOKEN_PLUS && (left == IR_TYPE_STRING || right == IR_TYPE_STRING)) {
+                        instruction->type = IR_TYPE_STRING;
+                    } else {
+                        instruction->type = left == IR_TYPE_INT && right == IR_TYPE_INT ? IR_TYPE_INT : IR_TYPE_ANY;
+                    }
+                    break;
+                }
+                default:
+                    // Constants, str() and calls keep the type lowering gave them
+                    break;
+            }
+        }
+    }
+}
+
+// Each global's type is the join of the values stored to it; a global
+// never stored is untyped. Stored values can depend on loads, so the
+// stored types are taken from a first pass with untyped loads. Typing the
+// loads cannot change a type that pass found, only refine ones it left
+// untyped, so the second pass with typed loads is sound.
+static void infer_types(IrProgram* program) {
+    int* stored = (int*)malloc((program->global_count ? program->global_count : 1) * sizeof(int));
+    for (uint32_t i = 0; i < program->global_count; i++) stored[i] = -1;
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        IrFunction* function = &program->functions[f];
+        infer_function_types(program, function, 0);
+        for (uint32_t b = 0; b < function->block_count; b++) {
+            const IrBlock* block = &function->blocks[b];
+            for (uint32_t i = 0; i < block->code_count; i++) {
+                const IrInstruction* instruction = &function->instructions[block->code[i]];
+                if (instruction->op != IR_STORE_GLOBAL && instruction->op != IR_STORE_FIELD) continue;
+                int global = symbol_index_get(&program->global_index, instruction->symbol);
+                IrType type = function->instructions[IR_OPERAND(function, instruction, 0)].type;
+                stored[global] = stored[global] < 0 ? (int)type : (int)join_types((IrType)stored[global], type);
+            }
+        }
+    }
+    for (uint32_t i = 0; i < program->global_count; i++) {
+        program->globals[i].type = stored[i] < 0 ? IR_TYPE_ANY : (IrType)stored[i];
+    }
+    free(stored);
+    for (uint32_t f = 0; f < program->function_count; f++) infer_function_types(program, &program->functions[f], 1);
+}
+
+// --- Back end preparation ---
+
+// Can a load be evaluated again at each use instead of where it is? Only
+// if all uses follow in its block, are not phis, and nothing before the
+// last one can change the variable.
+static int can_rematerialize_load(const IrFunction* function, const IrBlock* block, uint32_t position) {
+    uint32_t value = block->code[position];
+    const IrInstruction* load = &function->instructions[value];
+    uint32_t uses_left = load->use_count;
+    for (uint32_t i = position + 1; i < block->code_count && uses_left > 0; i++) {
+        const IrInstruction* instruction = &function->instructions[block->code[i]];
+        for (uint32_t j = 0; j < instruction->operand_count; j++) {
+            if (IR_OPERAND(function, instruction, j) != value) continue;
+            if (instruction->op == IR_PHI) return 0;
+            uses_left--;
+        }
+        if (uses_left == 0) break;
+        if (is_call(instruction->op)) return 0;
+        if ((instruction->op == IR_STORE_GLOBAL || instruction->op == IR_STORE_FIELD) && instruction->symbol == load->symbol) return 0;
+    }
+    return uses_left == 0;
+}
+
+// Does the value's only use come later in the same block, outside a phi?
+static int has_local_single_use(const IrFunction* function, const IrBlock* block, uint32_t position) {
+    uint32_t value = block->code[position];
+    if (function->instructions[value].use_count != 1) return 0;
+    for (uint32_t i = position + 1; i < block->code_count; i++) {
+        const IrInstruction* instruction = &function->instructions[block->code[i]];
+        for (uint32_t j = 0; j < instruction->operand_count; j++) {
+            if (IR_OPERAND(function, instruction, j) == value) return instruction->op != IR_PHI;
+        }
+    }
+    return 0;
+}
+
+static void select_trees(IrFunction* function) {
+    uint32_t* pending = (uint32_t*)malloc(function->instruction_count * sizeof(uint32_t));
+    uint8_t* is_pending = (uint8_t*)calloc(function->instruction_count, 1);
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        const IrBlock* block = &function->blocks[b];
+        uint32_t pending_count = 0;
+        for (uint32_t i = 0; i < block->code_count; i++) {
+            uint32_t value = block->code[i];
+            IrInstruction* instruction = &function->instructions[value];
+            instruction->inlined = 0;
+            instruction->rematerialized = 0;
+
+            // The operands waiting to be inlined must be the top of the
+            // stack, the last operand topmost; otherwise evaluating them
+            // here would reorder them, so they are all kept in variables
+            uint32_t matched = 0;
+            int in_order = 1;
+            for (uint32_t j = instruction->operand_count; j-- > 0 && in_order;) {
+                uint32_t operand = IR_OPERAND(function, instruction, j);
+                if (!is_pending[operand]) continue;
+                if (matched < pending_count && pending[pending_count - 1 - matched] == operand) {
+                    matched++;
+                } else {
+                    in_order = 0;
+                }
+            }
+            if (!in_order) matched = 0;
+            for (uint32_t j = 0; j < matched; j++) {
+                uint32_t operand = pending[--pending_count];
+                function->instructions[operand].inlined = 1;
+                is_pending[operand] = 0;
+            }
+
+            if (instruction->op == IR_CONST || instruction->op == IR_PARAM ||
+                (is_load(instruction->op) && can_rematerialize_load(function, block, i))) {
+                instruction->rematerialized = 1;
+            } else if (defines_value(instruction->op) && instruction->op != IR_PHI &&
+                       has_local_single_use(function, block, i)) {
+                pending[pending_count++] = value;
+                is_pending[value] = 1;
+            } else {
+                // Whatever is still waiting is used after this instruction
+                // and has to be kept in a variable
+                while (pending_count > 0) is_pending[pending[--pending_count]] = 0;
+            }
+        }
+        while (pending_count > 0) is_pending[pending[--pending_count]] = 0;
+    }
+    free(pending);
+    free(is_pending);
+}
+
+// Does the back end need somewhere to keep the value between its
+// definition and its uses? Phis always do: the jumps into their block
+// assign them.
+int ir_keeps_value(const IrInstruction* instruction) {
+    if (instruction->dead) return 0;
+    if (instruction->op == IR_PHI) return 1;
+    return defines_value(instruction->op) && instruction->use_count > 0 &&
+           !instruction->inlined && !instruction->rematerialized;
+}
+
+// --- Tracing ---
+
+#ifdef FLIPSCRIPT_TRACE
+static const char* const ir_op_names[] = {
+    [IR_CONST] = "const", [IR_PARAM] = "param", [IR_PHI] = "phi", [IR_COPY] = "copy",
+    [IR_LOAD_GLOBAL] = "load", [IR_STORE_GLOBAL] = "store", [IR_LOAD_FIELD] = "load_field",
+    [IR_STORE_FIELD] = "store_field", [IR_BINARY] = "binary", [IR_TO_STRING] = "str",
+    [IR_CALL] = "call", [IR_CALL_NATIVE] = "call_native", [IR_RESULT] = "result",
+    [IR_JUMP] = "jump", [IR_BRANCH] = "branch", [IR_RETURN] = "return", [IR_HALT] = "halt",
+};
+static const char* const ir_type_names[] = {"any", "int", "bool", "string", "none"};
+
+static void trace_function(const IrFunction* function) {
+    TRACE(TRACE_OPTIMIZER, 2, "function %s", function->name ? symbol_name(function->name) : "<top level>");
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        const IrBlock* block = &function->blocks[b];
+        if (block->dead) continue;
+        TRACE(TRACE_OPTIMIZER, 2, " block %u (%u predecessors) -> %d %d", b, block->predecessor_count,
+              block->successor_count > 0 ? (int)block->successors[0] : -1,
+              block->successor_count > 1 ? (int)block->successors[1] : -1);
+        for (uint32_t i = 0; i < block->code_count; i++) {
+            const IrInstruction* instruction = &function->instructions[block->code[i]];
+            char operands[128] = "";
+            size_t length = 0;
+            for (uint32_t j = 0; j < instruction->operand_count && length < sizeof(operands) - 16; j++) {
+                length += snprintf(operands + length, sizeof(operands) - length, " v%u", IR_OPERAND(function, instruction, j));
+            }
+            TRACE(TRACE_OPTIMIZER, 2, "  v%u: %s %s %d %s%s uses=%u%s%s", block->code[i], ir_type_names[instruction->type],
+                  ir_op_names[instruction->op], instruction->kind,
+                  instruction->symbol ? symbol_name(instruction->symbol) : "", operands, instruction->use_count,
+                  instruction->inlined ? " inlined" : "", instruction->rematerialized ? " remat" : "");
+        }
+    }
+}
+#endif
+
+static size_t ir_changes(const IrOptimizer* optimizer) {
+    return optimizer->folded + optimizer->branches_folded + optimizer->loads_forwarded +
+           optimizer->copies_propagated + optimizer->common_subexpressions;
+}
+
+// Optimize the IR at the given level (0 only removes unreachable code)
+// and prepare it for the back ends
+void optimize_ir(IrProgram* ir, int level) {
+    if (ir == NULL) return;
+    IrOptimizer optimizer;
+    memset(&optimizer, 0, sizeof(optimizer));
+    optimizer.program = ir;
+
+    for (uint32_t f = 0; f < ir->function_count; f++) {
+        IrFunction* function = &ir->functions[f];
+        optimizer.function = function;
+        optimizer.forward = (uint32_t*)calloc(function->instruction_count, sizeof(uint32_t));
+        remove_unreachable(&optimizer);
+        if (level >= 1) {
+            size_t changes, rounds = 0;
+            do {
+                changes = ir_changes(&optimizer);
+                if (propagate_constants(&optimizer)) remove_unreachable(&optimizer);
+                forward_loads(&optimizer);
+                propagate_copies(&optimizer);
+                apply_replacements(&optimizer);
+                compact_blocks(function);
+                eliminate_common_subexpressions(&optimizer);
+                apply_replacements(&optimizer);
+                compact_blocks(function);
+                rounds++;
+            } while (changes != ir_changes(&optimizer));
+            TRACE(TRACE_OPTIMIZER, 2, "IR function %s: %zu rounds",
+                  function->name ? symbol_name(function->name) : "<top level>", rounds);
+        }
+        compact_blocks(function);
+        free(optimizer.forward);
+    }
+
+    infer_types(ir);
+    for (uint32_t f = 0; f < ir->function_count; f++) {
+        IrFunction* function = &ir->functions[f];
+        if (level >= 1) {
+            optimizer.function = function;
+            eliminate_dead_code(&optimizer);
+        }
+        count_uses(function);
+        select_trees(function);
+    }
+
+    TRACE(TRACE_OPTIMIZER, 1, "IR: %zu folded, %zu branches folded, %zu unreachable blocks, %zu loads forwarded, "
+          "%zu copies propagated, %zu common subexpressions, %zu dead instructions removed",
+          optimizer.folded, optimizer.branches_folded, optimizer.unreachable_blocks, optimizer.loads_forwarded,
+          optimizer.copies_propagated, optimizer.common_subexpressions, optimizer.dead_instructions);
+#ifdef FLIPSCRIPT_TRACE
+    if (TRACE_ENABLED(TRACE_OPTIMIZER, 2)) {
+        for (uint32_t f = 0; f < ir->function_count; f++) trace_function(&ir->functions[f]);
+    }
+#endif
+}
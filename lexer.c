@@ -5,50 +5,115 @@
 
 #include "flipscript.h"
 #include "flipscript_types.h"
+#include "trace.h"
+#include <pthread.h>
+#include <unistd.h>
 
-// Initialize lexer
-Lexer* init_lexer(char* source) {
+// Initialize lexer over source[0, length). The source does not need to
+// be NUL-terminated.
+Lexer* init_lexer(const char* source, size_t length) {
     Lexer* lexer = (Lexer*)malloc(sizeof(Lexer));
     lexer->source = source;
-    lexer->source_len = strlen(source);
+    lexer->source_len = length;
     lexer->pos = 0;
     lexer->line = 1;
     lexer->column = 1;
     lexer->indent_level = 0;
+    lexer->line_indent = 0;
     return lexer;
 }
 
-// Check if character is a space (but not a newline)
-int is_space(char c) {
-    return c == ' ' || c == '\t' || c == '\r';
-}
-
-// Helper to create a token
-Token create_token(TokenType type, char* value, int line, int column) {
+// Helper to create a token spanning source[start, start + length)
+Token create_token(TokenType type, size_t start, size_t length, int line, int column) {
     Token token;
     token.type = type;
-    token.value = value ? strdup(value) : NULL;
+    token.start = start;
+    token.length = length;
     token.line = line;
     token.column = column;
+    token.symbol = NO_SYMBOL;
     return token;
 }
 
-// Get the next token from source
-Token get_next_token(Lexer* lexer) {
-    fprintf(stderr, "DEBUG: Lexer looking at position %zu, character: '%c' (ASCII %d)\n", 
-        lexer->pos, 
-        lexer->pos < lexer->source_len ? lexer->source[lexer->pos] : '?', 
+// Identifiers, numbers and strings carry the interned Symbol of their text
+static inline int token_has_symbol(TokenType type) {
+    return type == TOKEN_IDENTIFIER || type == TOKEN_NUMBER || type == TOKEN_STRING;
+}
+
+// Pointer to the first character of a token's text (not NUL-terminated)
+const char* token_start(Lexer* lexer, Token token) {
+    return lexer->source + token.start;
+}
+
+// Materialize a token's text as a heap string. Only call this when the
+// string has to outlive the token, e.g. when the AST keeps it.
+char* token_strdup(Lexer* lexer, Token token) {
+    char* value = (char*)malloc(token.length + 1);
+    memcpy(value, lexer->source + token.start, token.length);
+    value[token.length] = '\0';
+    return value;
+}
+
+// Keyword table. Each entry lists the keyword, its first and last
+// character and its token type; to add a keyword, add a line here.
+// The table is indexed by a perfect hash on (length, first, last), so a
+// lookup is one probe and one memcmp. If a new keyword collides with an
+// existing one the duplicate designated initializer triggers
+// -Woverride-init (part of -Wextra); pick new KEYWORD_HASH multipliers.
+#define KEYWORD_LIST(X) \
+    X("if",     'i', 'f', TOKEN_IF) \
+    X("else",   'e', 'e', TOKEN_ELSE) \
+    X("elif",   'e', 'f', TOKEN_ELIF) \
+    X("while",  'w', 'e', TOKEN_WHILE) \
+    X("for",    'f', 'r', TOKEN_FOR) \
+    X("def",    'd', 'f', TOKEN_DEF) \
+    X("return", 'r', 'n', TOKEN_RETURN) \
+    X("import", 'i', 't', TOKEN_IMPORT) \
+    X("cfunc",  'c', 'c', TOKEN_CFUNC) \
+    X("class",  'c', 's', TOKEN_CLASS)
+
+#define KEYWORD_TABLE_SIZE 64
+#define KEYWORD_HASH(length, first, last) \
+    (((length) + 3 * (unsigned char)(first) + 15 * (unsigned char)(last)) & (KEYWORD_TABLE_SIZE - 1))
+
+typedef struct {
+    const char* text;
+    size_t length;
+    TokenType type;
+} Keyword;
+
+#define KEYWORD_ENTRY(text, first, last, type) \
+    [KEYWORD_HASH(sizeof(text) - 1, first, last)] = { text, sizeof(text) - 1, type },
+
+static const Keyword keyword_table[KEYWORD_TABLE_SIZE] = {
+    KEYWORD_LIST(KEYWORD_ENTRY)
+};
+
+// Map an identifier to its keyword token type, or TOKEN_IDENTIFIER
+static TokenType lookup_keyword(const char* text, size_t length) {
+    const Keyword* keyword = &keyword_table[KEYWORD_HASH(length, text[0], text[length - 1])];
+    if (keyword->length == length && memcmp(keyword->text, text, length) == 0) {
+        return keyword->type;
+    }
+    return TOKEN_IDENTIFIER;
+}
+
+// Scan one token. Shared by get_next_token() and the tokenize_all() loop,
+// which gets its own inlined copy.
+static inline Token lex_token(Lexer* lexer) {
+    TRACE(TRACE_LEXER, 2, "looking at position %zu, character: '%c' (ASCII %d)",
+        lexer->pos,
+        lexer->pos < lexer->source_len ? lexer->source[lexer->pos] : '?',
         lexer->pos < lexer->source_len ? (int)lexer->source[lexer->pos] : -1);
     // Skip whitespace
-    while (lexer->pos < lexer->source_len && is_space(lexer->source[lexer->pos])) {
-        lexer->pos++;
-        lexer->column++;
-    }
+    size_t space_end = scan_spaces(lexer->source, lexer->pos, lexer->source_len);
+    lexer->column += space_end - lexer->pos;
+    lexer->pos = space_end;
     
     // Check for EOF
     if (lexer->pos >= lexer->source_len) {
-        fprintf(stderr, "DEBUG: EOF reached at position %zu\n", lexer->pos);
-        return create_token(TOKEN_EOF, NULL, lexer->line, lexer->column);
+        TRACE(TRACE_LEXER, 1, "EOF reached at position %zu, line %zu", lexer->pos, lexer->line);
+        return create_token(TOKEN_EOF, lexer->pos, 0, lexer->line, lexer->column);
     }
     
     
@@ -56,14 +121,17 @@ Token get_next_token(Lexer* lexer) {
 
     if (current_char == '#') {
         // Skip comment until end of line
-        fprintf(stderr, "DEBUG: Found comment at position %zu\n", lexer->pos);
-        while (lexer->pos < lexer->source_len && lexer->source[lexer->pos] != '\n') {
-            lexer->pos++;
-            lexer->column++;
-        }
+        TRACE(TRACE_LEXER, 3, "comment at position %zu", lexer->pos);
+        size_t comment_end = scan_line_end(lexer->source, lexer->pos, lexer->source_len);
+        lexer->column += comment_end - lexer->pos;
+        lexer->pos = comment_end;
         
-        // Recurse to get the next token
-        return get_next_token(lexer);
+        // The comment ends at a newline, which is handled below, or at EOF
+        if (lexer->pos >= lexer->source_len) {
+            TRACE(TRACE_LEXER, 1, "EOF reached at position %zu, line %zu", lexer->pos, lexer->line);
+            return create_token(TOKEN_EOF, lexer->pos, 0, lexer->line, lexer->column);
+        }
+        current_char = '\n';
     }
     
     
@@ -74,84 +142,45 @@ Token get_next_token(Lexer* lexer) {
         lexer->column = 1;
         
         // Count spaces at start of next line for indentation
-        int spaces = 0;
-        while (lexer->pos < lexer->source_len && is_space(lexer->source[lexer->pos])) {
-            spaces++;
-            lexer->pos++;
-            lexer->column++;
-        }
+        size_t indent_end = scan_spaces(lexer->source, lexer->pos, lexer->source_len);
+        int spaces = (int)(indent_end - lexer->pos);
+        lexer->column += spaces;
+        lexer->pos = indent_end;
         
         // Convert spaces to indentation level (assuming 4 spaces = 1 indent)
         int new_indent_level = spaces / 4;
+        lexer->line_indent = new_indent_level;
         
         if (new_indent_level > lexer->indent_level) {
             lexer->indent_level++;
-            return create_token(TOKEN_INDENT, NULL, lexer->line, lexer->column);
+            return create_token(TOKEN_INDENT, lexer->pos, 0, lexer->line, lexer->column);
         } else if (new_indent_level < lexer->indent_level) {
             lexer->indent_level--;
-            return create_token(TOKEN_DEDENT, NULL, lexer->line, lexer->column);
+            return create_token(TOKEN_DEDENT, lexer->pos, 0, lexer->line, lexer->column);
         } else {
-            return create_token(TOKEN_NEWLINE, NULL, lexer->line, lexer->column);
+            return create_token(TOKEN_NEWLINE, lexer->pos, 0, lexer->line, lexer->column);
         }
     }
     
     // Handle identifiers and keywords
-    if (isalpha(current_char) || current_char == '_') {
-        int start_pos = lexer->pos;
-        while (lexer->pos < lexer->source_len && 
-               (isalnum((unsigned char)lexer->source[lexer->pos]) || lexer->source[lexer->pos] == '_' ||
-                isdigit((unsigned char)lexer->source[lexer->pos]) || lexer->source[lexer->pos] == '.')) {
-            lexer->pos++;
-            lexer->column++;
-        }
-        
-        int length = lexer->pos - start_pos;
-        char* value = (char*)malloc(length + 1);
-        strncpy(value, &lexer->source[start_pos], length);
-        value[length] = '\0';
+    if (char_class[(unsigned char)current_char] & CHAR_IDENT_START) {
+        size_t start_pos = lexer->pos;
+        lexer->pos = scan_identifier(lexer->source, lexer->pos + 1, lexer->source_len);
         
-        // Check for keywords
-        if (strcmp(value, "if") == 0) {
-            return create_token(TOKEN_IF, value, lexer->line, lexer->column - length);
-        } else if (strcmp(value, "else") == 0) {
-            return create_token(TOKEN_ELSE, value, lexer->line, lexer->column - length);
-        } else if (strcmp(value, "elif") == 0) {
-            return create_token(TOKEN_ELIF, value, lexer->line, lexer->column - length);
-        } else if (strcmp(value, "while") == 0) {
-            return create_token(TOKEN_WHILE, value, lexer->line, lexer->column - length);
-        } else if (strcmp(value, "for") == 0) {
-            return create_token(TOKEN_FOR, value, lexer->line, lexer->column - length);
-        } else if (strcmp(value, "def") == 0) {
-            return create_token(TOKEN_DEF, value, lexer->line, lexer->column - length);
-        } else if (strcmp(value, "return") == 0) {
-            return create_token(TOKEN_RETURN, value, lexer->line, lexer->column - length);
-        } else if (strcmp(value, "import") == 0) {
-            return create_token(TOKEN_IMPORT, value, lexer->line, lexer->column - length);
-        } else if (strcmp(value, "cfunc") == 0) {
-            return create_token(TOKEN_CFUNC, value, lexer->line, lexer->column - length);
-        } else if (strcmp(value, "class") == 0) {
-            return create_token(TOKEN_CLASS, value, lexer->line, lexer->column - length);
-        } 
-        else {
-            return create_token(TOKEN_IDENTIFIER, value, lexer->line, lexer->column - length);
-        }
+        size_t length = lexer->pos - start_pos;
+        lexer->column += length;
+        TokenType type = lookup_keyword(&lexer->source[start_pos], length);
+        return create_token(type, start_pos, length, lexer->line, lexer->column - length);
     }
     
     // Handle numbers
-    if (isdigit(current_char)) {
-        int start_pos = lexer->pos;
-        while (lexer->pos < lexer->source_len && 
-               (isdigit((unsigned char)lexer->source[lexer->pos]) || lexer->source[lexer->pos] == '.')) {
-            lexer->pos++;
-            lexer->column++;
-        }
-        
-        int length = lexer->pos - start_pos;
-        char* value = (char*)malloc(length + 1);
-        strncpy(value, &lexer->source[start_pos], length);
-        value[length] = '\0';
+    if (char_class[(unsigned char)current_char] & CHAR_DIGIT) {
+        size_t start_pos = lexer->pos;
+        lexer->pos = scan_number(lexer->source, lexer->pos + 1, lexer->source_len);
         
-        return create_token(TOKEN_NUMBER, value, lexer->line, lexer->column - length);
+        size_t length = lexer->pos - start_pos;
+        lexer->column += length;
+        return create_token(TOKEN_NUMBER, start_pos, length, lexer->line, lexer->column - length);
     }
     
     // Handle strings
@@ -160,22 +189,20 @@ Token get_next_token(Lexer* lexer) {
         lexer->pos++;
         lexer->column++;
         
-        int start_pos = lexer->pos;
-        while (lexer->pos < lexer->source_len && lexer->source[lexer->pos] != quote) {
+        size_t start_pos = lexer->pos;
+        while (lexer->pos < lexer->source_len) {
+            size_t stop = scan_string_body(lexer->source, lexer->pos, lexer->source_len, quote);
+            lexer->column += stop - lexer->pos;
+            lexer->pos = stop;
+            if (lexer->pos >= lexer->source_len || lexer->source[lexer->pos] == quote) break;
+            
             // Handle escaped characters
-            if (lexer->source[lexer->pos] == '\\' && lexer->pos + 1 < lexer->source_len) {
-                lexer->pos += 2;
-                lexer->column += 2;
-            } else {
-                lexer->pos++;
-                lexer->column++;
-            }
+            size_t step = lexer->pos + 1 < lexer->source_len ? 2 : 1;
+            lexer->pos += step;
+            lexer->column += step;
         }
         
-        int length = lexer->pos - start_pos;
-        char* value = (char*)malloc(length + 1);
-        strncpy(value, &lexer->source[start_pos], length);
-        value[length] = '\0';
+        size_t length = lexer->pos - start_pos;
         
         // Skip closing quote
         if (lexer->pos < lexer->source_len) {
@@ -183,7 +210,7 @@ Token get_next_token(Lexer* lexer) {
             lexer->column++;
         }
         
-        return create_token(TOKEN_STRING, value, lexer->line, lexer->column - length - 2);
+        return create_token(TOKEN_STRING, start_pos, length, lexer->line, lexer->column - length - 2);
     }
     
     // Handle operators and other symbols
@@ -191,23 +218,23 @@ Token get_next_token(Lexer* lexer) {
         case '+':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_PLUS, "+", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_PLUS, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case '-':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_MINUS, "-", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_MINUS, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case '*':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_MULTIPLY, "*", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_MULTIPLY, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case '/':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_DIVIDE, "/", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_DIVIDE, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case '%':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_MODULO, "%", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_MODULO, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
 
         case '=':
             lexer->pos++;
@@ -215,64 +242,320 @@ Token get_next_token(Lexer* lexer) {
             if (lexer->pos < lexer->source_len && lexer->source[lexer->pos] == '=') {
                 lexer->pos++;
                 lexer->column++;
-                return create_token(TOKEN_EQUAL, "==", lexer->line, lexer->column - 2);
+                return create_token(TOKEN_EQUAL, lexer->pos - 2, 2, lexer->line, lexer->column - 2);
             }
-            return create_token(TOKEN_ASSIGN, "=", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_ASSIGN, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case '!':
             lexer->pos++;
             lexer->column++;
             if (lexer->pos < lexer->source_len && lexer->source[lexer->pos] == '=') {
                 lexer->pos++;
                 lexer->column++;
-                return create_token(TOKEN_NOT_EQUAL, "!=", lexer->line, lexer->column - 2);
+                return create_token(TOKEN_NOT_EQUAL, lexer->pos - 2, 2, lexer->line, lexer->column - 2);
             }
             // Error: unexpected character
-            return create_token(TOKEN_EOF, NULL, lexer->line, lexer->column - 1);
+            return create_token(TOKEN_EOF, lexer->pos - 1, 0, lexer->line, lexer->column - 1);
         case '>':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_GREATER, ">", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_GREATER, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case '<':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_LESS, "<", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_LESS, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case '(':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_LPAREN, "(", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_LPAREN, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case ')':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_RPAREN, ")", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_RPAREN, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case '{':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_LBRACE, "{", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_LBRACE, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case '}':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_RBRACE, "}", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_RBRACE, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case ',':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_COMMA, ",", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_COMMA, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case '.':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_DOT, ",", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_DOT, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case ';':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_SEMICOLON, ";", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_SEMICOLON, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         case ':':
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_COLON, ":", lexer->line, lexer->column - 1);
+            return create_token(TOKEN_COLON, lexer->pos - 1, 1, lexer->line, lexer->column - 1);
         default:
             // Error: unexpected character
             lexer->pos++;
             lexer->column++;
-            return create_token(TOKEN_EOF, NULL, lexer->line, lexer->column - 1);
+            return create_token(TOKEN_EOF, lexer->pos - 1, 0, lexer->line, lexer->column - 1);
+    }
+}
+
+// Get the next token from source
+Token get_next_token(Lexer* lexer) {
+    Token token = lex_token(lexer);
+    if (token_has_symbol(token.type)) token.symbol = intern_string(lexer->source + token.start, token.length);
+    return token;
+}
+
+// Grow every column of a token stream together
+static void grow_token_stream(TokenStream* stream) {
+    stream->capacity *= 2;
+    stream->types = (uint8_t*)realloc(stream->types, stream->capacity * sizeof(uint8_t));
+    stream->starts = (uint32_t*)realloc(stream->starts, stream->capacity * sizeof(uint32_t));
+    stream->lengths = (uint32_t*)realloc(stream->lengths, stream->capacity * sizeof(uint32_t));
+    stream->lines = (uint32_t*)realloc(stream->lines, stream->capacity * sizeof(uint32_t));
+    stream->columns = (uint32_t*)realloc(stream->columns, stream->capacity * sizeof(uint32_t));
+    stream->symbols = (Symbol*)realloc(stream->symbols, stream->capacity * sizeof(Symbol));
+}
+
+// Create an empty token stream sized for roughly `source_len` bytes of input
+TokenStream* create_token_stream(size_t source_len) {
+    TokenStream* stream = (TokenStream*)malloc(sizeof(TokenStream));
+    stream->capacity = source_len / 4 + 16;
+    stream->count = 0;
+    stream->types = (uint8_t*)malloc(stream->capacity * sizeof(uint8_t));
+    stream->starts = (uint32_t*)malloc(stream->capacity * sizeof(uint32_t));
+    stream->lengths = (uint32_t*)malloc(stream->capacity * sizeof(uint32_t));
+    stream->lines = (uint32_t*)malloc(stream->capacity * sizeof(uint32_t));
+    stream->columns = (uint32_t*)malloc(stream->capacity * sizeof(uint32_t));
+    stream->symbols = (Symbol*)malloc(stream->capacity * sizeof(Symbol));
+    return stream;
+}
+
+// Append a token to a stream
+void token_stream_push(TokenStream* stream, Token token) {
+    if (stream->count >= stream->capacity) grow_token_stream(stream);
+    size_t i = stream->count++;
+    stream->types[i] = (uint8_t)token.type;
+    stream->starts[i] = (uint32_t)token.start;
+    stream->lengths[i] = (uint32_t)token.length;
+    stream->lines[i] = (uint32_t)token.line;
+    stream->columns[i] = (uint32_t)token.column;
+    stream->symbols[i] = token.symbol;
+}
+
+// Lex the whole source in one pass. The stream always ends with exactly
+// one TOKEN_EOF: the lexer reports unexpected characters as EOF, and the
+// parser stops at the first one anyway.
+TokenStream* tokenize_all(Lexer* lexer) {
+    TokenStream* stream = create_token_stream(lexer->source_len);
+    for (;;) {
+        Token token = lex_token(lexer);
+        if (token_has_symbol(token.type)) token.symbol = intern_string(lexer->source + token.start, token.length);
+        token_stream_push(stream, token);
+        if (token.type == TOKEN_EOF) break;
+    }
+    TRACE(TRACE_LEXER, 1, "tokenized %zu bytes into %zu tokens", lexer->source_len, stream->count);
+    return stream;
+}
+
+// Read back token `index` of a stream. Indices past the end return the
+// trailing EOF token, so lookahead never needs a bounds check.
+Token token_stream_get(const TokenStream* stream, size_t index) {
+    if (index >= stream->count) index = stream->count - 1;
+    Token token;
+    token.type = (TokenType)stream->types[index];
+    token.start = stream->starts[index];
+    token.length = stream->lengths[index];
+    token.line = (int)stream->lines[index];
+    token.column = (int)stream->columns[index];
+    token.symbol = stream->symbols[index];
+    return token;
+}
+
+void free_token_stream(TokenStream* stream) {
+    if (!stream) return;
+    free(stream->types);
+    free(stream->starts);
+    free(stream->lengths);
+    free(stream->lines);
+    free(stream->columns);
+    free(stream->symbols);
+    free(stream);
+}
+
+// --- Parallel lexing ---
+//
+// The source is split into chunks that each start at a newline, and every
+// chunk is lexed on its own thread. Indentation is the only lexer state
+// that crosses a line boundary, and it only depends on the leading
+// whitespace of each line: so workers record the raw indentation of every
+// line they start, and a sequential pass replays the INDENT/DEDENT state
+// machine over those records, rebases line numbers and interns token
+// text. The symbol table is thread-safe, but interning there keeps Symbol
+// numbers in source order, the same as tokenize_all(), and the table's
+// lock would serialize the workers anyway. Strings are the one token that
+// may span a newline; if one runs into a chunk boundary the whole file is
+// lexed sequentially instead.
+
+#define PARALLEL_LEX_MIN_CHUNK (64 * 1024)
+
+typedef struct {
+    const char* source;
+    size_t start;            // First byte of the chunk (a '\n' unless 0)
+    size_t end;              // One past the last byte of the chunk
+    TokenStream* tokens;     // Chunk tokens, ending with one TOKEN_EOF
+    int* line_indents;       // Raw indentation for each newline token
+    size_t newline_count;
+    size_t lines_started;    // Number of newlines the chunk lexer consumed
+    int stopped_early;       // Hit an unexpected character (error EOF)
+    int split_string;        // A string literal runs past the chunk end
+} LexChunk;
+
+static void* lex_chunk(void* arg) {
+    LexChunk* chunk = (LexChunk*)arg;
+    Lexer lexer = {0};
+    lexer.source = chunk->source;
+    lexer.source_len = chunk->end;
+    lexer.pos = chunk->start;
+    lexer.line = 1;
+    lexer.column = 1;
+
+    size_t indent_capacity = 64;
+    chunk->tokens = create_token_stream(chunk->end - chunk->start);
+    chunk->line_indents = (int*)malloc(indent_capacity * sizeof(int));
+    chunk->newline_count = 0;
+
+    for (;;) {
+        Token token = lex_token(&lexer);
+        token_stream_push(chunk->tokens, token);
+        if (token.type == TOKEN_INDENT || token.type == TOKEN_DEDENT || token.type == TOKEN_NEWLINE) {
+            if (chunk->newline_count >= indent_capacity) {
+                indent_capacity *= 2;
+                chunk->line_indents = (int*)realloc(chunk->line_indents, indent_capacity * sizeof(int));
+            }
+            chunk->line_indents[chunk->newline_count++] = lexer.line_indent;
+        } else if (token.type == TOKEN_STRING && token.start + token.length >= chunk->end) {
+            chunk->split_string = 1;
+        } else if (token.type == TOKEN_EOF) {
+            chunk->stopped_early = token.start < chunk->end;
+            break;
+        }
+    }
+    chunk->lines_started = lexer.line - 1;
+    return NULL;
+}
+
+// Lex the source on up to `jobs` threads (capped at the number of online
+// cores). Produces the same stream as tokenize_all(); small inputs and a
+// single job simply call it.
+TokenStream* tokenize_parallel(Lexer* lexer, int jobs) {
+    size_t chunk_count = jobs > 1 ? (size_t)jobs : 1;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores > 0 && chunk_count > (size_t)cores) chunk_count = (size_t)cores;
+    if (chunk_count > lexer->source_len / PARALLEL_LEX_MIN_CHUNK) {
+        chunk_count = lexer->source_len / PARALLEL_LEX_MIN_CHUNK;
+    }
+    if (chunk_count <= 1) return tokenize_all(lexer);
+
+    // Pick chunk boundaries at the first newline after each even split point
+    LexChunk* chunks = (LexChunk*)calloc(chunk_count, sizeof(LexChunk));
+    size_t used = 0;
+    size_t start = 0;
+    for (size_t i = 1; i <= chunk_count; i++) {
+        size_t end = lexer->source_len;
+        if (i < chunk_count) {
+            size_t split = lexer->source_len / chunk_count * i;
+            if (split < start) split = start;
+            const char* newline = memchr(lexer->source + split, '\n', lexer->source_len - split);
+            end = newline ? (size_t)(newline - lexer->source) : lexer->source_len;
+        }
+        if (end <= start && i < chunk_count) continue;
+        chunks[used].source = lexer->source;
+        chunks[used].start = start;
+        chunks[used].end = end;
+        used++;
+        start = end;
+        if (start >= lexer->source_len) break;
+    }
+
+    pthread_t* threads = (pthread_t*)malloc(used * sizeof(pthread_t));
+    for (size_t i = 1; i < used; i++) pthread_create(&threads[i], NULL, lex_chunk, &chunks[i]);
+    lex_chunk(&chunks[0]);
+    for (size_t i = 1; i < used; i++) pthread_join(threads[i], NULL);
+    free(threads);
+
+    // Reconcile: replay indentation, rebase lines, concatenate
+    TokenStream* stream = NULL;
+    int fallback = 0;
+    for (size_t i = 0; i + 1 < used && !fallback; i++) {
+        if (chunks[i].stopped_early) break;
+        fallback = chunks[i].split_string;
     }
-    fprintf(stderr, "DEBUG: Lexer");
-}
\ No newline at end of file
+
+    if (!fallback) {
+        size_t total = 0;
+        for (size_t i = 0; i < used; i++) total += chunks[i].tokens->count;
+        stream = create_token_stream(0);
+        while (stream->capacity < total) grow_token_stream(stream);
+
+        int indent_level = 0;
+        size_t line_base = 0;
+        for (size_t i = 0; i < used; i++) {
+            LexChunk* chunk = &chunks[i];
+            TokenStream* tokens = chunk->tokens;
+            int last = i + 1 == used || chunk->stopped_early;
+            size_t count = last ? tokens->count : tokens->count - 1;  // Drop inner EOFs
+            size_t base = stream->count;
+
+            memcpy(stream->types + base, tokens->types, count * sizeof(uint8_t));
+            memcpy(stream->starts + base, tokens->starts, count * sizeof(uint32_t));
+            memcpy(stream->lengths + base, tokens->lengths, count * sizeof(uint32_t));
+            memcpy(stream->columns + base, tokens->columns, count * sizeof(uint32_t));
+            for (size_t t = 0; t < count; t++) {
+                stream->lines[base + t] = tokens->lines[t] + (uint32_t)line_base;
+                stream->symbols[base + t] = token_has_symbol((TokenType)tokens->types[t])
+                    ? intern_string(lexer->source + tokens->starts[t], tokens->lengths[t])
+                    : NO_SYMBOL;
+            }
+            stream->count += count;
+
+            size_t newline = 0;
+            for (size_t t = base; t < stream->count; t++) {
+                uint8_t type = stream->types[t];
+                if (type != TOKEN_INDENT && type != TOKEN_DEDENT && type != TOKEN_NEWLINE) continue;
+                int new_indent_level = chunk->line_indents[newline++];
+                if (new_indent_level > indent_level) {
+                    indent_level++;
+                    stream->types[t] = TOKEN_INDENT;
+                } else if (new_indent_level < indent_level) {
+                    indent_level--;
+                    stream->types[t] = TOKEN_DEDENT;
+                } else {
+                    stream->types[t] = TOKEN_NEWLINE;
+                }
+            }
+            line_base += chunk->lines_started;
+            if (last) break;
+        }
+        lexer->pos = lexer->source_len;
+        lexer->indent_level = indent_level;
+        TRACE(TRACE_LEXER, 1, "tokenized %zu bytes into %zu tokens on %zu threads",
+              lexer->source_len, stream->count, used);
+    }
+
+    for (size_t i = 0; i < used; i++) {
+        free_token_stream(chunks[i].tokens);
+        free(chunks[i].line_indents);
+    }
+    free(chunks);
+
+    if (fallback) {
+        TRACE(TRACE_LEXER, 1, "string literal crosses a chunk boundary, lexing sequentially");
+        return tokenize_all(lexer);
+    }
+    return stream;
+}
@@ -7,72 +7,141 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <pthread.h>
 #include "flipscript.h"
 #include "flipscript_types.h"
+#include "trace.h"
 
 // Print usage information
 void print_usage(const char* program_name) {
     printf("FlipScript - A Python-like language for Flipper Zero\n");
     printf("Usage:\n");
     printf("  %s [options] <filename>\n", program_name);
+    printf("  %s -c|-b [options] <filename> <filename>...\n", program_name);
+    printf("  (use - as the filename to read the script from standard input)\n");
     printf("\n");
     printf("Options:\n");
     printf("  -c           Generate C code output\n");
     printf("  -b           Generate bytecode output\n");
     printf("  -r           Run the script directly\n");
     printf("  -o <output>  Specify output filename\n");
+    printf("  -O<n>        Optimization level: 0 disables the AST, IR and bytecode\n");
+    printf("               optimizers\n");
+    printf("               (default 1)\n");
+    printf("  -j, --jobs <n>\n");
+    printf("               Compile several files (or lex one large file) on\n");
+    printf("               n threads\n");
+    printf("  --vm=<stack|reg>\n");
+    printf("               Engine used by -r: the stack VM (default) or the\n");
+    printf("               register VM, which needs a source file\n");
+    printf("  -m, --module <file>\n");
+    printf("               Load native module descriptors from file\n");
+    printf("  -v           Trace all phases (-vv for more detail)\n");
+    printf("  --trace=<phase[:level],...>\n");
+    printf("               Trace selected phases: lexer, parser, optimizer,\n");
+    printf("               compiler, codegen, vm or all\n");
+    printf("  --serve      Run the incremental language server on stdin/stdout\n");
     printf("  -h           Display this help message\n");
 }
 
-// Write bytecode to a binary file
-void write_bytecode_file(const char* filename, Compiler* compiler) {
-    FILE* file = fopen(filename, "wb");
-    if (!file) {
-        fprintf(stderr, "Error: Could not create bytecode file '%s'\n", filename);
-        return;
+// Version 3: adds the function table (see write_function_table)
+// Version 4: adds the top-level frame's slot count after it
+#define BYTECODE_VERSION 4
+
+// Write the constant pool: a count, then per constant a type byte and its
+// payload. Ints are 8-byte integers, floats 8-byte doubles, bools one
+// byte, strings a length and the text; None has no payload.
+static void write_constant_pool(FILE* file, const ConstantPool* pool) {
+    uint32_t constant_count = (uint32_t)pool->count;
+    fwrite(&constant_count, sizeof(uint32_t), 1, file);
+    for (uint32_t i = 0; i < constant_count; i++) {
+        const Constant* constant = &pool->entries[i];
+        uint8_t type = (uint8_t)constant->type;
+        fwrite(&type, 1, 1, file);
+        switch (constant->type) {
+            case CONST_INT: {
+                int64_t integer = constant->as.integer;
+                fwrite(&integer, sizeof(int64_t), 1, file);
+                break;
+            }
+            case CONST_FLOAT:
+                fwrite(&constant->as.number, sizeof(double), 1, file);
+                break;
+            case CONST_BOOL: {
+                uint8_t truth = (uint8_t)constant->as.integer;
+                fwrite(&truth, 1, 1, file);
+                break;
+            }
+            case CONST_STRING: {
+                uint32_t len = (uint32_t)symbol_length(constant->as.string);
+                fwrite(&len, sizeof(uint32_t), 1, file);
+                fwrite(symbol_name(constant->as.string), 1, len, file);
+                break;
+            }
+            case CONST_NONE:
+                break;
+        }
+    }
+}
+
+// Write the function table: a count, then per function its name (length
+// and text), type, arity, local slot count and address. Calls refer to
+// functions by position, so natives are listed too.
+static void write_function_table(FILE* file, const Compiler* compiler) {
+    uint32_t function_count = (uint32_t)compiler->function_count;
+    fwrite(&function_count, sizeof(uint32_t), 1, file);
+    for (uint32_t i = 0; i < function_count; i++) {
+        const CompiledFunction* func = &compiler->functions[i];
+        uint32_t length = (uint32_t)symbol_length(func->name);
+        uint32_t fields[4] = {(uint32_t)func->type, (uint32_t)func->arity,
+                              (uint32_t)func->local_count, (uint32_t)func->address};
+        fwrite(&length, sizeof(uint32_t), 1, file);
+        fwrite(symbol_name(func->name), 1, length, file);
+        fwrite(fields, sizeof(uint32_t), 4, file);
     }
+}
+
+// Write bytecode to a binary file. Returns 0 on success.
+int write_bytecode_file(const char* filename, Compiler* compiler) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) return -1;
     
     // Write magic number
     const char* magic = "FSCB"; // FlipScript ByteCode
     fwrite(magic, 1, 4, file);
     
     // Write version
-    uint8_t version = 1;
+    uint8_t version = BYTECODE_VERSION;
     fwrite(&version, 1, 1, file);
     
-    // Write constant pool size
-    uint32_t constant_count = compiler->constant_count;
-    fwrite(&constant_count, sizeof(uint32_t), 1, file);
-    
-    // Write constants
-    for (uint32_t i = 0; i < constant_count; i++) {
-        uint32_t len = strlen(compiler->constants[i]);
-        fwrite(&len, sizeof(uint32_t), 1, file);
-        fwrite(compiler->constants[i], 1, len, file);
-    }
+    write_constant_pool(file, &compiler->constants);
     
     // Write name pool size
-    uint32_t name_count = compiler->name_count;
+    uint32_t name_count = (uint32_t)compiler->names.count;
     fwrite(&name_count, sizeof(uint32_t), 1, file);
     
     // Write names
     for (uint32_t i = 0; i < name_count; i++) {
-        uint32_t len = strlen(compiler->names[i]);
+        uint32_t len = strlen(compiler->names.strings[i]);
         fwrite(&len, sizeof(uint32_t), 1, file);
-        fwrite(compiler->names[i], 1, len, file);
+        fwrite(compiler->names.strings[i], 1, len, file);
     }
     
     // Write c_function pool size
-    uint32_t c_function_count = compiler->c_function_count;
+    uint32_t c_function_count = (uint32_t)compiler->c_functions.count;
     fwrite(&c_function_count, sizeof(uint32_t), 1, file);
     
     // Write c_functions
     for (uint32_t i = 0; i < c_function_count; i++) {
-        uint32_t len = strlen(compiler->c_functions[i]);
+        uint32_t len = strlen(compiler->c_functions.strings[i]);
         fwrite(&len, sizeof(uint32_t), 1, file);
-        fwrite(compiler->c_functions[i], 1, len, file);
+        fwrite(compiler->c_functions.strings[i], 1, len, file);
     }
     
+    write_function_table(file, compiler);
+    uint32_t top_level_locals = (uint32_t)compiler->top_level_locals;
+    fwrite(&top_level_locals, sizeof(uint32_t), 1, file);
+    
     // Write bytecode size
     uint32_t bytecode_size = compiler->bytecode_size;
     fwrite(&bytecode_size, sizeof(uint32_t), 1, file);
@@ -84,7 +153,102 @@ void write_bytecode_file(const char* filename, Compiler* compiler) {
     }
     
     fclose(file);
-    printf("Wrote bytecode to %s\n", filename);
+    return 0;
+}
+
+static int read_function_table(FILE* file, Compiler* compiler) {
+    uint32_t function_count = 0;
+    if (fread(&function_count, sizeof(uint32_t), 1, file) != 1) return -1;
+    compiler->function_capacity = function_count ? function_count : 1;
+    compiler->functions = (CompiledFunction*)calloc(compiler->function_capacity, sizeof(CompiledFunction));
+    for (uint32_t i = 0; i < function_count; i++) {
+        uint32_t length, fields[4];
+        char name[4097];
+        if (fread(&length, sizeof(uint32_t), 1, file) != 1 || length >= sizeof(name)) return -1;
+        if (fread(name, 1, length, file) != length || fread(fields, sizeof(uint32_t), 4, file) != 4) return -1;
+        CompiledFunction* func = &compiler->functions[i];
+        func->name = intern_string(name, length);
+        func->type = fields[0] == FUNC_NATIVE ? FUNC_NATIVE : FUNC_SCRIPT;
+        func->arity = fields[1];
+        func->local_count = fields[2];
+        func->address = fields[3];
+        if (func->type == FUNC_SCRIPT && func->arity > func->local_count) return -1;
+        symbol_index_put(&compiler->function_index, func->name, i);
+        compiler->function_count++;
+    }
+    return 0;
+}
+
+// Read one length-prefixed string pool, interning every entry. Entries
+// keep their file positions, which the bytecode refers to.
+static void read_symbol_pool(FILE* file, SymbolPool* pool) {
+    uint32_t pool_count = 0;
+    fread(&pool_count, sizeof(uint32_t), 1, file);
+    pool->count = pool_count;
+    pool->capacity = pool_count;
+    pool->strings = (char**)malloc((pool_count ? pool_count : 1) * sizeof(char*));
+    pool->symbols = (Symbol*)malloc((pool_count ? pool_count : 1) * sizeof(Symbol));
+    
+    char* buffer = NULL;
+    for (uint32_t i = 0; i < pool_count; i++) {
+        uint32_t len = 0;
+        fread(&len, sizeof(uint32_t), 1, file);
+        buffer = (char*)realloc(buffer, len + 1);
+        len = (uint32_t)fread(buffer, 1, len, file);
+        pool->symbols[i] = intern_string(buffer, len);
+        pool->strings[i] = (char*)symbol_name(pool->symbols[i]);
+    }
+    free(buffer);
+}
+
+// Read a constant pool written by write_constant_pool. Returns 0 on
+// success, -1 on an unknown constant type.
+static int read_constant_pool(FILE* file, ConstantPool* pool) {
+    uint32_t constant_count = 0;
+    fread(&constant_count, sizeof(uint32_t), 1, file);
+    pool->count = constant_count;
+    pool->capacity = constant_count;
+    pool->entries = (Constant*)calloc(constant_count ? constant_count : 1, sizeof(Constant));
+    
+    char* buffer = NULL;
+    for (uint32_t i = 0; i < constant_count; i++) {
+        Constant* constant = &pool->entries[i];
+        uint8_t type = 0;
+        fread(&type, 1, 1, file);
+        constant->type = (ConstantType)type;
+        switch (constant->type) {
+            case CONST_INT: {
+                int64_t integer = 0;
+                fread(&integer, sizeof(int64_t), 1, file);
+                constant->as.integer = (long)integer;
+                break;
+            }
+            case CONST_FLOAT:
+                fread(&constant->as.number, sizeof(double), 1, file);
+                break;
+            case CONST_BOOL: {
+                uint8_t truth = 0;
+                fread(&truth, 1, 1, file);
+                constant->as.integer = truth != 0;
+                break;
+            }
+            case CONST_STRING: {
+                uint32_t len = 0;
+                fread(&len, sizeof(uint32_t), 1, file);
+                buffer = (char*)realloc(buffer, len + 1);
+                len = (uint32_t)fread(buffer, 1, len, file);
+                constant->as.string = intern_string(buffer, len);
+                break;
+            }
+            case CONST_NONE:
+                break;
+            default:
+                free(buffer);
+                return -1;
+        }
+    }
+    free(buffer);
+    return 0;
 }
 
 // Load bytecode from a binary file
@@ -107,57 +271,35 @@ Compiler* load_bytecode_file(const char* filename) {
     // Read version
     uint8_t version;
     fread(&version, 1, 1, file);
-    if (version != 1) {
-        fprintf(stderr, "Error: Unsupported bytecode version: %d\n", version);
+    if (version != BYTECODE_VERSION) {
+        fprintf(stderr, "Error: Unsupported bytecode version: %d (expected %d; recompile the script)\n",
+                version, BYTECODE_VERSION);
         fclose(file);
         return NULL;
     }
     
     // Create a new compiler to hold the data
-    Compiler* compiler = (Compiler*)malloc(sizeof(Compiler));
+    Compiler* compiler = (Compiler*)calloc(1, sizeof(Compiler));
     compiler->ast = NULL;
+    compiler->errors = stderr;
     
-    // Read constant pool
-    uint32_t constant_count;
-    fread(&constant_count, sizeof(uint32_t), 1, file);
-    compiler->constant_count = constant_count;
-    compiler->constants = (char**)malloc(constant_count * sizeof(char*));
-    
-    for (uint32_t i = 0; i < constant_count; i++) {
-        uint32_t len;
-        fread(&len, sizeof(uint32_t), 1, file);
-        compiler->constants[i] = (char*)malloc(len + 1);
-        fread(compiler->constants[i], 1, len, file);
-        compiler->constants[i][len] = '\0';
-    }
-    
-    // Read name pool
-    uint32_t name_count;
-    fread(&name_count, sizeof(uint32_t), 1, file);
-    compiler->name_count = name_count;
-    compiler->names = (char**)malloc(name_count * sizeof(char*));
-    
-    for (uint32_t i = 0; i < name_count; i++) {
-        uint32_t len;
-        fread(&len, sizeof(uint32_t), 1, file);
-        compiler->names[i] = (char*)malloc(len + 1);
-        fread(compiler->names[i], 1, len, file);
-        compiler->names[i][len] = '\0';
+    // Read the constant, name and c_function pools
+    if (read_constant_pool(file, &compiler->constants) != 0) {
+        fprintf(stderr, "Error: Corrupt constant pool in bytecode file '%s'\n", filename);
+        fclose(file);
+        free_compiler(compiler);
+        return NULL;
     }
-    
-    // Read c_function pool
-    uint32_t c_function_count;
-    fread(&c_function_count, sizeof(uint32_t), 1, file);
-    compiler->c_function_count = c_function_count;
-    compiler->c_functions = (char**)malloc(c_function_count * sizeof(char*));
-    
-    for (uint32_t i = 0; i < c_function_count; i++) {
-        uint32_t len;
-        fread(&len, sizeof(uint32_t), 1, file);
-        compiler->c_functions[i] = (char*)malloc(len + 1);
-        fread(compiler->c_functions[i], 1, len, file);
-        compiler->c_functions[i][len] = '\0';
+    read_symbol_pool(file, &compiler->names);
+    read_symbol_pool(file, &compiler->c_functions);
+    uint32_t top_level_locals = 0;
+    if (read_function_table(file, compiler) != 0 || fread(&top_level_locals, sizeof(uint32_t), 1, file) != 1) {
+        fprintf(stderr, "Error: Corrupt function table in bytecode file '%s'\n", filename);
+        fclose(file);
+        free_compiler(compiler);
+        return NULL;
     }
+    compiler->top_level_locals = top_level_locals;
     
     // Read bytecode
     uint32_t bytecode_size;
@@ -175,12 +317,206 @@ Compiler* load_bytecode_file(const char* filename) {
     return compiler;
 }
 
-int main(int argc, char* argv[]) {
-    fprintf(stderr, "DEBUG: FlipScript compiler starting\n");
-    fprintf(stderr, "DEBUG: Arguments: %d\n", argc);
-    for (int i = 0; i < argc; i++) {
-        fprintf(stderr, "DEBUG: argv[%d] = %s\n", i, argv[i]);
+// Settings shared by every input file
+typedef struct {
+    int generate_c;
+    int generate_bytecode;
+    int optimization_level;
+    int lex_jobs;               // Threads for lexing one file
+    int name_c_after_input;     // Default C output is <input>.c, not output.c
+} CompileOptions;
+
+// Replace the extension of `input_filename` (or append one)
+static char* derive_output_filename(const char* input_filename, const char* extension) {
+    size_t length = strlen(input_filename);
+    const char* dot = strrchr(input_filename, '.');
+    const char* slash = strrchr(input_filename, '/');
+    if (dot && (!slash || dot > slash)) length = (size_t)(dot - input_filename);
+    char* filename = (char*)malloc(length + strlen(extension) + 1);
+    memcpy(filename, input_filename, length);
+    strcpy(filename + length, extension);
+    return filename;
+}
+
+// Lex, parse, optimize and compile one source file, reporting errors to
+// `err`. Returns NULL if the file could not be read or did not compile.
+static Compiler* compile_source_file(const char* input_filename, const CompileOptions* options, FILE* err) {
+    SourceBuffer* source = load_source(input_filename);
+    if (!source) {
+        fprintf(err, "Error: Could not open file: %s\n", input_filename);
+        return NULL;
+    }
+
+    Lexer* lexer = init_lexer(source->data, source->length);
+    TokenStream* tokens = tokenize_parallel(lexer, options->lex_jobs);
+    Parser* parser = init_parser_with_tokens(lexer, tokens);
+    Ast* ast = parse_program(parser);
+    size_t syntax_errors = report_syntax_errors(parser, input_filename, err);
+    free_parser(parser);
+    // The tree holds symbols, not pointers into the source
+    free_token_stream(tokens);
+    free(lexer);
+    free_source(source);
+    if (syntax_errors > 0) {
+        free_ast(ast);
+        return NULL;
+    }
+
+    optimize_ast(ast, options->optimization_level);
+    link_native_bindings(ast);
+    Compiler* compiler = init_compiler(ast);
+    compiler->errors = err;
+    lower_to_ir(compiler);
+    if (compiler->error_count > 0) {
+        free_compiler(compiler);
+        return NULL;
+    }
+    optimize_ir(compiler->ir, options->optimization_level);
+    compile_ir(compiler);
+    if (compiler->error_count > 0) {
+        free_compiler(compiler);
+        return NULL;
+    }
+    compiler->peephole_removed = optimize_bytecode(compiler, options->optimization_level);
+    return compiler;
+}
+
+// Generate the C and/or bytecode output of a compiled file. Progress goes
+// to `out`, errors to `err`. Returns 0 on success.
+static int write_outputs(Compiler* compiler, const char* input_filename, const char* output_filename,
+                         const CompileOptions* options, FILE* out, FILE* err) {
+    if (options->generate_c) {
+        // Generate C code output
+        char* c_filename;
+        if (output_filename) {
+            c_filename = strdup(output_filename);
+        } else if (options->name_c_after_input) {
+            c_filename = derive_output_filename(input_filename, ".c");
+        } else {
+            // Create default output filename
+            c_filename = strdup("output.c");
+        }
+
+        FILE* c_file = fopen(c_filename, "w");
+        if (!c_file) {
+            fprintf(err, "Error: Could not create output file: %s\n", c_filename);
+            free(c_filename);
+            return 1;
+        }
+
+        fprintf(out, "Generating C code to: %s\n", c_filename);
+        generate_c_from_ir(compiler->ir, c_file);
+        fclose(c_file);
+        fprintf(out, "C code generation complete.\n");
+        free(c_filename);
+    }
+
+    if (options->generate_bytecode) {
+        // Generate bytecode output; by default next to the input, as .fsb
+        char* bytecode_filename = output_filename ? strdup(output_filename)
+                                                  : derive_output_filename(input_filename, ".fsb");
+
+        fprintf(out, "Generating bytecode to: %s\n", bytecode_filename);
+        if (write_bytecode_file(bytecode_filename, compiler) != 0) {
+            fprintf(err, "Error: Could not create bytecode file '%s'\n", bytecode_filename);
+            free(bytecode_filename);
+            return 1;
+        }
+        fprintf(out, "Wrote bytecode to %s (%zu instructions, %zu removed by the peephole optimizer)\n",
+                bytecode_filename, compiler->bytecode_size, compiler->peephole_removed);
+        fprintf(out, "Bytecode generation complete.\n");
+        free(bytecode_filename);
     }
+    return 0;
+}
+
+// One file of a multi-file build. Its messages are buffered and printed
+// in command-line order once every file is done, so the output does not
+// depend on which thread finished first.
+typedef struct {
+    const char* input_filename;
+    char* out_text;
+    size_t out_length;
+    char* err_text;
+    size_t err_length;
+    int status;
+} BuildJob;
+
+typedef struct {
+    BuildJob* jobs;
+    size_t job_count;
+    size_t next_job;            // Next job to hand out, guarded by `lock`
+    pthread_mutex_t lock;
+    const CompileOptions* options;
+} BuildQueue;
+
+static void run_build_job(BuildJob* job, const CompileOptions* options) {
+    FILE* out = open_memstream(&job->out_text, &job->out_length);
+    FILE* err = open_memstream(&job->err_text, &job->err_length);
+    Compiler* compiler = compile_source_file(job->input_filename, options, err);
+    job->status = 1;
+    if (compiler) {
+        job->status = write_outputs(compiler, job->input_filename, NULL, options, out, err);
+        free_compiler(compiler);
+    }
+    fclose(out);
+    fclose(err);
+}
+
+// Take jobs off the queue until it is empty
+static void* build_worker(void* arg) {
+    BuildQueue* queue = (BuildQueue*)arg;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        size_t index = queue->next_job++;
+        pthread_mutex_unlock(&queue->lock);
+        if (index >= queue->job_count) return NULL;
+        run_build_job(&queue->jobs[index], queue->options);
+    }
+}
+
+// Compile every file on up to `threads` threads (the calling thread is one
+// of them). Returns the number of files that failed.
+static size_t build_files(const char** filenames, size_t count, int threads, const CompileOptions* options) {
+    BuildQueue queue;
+    queue.jobs = (BuildJob*)calloc(count, sizeof(BuildJob));
+    queue.job_count = count;
+    queue.next_job = 0;
+    queue.options = options;
+    pthread_mutex_init(&queue.lock, NULL);
+    for (size_t i = 0; i < count; i++) queue.jobs[i].input_filename = filenames[i];
+
+    size_t worker_count = (size_t)threads < count ? (size_t)threads : count;
+    pthread_t* workers = (pthread_t*)malloc(worker_count * sizeof(pthread_t));
+    size_t started = 0;
+    // If a thread cannot be started, the ones that did (or this one) pick
+    // up its share
+    for (size_t i = 1; i < worker_count; i++) {
+        if (pthread_create(&workers[started], NULL, build_worker, &queue) == 0) started++;
+    }
+    build_worker(&queue);
+    for (size_t i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    TRACE(TRACE_COMPILER, 1, "compiled %zu files on %zu threads", count, started + 1);
+
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        BuildJob* job = &queue.jobs[i];
+        fwrite(job->out_text, 1, job->out_length, stdout);
+        fflush(stdout);
+        fwrite(job->err_text, 1, job->err_length, stderr);
+        failed += job->status != 0;
+        free(job->out_text);
+        free(job->err_text);
+    }
+    if (failed > 0) fprintf(stderr, "%zu of %zu files failed to compile\n", failed, count);
+
+    pthread_mutex_destroy(&queue.lock);
+    free(workers);
+    free(queue.jobs);
+    return failed;
+}
+
+int main(int argc, char* argv[]) {
     if (argc < 2) {
         print_usage(argv[0]);
         return 1;
@@ -190,12 +526,52 @@ int main(int argc, char* argv[]) {
     int generate_c = 0;
     int generate_bytecode = 0;
     int run_script = 1;
-    const char* input_filename = NULL;
+    const char** input_filenames = (const char**)malloc(argc * sizeof(char*));
+    size_t input_count = 0;
     const char* output_filename = NULL;
+    int jobs = 1;
+    int optimization_level = 1;
+    int serve = 0;
+    int register_vm = 0;
     
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
-        if (argv[i][0] == '-') {
+        if (strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "-j") == 0) {
+            if (i + 1 >= argc || (jobs = atoi(argv[i + 1])) < 1) {
+                fprintf(stderr, "Error: %s option requires a positive thread count\n", argv[i]);
+                free(input_filenames);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--module") == 0 || strcmp(argv[i], "-m") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s option requires a descriptor file\n", argv[i]);
+                free(input_filenames);
+                return 1;
+            }
+            if (load_module_descriptor(argv[++i]) != 0) {
+                free(input_filenames);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--vm=", 5) == 0) {
+            if (strcmp(argv[i] + 5, "reg") == 0) {
+                register_vm = 1;
+            } else if (strcmp(argv[i] + 5, "stack") == 0) {
+                register_vm = 0;
+            } else {
+                fprintf(stderr, "Error: Unknown VM: %s (expected stack or reg)\n", argv[i] + 5);
+                free(input_filenames);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            serve = 1;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            if (trace_configure(argv[i] + 8) != 0) {
+                fprintf(stderr, "Error: Invalid trace specification: %s\n", argv[i] + 8);
+                free(input_filenames);
+                return 1;
+            }
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
             // Option
             switch (argv[i][1]) {
                 case 'c':
@@ -214,28 +590,87 @@ int main(int argc, char* argv[]) {
                         output_filename = argv[++i];
                     } else {
                         fprintf(stderr, "Error: -o option requires an argument\n");
+                        free(input_filenames);
+                        return 1;
+                    }
+                    break;
+                case 'O': {
+                    // -O alone means -O1
+                    char* end;
+                    optimization_level = argv[i][2] ? (int)strtol(argv[i] + 2, &end, 10) : 1;
+                    if (argv[i][2] && (*end != '\0' || optimization_level < 0)) {
+                        fprintf(stderr, "Error: Invalid optimization level: %s\n", argv[i]);
+                        free(input_filenames);
                         return 1;
                     }
                     break;
+                }
+                case 'v':
+                    trace_set_all((int)strspn(argv[i] + 1, "v"));
+                    break;
                 case 'h':
                     print_usage(argv[0]);
+                    free(input_filenames);
                     return 0;
                 default:
                     fprintf(stderr, "Unknown option: %s\n", argv[i]);
                     print_usage(argv[0]);
+                    free(input_filenames);
                     return 1;
             }
         } else {
             // Input filename
-            input_filename = argv[i];
+            input_filenames[input_count++] = argv[i];
         }
     }
     
-    if (!input_filename) {
+    if (serve) {
+        free(input_filenames);
+        return run_language_server(stdin, stdout);
+    }
+    
+    if (input_count == 0) {
         fprintf(stderr, "Error: No input file specified\n");
         print_usage(argv[0]);
+        free(input_filenames);
         return 1;
     }
+
+    CompileOptions options;
+    options.generate_c = generate_c;
+    options.generate_bytecode = generate_bytecode;
+    options.optimization_level = optimization_level;
+    options.lex_jobs = jobs;
+    options.name_c_after_input = 0;
+
+    // Several inputs: -j spreads whole files over threads instead
+    if (input_count > 1) {
+        if (run_script) {
+            fprintf(stderr, "Error: Only one script can be run at a time; use -c or -b to build several files\n");
+            free(input_filenames);
+            return 1;
+        }
+        if (output_filename) {
+            fprintf(stderr, "Error: -o cannot be used with several input files\n");
+            free(input_filenames);
+            return 1;
+        }
+        for (size_t i = 0; i < input_count; i++) {
+            const char* ext = strrchr(input_filenames[i], '.');
+            if ((ext && strcmp(ext, ".fsb") == 0) || strcmp(input_filenames[i], "-") == 0) {
+                fprintf(stderr, "Error: %s cannot be built together with other files\n", input_filenames[i]);
+                free(input_filenames);
+                return 1;
+            }
+        }
+        options.lex_jobs = 1;
+        options.name_c_after_input = 1;
+        size_t failed = build_files(input_filenames, input_count, jobs, &options);
+        free(input_filenames);
+        return failed > 0 ? 1 : 0;
+    }
+    const char* input_filename = input_filenames[0];
+    free(input_filenames);
     
     // Check file extension to determine if it's a FlipScript file or bytecode file
     const char* ext = strrchr(input_filename, '.');
@@ -244,8 +679,8 @@ int main(int argc, char* argv[]) {
     if (ext && strcmp(ext, ".fsb") == 0) {
         is_bytecode = 1;
         // Can only run bytecode, not generate C or more bytecode
-        generate_c = 0;
-        generate_bytecode = 0;
+        options.generate_c = 0;
+        options.generate_bytecode = 0;
     }
     
     Compiler* compiler = NULL;
@@ -253,141 +688,65 @@ int main(int argc, char* argv[]) {
     if (is_bytecode) {
         // Load bytecode from file
         compiler = load_bytecode_file(input_filename);
-        if (!compiler) {
-            return 1;
-        }
     } else {
-        // Read the source file
-        FILE* file = fopen(input_filename, "r");
-        if (!file) {
-            fprintf(stderr, "Error: Could not open file: %s\n", input_filename);
-            return 1;
-        }
-        
-        // Get file size
-        fseek(file, 0, SEEK_END);
-        long file_size = ftell(file);
-        fseek(file, 0, SEEK_SET);
-        
-        // Read file content
-        char* source = (char*)malloc(file_size + 1);
-        fread(source, 1, file_size, file);
-        source[file_size] = '\0';
-        fclose(file);
-
-        // After reading the file content
-        fprintf(stderr, "DEBUG: Read %ld bytes from input file: %s\n", file_size, input_filename);
-        if (file_size > 0) {
-            fprintf(stderr, "DEBUG: First 100 chars: %.100s\n", source);
-        } else {
-            fprintf(stderr, "DEBUG: Input file is empty!\n");
-        }
-        
-        // Initialize lexer, parser, and compiler
-        Lexer* lexer = init_lexer(source);
-        Parser* parser = init_parser(lexer);
-        ASTNode* ast = parse_program(parser);
-        fprintf(stderr, "DEBUG: Parsing complete. AST generated with type: %d\n", ast->type);
-        compiler = init_compiler(ast);
-        
-        // Compile AST to bytecode
-        compile_ast(compiler, ast);
+        compiler = compile_source_file(input_filename, &options, stderr);
+    }
+    if (!compiler) {
+        return 1;
     }
     
     // Process according to mode
-    if (generate_c) {
-        // Generate C code output
-        const char* c_filename;
-        if (output_filename) {
-            c_filename = output_filename;
-        } else {
-            // Create default output filename
-            c_filename = "output.c";
-        }
-        
-        FILE* c_file = fopen(c_filename, "w");
-        if (!c_file) {
-            fprintf(stderr, "Error: Could not create output file: %s\n", c_filename);
-            return 1;
-        }
-        
-        printf("Generating C code to: %s\n", c_filename);
-        generate_c_from_ast(compiler->ast, c_file, 0);
-        fclose(c_file);
-        printf("C code generation complete.\n");
+    if (write_outputs(compiler, input_filename, output_filename, &options, stdout, stderr) != 0) {
+        free_compiler(compiler);
+        return 1;
     }
     
-    if (generate_bytecode) {
-        // Generate bytecode output
-        const char* bytecode_filename;
-        if (output_filename) {
-            bytecode_filename = output_filename;
-        } else {
-            // Create default output filename
-            char* default_filename = (char*)malloc(strlen(input_filename) + 5);
-            strcpy(default_filename, input_filename);
-            
-            // Replace extension with .fsb or add it if no extension
-            char* ext_pos = strrchr(default_filename, '.');
-            if (ext_pos) {
-                strcpy(ext_pos, ".fsb");
-            } else {
-                strcat(default_filename, ".fsb");
-            }
-            
-            bytecode_filename = default_filename;
+    if (run_script && register_vm) {
+        // The register code is lowered from the IR, which .fsb files lack
+        if (is_bytecode) {
+            fprintf(stderr, "Error: The register VM runs source files only, not %s\n", input_filename);
+            free_compiler(compiler);
+            return 1;
         }
-        
-        printf("Generating bytecode to: %s\n", bytecode_filename);
-        write_bytecode_file(bytecode_filename, compiler);
-        printf("Bytecode generation complete.\n");
-        
-        if (bytecode_filename != output_filename) {
-            // We allocated memory for default_filename
-            free((void*)bytecode_filename);
+        if (lower_to_registers(compiler) != 0) {
+            free_compiler(compiler);
+            return 1;
         }
     }
     
     if (run_script) {
         // Execute bytecode
-        printf("Running script...\n");
         Runtime* runtime = init_runtime(compiler);
-        execute_bytecode(runtime);
+        if (!runtime) {
+            free_compiler(compiler);
+            return 1;
+        }
+        printf("Running script...\n");
+        int status = register_vm ? execute_registers(runtime) : execute_bytecode(runtime);
+        if (status != 0) {
+            free_runtime(runtime);
+            free_compiler(compiler);
+            return 1;
+        }
         printf("Execution complete.\n");
         
-        // Print the top of the stack as result if there's anything
-        if (runtime->stack_size > 0) {
-            void* result = runtime->call_stack[runtime->stack_size - 1];
-            printf("Result: %ld\n", (long)result);
+        // Print the top of the stack (or the register VM's result
+        // register) as result if there's anything
+        if (register_vm && compiler->registers.result_register >= 0) {
+            printf("Result: ");
+            print_value(stdout, runtime->registers[compiler->registers.result_register]);
+            printf("\n");
+        } else if (!register_vm && runtime->stack_size > runtime->top_level_locals) {
+            printf("Result: ");
+            print_value(stdout, runtime->stack[runtime->stack_size - 1]);
+            printf("\n");
         }
         
-        // Clean up runtime
-        free(runtime->variables);
-        free(runtime->c_functions);
-        free(runtime->call_stack);
-        free(runtime);
+        free_runtime(runtime);
     }
     
-    // Clean up compiler
-    // In a real implementation, you'd also free all memory used by the AST
-    free(compiler->bytecode);
-    
-    for (size_t i = 0; i < compiler->constant_count; i++) {
-        free(compiler->constants[i]);
-    }
-    free(compiler->constants);
-    
-    for (size_t i = 0; i < compiler->name_count; i++) {
-        free(compiler->names[i]);
-    }
-    free(compiler->names);
-    
-    for (size_t i = 0; i < compiler->c_function_count; i++) {
-        free(compiler->c_functions[i]);
-    }
-    free(compiler->c_functions);
-    
-    free(compiler);
+    // Clean up compiler and the AST arena
+    free_compiler(compiler);
     
     return 0;
-}
\ No newline at end of file
+}
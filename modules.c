@@ -0,0 +1,344 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * Native Module Registry - Importable C functions and lazy binding
+ *
+ * Every native function lives in one hash table keyed by (module, name)
+ * Symbols. The built-in Flipper modules are registered from the table
+ * below; more can be loaded from descriptor files (--module <file>):
+ *
+ *     # comment
+ *     module gui
+ *     canvas_clear      canvas_clear      n(v)
+ *     canvas_draw_str   canvas_draw_str   n(viis)
+ *     my_helper         my_helper         2
+ *
+ * Each function line is `<script name> <C name> <signature>` and belongs to
+ * the last `module` line above it. The signature gives the argument and
+ * return types (see native.c); a plain arity N means N Values in and a
+ * Value out. Loading a function that already exists
+ * replaces it. Descriptors are loaded while the command line is read;
+ * after that the registry is only read, so compiler threads share it.
+ *
+ * `import` statements stay in the AST as markers. After parsing (and
+ * optimization, so calls folded away do not count), link_native_bindings()
+ * finds the calls that name no script function, looks them up in the
+ * imported modules and prepends one NODE_C_BINDING per distinct function
+ * actually called. Importing a module twice, or importing a module with
+ * hundreds of functions, costs nothing for the functions never called.
+ */
+
+#include <pthread.h>
+#include "flipscript.h"
+#include "flipscript_types.h"
+#include "trace.h"
+
+#define REGISTRY_INITIAL_SLOTS 256
+
+typedef struct {
+    const char* module;
+    const char* name;
+    const char* c_name;
+    const char* signature;
+} BuiltinFunction;
+
+// FIX: Added mappings for box, circle, and disc drawing functions.
+static const BuiltinFunction builtin_functions[] = {
+    {"gui", "canvas_clear", "canvas_clear", "n(v)"},
+    {"gui", "canvas_draw_str", "canvas_draw_str", "n(viis)"},
+    {"gui", "canvas_draw_frame", "canvas_draw_frame", "n(viiii)"},
+    {"gui", "canvas_draw_box", "canvas_draw_box", "n(viiii)"},
+    {"gui", "canvas_draw_circle", "canvas_draw_circle", "n(viii)"},
+    {"gui", "canvas_draw_disc", "canvas_draw_disc", "n(viii)"},
+    {"gui", "canvas_flush", "canvas_flush", "n(v)"},
+    {"furi", "delay_ms", "furi_delay_ms", "n(i)"},
+    {"notification", "notification_message", "notification_message", "n(vv)"},
+};
+
+static NativeBinding* bindings = NULL;
+static uint32_t binding_count = 0;
+static uint32_t binding_capacity = 0;
+static uint32_t* binding_slots = NULL;      // Index + 1 into bindings, 0 = empty
+static uint32_t binding_slot_mask = 0;
+static Symbol* modules = NULL;              // Every module that has been declared
+static uint32_t module_count = 0;
+static uint32_t module_capacity = 0;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+
+static uint32_t binding_hash(Symbol module, Symbol name) {
+    uint32_t hash = module * 0x9E3779B1u ^ name * 0x85EBCA77u;
+    return hash ^ (hash >> 15);
+}
+
+static void grow_binding_slots(void) {
+    uint32_t slot_count = binding_slot_mask ? (binding_slot_mask + 1) * 2 : REGISTRY_INITIAL_SLOTS;
+    free(binding_slots);
+    binding_slots = (uint32_t*)calloc(slot_count, sizeof(uint32_t));
+    binding_slot_mask = slot_count - 1;
+    for (uint32_t i = 0; i < binding_count; i++) {
+        uint32_t slot = binding_hash(bindings[i].module, bindings[i].name) & binding_slot_mask;
+        while (binding_slots[slot]) slot = (slot + 1) & binding_slot_mask;
+        binding_slots[slot] = i + 1;
+    }
+}
+
+// Slot holding (module, name), or the empty slot where it would go
+static uint32_t find_binding_slot(Symbol module, Symbol name) {
+    uint32_t slot = binding_hash(module, name) & binding_slot_mask;
+    while (binding_slots[slot]) {
+        const NativeBinding* binding = &bindings[binding_slots[slot] - 1];
+        if (binding->module == module && binding->name == name) break;
+        slot = (slot + 1) & binding_slot_mask;
+    }
+    return slot;
+}
+
+static void declare_module(Symbol module) {
+    for (uint32_t i = 0; i < module_count; i++) {
+        if (modules[i] == module) return;
+    }
+    if (module_count >= module_capacity) {
+        module_capacity = module_capacity ? module_capacity * 2 : 16;
+        modules = (Symbol*)realloc(modules, module_capacity * sizeof(Symbol));
+    }
+    modules[module_count++] = module;
+}
+
+// The signature must be well formed and outlive the registry
+static void add_native_binding(Symbol module, Symbol name, Symbol c_name, const char* signature) {
+    declare_module(module);
+    uint32_t slot = find_binding_slot(module, name);
+    if (binding_slots[slot]) {
+        NativeBinding* existing = &bindings[binding_slots[slot] - 1];
+        existing->c_name = c_name;
+        existing->signature = signature;
+        existing->arity = signature_arity(signature);
+        return;
+    }
+    if (binding_count >= binding_capacity) {
+        binding_capacity = binding_capacity ? binding_capacity * 2 : 64;
+        bindings = (NativeBinding*)realloc(bindings, binding_capacity * sizeof(NativeBinding));
+    }
+    NativeBinding* binding = &bindings[binding_count++];
+    binding->module = module;
+    binding->name = name;
+    binding->c_name = c_name;
+    binding->signature = signature;
+    binding->arity = signature_arity(signature);
+    binding_slots[slot] = binding_count;
+    if (binding_count * 2 > binding_slot_mask + 1) grow_binding_slots();
+}
+
+static void init_registry(void) {
+    grow_binding_slots();
+    for (size_t i = 0; i < sizeof(builtin_functions) / sizeof(builtin_functions[0]); i++) {
+        const BuiltinFunction* function = &builtin_functions[i];
+        add_native_binding(intern_cstring(function->module), intern_cstring(function->name),
+                           intern_cstring(function->c_name), function->signature);
+    }
+}
+
+// Look up a function of a module, or NULL
+const NativeBinding* find_native_binding(Symbol module, Symbol name) {
+    pthread_once(&registry_once, init_registry);
+    uint32_t slot = find_binding_slot(module, name);
+    return binding_slots[slot] ? &bindings[binding_slots[slot] - 1] : NULL;
+}
+
+int is_native_module(Symbol module) {
+    pthread_once(&registry_once, init_registry);
+    for (uint32_t i = 0; i < module_count; i++) {
+        if (modules[i] == module) return 1;
+    }
+    return 0;
+}
+
+// Load a module descriptor file. Returns 0 on success; on a malformed
+// file prints the offending line and returns -1.
+int load_module_descriptor(const char* filename) {
+    pthread_once(&registry_once, init_registry);
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open module descriptor: %s\n", filename);
+        return -1;
+    }
+
+    char line[512];
+    int line_number = 0;
+    Symbol module = NO_SYMBOL;
+    size_t loaded = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char first[128], second[128], third[128];
+        char extra;
+        int fields = sscanf(line, "%127s %127s %127s %c", first, second, third, &extra);
+        if (fields <= 0) continue;
+        if (fields == 2 && strcmp(first, "module") == 0) {
+            module = intern_cstring(second);
+            declare_module(module);
+            continue;
+        }
+        if (fields != 3 || module == NO_SYMBOL) {
+            fprintf(stderr, "%s:%d: error: expected 'module <name>' or '<name> <C name> <signature>'%s\n",
+                    filename, line_number, module == NO_SYMBOL && fields == 3 ? " after a module line" : "");
+            fclose(file);
+            return -1;
+        }
+        // A bare arity stands for the all-Value signature. Signature text
+        // is interned so that it lives as long as the registry.
+        char* end;
+        long arity = strtol(third, &end, 10);
+        const char* signature = *end == '\0' ? generic_signature((int)arity) : symbol_name(intern_cstring(third));
+        if (!signature || !find_trampoline(signature)) {
+            fprintf(stderr, "%s:%d: error: unsupported signature '%s' for %s\n", filename, line_number, third, first);
+            fclose(file);
+            return -1;
+        }
+        add_native_binding(module, intern_cstring(first), intern_cstring(second), signature);
+        loaded++;
+    }
+    fclose(file);
+    TRACE(TRACE_PARSER, 1, "loaded %zu native functions from %s", loaded, filename);
+    return 0;
+}
+
+// --- Linking ---
+
+typedef struct {
+    Ast* ast;
+    Symbol* imports;
+    uint32_t import_count;
+    SymbolIndex resolved;   // Script functions, bindings, and names looked up once
+    uint32_t list_mark;     // Scratch list of the new binding nodes
+} Linker;
+
+// Create the AST node for a native function binding
+static NodeId create_binding_node(Ast* ast, const NativeBinding* binding) {
+    uint32_t mark = ast_list_begin(ast);
+    for (int i = 0; i < binding->arity; i++) {
+        char param_name[16];
+        snprintf(param_name, sizeof(param_name), "p%d", i);
+        NodeId param = create_node(ast, NODE_IDENTIFIER);
+        AST_NODE(ast, param)->data.identifier.name = intern_cstring(param_name);
+        ast_list_push(ast, param);
+    }
+    NodeList parameters = ast_list_end(ast, mark);
+    NodeId id = create_node(ast, NODE_C_BINDING);
+    ASTNode* node = AST_NODE(ast, id);
+    node->data.c_binding.name = binding->name;
+    node->data.c_binding.c_function_name = binding->c_name;
+    node->data.c_binding.parameters = parameters;
+    return id;
+}
+
+// Bind a called name to the first imported module that provides it
+static void bind_call(Linker* linker, Symbol name) {
+    if (symbol_index_get(&linker->resolved, name) >= 0) return;
+    symbol_index_put(&linker->resolved, name, 1);
+    for (uint32_t i = 0; i < linker->import_count; i++) {
+        const NativeBinding* binding = find_native_binding(linker->imports[i], name);
+        if (!binding) continue;
+        TRACE(TRACE_PARSER, 2, "binding %s to %s from module %s", symbol_name(name),
+              symbol_name(binding->c_name), symbol_name(binding->module));
+        ast_list_push(linker->ast, create_binding_node(linker->ast, binding));
+        return;
+    }
+}
+
+static void link_calls(Linker* linker, NodeId id) {
+    if (id == NULL_NODE) return;
+    Ast* ast = linker->ast;
+    const ASTNode* node = AST_NODE(ast, id);
+    switch (node->type) {
+        case NODE_PROGRAM:
+        case NODE_BLOCK: {
+            NodeList statements = node->data.block.statements;
+            for (uint32_t i = 0; i < statements.count; i++) link_calls(linker, AST_LIST_GET(ast, statements, i));
+            break;
+        }
+        case NODE_FUNCTION_CALL: {
+            Symbol name = node->data.function_call.name;
+            NodeList arguments = node->data.function_call.arguments;
+            bind_call(linker, name);
+            for (uint32_t i = 0; i < arguments.count; i++) link_calls(linker, AST_LIST_GET(ast, arguments, i));
+            break;
+        }
+        case NODE_BINARY_OP: {
+            NodeId right = node->data.binary_op.right;
+            link_calls(linker, node->data.binary_op.left);
+            link_calls(linker, right);
+            break;
+        }
+        case NODE_UNARY_OP:
+            link_calls(linker, node->data.unary_op.operand);
+            break;
+        case NODE_ASSIGNMENT:
+            link_calls(linker, node->data.assignment.value);
+            break;
+        case NODE_IF: {
+            NodeList elifs = node->data.if_statement.elif_clauses;
+            NodeId else_block = node->data.if_statement.else_block;
+            link_calls(linker, node->data.if_statement.condition);
+            link_calls(linker, AST_NODE(ast, id)->data.if_statement.if_block);
+            for (uint32_t i = 0; i < elifs.count; i++) link_calls(linker, AST_LIST_GET(ast, elifs, i));
+            link_calls(linker, else_block);
+            break;
+        }
+        case NODE_WHILE: {
+            NodeId block = node->data.while_loop.block;
+            link_calls(linker, node->data.while_loop.condition);
+            link_calls(linker, block);
+            break;
+        }
+        case NODE_FUNCTION_DEF:
+            link_calls(linker, node->data.function_def.body);
+            break;
+        case NODE_CLASS_DEF:
+            link_calls(linker, node->data.class_def.body);
+            break;
+        case NODE_RETURN:
+            link_calls(linker, node->data.return_statement.value);
+            break;
+        default:
+            break;
+    }
+}
+
+// Materialize bindings for the native functions the program calls. The
+// new NODE_C_BINDING statements are placed before the program's own.
+void link_native_bindings(Ast* ast) {
+    if (ast->root == NULL_NODE) return;
+    pthread_once(&registry_once, init_registry);
+
+    Linker linker = {0};
+    linker.ast = ast;
+    NodeList statements = AST_NODE(ast, ast->root)->data.block.statements;
+    linker.imports = (Symbol*)malloc((statements.count ? statements.count : 1) * sizeof(Symbol));
+
+    // Imported modules (each once) and the names the script defines itself
+    for (uint32_t i = 0; i < statements.count; i++) {
+        const ASTNode* stmt = AST_NODE(ast, AST_LIST_GET(ast, statements, i));
+        if (stmt->type == NODE_IMPORT) {
+            Symbol module = stmt->data.import.module_name;
+            int seen = 0;
+            for (uint32_t j = 0; j < linker.import_count; j++) seen |= linker.imports[j] == module;
+            if (!seen && is_native_module(module)) linker.imports[linker.import_count++] = module;
+        } else if (stmt->type == NODE_FUNCTION_DEF) {
+            symbol_index_put(&linker.resolved, stmt->data.function_def.name, 1);
+        } else if (stmt->type == NODE_C_BINDING) {
+            symbol_index_put(&linker.resolved, stmt->data.c_binding.name, 1);
+        }
+    }
+
+    linker.list_mark = ast_list_begin(ast);
+    if (linker.import_count > 0) link_calls(&linker, ast->root);
+    for (uint32_t i = 0; i < statements.count; i++) ast_list_push(ast, AST_LIST_GET(ast, statements, i));
+    AST_NODE(ast, ast->root)->data.block.statements = ast_list_end(ast, linker.list_mark);
+
+    TRACE(TRACE_PARSER, 1, "linked %u native bindings from %u imported modules",
+          AST_NODE(ast, ast->root)->data.block.statements.count - statements.count, linker.import_count);
+    free(linker.imports);
+    free(linker.resolved.slots);
+}
@@ -0,0 +1,296 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * Native Calls - Per-signature trampolines between the VM and C functions
+ *
+ * A native function's signature is written `<return>(<parameters>)` with
+ * one letter per type:
+ *
+ *     v  Value, passed through unchanged
+ *     i  long         (from an int or bool)
+ *     f  double       (from an int or float)
+ *     s  const char*  (from a string)
+ *     n  nothing: the function returns void and the call yields None
+ *        (return type only)
+ *
+ * so canvas_draw_str is "n(viis)". Every supported signature gets a
+ * trampoline, generated by the TRAMPOLINE macros below, that casts the
+ * stored function pointer back to its real type and calls it with the
+ * arguments read straight from the caller's stack slots or registers.
+ * Nothing is copied and the VM does not check arity per call: the runtime
+ * checks it once, when it links the function table.
+ *
+ * To support another signature add it to NATIVE_SIGNATURES.
+ *
+ * The functions a runtime can call are kept in a registry keyed by C
+ * name. It starts with the built-ins below; host code embedding the VM
+ * adds its own with register_host_function() before creating a runtime.
+ * init_runtime() resolves every name in the program's c_functions pool
+ * once, into a dense table the VM indexes directly. Builds with
+ * FLIPSCRIPT_DLSYM also look names the registry lacks up with dlsym();
+ * such a function must take and return Values (the all-Value signature of
+ * the arity the program calls it with).
+ */
+
+#include <pthread.h>
+#ifdef FLIPSCRIPT_DLSYM
+#include <dlfcn.h>
+#endif
+#include "flipscript.h"
+#include "flipscript_types.h"
+
+#define NATIVE_MAX_ARITY 6
+
+#define NATIVE_TYPE_v Value
+#define NATIVE_TYPE_i long
+#define NATIVE_TYPE_f double
+#define NATIVE_TYPE_s const char*
+#define NATIVE_TYPE_n void
+
+#define NATIVE_ARG_v(value) (value)
+#define NATIVE_ARG_i(value) (value_is_int(value) ? value_as_int(value) : (long)((value) == VALUE_TRUE))
+#define NATIVE_ARG_f(value) value_to_float(value)
+#define NATIVE_ARG_s(value) value_as_string(value)
+
+#define NATIVE_RETURN_v(call) return (call)
+#define NATIVE_RETURN_i(call) return value_from_int(call)
+#define NATIVE_RETURN_f(call) return value_from_float(call)
+#define NATIVE_RETURN_s(call) return value_from_string(call)
+#define NATIVE_RETURN_n(call) return ((call), VALUE_NONE)
+
+#define NATIVE_CAST(r, ...) ((NATIVE_TYPE_##r (*)(__VA_ARGS__))function)
+
+#define TRAMPOLINE0(r) \
+    static Value trampoline_##r##_(NativeFunction function, const Value* args) { \
+        (void)args; \
+        NATIVE_RETURN_##r(NATIVE_CAST(r, void)()); \
+    }
+#define TRAMPOLINE1(r, a) \
+    static Value trampoline_##r##_##a(NativeFunction function, const Value* args) { \
+        NATIVE_RETURN_##r(NATIVE_CAST(r, NATIVE_TYPE_##a)(NATIVE_ARG_##a(args[0]))); \
+    }
+#define TRAMPOLINE2(r, a, b) \
+    static Value trampoline_##r##_##a##b(NativeFunction function, const Value* args) { \
+        NATIVE_RETURN_##r(NATIVE_CAST(r, NATIVE_TYPE_##a, NATIVE_TYPE_##b)( \
+            NATIVE_ARG_##a(args[0]), NATIVE_ARG_##b(args[1]))); \
+    }
+#define TRAMPOLINE3(r, a, b, c) \
+    static Value trampoline_##r##_##a##b##c(NativeFunction function, const Value* args) { \
+        NATIVE_RETURN_##r(NATIVE_CAST(r, NATIVE_TYPE_##a, NATIVE_TYPE_##b, NATIVE_TYPE_##c)( \
+            NATIVE_ARG_##a(args[0]), NATIVE_ARG_##b(args[1]), NATIVE_ARG_##c(args[2]))); \
+    }
+#define TRAMPOLINE4(r, a, b, c, d) \
+    static Value trampoline_##r##_##a##b##c##d(NativeFunction function, const Value* args) { \
+        NATIVE_RETURN_##r(NATIVE_CAST(r, NATIVE_TYPE_##a, NATIVE_TYPE_##b, NATIVE_TYPE_##c, NATIVE_TYPE_##d)( \
+            NATIVE_ARG_##a(args[0]), NATIVE_ARG_##b(args[1]), NATIVE_ARG_##c(args[2]), \
+            NATIVE_ARG_##d(args[3]))); \
+    }
+#define TRAMPOLINE5(r, a, b, c, d, e) \
+    static Value trampoline_##r##_##a##b##c##d##e(NativeFunction function, const Value* args) { \
+        NATIVE_RETURN_##r(NATIVE_CAST(r, NATIVE_TYPE_##a, NATIVE_TYPE_##b, NATIVE_TYPE_##c, NATIVE_TYPE_##d, \
+                                      NATIVE_TYPE_##e)( \
+            NATIVE_ARG_##a(args[0]), NATIVE_ARG_##b(args[1]), NATIVE_ARG_##c(args[2]), \
+            NATIVE_ARG_##d(args[3]), NATIVE_ARG_##e(args[4]))); \
+    }
+#define TRAMPOLINE6(r, a, b, c, d, e, f) \
+    static Value trampoline_##r##_##a##b##c##d##e##f(NativeFunction function, const Value* args) { \
+        NATIVE_RETURN_##r(NATIVE_CAST(r, NATIVE_TYPE_##a, NATIVE_TYPE_##b, NATIVE_TYPE_##c, NATIVE_TYPE_##d, \
+                                      NATIVE_TYPE_##e, NATIVE_TYPE_##f)( \
+            NATIVE_ARG_##a(args[0]), NATIVE_ARG_##b(args[1]), NATIVE_ARG_##c(args[2]), \
+            NATIVE_ARG_##d(args[3]), NATIVE_ARG_##e(args[4]), NATIVE_ARG_##f(args[5]))); \
+    }
+
+// The all-Value signatures v() .. v(vvvvvv) back descriptors that give
+// only an arity; the rest are the typed Flipper APIs we bind
+#define NATIVE_SIGNATURES(X0, X1, X2, X3, X4, X5, X6) \
+    X0(v) X0(n) X0(i) \
+    X1(v, v) X1(n, v) X1(n, i) X1(i, v) X1(s, i) \
+    X2(v, v, v) X2(n, v, v) X2(n, v, i) \
+    X3(v, v, v, v) X3(n, v, i, i) \
+    X4(v, v, v, v, v) X4(n, v, i, i, s) X4(n, v, i, i, i) \
+    X5(v, v, v, v, v, v) X5(n, v, i, i, i, i) \
+    X6(v, v, v, v, v, v, v)
+
+NATIVE_SIGNATURES(TRAMPOLINE0, TRAMPOLINE1, TRAMPOLINE2, TRAMPOLINE3, TRAMPOLINE4, TRAMPOLINE5, TRAMPOLINE6)
+
+typedef struct {
+    const char* signature;
+    NativeTrampoline trampoline;
+} TrampolineEntry;
+
+#define ENTRY0(r) {#r "()", trampoline_##r##_},
+#define ENTRY1(r, a) {#r "(" #a ")", trampoline_##r##_##a},
+#define ENTRY2(r, a, b) {#r "(" #a #b ")", trampoline_##r##_##a##b},
+#define ENTRY3(r, a, b, c) {#r "(" #a #b #c ")", trampoline_##r##_##a##b##c},
+#define ENTRY4(r, a, b, c, d) {#r "(" #a #b #c #d ")", trampoline_##r##_##a##b##c##d},
+#define ENTRY5(r, a, b, c, d, e) {#r "(" #a #b #c #d #e ")", trampoline_##r##_##a##b##c##d##e},
+#define ENTRY6(r, a, b, c, d, e, f) {#r "(" #a #b #c #d #e #f ")", trampoline_##r##_##a##b##c##d##e##f},
+
+static const TrampolineEntry trampolines[] = {
+    NATIVE_SIGNATURES(ENTRY0, ENTRY1, ENTRY2, ENTRY3, ENTRY4, ENTRY5, ENTRY6)
+};
+
+static const char* const generic_signatures[NATIVE_MAX_ARITY + 1] = {
+    "v()", "v(v)", "v(vv)", "v(vvv)", "v(vvvv)", "v(vvvvv)", "v(vvvvvv)",
+};
+
+// Trampoline for a signature, or NULL if it is not supported
+NativeTrampoline find_trampoline(const char* signature) {
+    for (size_t i = 0; i < sizeof(trampolines) / sizeof(trampolines[0]); i++) {
+        if (strcmp(trampolines[i].signature, signature) == 0) return trampolines[i].trampoline;
+    }
+    return NULL;
+}
+
+// Signature taking `arity` Values and returning a Value, or NULL
+const char* generic_signature(int arity) {
+    return arity >= 0 && arity <= NATIVE_MAX_ARITY ? generic_signatures[arity] : NULL;
+}
+
+// Number of parameters in a well-formed signature, otherwise -1
+int signature_arity(const char* signature) {
+    if (signature[0] == '\0' || !strchr("vifsn", signature[0]) || signature[1] != '(') return -1;
+    int arity = 0;
+    const char* type = signature + 2;
+    for (; *type && *type != ')'; type++, arity++) {
+        if (!strchr("vifs", *type)) return -1;  // Never 'n'
+    }
+    return type[0] == ')' && type[1] == '\0' ? arity : -1;
+}
+
+// Fill in a host function. Returns -1 if the signature has no trampoline.
+int bind_host_function(HostFunction* host, const char* name, const char* signature, NativeFunction function) {
+    NativeTrampoline trampoline = find_trampoline(signature);
+    if (!trampoline) {
+        fprintf(stderr, "Error: No native trampoline for %s signature '%s'\n", name, signature);
+        return -1;
+    }
+    host->name = name;
+    host->signature = signature;
+    host->function = function;
+    host->trampoline = trampoline;
+    host->arity = signature_arity(signature);
+    host->typed = strspn(signature + 2, "v") != (size_t)host->arity;
+    return 0;
+}
+
+// Check a typed call's arguments before they are converted. Returns 0 if
+// they fit the signature.
+int check_native_arguments(const HostFunction* host, const Value* args) {
+    for (int i = 0; i < host->arity; i++) {
+        char type = host->signature[2 + i];
+        Value arg = args[i];
+        int ok = type == 'v' ||
+                 (type == 'i' && (value_is_int(arg) || value_is_bool(arg))) ||
+                 (type == 'f' && value_is_number(arg)) ||
+                 (type == 's' && value_is_string(arg));
+        if (!ok) {
+            static const char* const type_names[] = {['i'] = "an int", ['f'] = "a number", ['s'] = "a string"};
+            fprintf(stderr, "Error: Argument %d of %s must be %s, got ", i + 1, host->name,
+                    type_names[(unsigned char)type]);
+            print_value(stderr, arg);
+            fputc('\n', stderr);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// --- Host function registry ---
+
+// Faux C binding for a print function for testing.
+static Value c_print(Value value) {
+    print_value(stdout, value);
+    putchar('\n');
+    return VALUE_NONE;
+}
+
+// str(): the text print would show. Results are interned, so they stay
+// valid for the whole process.
+static Value c_int_to_str(Value value) {
+    char text[64];
+    if (value_is_string(value)) return value;
+    if (value_is_int(value)) snprintf(text, sizeof(text), "%ld", value_as_int(value));
+    else if (value_is_float(value)) snprintf(text, sizeof(text), "%g", value_as_float(value));
+    else snprintf(text, sizeof(text), "%s", value == VALUE_TRUE ? "True" : value == VALUE_FALSE ? "False" : "None");
+    return value_from_string(symbol_name(intern_cstring(text)));
+}
+
+typedef struct {
+    const char* name;
+    const char* signature;
+    NativeFunction function;
+} BuiltinHostFunction;
+
+// Names match the c_functions the compiler pre-registers for print and str
+static const BuiltinHostFunction builtin_host_functions[] = {
+    {"print", "v(v)", (NativeFunction)c_print},
+    {"int_to_str", "v(v)", (NativeFunction)c_int_to_str},
+};
+
+static HostFunction* host_functions = NULL;
+static size_t host_function_count = 0;
+static size_t host_function_capacity = 0;
+static pthread_once_t host_registry_once = PTHREAD_ONCE_INIT;
+
+static HostFunction* find_registered(const char* name) {
+    for (size_t i = 0; i < host_function_count; i++) {
+        if (strcmp(host_functions[i].name, name) == 0) return &host_functions[i];
+    }
+    return NULL;
+}
+
+static int add_host_function(const char* name, const char* signature, NativeFunction function) {
+    HostFunction host;
+    if (bind_host_function(&host, name, signature, function) != 0) return -1;
+    HostFunction* existing = find_registered(name);
+    if (existing) {
+        *existing = host;
+        return 0;
+    }
+    if (host_function_count >= host_function_capacity) {
+        host_function_capacity = host_function_capacity ? host_function_capacity * 2 : 16;
+        host_functions = (HostFunction*)realloc(host_functions, host_function_capacity * sizeof(HostFunction));
+    }
+    host_functions[host_function_count++] = host;
+    return 0;
+}
+
+static void init_host_registry(void) {
+    for (size_t i = 0; i < sizeof(builtin_host_functions) / sizeof(builtin_host_functions[0]); i++) {
+        const BuiltinHostFunction* builtin = &builtin_host_functions[i];
+        add_host_function(builtin->name, builtin->signature, builtin->function);
+    }
+}
+
+// Make a C function callable from bytecode under `name`, replacing any
+// function already registered with that name. The name and signature
+// must stay valid while runtimes use them. Not thread-safe: register
+// everything before creating runtimes. Returns -1 if the signature has no
+// trampoline.
+int register_host_function(const char* name, const char* signature, NativeFunction function) {
+    pthread_once(&host_registry_once, init_host_registry);
+    return add_host_function(name, signature, function);
+}
+
+// Resolve a C function name for a call site taking `arity` arguments.
+// Returns 0 and fills in *host, or -1 if nothing provides the name.
+int resolve_host_function(const char* name, int arity, HostFunction* host) {
+    pthread_once(&host_registry_once, init_host_registry);
+    const HostFunction* registered = find_registered(name);
+    if (registered) {
+        *host = *registered;
+        return 0;
+    }
+#ifdef FLIPSCRIPT_DLSYM
+    void* symbol = dlsym(RTLD_DEFAULT, name);
+    const char* signature = generic_signature(arity);
+    if (symbol && signature) {
+        NativeFunction function;
+        memcpy(&function, &symbol, sizeof(function));  // Object to function pointer
+        return bind_host_function(host, name, signature, function);
+    }
+#else
+    (void)arity;
+#endif
+    return -1;
+}
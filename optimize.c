@@ -0,0 +1,522 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * AST Optimizer - Constant folding and algebraic simplification
+ *
+ * Runs between parse_program() and the back ends, so the bytecode compiler
+ * and the C generator both see the simplified tree. At -O1 and above it:
+ *   - folds arithmetic over integer literals (`/` only when the division
+ *     is exact, so C and Python agree), and comparisons to True or False
+ *   - simplifies x+0, 0+x, x-0, x*1, 1*x, and x*0 when x is certainly an
+ *     integer, so that a type error or a None still reaches the VM
+ *   - reassociates chains such as `x + 30 - 5` into `x + 25`
+ *   - replaces an `if` whose condition is constant by the branch taken,
+ *     splicing its statements into the enclosing block
+ *   - propagates names that are assigned exactly once in the program, at
+ *     the top level of the script or of a function, to a constant; uses
+ *     that follow the assignment in the same scope (and, for script-level
+ *     names, in later function bodies) see the literal instead
+ *
+ * Nodes are rewritten in place, so parents keep valid NodeIds. Only
+ * canonical decimal integers are folded: floats, leading zeros and
+ * results outside the VM's 48-bit integer range are left alone.
+ */
+
+#include <limits.h>
+#include "flipscript.h"
+#include "flipscript_types.h"
+#include "trace.h"
+
+typedef struct {
+    Ast* ast;
+    uint32_t* assignment_counts;    // Indexed by Symbol
+    NodeId* constants;              // Literal a propagated name stands for
+    Symbol* local_constants;        // Names to forget when a function ends
+    size_t local_count;
+    size_t local_capacity;
+    size_t symbol_limit;
+    int in_function;
+    size_t folded;
+    size_t simplified;
+    size_t branches_removed;
+    size_t propagated;
+} Optimizer;
+
+static NodeId optimize_expression(Optimizer* optimizer, NodeId id);
+static NodeList optimize_statements(Optimizer* optimizer, NodeList statements, int scope_level);
+
+// --- Helpers ---
+
+// Value of number literal text if it is a canonical decimal integer. The
+// IR optimizer folds with the same rules.
+int integer_literal_value(Symbol text, long* value) {
+    const char* digits = symbol_name(text);
+    if (digits[0] == '-') digits++;
+    if (digits[0] == '\0' || (digits[0] == '0' && digits[1] != '\0')) return 0;
+    for (const char* c = digits; *c; c++) {
+        if (!(char_class[(unsigned char)*c] & CHAR_DIGIT)) return 0;
+    }
+    char* end;
+    *value = strtol(symbol_name(text), &end, 10);
+    return *end == '\0' && (*value != LONG_MAX && *value != LONG_MIN);
+}
+
+// Value of a canonical decimal integer literal node
+static int literal_value(const Ast* ast, NodeId id, long* value) {
+    const ASTNode* node = AST_NODE(ast, id);
+    if (node->type != NODE_LITERAL || node->data.literal.kind != TOKEN_NUMBER) return 0;
+    return integer_literal_value(node->data.literal.value, value);
+}
+
+// Truth value of a constant condition: an integer literal, True or False
+static int constant_condition(const Ast* ast, NodeId id, int* truth) {
+    long value;
+    if (literal_value(ast, id, &value)) {
+        *truth = value != 0;
+        return 1;
+    }
+    const ASTNode* node = AST_NODE(ast, id);
+    if (node->type == NODE_IDENTIFIER && (node->data.identifier.name == SYM_TRUE || node->data.identifier.name == SYM_FALSE)) {
+        *truth = node->data.identifier.name == SYM_TRUE;
+        return 1;
+    }
+    return 0;
+}
+
+// Turn node `id` into an integer literal
+static void make_literal(Ast* ast, NodeId id, long value) {
+    char text[24];
+    snprintf(text, sizeof(text), "%ld", value);
+    ASTNode* node = AST_NODE(ast, id);
+    node->type = NODE_LITERAL;
+    node->data.literal.value = intern_cstring(text);
+    node->data.literal.kind = TOKEN_NUMBER;
+}
+
+// Turn node `id` into True or False
+static void make_boolean(Ast* ast, NodeId id, int truth) {
+    ASTNode* node = AST_NODE(ast, id);
+    node->type = NODE_IDENTIFIER;
+    node->data.identifier.name = truth ? SYM_TRUE : SYM_FALSE;
+}
+
+// Replace node `id` by a copy of node `source`
+static void replace_node(Ast* ast, NodeId id, NodeId source) {
+    *AST_NODE(ast, id) = *AST_NODE(ast, source);
+}
+
+// Could the expression be a string? `+` concatenates strings, so string
+// operands block reassociation. Identifiers are treated as integers by
+// both back ends.
+static int may_be_string(const Ast* ast, NodeId id) {
+    const ASTNode* node = AST_NODE(ast, id);
+    switch (node->type) {
+        case NODE_LITERAL: return node->data.literal.kind == TOKEN_STRING;
+        case NODE_FUNCTION_CALL: return 1;
+        case NODE_BINARY_OP:
+            return node->data.binary_op.operator == TOKEN_PLUS &&
+                   (may_be_string(ast, node->data.binary_op.left) || may_be_string(ast, node->data.binary_op.right));
+        default: return 0;
+    }
+}
+
+// Is the expression certainly an integer: an integer literal, or integer
+// arithmetic on such expressions? Only then can the identities drop an
+// operation without hiding a type error, or a None, from the VM.
+static int is_integer(const Ast* ast, NodeId id) {
+    const ASTNode* node = AST_NODE(ast, id);
+    long value;
+    if (literal_value(ast, id, &value)) return 1;
+    if (node->type != NODE_BINARY_OP) return 0;
+    TokenType op = node->data.binary_op.operator;
+    return (op == TOKEN_PLUS || op == TOKEN_MINUS || op == TOKEN_MULTIPLY) &&
+           is_integer(ast, node->data.binary_op.left) && is_integer(ast, node->data.binary_op.right);
+}
+
+// Evaluate `left op right`; returns 0 when the result cannot be folded
+int fold_operation(TokenType op, long left, long right, long* result) {
+    switch (op) {
+        case TOKEN_PLUS:      return !__builtin_add_overflow(left, right, result);
+        case TOKEN_MINUS:     return !__builtin_sub_overflow(left, right, result);
+        case TOKEN_MULTIPLY:  return !__builtin_mul_overflow(left, right, result);
+        case TOKEN_DIVIDE:
+            if (right == 0 || left % right != 0 || (left == LONG_MIN && right == -1)) return 0;
+            *result = left / right;
+            return 1;
+        case TOKEN_EQUAL:     *result = left == right; return 1;
+        case TOKEN_NOT_EQUAL: *result = left != right; return 1;
+        case TOKEN_GREATER:   *result = left > right; return 1;
+        case TOKEN_LESS:      *result = left < right; return 1;
+        default:              return 0;
+    }
+}
+
+// --- Expressions ---
+
+// Rewrite (x op1 c1) op2 c2 with op1, op2 in {+, -} as x + (±c1 ± c2),
+// and (x * c1) * c2 as x * (c1 * c2). Node `id` is the outer operation.
+static int reassociate(Optimizer* optimizer, NodeId id) {
+    Ast* ast = optimizer->ast;
+    ASTNode* node = AST_NODE(ast, id);
+    TokenType outer = node->data.binary_op.operator;
+    NodeId inner_id = node->data.binary_op.left;
+    long c2;
+    if (!literal_value(ast, node->data.binary_op.right, &c2)) return 0;
+
+    const ASTNode* inner = AST_NODE(ast, inner_id);
+    long c1;
+    if (inner->type != NODE_BINARY_OP || !literal_value(ast, inner->data.binary_op.right, &c1)) return 0;
+    TokenType inner_op = inner->data.binary_op.operator;
+    NodeId x = inner->data.binary_op.left;
+
+    long combined;
+    TokenType op;
+    if ((outer == TOKEN_PLUS || outer == TOKEN_MINUS) && (inner_op == TOKEN_PLUS || inner_op == TOKEN_MINUS)) {
+        if (may_be_string(ast, x)) return 0;
+        long first = inner_op == TOKEN_PLUS ? c1 : -c1;
+        long second = outer == TOKEN_PLUS ? c2 : -c2;
+        if (c1 == LONG_MIN || c2 == LONG_MIN || __builtin_add_overflow(first, second, &combined)) return 0;
+        op = combined < 0 ? TOKEN_MINUS : TOKEN_PLUS;
+        if (combined < 0) combined = -combined;
+    } else if (outer == TOKEN_MULTIPLY && inner_op == TOKEN_MULTIPLY) {
+        if (__builtin_mul_overflow(c1, c2, &combined)) return 0;
+        op = TOKEN_MULTIPLY;
+    } else {
+        return 0;
+    }
+    if (combined < VALUE_INT_MIN || combined > VALUE_INT_MAX) return 0;
+
+    // Reuse the inner node for the combined constant
+    NodeId constant = inner->data.binary_op.right;
+    make_literal(ast, constant, combined);
+    node = AST_NODE(ast, id);
+    node->data.binary_op.left = x;
+    node->data.binary_op.operator = op;
+    node->data.binary_op.right = constant;
+    optimizer->simplified++;
+    return 1;
+}
+
+// Identities with one constant operand, when the other is an integer
+static int simplify_identity(Optimizer* optimizer, NodeId id) {
+    Ast* ast = optimizer->ast;
+    const ASTNode* node = AST_NODE(ast, id);
+    TokenType op = node->data.binary_op.operator;
+    NodeId left = node->data.binary_op.left;
+    NodeId right = node->data.binary_op.right;
+    long value;
+
+    if (literal_value(ast, right, &value) && is_integer(ast, left)) {
+        if ((value == 0 && (op == TOKEN_PLUS || op == TOKEN_MINUS)) || (value == 1 && op == TOKEN_MULTIPLY)) {
+            replace_node(ast, id, left);
+            optimizer->simplified++;
+            return 1;
+        }
+        if (value == 0 && op == TOKEN_MULTIPLY) {
+            make_literal(ast, id, 0);
+            optimizer->simplified++;
+            return 1;
+        }
+    }
+    if (literal_value(ast, left, &value) && is_integer(ast, right)) {
+        if ((value == 0 && op == TOKEN_PLUS) || (value == 1 && op == TOKEN_MULTIPLY)) {
+            replace_node(ast, id, right);
+            optimizer->simplified++;
+            return 1;
+        }
+        if (value == 0 && op == TOKEN_MULTIPLY) {
+            make_literal(ast, id, 0);
+            optimizer->simplified++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static NodeId optimize_expression(Optimizer* optimizer, NodeId id) {
+    if (id == NULL_NODE) return id;
+    Ast* ast = optimizer->ast;
+    ASTNode* node = AST_NODE(ast, id);
+
+    switch (node->type) {
+        case NODE_IDENTIFIER: {
+            Symbol name = node->data.identifier.name;
+            if (name < optimizer->symbol_limit && optimizer->constants[name] != NULL_NODE) {
+                replace_node(ast, id, optimizer->constants[name]);
+                optimizer->propagated++;
+            }
+            break;
+        }
+        case NODE_FUNCTION_CALL: {
+            NodeList arguments = node->data.function_call.arguments;
+            for (uint32_t i = 0; i < arguments.count; i++) {
+                optimize_expression(optimizer, AST_LIST_GET(ast, arguments, i));
+            }
+            break;
+        }
+        case NODE_UNARY_OP:
+            optimize_expression(optimizer, node->data.unary_op.operand);
+            break;
+        case NODE_BINARY_OP: {
+            optimize_expression(optimizer, node->data.binary_op.left);
+            optimize_expression(optimizer, AST_NODE(ast, id)->data.binary_op.right);
+            node = AST_NODE(ast, id);
+
+            long left, right, result;
+            if (literal_value(ast, node->data.binary_op.left, &left) &&
+                literal_value(ast, node->data.binary_op.right, &right) &&
+                fold_operation(node->data.binary_op.operator, left, right, &result)) {
+                TokenType op = node->data.binary_op.operator;
+                if (op == TOKEN_EQUAL || op == TOKEN_NOT_EQUAL || op == TOKEN_GREATER || op == TOKEN_LESS) {
+                    make_boolean(ast, id, (int)result);
+                    optimizer->folded++;
+                    break;
+                }
+                // Larger results are floats in the VM
+                if (result >= VALUE_INT_MIN && result <= VALUE_INT_MAX) {
+                    make_literal(ast, id, result);
+                    optimizer->folded++;
+                    break;
+                }
+            }
+            if (reassociate(optimizer, id)) {
+                // The combined constant may have made an identity
+                if (AST_NODE(ast, id)->type == NODE_BINARY_OP) simplify_identity(optimizer, id);
+                break;
+            }
+            simplify_identity(optimizer, id);
+            break;
+        }
+        default:
+            break;
+    }
+    return id;
+}
+
+// --- Statements ---
+
+static NodeId optimize_block(Optimizer* optimizer, NodeId block) {
+    if (block == NULL_NODE) return block;
+    NodeList statements = optimize_statements(optimizer, AST_NODE(optimizer->ast, block)->data.block.statements, 0);
+    AST_NODE(optimizer->ast, block)->data.block.statements = statements;
+    return block;
+}
+
+// Fold an if/elif/else chain. Returns the node to put in the enclosing
+// block: the if itself, or a NODE_BLOCK whose statements are spliced in.
+static NodeId optimize_if(Optimizer* optimizer, NodeId id) {
+    Ast* ast = optimizer->ast;
+
+    // Conditions and branches as one list: the if itself, then the elifs
+    uint32_t clause_mark = ast_list_begin(ast);
+    ast_list_push(ast, id);
+    NodeList elifs = AST_NODE(ast, id)->data.if_statement.elif_clauses;
+    for (uint32_t i = 0; i < elifs.count; i++) ast_list_push(ast, AST_LIST_GET(ast, elifs, i));
+    NodeList clauses = ast_list_end(ast, clause_mark);
+
+    // Keep the clauses whose condition is not constant. A constant true
+    // one becomes the else branch and ends the chain.
+    NodeId else_block = AST_NODE(ast, id)->data.if_statement.else_block;
+    int else_replaced = 0;
+    uint32_t live_mark = ast_list_begin(ast);
+    for (uint32_t i = 0; i < clauses.count && !else_replaced; i++) {
+        NodeId clause = AST_LIST_GET(ast, clauses, i);
+        optimize_expression(optimizer, AST_NODE(ast, clause)->data.if_statement.condition);
+        NodeId block = AST_NODE(ast, clause)->data.if_statement.if_block;
+
+        int truth;
+        if (constant_condition(ast, AST_NODE(ast, clause)->data.if_statement.condition, &truth)) {
+            optimizer->branches_removed++;
+            if (truth) {
+                else_block = optimize_block(optimizer, block);
+                else_replaced = 1;
+            }
+            continue;
+        }
+        optimize_block(optimizer, block);
+        ast_list_push(ast, clause);
+    }
+    if (!else_replaced) optimize_block(optimizer, else_block);
+    NodeList live = ast_list_end(ast, live_mark);
+
+    if (live.count == 0) {
+        // No condition is left: the statement is the branch taken, if any
+        if (else_block != NULL_NODE) return else_block;
+        return create_node(ast, NODE_BLOCK);
+    }
+
+    NodeId first = AST_LIST_GET(ast, live, 0);
+    ASTNode* result = AST_NODE(ast, first);
+    result->data.if_statement.elif_clauses.start = live.start + 1;
+    result->data.if_statement.elif_clauses.count = live.count - 1;
+    result->data.if_statement.else_block = else_block;
+    return first;
+}
+
+// Record a propagatable constant assignment at the top of a scope
+static void note_assignment(Optimizer* optimizer, NodeId id) {
+    const ASTNode* node = AST_NODE(optimizer->ast, id);
+    Symbol name = node->data.assignment.name;
+    long value;
+    if (name >= optimizer->symbol_limit || optimizer->assignment_counts[name] != 1) return;
+    if (!literal_value(optimizer->ast, node->data.assignment.value, &value)) return;
+    optimizer->constants[name] = node->data.assignment.value;
+    if (optimizer->in_function) {
+        if (optimizer->local_count >= optimizer->local_capacity) {
+            optimizer->local_capacity = optimizer->local_capacity ? optimizer->local_capacity * 2 : 16;
+            optimizer->local_constants = (Symbol*)realloc(optimizer->local_constants, optimizer->local_capacity * sizeof(Symbol));
+        }
+        optimizer->local_constants[optimizer->local_count++] = name;
+    }
+}
+
+static NodeId optimize_statement(Optimizer* optimizer, NodeId id, int scope_level) {
+    Ast* ast = optimizer->ast;
+    ASTNode* node = AST_NODE(ast, id);
+    switch (node->type) {
+        case NODE_ASSIGNMENT:
+            optimize_expression(optimizer, node->data.assignment.value);
+            if (scope_level) note_assignment(optimizer, id);
+            return id;
+        case NODE_IF:
+            return optimize_if(optimizer, id);
+        case NODE_WHILE:
+            optimize_expression(optimizer, node->data.while_loop.condition);
+            optimize_block(optimizer, AST_NODE(ast, id)->data.while_loop.block);
+            return id;
+        case NODE_RETURN:
+            optimize_expression(optimizer, node->data.return_statement.value);
+            return id;
+        case NODE_FUNCTION_DEF: {
+            size_t locals = optimizer->local_count;
+            int in_function = optimizer->in_function;
+            optimizer->in_function = 1;
+            NodeId body = node->data.function_def.body;
+            NodeList statements = optimize_statements(optimizer, AST_NODE(ast, body)->data.block.statements, 1);
+            AST_NODE(ast, body)->data.block.statements = statements;
+            // Function-level constants are not visible outside the function
+            while (optimizer->local_count > locals) {
+                optimizer->constants[optimizer->local_constants[--optimizer->local_count]] = NULL_NODE;
+            }
+            optimizer->in_function = in_function;
+            return id;
+        }
+        case NODE_CLASS_DEF:
+            optimize_block(optimizer, node->data.class_def.body);
+            return id;
+        case NODE_BLOCK:
+            return optimize_block(optimizer, id);
+        default:
+            return optimize_expression(optimizer, id);
+    }
+}
+
+// Optimize a statement list into a new list, splicing in the statements
+// of folded ifs. `scope_level` is set for the top level of the script or
+// of a function, where single assignments may be propagated.
+static NodeList optimize_statements(Optimizer* optimizer, NodeList statements, int scope_level) {
+    Ast* ast = optimizer->ast;
+    uint32_t mark = ast_list_begin(ast);
+    for (uint32_t i = 0; i < statements.count; i++) {
+        NodeId result = optimize_statement(optimizer, AST_LIST_GET(ast, statements, i), scope_level);
+        const ASTNode* node = AST_NODE(ast, result);
+        if (node->type == NODE_BLOCK) {
+            NodeList inner = node->data.block.statements;
+            for (uint32_t j = 0; j < inner.count; j++) ast_list_push(ast, AST_LIST_GET(ast, inner, j));
+        } else {
+            ast_list_push(ast, result);
+        }
+    }
+    return ast_list_end(ast, mark);
+}
+
+// --- Assignment counting ---
+
+static void count_symbol(Optimizer* optimizer, Symbol name, uint32_t weight) {
+    if (name >= optimizer->symbol_limit) return;
+    uint32_t* count = &optimizer->assignment_counts[name];
+    *count = *count > UINT32_MAX - weight ? UINT32_MAX : *count + weight;
+}
+
+// Count assignments to every name. Parameters and class fields are never
+// propagated, so they count as many assignments.
+static void count_assignments(Optimizer* optimizer, NodeId id) {
+    if (id == NULL_NODE) return;
+    Ast* ast = optimizer->ast;
+    const ASTNode* node = AST_NODE(ast, id);
+    switch (node->type) {
+        case NODE_PROGRAM:
+        case NODE_BLOCK:
+            for (uint32_t i = 0; i < node->data.block.statements.count; i++) {
+                count_assignments(optimizer, AST_LIST_GET(ast, node->data.block.statements, i));
+            }
+            break;
+        case NODE_ASSIGNMENT: {
+            // Dotted names are fields of shared state
+            const char* name = symbol_name(node->data.assignment.name);
+            count_symbol(optimizer, node->data.assignment.name, strchr(name, '.') ? 2 : 1);
+            break;
+        }
+        case NODE_IF:
+            count_assignments(optimizer, node->data.if_statement.if_block);
+            for (uint32_t i = 0; i < node->data.if_statement.elif_clauses.count; i++) {
+                count_assignments(optimizer, AST_LIST_GET(ast, node->data.if_statement.elif_clauses, i));
+            }
+            count_assignments(optimizer, node->data.if_statement.else_block);
+            break;
+        case NODE_WHILE:
+            count_assignments(optimizer, node->data.while_loop.block);
+            break;
+        case NODE_FUNCTION_DEF:
+            for (uint32_t i = 0; i < node->data.function_def.parameters.count; i++) {
+                NodeId param = AST_LIST_GET(ast, node->data.function_def.parameters, i);
+                count_symbol(optimizer, AST_NODE(ast, param)->data.identifier.name, 2);
+            }
+            count_assignments(optimizer, node->data.function_def.body);
+            break;
+        case NODE_CLASS_DEF: {
+            NodeList fields = AST_NODE(ast, node->data.class_def.body)->data.block.statements;
+            for (uint32_t i = 0; i < fields.count; i++) {
+                const ASTNode* field = AST_NODE(ast, AST_LIST_GET(ast, fields, i));
+                if (field->type == NODE_ASSIGNMENT) count_symbol(optimizer, field->data.assignment.name, 2);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Largest Symbol used as a name anywhere in the tree, plus one
+static size_t name_symbol_limit(const Ast* ast) {
+    Symbol limit = 0;
+    for (uint32_t id = 1; id < ast->node_count; id++) {
+        const ASTNode* node = AST_NODE(ast, id);
+        Symbol name = NO_SYMBOL;
+        if (node->type == NODE_IDENTIFIER) name = node->data.identifier.name;
+        else if (node->type == NODE_ASSIGNMENT) name = node->data.assignment.name;
+        if (name > limit) limit = name;
+    }
+    return (size_t)limit + 1;
+}
+
+// Optimize the program in place. Level 0 leaves the tree untouched.
+void optimize_ast(Ast* ast, int level) {
+    if (level < 1 || ast->root == NULL_NODE) return;
+
+    Optimizer optimizer = {0};
+    optimizer.ast = ast;
+    optimizer.symbol_limit = name_symbol_limit(ast);
+    optimizer.assignment_counts = (uint32_t*)calloc(optimizer.symbol_limit, sizeof(uint32_t));
+    optimizer.constants = (NodeId*)calloc(optimizer.symbol_limit, sizeof(NodeId));
+
+    count_assignments(&optimizer, ast->root);
+    NodeList statements = optimize_statements(&optimizer, AST_NODE(ast, ast->root)->data.block.statements, 1);
+    AST_NODE(ast, ast->root)->data.block.statements = statements;
+
+    TRACE(TRACE_OPTIMIZER, 1, "folded %zu expressions, simplified %zu, removed %zu branches, propagated %zu constants",
+          optimizer.folded, optimizer.simplified, optimizer.branches_removed, optimizer.propagated);
+
+    free(optimizer.assignment_counts);
+    free(optimizer.constants);
+    free(optimizer.local_constants);
+}
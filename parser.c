@@ -5,290 +5,391 @@
 
 #include "flipscript.h"
 #include "flipscript_types.h"
+#include "trace.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
 
 // Forward declarations for parser functions
-ASTNode* parse_statement(Parser* parser);
-ASTNode* parse_block(Parser* parser);
-ASTNode* parse_expression(Parser* parser);
-ASTNode* create_node(NodeType type);
-ASTNode* parse_class_definition(Parser* parser);
-ASTNode* parse_if_statement(Parser* parser);
-
-// Helper function to create an AST node for a C function binding
-ASTNode* create_automatic_binding(const char* name, const char* c_function_name, int param_count) {
-    ASTNode* node = create_node(NODE_C_BINDING);
-    node->data.c_binding.name = strdup(name);
-    node->data.c_binding.c_function_name = strdup(c_function_name);
-    node->data.c_binding.parameters = (char**)malloc(param_count * sizeof(char*));
-    node->data.c_binding.parameter_count = param_count;
-    for (int i = 0; i < param_count; i++) {
-        char param_name[16];
-        snprintf(param_name, sizeof(param_name), "p%d", i);
-        node->data.c_binding.parameters[i] = strdup(param_name);
-    }
-    return node;
+NodeId parse_statement(Parser* parser);
+NodeId parse_block(Parser* parser);
+NodeId parse_expression(Parser* parser);
+NodeId parse_class_definition(Parser* parser);
+NodeId parse_if_statement(Parser* parser);
+
+// Initialize parser over an already lexed token stream
+Parser* init_parser_with_tokens(Lexer* lexer, TokenStream* tokens) {
+    Parser* parser = (Parser*)malloc(sizeof(Parser));
+    parser->lexer = lexer;
+    parser->tokens = tokens;
+    parser->ast = create_ast();
+    parser->index = 0;
+    parser->current_token = token_stream_get(parser->tokens, 0);
+    parser->error_jmp = NULL;
+    parser->diagnostics = NULL;
+    parser->diagnostic_count = 0;
+    parser->diagnostic_capacity = 0;
+    return parser;
 }
 
-// Define the mappings for native Flipper functions that can be imported
-typedef struct {
-    const char* flipscript_name;
-    const char* c_name;
-    int param_count;
-} NativeFunctionMapping;
-
-// FIX: Added mappings for box, circle, and disc drawing functions.
-static const NativeFunctionMapping gui_mappings[] = {
-    {"canvas_clear", "canvas_clear", 1},
-    {"canvas_draw_str", "canvas_draw_str", 4},
-    {"canvas_draw_frame", "canvas_draw_frame", 5},
-    {"canvas_draw_box", "canvas_draw_box", 5},
-    {"canvas_draw_circle", "canvas_draw_circle", 4},
-    {"canvas_draw_disc", "canvas_draw_disc", 4},
-    {"canvas_flush", "canvas_flush", 1},
-    {NULL, NULL, 0}
-};
-static const NativeFunctionMapping furi_mappings[] = {
-    {"delay_ms", "furi_delay_ms", 1},
-    {NULL, NULL, 0}
-};
-static const NativeFunctionMapping notification_mappings[] = {
-    {"notification_message", "notification_message", 2},
-    {NULL, NULL, 0}
-};
-
+// Release a parser together with its diagnostics and any tree it still owns
+void free_parser(Parser* parser) {
+    if (parser == NULL) return;
+    free_ast(parser->ast);
+    free(parser->diagnostics);
+    free(parser);
+}
 
 // Initialize parser
 Parser* init_parser(Lexer* lexer) {
-    Parser* parser = (Parser*)malloc(sizeof(Parser));
-    parser->lexer = lexer;
-    parser->current_token = get_next_token(lexer);
-    return parser;
+    return init_parser_with_tokens(lexer, tokenize_all(lexer));
+}
+
+static int is_layout_token(TokenType type) {
+    return type == TOKEN_NEWLINE || type == TOKEN_INDENT || type == TOKEN_DEDENT || type == TOKEN_EOF;
+}
+
+// Report a syntax error at the current token. The diagnostic is recorded
+// and control returns to the statement being parsed, which resynchronizes
+// (see parse_statement). Only the first error on a line is kept, since the
+// rest are usually knock-on errors. Without an enclosing statement the
+// message is printed and the compiler exits.
+static void syntax_error(Parser* parser, const char* format, ...) {
+    // Layout tokens sit at the start of the next line; report errors on
+    // them just after the last token of the line being parsed instead.
+    Token token = parser->current_token;
+    if (is_layout_token(token.type) && parser->index > 0) {
+        Token previous = token_stream_get(parser->tokens, parser->index - 1);
+        token.line = previous.line;
+        token.column = previous.column + (int)previous.length;
+    }
+    ParseDiagnostic* last = parser->diagnostic_count ? &parser->diagnostics[parser->diagnostic_count - 1] : NULL;
+    if (last == NULL || last->line != token.line) {
+        if (parser->diagnostic_count >= parser->diagnostic_capacity) {
+            parser->diagnostic_capacity = parser->diagnostic_capacity ? parser->diagnostic_capacity * 2 : 8;
+            parser->diagnostics = (ParseDiagnostic*)realloc(parser->diagnostics,
+                                                            parser->diagnostic_capacity * sizeof(ParseDiagnostic));
+        }
+        ParseDiagnostic* diagnostic = &parser->diagnostics[parser->diagnostic_count++];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(diagnostic->message, sizeof(diagnostic->message), format, args);
+        va_end(args);
+        diagnostic->line = token.line;
+        diagnostic->column = token.column;
+        TRACE(TRACE_PARSER, 1, "syntax error on line %d, column %d: %s", token.line, token.column, diagnostic->message);
+    }
+
+    if (parser->error_jmp) longjmp(*parser->error_jmp, 1);
+    fprintf(stderr, "Syntax error: %s on line %d\n", parser->diagnostics[parser->diagnostic_count - 1].message, token.line);
+    exit(1);
+}
+
+// Print every collected syntax error. Returns the number of errors.
+size_t report_syntax_errors(const Parser* parser, const char* filename, FILE* out) {
+    for (size_t i = 0; i < parser->diagnostic_count; i++) {
+        const ParseDiagnostic* diagnostic = &parser->diagnostics[i];
+        fprintf(out, "%s:%d:%d: syntax error: %s\n", filename, diagnostic->line, diagnostic->column, diagnostic->message);
+    }
+    if (parser->diagnostic_count > 1) fprintf(out, "%zu syntax errors\n", parser->diagnostic_count);
+    return parser->diagnostic_count;
 }
 
 void advance(Parser* parser) {
-    if(parser->current_token.value) free(parser->current_token.value);
-    parser->current_token = get_next_token(parser->lexer);
+    if (parser->index + 1 < parser->tokens->count) parser->index++;
+    parser->current_token = token_stream_get(parser->tokens, parser->index);
 }
 
-ASTNode* create_node(NodeType type) {
-    ASTNode* node = (ASTNode*)calloc(1, sizeof(ASTNode));
-    node->type = type;
-    return node;
+// Look at the token `offset` positions after the current one
+Token peek_token(Parser* parser, size_t offset) {
+    return token_stream_get(parser->tokens, parser->index + offset);
+}
+
+// Symbol for a token's text. Only identifiers, numbers and strings are
+// interned by the lexer; anything else is interned here.
+static Symbol token_name(Parser* parser, Token token) {
+    if (token.symbol != NO_SYMBOL) return token.symbol;
+    return intern_string(token_start(parser->lexer, token), token.length);
+}
+
+// Build a binary operation node
+static NodeId create_binary_op(Ast* ast, NodeId left, TokenType op, NodeId right) {
+    NodeId id = create_node(ast, NODE_BINARY_OP);
+    ASTNode* node = AST_NODE(ast, id);
+    node->data.binary_op.left = left;
+    node->data.binary_op.operator = op;
+    node->data.binary_op.right = right;
+    return id;
 }
 
 // Expression Parsing Logic
-ASTNode* parse_factor(Parser* parser) {
+NodeId parse_factor(Parser* parser) {
+    Ast* ast = parser->ast;
     Token token = parser->current_token;
     switch (token.type) {
         case TOKEN_NUMBER:
         case TOKEN_STRING: {
-            ASTNode* node = create_node(NODE_LITERAL);
-            node->data.literal.value = strdup(token.value);
+            NodeId node = create_node(ast, NODE_LITERAL);
+            AST_NODE(ast, node)->data.literal.value = token_name(parser, token);
+            AST_NODE(ast, node)->data.literal.kind = token.type;
             advance(parser);
             return node;
         }
         case TOKEN_IDENTIFIER: {
-            char* name = strdup(token.value);
+            Token name_token = token;
             advance(parser);
             if (parser->current_token.type == TOKEN_LPAREN) {
                 advance(parser);
-                ASTNode* node = create_node(NODE_FUNCTION_CALL);
-                node->data.function_call.name = name;
-                node->data.function_call.arguments = (ASTNode**)malloc(10 * sizeof(ASTNode*));
-                node->data.function_call.argument_count = 0;
+                uint32_t mark = ast_list_begin(ast);
                 if (parser->current_token.type != TOKEN_RPAREN) {
                     do {
                         if(parser->current_token.type == TOKEN_COMMA) advance(parser);
-                        node->data.function_call.arguments[node->data.function_call.argument_count++] = parse_expression(parser);
+                        ast_list_push(ast, parse_expression(parser));
                     } while (parser->current_token.type == TOKEN_COMMA);
                 }
-                if (parser->current_token.type != TOKEN_RPAREN) {
-                    fprintf(stderr, "Syntax error: expected ')' on line %d\n", parser->current_token.line);
-                    exit(1);
-                }
+                if (parser->current_token.type != TOKEN_RPAREN) syntax_error(parser, "expected ')'");
                 advance(parser);
+                NodeList arguments = ast_list_end(ast, mark);
+                NodeId node = create_node(ast, NODE_FUNCTION_CALL);
+                AST_NODE(ast, node)->data.function_call.name = token_name(parser, name_token);
+                AST_NODE(ast, node)->data.function_call.arguments = arguments;
                 return node;
             } else if (parser->current_token.type == TOKEN_DOT) {
                 advance(parser);
-                 if(parser->current_token.type != TOKEN_IDENTIFIER) {
-                    fprintf(stderr, "Syntax error: expected field name after '.' on line %d\n", parser->current_token.line);
-                    exit(1);
-                }
-                char* field_name = parser->current_token.value;
-                char* combined_name = malloc(strlen(name) + strlen(field_name) + 2);
-                sprintf(combined_name, "%s.%s", name, field_name);
+                if (parser->current_token.type != TOKEN_IDENTIFIER) syntax_error(parser, "expected field name after '.'");
+                Token field_token = parser->current_token;
+                char* name = malloc(name_token.length + field_token.length + 2);
+                sprintf(name, "%.*s.%.*s",
+                        (int)name_token.length, token_start(parser->lexer, name_token),
+                        (int)field_token.length, token_start(parser->lexer, field_token));
+                NodeId node = create_node(ast, NODE_IDENTIFIER);
+                AST_NODE(ast, node)->data.identifier.name = intern_cstring(name);
                 free(name);
-                name = combined_name;
                 advance(parser);
+                return node;
             }
-            ASTNode* node = create_node(NODE_IDENTIFIER);
-            node->data.identifier.name = name;
+            NodeId node = create_node(ast, NODE_IDENTIFIER);
+            AST_NODE(ast, node)->data.identifier.name = token_name(parser, name_token);
             return node;
         }
         case TOKEN_LPAREN: {
             advance(parser);
-            ASTNode* node = parse_expression(parser);
-            if (parser->current_token.type != TOKEN_RPAREN) {
-                fprintf(stderr, "Syntax error: expected ')' on line %d\n", parser->current_token.line);
-                exit(1);
-            }
+            NodeId node = parse_expression(parser);
+            if (parser->current_token.type != TOKEN_RPAREN) syntax_error(parser, "expected ')'");
             advance(parser);
             return node;
         }
         default:
-            fprintf(stderr, "Syntax error: unexpected token '%s' on line %d\n", token.value ? token.value : "NULL", token.line);
-            exit(1);
+            if (token.type == TOKEN_EOF) syntax_error(parser, "unexpected end of file");
+            if (is_layout_token(token.type)) syntax_error(parser, "unexpected end of line");
+            syntax_error(parser, "unexpected token '%.*s'", (int)token.length, token_start(parser->lexer, token));
+            return NULL_NODE;
     }
 }
 
-ASTNode* parse_term(Parser* parser) {
-    ASTNode* node = parse_factor(parser);
+NodeId parse_term(Parser* parser) {
+    NodeId node = parse_factor(parser);
     while (parser->current_token.type == TOKEN_MULTIPLY || parser->current_token.type == TOKEN_DIVIDE) {
         TokenType op = parser->current_token.type;
         advance(parser);
-        ASTNode* right = parse_factor(parser);
-        ASTNode* new_node = create_node(NODE_BINARY_OP);
-        new_node->data.binary_op.left = node;
-        new_node->data.binary_op.operator = op;
-        new_node->data.binary_op.right = right;
-        node = new_node;
+        NodeId right = parse_factor(parser);
+        node = create_binary_op(parser->ast, node, op, right);
     }
     return node;
 }
 
-ASTNode* parse_expression(Parser* parser) {
-    ASTNode* node = parse_term(parser);
+NodeId parse_expression(Parser* parser) {
+    NodeId node = parse_term(parser);
     while (parser->current_token.type == TOKEN_PLUS || parser->current_token.type == TOKEN_MINUS || 
            parser->current_token.type == TOKEN_EQUAL || parser->current_token.type == TOKEN_NOT_EQUAL ||
            parser->current_token.type == TOKEN_GREATER || parser->current_token.type == TOKEN_LESS) {
         TokenType op = parser->current_token.type;
         advance(parser);
-        ASTNode* right = parse_term(parser);
-        ASTNode* new_node = create_node(NODE_BINARY_OP);
-        new_node->data.binary_op.left = node;
-        new_node->data.binary_op.operator = op;
-        new_node->data.binary_op.right = right;
-        node = new_node;
+        NodeId right = parse_term(parser);
+        node = create_binary_op(parser->ast, node, op, right);
     }
     return node;
 }
 
 
 // Statement-specific parsing functions
-ASTNode* parse_def_statement(Parser* parser) {
+NodeId parse_def_statement(Parser* parser) {
+    Ast* ast = parser->ast;
     advance(parser); // Consume 'def'
-    if (parser->current_token.type != TOKEN_IDENTIFIER) { /* error */ exit(1); }
-    ASTNode* node = create_node(NODE_FUNCTION_DEF);
-    node->data.function_def.name = strdup(parser->current_token.value);
+    if (parser->current_token.type != TOKEN_IDENTIFIER) syntax_error(parser, "expected function name after 'def'");
+    Symbol name = token_name(parser, parser->current_token);
     advance(parser);
-    if (parser->current_token.type != TOKEN_LPAREN) { /* ... error ... */ exit(1); }
+    if (parser->current_token.type != TOKEN_LPAREN) syntax_error(parser, "expected '(' after function name");
     advance(parser);
-    node->data.function_def.parameters = (char**)malloc(10 * sizeof(char*));
-    node->data.function_def.parameter_count = 0;
+    uint32_t mark = ast_list_begin(ast);
     if (parser->current_token.type != TOKEN_RPAREN) {
         do {
             if(parser->current_token.type == TOKEN_COMMA) advance(parser);
-            node->data.function_def.parameters[node->data.function_def.parameter_count++] = strdup(parser->current_token.value);
+            if (parser->current_token.type != TOKEN_IDENTIFIER) syntax_error(parser, "expected parameter name");
+            NodeId param = create_node(ast, NODE_IDENTIFIER);
+            AST_NODE(ast, param)->data.identifier.name = token_name(parser, parser->current_token);
+            ast_list_push(ast, param);
             advance(parser);
         } while(parser->current_token.type == TOKEN_COMMA);
     }
-    if (parser->current_token.type != TOKEN_RPAREN) { /* ... error ... */ exit(1); }
+    if (parser->current_token.type != TOKEN_RPAREN) syntax_error(parser, "expected ')' after parameters");
     advance(parser);
-    if (parser->current_token.type != TOKEN_COLON) { /* ... error ... */ exit(1); }
+    if (parser->current_token.type != TOKEN_COLON) syntax_error(parser, "expected ':' after function signature");
     advance(parser);
-    node->data.function_def.body = parse_block(parser);
+    NodeList parameters = ast_list_end(ast, mark);
+    NodeId body = parse_block(parser);
+    NodeId node = create_node(ast, NODE_FUNCTION_DEF);
+    AST_NODE(ast, node)->data.function_def.name = name;
+    AST_NODE(ast, node)->data.function_def.parameters = parameters;
+    AST_NODE(ast, node)->data.function_def.body = body;
     return node;
 }
 
-ASTNode* parse_class_definition(Parser* parser) {
+NodeId parse_class_definition(Parser* parser) {
+    Ast* ast = parser->ast;
     advance(parser); // Consume 'class' token
-    if (parser->current_token.type != TOKEN_IDENTIFIER) { /* error */ exit(1); }
-    ASTNode* node = create_node(NODE_CLASS_DEF);
-    node->data.class_def.name = strdup(parser->current_token.value);
+    if (parser->current_token.type != TOKEN_IDENTIFIER) syntax_error(parser, "expected class name after 'class'");
+    Symbol name = token_name(parser, parser->current_token);
     advance(parser);
-    if (parser->current_token.type != TOKEN_COLON) { /* error */ exit(1); }
+    if (parser->current_token.type != TOKEN_COLON) syntax_error(parser, "expected ':' after class name");
     advance(parser);
-    node->data.class_def.body = parse_block(parser);
+    NodeId body = parse_block(parser);
+    NodeId node = create_node(ast, NODE_CLASS_DEF);
+    AST_NODE(ast, node)->data.class_def.name = name;
+    AST_NODE(ast, node)->data.class_def.body = body;
     return node;
 }
 
-ASTNode* parse_if_statement(Parser* parser) {
+NodeId parse_if_statement(Parser* parser) {
+    Ast* ast = parser->ast;
     advance(parser); // Consume 'if'
-    ASTNode* node = create_node(NODE_IF);
-    node->data.if_statement.condition = parse_expression(parser);
-    if (parser->current_token.type != TOKEN_COLON) { /* error */ exit(1); }
+    NodeId condition = parse_expression(parser);
+    if (parser->current_token.type != TOKEN_COLON) syntax_error(parser, "expected ':' after if condition");
     advance(parser);
-    node->data.if_statement.if_block = parse_block(parser);
-
-    node->data.if_statement.elif_clauses = NULL;
-    node->data.if_statement.elif_count = 0;
-    node->data.if_statement.else_block = NULL;
+    NodeId if_block = parse_block(parser);
 
+    uint32_t mark = ast_list_begin(ast);
     while (parser->current_token.type == TOKEN_ELIF) {
         advance(parser); 
-        node->data.if_statement.elif_count++;
-        node->data.if_statement.elif_clauses = realloc(
-            node->data.if_statement.elif_clauses,
-            node->data.if_statement.elif_count * sizeof(*(node->data.if_statement.elif_clauses))
-        );
-        size_t current_elif_index = node->data.if_statement.elif_count - 1;
-        node->data.if_statement.elif_clauses[current_elif_index].condition = parse_expression(parser);
-        if (parser->current_token.type != TOKEN_COLON) { /* error */ exit(1); }
+        NodeId elif_condition = parse_expression(parser);
+        if (parser->current_token.type != TOKEN_COLON) syntax_error(parser, "expected ':' after elif condition");
         advance(parser);
-        node->data.if_statement.elif_clauses[current_elif_index].block = parse_block(parser);
+        NodeId elif_block = parse_block(parser);
+        NodeId clause = create_node(ast, NODE_IF);
+        AST_NODE(ast, clause)->data.if_statement.condition = elif_condition;
+        AST_NODE(ast, clause)->data.if_statement.if_block = elif_block;
+        ast_list_push(ast, clause);
     }
+    NodeList elif_clauses = ast_list_end(ast, mark);
 
+    NodeId else_block = NULL_NODE;
     if (parser->current_token.type == TOKEN_ELSE) {
         advance(parser);
-        if (parser->current_token.type != TOKEN_COLON) { /* error */ exit(1); }
+        if (parser->current_token.type != TOKEN_COLON) syntax_error(parser, "expected ':' after 'else'");
         advance(parser);
-        node->data.if_statement.else_block = parse_block(parser);
+        else_block = parse_block(parser);
     }
 
+    NodeId node = create_node(ast, NODE_IF);
+    ASTNode* if_node = AST_NODE(ast, node);
+    if_node->data.if_statement.condition = condition;
+    if_node->data.if_statement.if_block = if_block;
+    if_node->data.if_statement.elif_clauses = elif_clauses;
+    if_node->data.if_statement.else_block = else_block;
     return node;
 }
 
-ASTNode* parse_return_statement(Parser* parser) {
+NodeId parse_return_statement(Parser* parser) {
     advance(parser); // Consume 'return'
-    ASTNode* node = create_node(NODE_RETURN);
+    NodeId value = NULL_NODE;
     if(parser->current_token.type != TOKEN_NEWLINE && parser->current_token.type != TOKEN_EOF) {
-        node->data.return_statement.value = parse_expression(parser);
-    } else {
-        node->data.return_statement.value = NULL;
+        value = parse_expression(parser);
     }
+    NodeId node = create_node(parser->ast, NODE_RETURN);
+    AST_NODE(parser->ast, node)->data.return_statement.value = value;
     return node;
 }
 
-ASTNode* parse_expression_statement(Parser* parser) {
-    ASTNode* expr = parse_expression(parser);
-    if (expr->type == NODE_IDENTIFIER && parser->current_token.type == TOKEN_ASSIGN) {
+NodeId parse_expression_statement(Parser* parser) {
+    Ast* ast = parser->ast;
+    NodeId expr = parse_expression(parser);
+    if (AST_NODE(ast, expr)->type == NODE_IDENTIFIER && parser->current_token.type == TOKEN_ASSIGN) {
         advance(parser); // consume '='
-        ASTNode* value = parse_expression(parser);
-        ASTNode* assignment_node = create_node(NODE_ASSIGNMENT);
-        assignment_node->data.assignment.name = expr->data.identifier.name;
+        NodeId value = parse_expression(parser);
+        // Turn the target identifier into the assignment in place
+        ASTNode* assignment_node = AST_NODE(ast, expr);
+        Symbol name = assignment_node->data.identifier.name;
+        assignment_node->type = NODE_ASSIGNMENT;
+        assignment_node->data.assignment.name = name;
         assignment_node->data.assignment.value = value;
-        free(expr);
-        return assignment_node;
     }
     return expr;
 }
 
-ASTNode* parse_statement(Parser* parser) {
+// Can this token begin a statement? Recovery resumes at these.
+static int starts_statement(TokenType type) {
+    switch (type) {
+        case TOKEN_DEF: case TOKEN_CLASS: case TOKEN_IF: case TOKEN_WHILE:
+        case TOKEN_FOR: case TOKEN_RETURN: case TOKEN_IMPORT: case TOKEN_CFUNC:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Panic mode: skip the rest of a broken statement. Stops after the end of
+// the line, or before a DEDENT, EOF or statement keyword. If the broken
+// line opened a block, the block is parsed (so its own errors are still
+// found) and dropped.
+static void synchronize(Parser* parser, size_t statement_start) {
+    // Always make progress, even when the statement broke on its first token
+    if (parser->index == statement_start && parser->current_token.type != TOKEN_EOF &&
+        parser->current_token.type != TOKEN_INDENT) {
+        advance(parser);
+    }
+    for (;;) {
+        TokenType type = parser->current_token.type;
+        if (type == TOKEN_INDENT) {
+            parse_block(parser);
+            return;
+        }
+        if (type == TOKEN_EOF || type == TOKEN_DEDENT || starts_statement(type)) return;
+        advance(parser);
+        if (type == TOKEN_NEWLINE) return;
+    }
+}
+
+NodeId parse_statement(Parser* parser) {
     while (parser->current_token.type == TOKEN_NEWLINE) advance(parser);
-    if (parser->current_token.type == TOKEN_EOF) return NULL;
+    if (parser->current_token.type == TOKEN_EOF) return NULL_NODE;
+
+    // Errors anywhere inside this statement come back here
+    jmp_buf recover;
+    jmp_buf* outer = parser->error_jmp;
+    uint32_t scratch_mark = parser->ast->scratch_count;
+    size_t statement_start = parser->index;
+    parser->error_jmp = &recover;
+    if (setjmp(recover) != 0) {
+        // Drop the half-built child lists; their nodes stay unreferenced
+        // in the arena.
+        parser->error_jmp = outer;
+        parser->ast->scratch_count = scratch_mark;
+        synchronize(parser, statement_start);
+        return NULL_NODE;
+    }
 
-    ASTNode* statement_node = NULL;
+    NodeId statement_node = NULL_NODE;
     switch (parser->current_token.type) {
         case TOKEN_DEF:     statement_node = parse_def_statement(parser); break;
         case TOKEN_RETURN:  statement_node = parse_return_statement(parser); break;
         case TOKEN_CLASS:   statement_node = parse_class_definition(parser); break;
         case TOKEN_IF:      statement_node = parse_if_statement(parser); break;
+        case TOKEN_INDENT:  syntax_error(parser, "unexpected indent"); break;
         case TOKEN_IMPORT:
             advance(parser);
-            statement_node = create_node(NODE_IMPORT);
-            statement_node->data.import.module_name = strdup(parser->current_token.value);
+            if (parser->current_token.type != TOKEN_IDENTIFIER) syntax_error(parser, "expected module name after 'import'");
+            statement_node = create_node(parser->ast, NODE_IMPORT);
+            AST_NODE(parser->ast, statement_node)->data.import.module_name = token_name(parser, parser->current_token);
             advance(parser);
             break;
         default:
@@ -296,102 +397,47 @@ ASTNode* parse_statement(Parser* parser) {
             break;
     }
 
+    parser->error_jmp = outer;
     if (parser->current_token.type == TOKEN_NEWLINE) advance(parser);
     return statement_node;
 }
 
-ASTNode* parse_block(Parser* parser) {
-    ASTNode* node = create_node(NODE_BLOCK);
-    node->data.block.statements = (ASTNode**)malloc(100 * sizeof(ASTNode*));
-    node->data.block.statement_count = 0;
-    size_t capacity = 100;
+NodeId parse_block(Parser* parser) {
+    Ast* ast = parser->ast;
     if (parser->current_token.type == TOKEN_NEWLINE) advance(parser);
-    if (parser->current_token.type != TOKEN_INDENT) { /* ... error ... */ exit(1); }
+    if (parser->current_token.type != TOKEN_INDENT) syntax_error(parser, "expected an indented block");
     advance(parser);
+    uint32_t mark = ast_list_begin(ast);
     while (parser->current_token.type != TOKEN_DEDENT && parser->current_token.type != TOKEN_EOF) {
-        if(node->data.block.statement_count >= capacity) {
-            capacity *= 2;
-            node->data.block.statements = (ASTNode**)realloc(node->data.block.statements, capacity * sizeof(ASTNode*));
-        }
-        node->data.block.statements[node->data.block.statement_count++] = parse_statement(parser);
+        NodeId statement = parse_statement(parser);
+        if (statement != NULL_NODE) ast_list_push(ast, statement);
     }
     if (parser->current_token.type == TOKEN_DEDENT) advance(parser);
+    NodeList statements = ast_list_end(ast, mark);
+    NodeId node = create_node(ast, NODE_BLOCK);
+    AST_NODE(ast, node)->data.block.statements = statements;
     return node;
 }
 
-ASTNode* parse_program(Parser* parser) {
-    ASTNode* program_node = create_node(NODE_PROGRAM);
-    size_t capacity = 100;
-    program_node->data.block.statements = (ASTNode**)malloc(capacity * sizeof(ASTNode*));
-    program_node->data.block.statement_count = 0;
+// Parse a whole program, recovering from syntax errors so that all of them
+// are collected (see report_syntax_errors). The returned tree is owned by
+// the caller and released with free_ast().
+Ast* parse_program(Parser* parser) {
+    Ast* ast = parser->ast;
 
-    // Create a temporary list to hold user statements
-    ASTNode** user_statements = (ASTNode**)malloc(capacity * sizeof(ASTNode*));
-    size_t user_statement_count = 0;
-    size_t user_capacity = capacity;
-
-    // Pass 1: Parse all statements from the source file
+    // Imports stay in the tree; link_native_bindings() resolves them later
+    uint32_t mark = ast_list_begin(ast);
     while (parser->current_token.type != TOKEN_EOF) {
-        if(user_statement_count >= user_capacity) {
-            user_capacity *= 2;
-            user_statements = (ASTNode**)realloc(user_statements, user_capacity * sizeof(ASTNode*));
-        }
-        ASTNode* stmt = parse_statement(parser);
-        if(stmt) {
-            user_statements[user_statement_count++] = stmt;
-        }
+        NodeId stmt = parse_statement(parser);
+        if (stmt != NULL_NODE) ast_list_push(ast, stmt);
     }
 
-    // Pass 2: Add C function bindings to the final AST first
-    for (size_t i = 0; i < user_statement_count; i++) {
-        ASTNode* stmt = user_statements[i];
-        if (stmt && stmt->type == NODE_IMPORT) {
-            const char* module_name = stmt->data.import.module_name;
-            const NativeFunctionMapping* mappings = NULL;
-            int mapping_count = 0;
-
-            if (strcmp(module_name, "gui") == 0) {
-                mappings = gui_mappings;
-                while(mappings[mapping_count].flipscript_name) mapping_count++;
-            } else if (strcmp(module_name, "furi") == 0) {
-                mappings = furi_mappings;
-                while(mappings[mapping_count].flipscript_name) mapping_count++;
-            } else if (strcmp(module_name, "notification") == 0) {
-                 mappings = notification_mappings;
-                 while(mappings[mapping_count].flipscript_name) mapping_count++;
-            }
-
-
-            if (mappings) {
-                 for(int j=0; j < mapping_count; j++) {
-                     if(program_node->data.block.statement_count >= capacity) {
-                        capacity *= 2;
-                        program_node->data.block.statements = (ASTNode**)realloc(program_node->data.block.statements, capacity * sizeof(ASTNode*));
-                     }
-                     program_node->data.block.statements[program_node->data.block.statement_count++] = 
-                        create_automatic_binding(mappings[j].flipscript_name, mappings[j].c_name, mappings[j].param_count);
-                }
-            }
-        }
-    }
-    
-    // Pass 3: Add all user statements (except imports) to the final AST
-    for (size_t i = 0; i < user_statement_count; i++) {
-        ASTNode* stmt = user_statements[i];
-        if (stmt && stmt->type != NODE_IMPORT) {
-             if(program_node->data.block.statement_count >= capacity) {
-                capacity *= 2;
-                program_node->data.block.statements = (ASTNode**)realloc(program_node->data.block.statements, capacity * sizeof(ASTNode*));
-             }
-             program_node->data.block.statements[program_node->data.block.statement_count++] = stmt;
-        } else if (stmt) {
-            // Free the import node, it's no longer needed
-            free(stmt->data.import.module_name);
-            free(stmt);
-        }
-    }
-    
-    free(user_statements);
-    fprintf(stderr, "DEBUG: Parsing complete. Final AST has %zu statements.\n", program_node->data.block.statement_count);
-    return program_node;
+    NodeList statements = ast_list_end(ast, mark);
+    ast->root = create_node(ast, NODE_PROGRAM);
+    AST_NODE(ast, ast->root)->data.block.statements = statements;
+    // The tree now belongs to the caller
+    parser->ast = NULL;
+    TRACE(TRACE_PARSER, 1, "parsing complete, final AST has %u statements (%u nodes), %zu syntax errors",
+          statements.count, ast->node_count - 1, parser->diagnostic_count);
+    return ast;
 }
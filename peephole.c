@@ -0,0 +1,268 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * Peephole Optimizer - Local cleanups of the emitted stack bytecode
+ *
+ * Runs over Compiler.bytecode after compile_ir() at -O1 and above. Each
+ * round it:
+ *   - threads jumps whose target is another OP_JUMP to the final target
+ *   - deletes instructions no path from the entry points reaches (code
+ *     after OP_RETURN_VALUE, OP_HALT or OP_JUMP that nothing jumps to)
+ *   - deletes OP_JUMPs to the instruction that follows anyway
+ *   - fuses common sequences into superinstructions:
+ *       LOAD_NAME x; LOAD_CONST k; BINARY_ADD; STORE_NAME x -> INC_NAME
+ *       LOAD_NAME; LOAD_CONST          -> LOAD_NAME_LOAD_CONST
+ *       COMPARE_EQ/LT; JUMP_IF_FALSE   -> COMPARE_EQ/LT_JUMP_IF_FALSE
+ *       LOAD_NAME; RETURN_VALUE        -> LOAD_NAME_RETURN
+ *     These were the most frequent opcode pairs in our apps' input
+ *     handlers and counters (see --trace=vm)
+ *   - turns STORE_NAME x; LOAD_NAME x into DUP; STORE_NAME x, and the
+ *     same for locals
+ * and then compacts the code, relocating jump targets and function entry
+ * addresses. Rounds repeat until nothing more is removed, since each
+ * deletion can expose another dead jump.
+ *
+ * Entry points are address 0 and every script function's address.
+ */
+
+#include "flipscript.h"
+#include "flipscript_types.h"
+#include "trace.h"
+
+typedef struct {
+    Compiler* compiler;
+    uint8_t* keep;              // Instruction survives this round
+    uint8_t* target;            // Instruction is a jump target or entry point
+    size_t* relocation;         // Old address -> new address
+    size_t threaded;
+    size_t unreachable;
+    size_t dead_jumps;
+    size_t dups;
+    size_t fused;
+} Peephole;
+
+static int is_jump(OpCode opcode) {
+    return opcode == OP_JUMP || opcode == OP_JUMP_IF_FALSE ||
+           opcode == OP_COMPARE_EQ_JUMP_IF_FALSE || opcode == OP_COMPARE_LT_JUMP_IF_FALSE;
+}
+
+// Control does not continue past these
+static int is_return(OpCode opcode) {
+    return opcode == OP_RETURN_VALUE || opcode == OP_LOAD_NAME_RETURN || opcode == OP_HALT;
+}
+
+// Point jumps at the end of any chain of unconditional jumps
+static void thread_jumps(Peephole* peephole) {
+    Instruction* code = peephole->compiler->bytecode;
+    size_t size = peephole->compiler->bytecode_size;
+    for (size_t i = 0; i < size; i++) {
+        if (!is_jump(code[i].opcode)) continue;
+        size_t destination = (size_t)code[i].operand;
+        // Bounded so that a jump cycle cannot hang the compiler
+        for (size_t hops = 0; hops < size && destination < size && code[destination].opcode == OP_JUMP; hops++) {
+            if ((size_t)code[destination].operand == destination) break;
+            destination = (size_t)code[destination].operand;
+        }
+        if (destination != (size_t)code[i].operand) {
+            code[i].operand = (int)destination;
+            peephole->threaded++;
+        }
+    }
+}
+
+// Keep only instructions reachable from an entry point
+static void mark_reachable(Peephole* peephole) {
+    Compiler* compiler = peephole->compiler;
+    const Instruction* code = compiler->bytecode;
+    size_t size = compiler->bytecode_size;
+    size_t* worklist = (size_t*)malloc((size + compiler->function_count + 1) * sizeof(size_t));
+    size_t pending = 0;
+
+    memset(peephole->keep, 0, size);
+    worklist[pending++] = 0;
+    for (size_t i = 0; i < compiler->function_count; i++) {
+        if (compiler->functions[i].type == FUNC_SCRIPT) worklist[pending++] = compiler->functions[i].address;
+    }
+    while (pending > 0) {
+        size_t pc = worklist[--pending];
+        // Follow the fall-through path, queueing branch targets
+        while (pc < size && !peephole->keep[pc]) {
+            peephole->keep[pc] = 1;
+            OpCode opcode = code[pc].opcode;
+            if (is_jump(opcode)) worklist[pending++] = (size_t)code[pc].operand;
+            if (opcode == OP_JUMP || is_return(opcode)) break;
+            pc++;
+        }
+    }
+    for (size_t i = 0; i < size; i++) peephole->unreachable += !peephole->keep[i];
+    free(worklist);
+}
+
+static void mark_targets(Peephole* peephole) {
+    Compiler* compiler = peephole->compiler;
+    size_t size = compiler->bytecode_size;
+    memset(peephole->target, 0, size + 1);
+    peephole->target[0] = 1;
+    for (size_t i = 0; i < compiler->function_count; i++) {
+        if (compiler->functions[i].type == FUNC_SCRIPT && compiler->functions[i].address <= size) {
+            peephole->target[compiler->functions[i].address] = 1;
+        }
+    }
+    for (size_t i = 0; i < size; i++) {
+        if (peephole->keep[i] && is_jump(compiler->bytecode[i].opcode)) {
+            peephole->target[compiler->bytecode[i].operand] = 1;
+        }
+    }
+}
+
+// Drop unconditional jumps to the next surviving instruction
+static void remove_dead_jumps(Peephole* peephole) {
+    const Instruction* code = peephole->compiler->bytecode;
+    size_t size = peephole->compiler->bytecode_size;
+    // Right to left, so a removed jump can make the one before it dead
+    for (size_t i = size; i-- > 0;) {
+        if (!peephole->keep[i] || code[i].opcode != OP_JUMP) continue;
+        size_t destination = (size_t)code[i].operand;
+        if (destination <= i) continue;
+        size_t next = i + 1;
+        while (next < destination && !peephole->keep[next]) next++;
+        if (next == destination) {
+            peephole->keep[i] = 0;
+            peephole->dead_jumps++;
+        }
+    }
+}
+
+// Instructions [start, start + length) are live and only the first is
+// jumped to, so they can be replaced by one
+static int fusible(const Peephole* peephole, size_t start, size_t length) {
+    if (start + length > peephole->compiler->bytecode_size) return 0;
+    for (size_t i = start; i < start + length; i++) {
+        if (!peephole->keep[i] || (i > start && peephole->target[i])) return 0;
+    }
+    return 1;
+}
+
+static void fuse(Peephole* peephole, size_t start, size_t length, OpCode opcode, int operand) {
+    Instruction* code = peephole->compiler->bytecode;
+    code[start].opcode = opcode;
+    code[start].operand = operand;
+    for (size_t i = start + 1; i < start + length; i++) peephole->keep[i] = 0;
+    peephole->fused++;
+}
+
+static int packable(int first, int second) {
+    return first < PACKED_OPERAND_LIMIT && second < PACKED_OPERAND_LIMIT;
+}
+
+static void fuse_superinstructions(Peephole* peephole) {
+    Instruction* code = peephole->compiler->bytecode;
+    size_t size = peephole->compiler->bytecode_size;
+    for (size_t i = 0; i < size; i++) {
+        const Instruction* next = &code[i + 1];
+        if (code[i].opcode == OP_LOAD_NAME && fusible(peephole, i, 4) &&
+            next[0].opcode == OP_LOAD_CONST && next[1].opcode == OP_BINARY_ADD &&
+            next[2].opcode == OP_STORE_NAME && next[2].operand == code[i].operand &&
+            packable(code[i].operand, next[0].operand)) {
+            fuse(peephole, i, 4, OP_INC_NAME, PACK_OPERANDS(code[i].operand, next[0].operand));
+            i += 3;
+        } else if (code[i].opcode == OP_LOAD_NAME && fusible(peephole, i, 2) &&
+                   next[0].opcode == OP_LOAD_CONST && packable(code[i].operand, next[0].operand)) {
+            fuse(peephole, i, 2, OP_LOAD_NAME_LOAD_CONST, PACK_OPERANDS(code[i].operand, next[0].operand));
+            i += 1;
+        } else if (code[i].opcode == OP_LOAD_NAME && fusible(peephole, i, 2) &&
+                   next[0].opcode == OP_RETURN_VALUE) {
+            fuse(peephole, i, 2, OP_LOAD_NAME_RETURN, code[i].operand);
+            i += 1;
+        } else if ((code[i].opcode == OP_COMPARE_EQ || code[i].opcode == OP_COMPARE_LT) &&
+                   fusible(peephole, i, 2) && next[0].opcode == OP_JUMP_IF_FALSE) {
+            fuse(peephole, i, 2, code[i].opcode == OP_COMPARE_EQ ? OP_COMPARE_EQ_JUMP_IF_FALSE
+                                                                 : OP_COMPARE_LT_JUMP_IF_FALSE,
+                 next[0].operand);
+            i += 1;
+        }
+    }
+}
+
+// STORE_NAME x; LOAD_NAME x leaves x's value on the stack, which DUP
+// does without a variable lookup (likewise for locals). Not when something
+// jumps to the load.
+static void combine_store_load(Peephole* peephole) {
+    Instruction* code = peephole->compiler->bytecode;
+    size_t size = peephole->compiler->bytecode_size;
+    for (size_t i = 0; i + 1 < size; i++) {
+        if (!peephole->keep[i] || (code[i].opcode != OP_STORE_NAME && code[i].opcode != OP_STORE_LOCAL)) continue;
+        OpCode load = code[i].opcode == OP_STORE_NAME ? OP_LOAD_NAME : OP_LOAD_LOCAL;
+        size_t next = i + 1;
+        while (next < size && !peephole->keep[next] && !peephole->target[next]) next++;
+        if (next >= size || peephole->target[next] || !peephole->keep[next]) continue;
+        if (code[next].opcode != load || code[next].operand != code[i].operand) continue;
+        code[next].opcode = code[i].opcode;
+        code[i].opcode = OP_DUP;
+        code[i].operand = 0;
+        peephole->dups++;
+    }
+}
+
+// Squeeze out deleted instructions and fix up every address. Returns the
+// number removed.
+static size_t compact(Peephole* peephole) {
+    Compiler* compiler = peephole->compiler;
+    Instruction* code = compiler->bytecode;
+    size_t size = compiler->bytecode_size;
+
+    // A deleted instruction relocates to the next one that survives
+    size_t kept = 0;
+    for (size_t i = 0; i < size; i++) {
+        peephole->relocation[i] = kept;
+        kept += peephole->keep[i];
+    }
+    peephole->relocation[size] = kept;
+
+    size_t out = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (!peephole->keep[i]) continue;
+        code[out] = code[i];
+        if (is_jump(code[out].opcode)) code[out].operand = (int)peephole->relocation[code[out].operand];
+        out++;
+    }
+    for (size_t i = 0; i < compiler->function_count; i++) {
+        CompiledFunction* func = &compiler->functions[i];
+        if (func->type == FUNC_SCRIPT && func->address <= size) func->address = peephole->relocation[func->address];
+    }
+    compiler->bytecode_size = out;
+    return size - out;
+}
+
+// Optimize compiler->bytecode in place. Level 0 leaves it untouched.
+// Returns the number of instructions removed.
+size_t optimize_bytecode(Compiler* compiler, int level) {
+    if (level < 1 || compiler->bytecode_size == 0) return 0;
+
+    size_t original_size = compiler->bytecode_size;
+    Peephole peephole = {0};
+    peephole.compiler = compiler;
+    peephole.keep = (uint8_t*)malloc(original_size);
+    peephole.target = (uint8_t*)malloc(original_size + 1);
+    peephole.relocation = (size_t*)malloc((original_size + 1) * sizeof(size_t));
+
+    size_t removed;
+    do {
+        thread_jumps(&peephole);
+        mark_reachable(&peephole);
+        remove_dead_jumps(&peephole);
+        mark_targets(&peephole);
+        fuse_superinstructions(&peephole);
+        combine_store_load(&peephole);
+        removed = compact(&peephole);
+    } while (removed > 0);
+
+    TRACE(TRACE_OPTIMIZER, 1, "peephole: %zu -> %zu instructions (%zu unreachable, %zu dead jumps removed), "
+          "threaded %zu jumps, %zu superinstructions, %zu store/load pairs to DUP",
+          original_size, compiler->bytecode_size, peephole.unreachable, peephole.dead_jumps,
+          peephole.threaded, peephole.fused, peephole.dups);
+
+    free(peephole.keep);
+    free(peephole.target);
+    free(peephole.relocation);
+    return original_size - compiler->bytecode_size;
+}
@@ -5,12 +5,113 @@
 
 #include "flipscript.h"
 #include "flipscript_types.h"
+#include "trace.h"
 
-// Faux C binding for a print function for testing.
-void* c_print(void** args) {
-    // In a real system, you would check the type of args[0]
-    printf("%s\n", (char*)args[0]);
-    return NULL;
+// Deepest script recursion before the VMs report a call stack overflow.
+// Build with -DFLIPSCRIPT_MAX_CALL_DEPTH=n to change it.
+#ifndef FLIPSCRIPT_MAX_CALL_DEPTH
+#define FLIPSCRIPT_MAX_CALL_DEPTH 100000
+#endif
+
+static int run_bytecode(Runtime* runtime, int decode_only);
+
+// Write a value the way a script would print it
+void print_value(FILE* file, Value value) {
+    if (value_is_int(value)) fprintf(file, "%ld", value_as_int(value));
+    else if (value_is_float(value)) fprintf(file, "%g", value_as_float(value));
+    else if (value_is_string(value)) fputs(value_as_string(value), file);
+    else if (value == VALUE_TRUE) fputs("True", file);
+    else if (value == VALUE_FALSE) fputs("False", file);
+    else fputs("None", file);
+}
+
+// Resolve every name in the program's c_functions pool to a host
+// function, in pool order so the VM can index the table directly, and
+// check each native function's arity against it once here rather than per
+// call. Reports every unresolved name before failing.
+static int link_host_functions(Runtime* runtime, const Compiler* compiler) {
+    int failed = 0;
+    for (size_t i = 0; i < runtime->c_function_count; i++) {
+        const char* name = compiler->c_functions.strings[i];
+        const CompiledFunction* caller = NULL;
+        for (size_t f = 0; f < runtime->function_count_ref; f++) {
+            if (runtime->functions[f].type == FUNC_NATIVE && runtime->functions[f].address == i) {
+                caller = &runtime->functions[f];
+                break;
+            }
+        }
+        HostFunction* host = &runtime->c_functions[i];
+        if (resolve_host_function(name, caller ? (int)caller->arity : -1, host) != 0) {
+            fprintf(stderr, "Error: Unresolved C function '%s'\n", name);
+            failed = 1;
+        }
+    }
+    if (failed) return -1;
+
+    for (size_t i = 0; i < runtime->function_count_ref; i++) {
+        const CompiledFunction* func = &runtime->functions[i];
+        if (func->type != FUNC_NATIVE) continue;
+        if (func->address >= runtime->c_function_count) {
+            fprintf(stderr, "Error: C function index out of bounds\n");
+            return -1;
+        }
+        const HostFunction* host = &runtime->c_functions[func->address];
+        if ((size_t)host->arity != func->arity) {
+            fprintf(stderr, "Error: %s takes %zu arguments but its C function %s takes %d\n",
+                    symbol_name(func->name), func->arity, host->name, host->arity);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Check the operands the interpreter uses without checking them itself, so
+// that bytecode from a file cannot make it read outside its tables or jump
+// outside the code. Runs once at load time; returns 0 if the code is safe.
+static int validate_bytecode(const Runtime* runtime) {
+    for (size_t pc = 0; pc < runtime->bytecode_size; pc++) {
+        const Instruction* instruction = &runtime->bytecode[pc];
+        size_t operand = (size_t)(uint32_t)instruction->operand;
+        int valid = 1;
+        switch (instruction->opcode) {
+            case OP_LOAD_CONST:
+                valid = instruction->operand >= 0 && operand < runtime->constant_count;
+                break;
+            case OP_LOAD_NAME:
+            case OP_STORE_NAME:
+            case OP_LOAD_NAME_RETURN:
+                valid = instruction->operand >= 0 && operand < runtime->variable_count;
+                break;
+            case OP_LOAD_NAME_LOAD_CONST:
+            case OP_INC_NAME:
+                valid = PACKED_FIRST(operand) < runtime->variable_count &&
+                        PACKED_SECOND(operand) < runtime->constant_count;
+                break;
+            case OP_CALL_FUNCTION:
+                valid = instruction->operand >= 0 && operand < runtime->function_count_ref &&
+                        runtime->functions[operand].type == FUNC_SCRIPT &&
+                        runtime->functions[operand].address <= runtime->bytecode_size;
+                break;
+            case OP_CALL_C_FUNCTION:
+                valid = instruction->operand >= 0 && operand < runtime->c_function_count;
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_COMPARE_EQ_JUMP_IF_FALSE:
+            case OP_COMPARE_LT_JUMP_IF_FALSE:
+                // Jumping to the end of the code ends the script
+                valid = instruction->operand >= 0 && operand <= runtime->bytecode_size;
+                break;
+            default:
+                break;
+        }
+        if (!valid) {
+            fprintf(stderr, "Error: Invalid operand %d for opcode %d at %zu\n",
+                    instruction->operand, instruction->opcode, pc);
+            return -1;
+        }
+    }
+    return 0;
 }
 
 // Initialize runtime environment
@@ -18,19 +119,33 @@ Runtime* init_runtime(Compiler* compiler) {
     Runtime* runtime = (Runtime*)malloc(sizeof(Runtime));
     runtime->bytecode = compiler->bytecode;
     runtime->bytecode_size = compiler->bytecode_size;
-    runtime->constants = compiler->constants;
-    runtime->constant_count = compiler->constant_count;
-    runtime->variables = (void**)calloc(compiler->name_count, sizeof(void*));
-    runtime->variable_count = compiler->name_count;
+    // Constants were decoded by the compiler; box each one once
+    runtime->constant_count = compiler->constants.count;
+    runtime->constants = (Value*)malloc((runtime->constant_count ? runtime->constant_count : 1) * sizeof(Value));
+    for (size_t i = 0; i < runtime->constant_count; i++) {
+        const Constant* constant = &compiler->constants.entries[i];
+        switch (constant->type) {
+            case CONST_INT:    runtime->constants[i] = value_from_int(constant->as.integer); break;
+            case CONST_FLOAT:  runtime->constants[i] = value_from_float(constant->as.number); break;
+            case CONST_BOOL:   runtime->constants[i] = value_from_bool((int)constant->as.integer); break;
+            case CONST_STRING: runtime->constants[i] = value_from_string(symbol_name(constant->as.string)); break;
+            case CONST_NONE:   runtime->constants[i] = VALUE_NONE; break;
+        }
+    }
+    runtime->variable_count = compiler->names.count;
+    runtime->variables = (Value*)malloc((runtime->variable_count ? runtime->variable_count : 1) * sizeof(Value));
+    for (size_t i = 0; i < runtime->variable_count; i++) runtime->variables[i] = VALUE_NONE;
     
-    // Wire up the print function
-    runtime->c_functions = (CFunctionPtr*)calloc(1, sizeof(CFunctionPtr)); // Only 1 C func for now
-    runtime->c_functions[0] = &c_print;
-    runtime->c_function_count = 1;
-
-    runtime->stack_capacity = 1000;
-    runtime->stack = (void**)malloc(runtime->stack_capacity * sizeof(void*));
-    runtime->stack_size = 0;
+    runtime->c_function_count = compiler->c_functions.count;
+    runtime->c_functions = (HostFunction*)calloc(runtime->c_function_count ? runtime->c_function_count : 1,
+                                                 sizeof(HostFunction));
+
+    // The stack starts with the top-level code's frame
+    runtime->top_level_locals = compiler->top_level_locals;
+    runtime->stack_capacity = 1000 + runtime->top_level_locals;
+    runtime->stack = (Value*)malloc(runtime->stack_capacity * sizeof(Value));
+    runtime->stack_size = runtime->top_level_locals;
+    for (size_t i = 0; i < runtime->stack_size; i++) runtime->stack[i] = VALUE_NONE;
     
     runtime->pc = 0;
 
@@ -42,150 +157,703 @@ Runtime* init_runtime(Compiler* compiler) {
     // Get reference to compiled functions
     runtime->functions = compiler->functions;
     runtime->function_count_ref = compiler->function_count;
+    if (link_host_functions(runtime, compiler) != 0 || validate_bytecode(runtime) != 0) {
+        free(runtime->constants);
+        free(runtime->variables);
+        free(runtime->c_functions);
+        free(runtime->stack);
+        free(runtime->call_frames);
+        free(runtime);
+        return NULL;
+    }
+
+    runtime->opcode_pairs = NULL;
+    runtime->threaded_code = NULL;
+    run_bytecode(runtime, 1);
+    runtime->register_program = compiler->registers.code ? &compiler->registers : NULL;
+    runtime->registers = NULL;
+    runtime->register_capacity = 0;
+
+    runtime->strings = NULL;
+    runtime->string_count = 0;
+    runtime->string_capacity = 0;
 
     return runtime;
 }
 
+// Release a runtime and the strings it created
+void free_runtime(Runtime* runtime) {
+    for (size_t i = 0; i < runtime->string_count; i++) free(runtime->strings[i]);
+    free(runtime->strings);
+    free(runtime->constants);
+    free(runtime->variables);
+    free(runtime->c_functions);
+    free(runtime->stack);
+    free(runtime->call_frames);
+    free(runtime->registers);
+    free(runtime->threaded_code);
+    free(runtime);
+}
+
 // Push a value onto the stack
-void push(Runtime* runtime, void* value) {
+void push(Runtime* runtime, Value value) {
     if (runtime->stack_size >= runtime->stack_capacity) {
         runtime->stack_capacity *= 2;
-        runtime->stack = (void**)realloc(
-            runtime->stack, runtime->stack_capacity * sizeof(void*));
+        runtime->stack = (Value*)realloc(
+            runtime->stack, runtime->stack_capacity * sizeof(Value));
     }
     runtime->stack[runtime->stack_size++] = value;
 }
 
-// Pop a value from the stack
-void* pop(Runtime* runtime) {
-    if (runtime->stack_size == 0) {
-        fprintf(stderr, "Error: Stack underflow\n");
-        exit(1);
+// Push a call frame, growing the frame array as recursion deepens.
+// Returns NULL past FLIPSCRIPT_MAX_CALL_DEPTH.
+static CallFrame* push_frame(Runtime* runtime) {
+    if (runtime->frame_count >= runtime->frame_capacity) {
+        if (runtime->frame_capacity >= FLIPSCRIPT_MAX_CALL_DEPTH) {
+            fprintf(stderr, "Error: Call stack overflow\n");
+            return NULL;
+        }
+        runtime->frame_capacity *= 2;
+        if (runtime->frame_capacity > FLIPSCRIPT_MAX_CALL_DEPTH) runtime->frame_capacity = FLIPSCRIPT_MAX_CALL_DEPTH;
+        runtime->call_frames = (CallFrame*)realloc(
+            runtime->call_frames, runtime->frame_capacity * sizeof(CallFrame));
     }
+    return &runtime->call_frames[runtime->frame_count++];
+}
+
+// Pop a value from the stack. The interpreter checks the depth first.
+Value pop(Runtime* runtime) {
     return runtime->stack[--runtime->stack_size];
 }
 
-// Execute bytecode
-void execute_bytecode(Runtime* runtime) {
-    while (runtime->pc < runtime->bytecode_size) {
-        Instruction instruction = runtime->bytecode[runtime->pc++];
-        
-        switch (instruction.opcode) {
-            case OP_LOAD_CONST:
-                push(runtime, runtime->constants[instruction.operand]);
-                break;
-            
-            case OP_LOAD_NAME:
-                if ((size_t)instruction.operand >= runtime->variable_count) {
-                    fprintf(stderr, "Error: Variable index out of bounds\n");
-                    return;
+// Concatenate two strings into a new string owned by the runtime
+static Value concat_strings(Runtime* runtime, const char* left, const char* right) {
+    size_t left_length = strlen(left);
+    size_t right_length = strlen(right);
+    char* result = (char*)malloc(left_length + right_length + 1);
+    memcpy(result, left, left_length);
+    memcpy(result + left_length, right, right_length + 1);
+    if (runtime->string_count >= runtime->string_capacity) {
+        runtime->string_capacity = runtime->string_capacity ? runtime->string_capacity * 2 : 16;
+        runtime->strings = (char**)realloc(runtime->strings, runtime->string_capacity * sizeof(char*));
+    }
+    runtime->strings[runtime->string_count++] = result;
+    return value_from_string(result);
+}
+
+// Apply an arithmetic operator. Two ints stay ints (becoming a float on
+// overflow); any float operand makes the result a float. Returns 0 if the
+// operands do not support the operator.
+static int arithmetic(OpCode opcode, Value left, Value right, Value* result) {
+    if (!value_is_number(left) || !value_is_number(right)) return 0;
+    if (value_is_int(left) && value_is_int(right)) {
+        long a = value_as_int(left), b = value_as_int(right), r;
+        switch (opcode) {
+            case OP_BINARY_ADD: r = a + b; break;     // 48-bit operands cannot overflow a long
+            case OP_BINARY_SUB: r = a - b; break;
+            case OP_BINARY_MUL:
+                if (__builtin_mul_overflow(a, b, &r)) {
+                    *result = value_from_float((double)a * (double)b);
+                    return 1;
                 }
-                push(runtime, runtime->variables[instruction.operand]);
                 break;
+            default: r = a / b; break;                // Caller rejects division by zero
+        }
+        *result = value_from_int(r);
+        return 1;
+    }
+    double a = value_to_float(left), b = value_to_float(right);
+    switch (opcode) {
+        case OP_BINARY_ADD: *result = value_from_float(a + b); break;
+        case OP_BINARY_SUB: *result = value_from_float(a - b); break;
+        case OP_BINARY_MUL: *result = value_from_float(a * b); break;
+        default:            *result = value_from_float(a / b); break;
+    }
+    return 1;
+}
+
+static int values_equal(Value left, Value right) {
+    if (value_is_number(left) && value_is_number(right)) {
+        if (value_is_int(left) && value_is_int(right)) return left == right;
+        return value_to_float(left) == value_to_float(right);
+    }
+    if (value_is_string(left) && value_is_string(right)) {
+        return strcmp(value_as_string(left), value_as_string(right)) == 0;
+    }
+    return left == right;
+}
+
+// Apply a comparison operator. Numbers and strings can be ordered; any
+// two values can be tested for equality. Returns 0 (after reporting) if
+// the operands cannot be ordered.
+static int compare_operation(OpCode opcode, Value left, Value right, int* truth) {
+    if (opcode == OP_COMPARE_EQ || opcode == OP_COMPARE_NEQ) {
+        *truth = values_equal(left, right) == (opcode == OP_COMPARE_EQ);
+        return 1;
+    }
+    int order;
+    if (value_is_int(left) && value_is_int(right)) {
+        long a = value_as_int(left), b = value_as_int(right);
+        order = (a > b) - (a < b);
+    } else if (value_is_number(left) && value_is_number(right)) {
+        double a = value_to_float(left), b = value_to_float(right);
+        order = (a > b) - (a < b);
+    } else if (value_is_string(left) && value_is_string(right)) {
+        order = strcmp(value_as_string(left), value_as_string(right));
+    } else {
+        fprintf(stderr, "Error: Unsupported operand types for %s\n", opcode == OP_COMPARE_LT ? "<" : ">");
+        return 0;
+    }
+    *truth = opcode == OP_COMPARE_LT ? order < 0 : order > 0;
+    return 1;
+}
+
+// Python truthiness: None, False, 0, 0.0 and "" are false
+static int value_truthy(Value value) {
+    if (value_is_int(value)) return value_as_int(value) != 0;
+    if (value_is_float(value)) return value_as_float(value) != 0.0;
+    if (value_is_string(value)) return value_as_string(value)[0] != '\0';
+    return value == VALUE_TRUE;
+}
+
+static const char* operator_symbol(OpCode opcode) {
+    switch (opcode) {
+        case OP_BINARY_ADD: return "+";
+        case OP_BINARY_SUB: return "-";
+        case OP_BINARY_MUL: return "*";
+        default: return "/";
+    }
+}
+
+// Apply +, -, * or / with the language's rules, reporting errors.
+// Returns 0 if the script must stop.
+static int binary_operation(Runtime* runtime, OpCode opcode, Value left, Value right, Value* result) {
+    if (opcode == OP_BINARY_ADD && value_is_string(left) && value_is_string(right)) {
+        *result = concat_strings(runtime, value_as_string(left), value_as_string(right));
+        return 1;
+    }
+    if (opcode == OP_BINARY_DIV && value_is_int(right) && value_as_int(right) == 0) {
+        fprintf(stderr, "Error: Division by zero\n");
+        return 0;
+    }
+    if (!arithmetic(opcode, left, right, result)) {
+        fprintf(stderr, "Error: Unsupported operand types for %s\n", operator_symbol(opcode));
+        return 0;
+    }
+    return 1;
+}
+
+// Dispatch. GCC and Clang builds thread the code: each instruction is
+// pre-decoded to the address of its handler, and every handler jumps
+// straight to the next one's. That gives the branch predictor one
+// indirect jump per handler to learn instead of one shared switch, and
+// needs no end-of-code check: a sentinel handler ends the script.
+// Build with `make DISPATCH=switch` for the portable switch loop.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(FLIPSCRIPT_SWITCH_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+#ifdef FLIPSCRIPT_TRACE
+// Trace the instruction at `pc` and count the pair it forms with the last
+static void trace_step(Runtime* runtime, size_t pc, OpCode* previous) {
+    if (pc >= runtime->bytecode_size) return;
+    const Instruction* instruction = &runtime->bytecode[pc];
+    TRACE(TRACE_VM, 2, "%4zu: opcode %d operand %d, stack depth %zu",
+          pc, instruction->opcode, instruction->operand, runtime->stack_size);
+    if (runtime->opcode_pairs && *previous != OP_COUNT) {
+        runtime->opcode_pairs[*previous * OP_COUNT + instruction->opcode]++;
+    }
+    *previous = instruction->opcode;
+}
+#define TRACE_STEP() trace_step(runtime, pc, &previous)
+#else
+#define TRACE_STEP() ((void)0)
+#endif
+
+// Stop the script unless the current frame has `count` values above its
+// local slots to pop
+#define NEED_STACK(count) \
+    do { if (runtime->stack_size < base + locals + (count)) goto stack_underflow; } while (0)
+
+#ifdef THREADED_DISPATCH
+#define TARGET(opcode) TARGET_##opcode:
+#define DISPATCH() do { TRACE_STEP(); ip = &code[pc++]; goto *ip->handler; } while (0)
+#else
+#define TARGET(opcode) case opcode:
+#define DISPATCH() continue
+#endif
+
+// Run the bytecode from runtime->pc, returning 0 when the script ends and
+// -1 on a runtime error. With decode_only set it instead pre-decodes
+// runtime->bytecode into runtime->threaded_code, which has to happen in
+// here because handler addresses are local to this function.
+static int run_bytecode(Runtime* runtime, int decode_only) {
+#ifdef FLIPSCRIPT_TRACE
+    OpCode previous = OP_COUNT;
+#endif
+    size_t pc = runtime->pc;
+    size_t base = 0;    // Stack index of the current frame's slot 0
+    size_t locals = runtime->top_level_locals;      // Slots in the current frame
+#ifdef THREADED_DISPATCH
+    static const void* const handlers[OP_COUNT] = {
+        [OP_LOAD_CONST] = &&TARGET_OP_LOAD_CONST,
+        [OP_LOAD_NAME] = &&TARGET_OP_LOAD_NAME,
+        [OP_STORE_NAME] = &&TARGET_OP_STORE_NAME,
+        [OP_DUP] = &&TARGET_OP_DUP,
+        [OP_LOAD_LOCAL] = &&TARGET_OP_LOAD_LOCAL,
+        [OP_STORE_LOCAL] = &&TARGET_OP_STORE_LOCAL,
+        [OP_HALT] = &&TARGET_OP_HALT,
+        [OP_BINARY_ADD] = &&TARGET_OP_BINARY_ADD,
+        [OP_BINARY_SUB] = &&TARGET_OP_BINARY_SUB,
+        [OP_BINARY_MUL] = &&TARGET_OP_BINARY_MUL,
+        [OP_BINARY_DIV] = &&TARGET_OP_BINARY_DIV,
+        [OP_COMPARE_EQ] = &&TARGET_OP_COMPARE_EQ,
+        [OP_COMPARE_NEQ] = &&TARGET_OP_COMPARE_NEQ,
+        [OP_COMPARE_GT] = &&TARGET_OP_COMPARE_GT,
+        [OP_COMPARE_LT] = &&TARGET_OP_COMPARE_LT,
+        [OP_JUMP_IF_FALSE] = &&TARGET_OP_JUMP_IF_FALSE,
+        [OP_JUMP] = &&TARGET_OP_JUMP,
+        [OP_CALL_FUNCTION] = &&TARGET_OP_CALL_FUNCTION,
+        [OP_RETURN_VALUE] = &&TARGET_OP_RETURN_VALUE,
+        [OP_LOAD_NAME_LOAD_CONST] = &&TARGET_OP_LOAD_NAME_LOAD_CONST,
+        [OP_COMPARE_EQ_JUMP_IF_FALSE] = &&TARGET_OP_COMPARE_EQ_JUMP_IF_FALSE,
+        [OP_COMPARE_LT_JUMP_IF_FALSE] = &&TARGET_OP_COMPARE_LT_JUMP_IF_FALSE,
+        [OP_INC_NAME] = &&TARGET_OP_INC_NAME,
+        [OP_LOAD_NAME_RETURN] = &&TARGET_OP_LOAD_NAME_RETURN,
+        [OP_CALL_C_FUNCTION] = &&TARGET_OP_CALL_C_FUNCTION,
+    };
+    if (decode_only) {
+        size_t size = runtime->bytecode_size;
+        ThreadedInstruction* decoded = (ThreadedInstruction*)malloc((size + 1) * sizeof(ThreadedInstruction));
+        for (size_t i = 0; i < size; i++) {
+            OpCode opcode = runtime->bytecode[i].opcode;
+            decoded[i].handler = (unsigned)opcode < OP_COUNT && handlers[opcode] ? handlers[opcode] : &&TARGET_UNKNOWN;
+            decoded[i].opcode = opcode;
+            decoded[i].operand = runtime->bytecode[i].operand;
+        }
+        // Falling off the end of the code ends the script
+        decoded[size].handler = &&TARGET_END;
+        decoded[size].opcode = OP_COUNT;
+        decoded[size].operand = 0;
+        runtime->threaded_code = decoded;
+        return 0;
+    }
+    const ThreadedInstruction* code = runtime->threaded_code;
+    const ThreadedInstruction* ip;
+    DISPATCH();
+#else
+    if (decode_only) return 0;
+    const Instruction* code = runtime->bytecode;
+    const Instruction* ip;
+    for (;;) {
+        if (pc >= runtime->bytecode_size) return 0;
+        TRACE_STEP();
+        ip = &code[pc++];
+        switch (ip->opcode) {
+#endif
+        TARGET(OP_LOAD_CONST)
+            push(runtime, runtime->constants[ip->operand]);
+            DISPATCH();
+        
+        TARGET(OP_LOAD_NAME)
+            push(runtime, runtime->variables[ip->operand]);
+            DISPATCH();
+        
+        TARGET(OP_STORE_NAME)
+            NEED_STACK(1);
+            runtime->variables[ip->operand] = pop(runtime);
+            DISPATCH();
+        
+        TARGET(OP_DUP)
+            NEED_STACK(1);
+            push(runtime, runtime->stack[runtime->stack_size - 1]);
+            DISPATCH();
+        
+        TARGET(OP_LOAD_LOCAL)
+            if ((size_t)ip->operand >= locals) goto bad_local;
+            push(runtime, runtime->stack[base + ip->operand]);
+            DISPATCH();
+        
+        TARGET(OP_STORE_LOCAL)
+            if ((size_t)ip->operand >= locals) goto bad_local;
+            NEED_STACK(1);
+            runtime->stack[base + ip->operand] = pop(runtime);
+            DISPATCH();
+        
+        // --- BINARY OPERATIONS ---
+        TARGET(OP_BINARY_ADD)
+        TARGET(OP_BINARY_SUB)
+        TARGET(OP_BINARY_MUL)
+        TARGET(OP_BINARY_DIV) {
+            NEED_STACK(2);
+            Value right = pop(runtime);
+            Value left = pop(runtime);
+            Value result;
+            if (!binary_operation(runtime, ip->opcode, left, right, &result)) return -1;
+            push(runtime, result);
+            DISPATCH();
+        }
+        // --- COMPARISON OPERATIONS ---
+        TARGET(OP_COMPARE_EQ)
+        TARGET(OP_COMPARE_NEQ)
+        TARGET(OP_COMPARE_GT)
+        TARGET(OP_COMPARE_LT) {
+            NEED_STACK(2);
+            Value right = pop(runtime);
+            Value left = pop(runtime);
+            int truth;
+            if (!compare_operation(ip->opcode, left, right, &truth)) return -1;
+            push(runtime, value_from_bool(truth));
+            DISPATCH();
+        }
+        // --- JUMP OPERATIONS ---
+        TARGET(OP_JUMP_IF_FALSE) {
+            NEED_STACK(1);
+            Value condition = pop(runtime);
+            if (!value_truthy(condition)) {
+                pc = ip->operand;
+            }
+            DISPATCH();
+        }
+        TARGET(OP_JUMP)
+            pc = ip->operand;
+            DISPATCH();
+        
+        // --- FUNCTION OPERATIONS ---
+        TARGET(OP_CALL_FUNCTION) {
+            const CompiledFunction* func = &runtime->functions[ip->operand];
+            NEED_STACK(func->arity);
+            // Push a new call frame
+            CallFrame* frame = push_frame(runtime);
+            if (!frame) return -1;
+            frame->return_address = pc;
+            frame->base = base;
+            frame->frame_size = locals;
+
+            // The arguments on the stack become the first slots of the
+            // callee's frame; its other locals start as None
+            base = runtime->stack_size - func->arity;
+            locals = func->local_count;
+            for (size_t i = func->arity; i < func->local_count; i++) push(runtime, VALUE_NONE);
+
+            // Jump to the function's bytecode
+            pc = func->address;
+            DISPATCH();
+        }
+        TARGET(OP_RETURN_VALUE) {
+            if (runtime->frame_count == 0) {
+                // Returning from top-level script, so we are done
+                return 0;
+            }
+            // Pop the call frame, leaving only the result where the
+            // arguments were
+            NEED_STACK(1);
+            Value result = pop(runtime);
+            CallFrame* frame = &runtime->call_frames[--runtime->frame_count];
+            runtime->stack_size = base;
+            push(runtime, result);
+            base = frame->base;
+            locals = frame->frame_size;
             
-            case OP_STORE_NAME:
-                if ((size_t)instruction.operand >= runtime->variable_count) {
-                    fprintf(stderr, "Error: Variable index out of bounds\n");
-                    return;
-                }
-                runtime->variables[instruction.operand] = pop(runtime);
+            // Jump back to where we were before the call
+            pc = frame->return_address;
+            DISPATCH();
+        }
+        TARGET(OP_HALT)
+            return 0;
+        // --- SUPERINSTRUCTIONS ---
+        TARGET(OP_LOAD_NAME_LOAD_CONST)
+            push(runtime, runtime->variables[PACKED_FIRST(ip->operand)]);
+            push(runtime, runtime->constants[PACKED_SECOND(ip->operand)]);
+            DISPATCH();
+        TARGET(OP_COMPARE_EQ_JUMP_IF_FALSE) {
+            NEED_STACK(2);
+            Value right = pop(runtime);
+            Value left = pop(runtime);
+            if (!values_equal(left, right)) pc = ip->operand;
+            DISPATCH();
+        }
+        TARGET(OP_COMPARE_LT_JUMP_IF_FALSE) {
+            NEED_STACK(2);
+            Value right = pop(runtime);
+            Value left = pop(runtime);
+            int truth;
+            if (value_is_int(left) && value_is_int(right)) {
+                truth = value_as_int(left) < value_as_int(right);
+            } else if (!compare_operation(OP_COMPARE_LT, left, right, &truth)) {
+                return -1;
+            }
+            if (!truth) pc = ip->operand;
+            DISPATCH();
+        }
+        TARGET(OP_INC_NAME) {
+            Value* variable = &runtime->variables[PACKED_FIRST(ip->operand)];
+            Value step = runtime->constants[PACKED_SECOND(ip->operand)];
+            if (value_is_int(*variable) && value_is_int(step)) {
+                *variable = value_from_int(value_as_int(*variable) + value_as_int(step));
+            } else if (!binary_operation(runtime, OP_BINARY_ADD, *variable, step, variable)) {
+                return -1;
+            }
+            DISPATCH();
+        }
+        TARGET(OP_LOAD_NAME_RETURN) {
+            Value result = runtime->variables[ip->operand];
+            if (runtime->frame_count == 0) {
+                push(runtime, result);
+                return 0;
+            }
+            CallFrame* frame = &runtime->call_frames[--runtime->frame_count];
+            runtime->stack_size = base;
+            push(runtime, result);
+            base = frame->base;
+            locals = frame->frame_size;
+            pc = frame->return_address;
+            DISPATCH();
+        }
+        TARGET(OP_CALL_C_FUNCTION) {
+            // The arguments are the top `arity` stack slots, passed in
+            // place. Their count was checked when the runtime was linked.
+            const HostFunction* host = &runtime->c_functions[ip->operand];
+            NEED_STACK((size_t)host->arity);
+            Value* args = runtime->stack + runtime->stack_size - host->arity;
+            if (host->typed && check_native_arguments(host, args) != 0) return -1;
+            Value result = host->trampoline(host->function, args);
+            runtime->stack_size -= host->arity;
+            push(runtime, result);
+            DISPATCH();
+        }
+#ifdef THREADED_DISPATCH
+        TARGET_END:
+            return 0;
+        TARGET_UNKNOWN:
+#else
+        default:
+#endif
+            fprintf(stderr, "Error: Unknown opcode: %d\n", ip->opcode);
+            return -1;
+#ifndef THREADED_DISPATCH
+        }
+    }
+#endif
+stack_underflow:
+    fprintf(stderr, "Error: Stack underflow\n");
+    return -1;
+bad_local:
+    fprintf(stderr, "Error: Local slot %d out of range\n", ip->operand);
+    return -1;
+}
+
+#ifdef FLIPSCRIPT_TRACE
+static const char* const opcode_names[OP_COUNT] = {
+    [OP_LOAD_CONST] = "LOAD_CONST",
+    [OP_LOAD_NAME] = "LOAD_NAME",
+    [OP_STORE_NAME] = "STORE_NAME",
+    [OP_BINARY_ADD] = "BINARY_ADD",
+    [OP_BINARY_SUB] = "BINARY_SUB",
+    [OP_BINARY_MUL] = "BINARY_MUL",
+    [OP_BINARY_DIV] = "BINARY_DIV",
+    [OP_BINARY_MOD] = "BINARY_MOD",
+    [OP_COMPARE_EQ] = "COMPARE_EQ",
+    [OP_COMPARE_NEQ] = "COMPARE_NEQ",
+    [OP_COMPARE_GT] = "COMPARE_GT",
+    [OP_COMPARE_LT] = "COMPARE_LT",
+    [OP_JUMP_IF_FALSE] = "JUMP_IF_FALSE",
+    [OP_JUMP] = "JUMP",
+    [OP_CALL_FUNCTION] = "CALL_FUNCTION",
+    [OP_RETURN_VALUE] = "RETURN_VALUE",
+    [OP_CALL_C_FUNCTION] = "CALL_C_FUNCTION",
+    [OP_DUP] = "DUP",
+    [OP_LOAD_LOCAL] = "LOAD_LOCAL",
+    [OP_STORE_LOCAL] = "STORE_LOCAL",
+    [OP_HALT] = "HALT",
+    [OP_LOAD_NAME_LOAD_CONST] = "LOAD_NAME_LOAD_CONST",
+    [OP_COMPARE_EQ_JUMP_IF_FALSE] = "COMPARE_EQ_JUMP_IF_FALSE",
+    [OP_COMPARE_LT_JUMP_IF_FALSE] = "COMPARE_LT_JUMP_IF_FALSE",
+    [OP_INC_NAME] = "INC_NAME",
+    [OP_LOAD_NAME_RETURN] = "LOAD_NAME_RETURN",
+};
+
+// Trace the most frequent pairs of consecutively executed opcodes, the
+// candidates for new superinstructions
+static void report_opcode_pairs(const size_t* pairs) {
+    enum { REPORTED_PAIRS = 10 };
+    size_t total = 0;
+    for (size_t i = 0; i < OP_COUNT * OP_COUNT; i++) total += pairs[i];
+    TRACE(TRACE_VM, 1, "%zu opcode pairs executed; most frequent:", total);
+    uint8_t* reported = (uint8_t*)calloc(OP_COUNT * OP_COUNT, 1);
+    for (int rank = 0; rank < REPORTED_PAIRS; rank++) {
+        size_t best = 0;
+        for (size_t i = 1; i < OP_COUNT * OP_COUNT; i++) {
+            if (!reported[i] && (reported[best] || pairs[i] > pairs[best])) best = i;
+        }
+        if (reported[best] || pairs[best] == 0) break;
+        reported[best] = 1;
+        TRACE(TRACE_VM, 1, "  %8zu  %5.1f%%  %s %s", pairs[best], 100.0 * pairs[best] / total,
+              opcode_names[best / OP_COUNT], opcode_names[best % OP_COUNT]);
+    }
+    free(reported);
+}
+#endif
+
+// Execute bytecode. Returns 0 on success, -1 if the script failed.
+int execute_bytecode(Runtime* runtime) {
+#ifdef FLIPSCRIPT_TRACE
+    if (TRACE_ENABLED(TRACE_VM, 1)) {
+        runtime->opcode_pairs = (size_t*)calloc(OP_COUNT * OP_COUNT, sizeof(size_t));
+    }
+#endif
+    int status = run_bytecode(runtime, 0);
+#ifdef FLIPSCRIPT_TRACE
+    if (runtime->opcode_pairs) {
+        report_opcode_pairs(runtime->opcode_pairs);
+        free(runtime->opcode_pairs);
+        runtime->opcode_pairs = NULL;
+    }
+#endif
+    return status;
+}
+
+// Make room for registers [0, needed), filling new ones with None
+static void reserve_registers(Runtime* runtime, size_t needed) {
+    if (needed <= runtime->register_capacity) return;
+    size_t capacity = runtime->register_capacity ? runtime->register_capacity : 256;
+    while (capacity < needed) capacity *= 2;
+    runtime->registers = (Value*)realloc(runtime->registers, capacity * sizeof(Value));
+    for (size_t i = runtime->register_capacity; i < capacity; i++) runtime->registers[i] = VALUE_NONE;
+    runtime->register_capacity = capacity;
+}
+
+// Execute the register program built by lower_to_registers(). `regs` is
+// the current frame's window into runtime->registers; the top-level frame
+// starts at 0 and holds the globals. Returns 0 on success, -1 if the
+// script failed.
+int execute_registers(Runtime* runtime) {
+    const RegisterProgram* program = runtime->register_program;
+    const RegInstruction* code = program->code;
+    reserve_registers(runtime, (size_t)program->main_registers);
+    size_t base = 0;
+    size_t frame_size = (size_t)program->main_registers;
+    Value* regs = runtime->registers;
+    size_t pc = 0;
+
+    for (;;) {
+        const RegInstruction* instruction = &code[pc++];
+        TRACE(TRACE_VM, 2, "%4zu: reg opcode %d %d %d %d, frame base %zu",
+              pc - 1, instruction->opcode, instruction->a, instruction->b, instruction->c, base);
+
+        switch (instruction->opcode) {
+            case REG_LOAD_CONST:
+                regs[instruction->a] = runtime->constants[instruction->b];
                 break;
-            
-            // --- BINARY OPERATIONS ---
-            case OP_BINARY_ADD: {
-                long right = atol((char*)pop(runtime));
-                long left = atol((char*)pop(runtime));
-                long result = left + right;
-                char* str_res = malloc(21);
-                snprintf(str_res, 21, "%ld", result);
-                push(runtime, str_res);
+            case REG_MOVE:
+                regs[instruction->a] = regs[instruction->b];
                 break;
-            }
-            case OP_BINARY_SUB: {
-                long right = atol((char*)pop(runtime));
-                long left = atol((char*)pop(runtime));
-                push(runtime, (void*)(left - right));
+            case REG_GET_GLOBAL:
+                regs[instruction->a] = runtime->registers[instruction->b];
                 break;
-            }
-            case OP_BINARY_MUL: {
-                long right = atol((char*)pop(runtime));
-                long left = atol((char*)pop(runtime));
-                push(runtime, (void*)(left * right));
+            case REG_SET_GLOBAL:
+                runtime->registers[instruction->a] = regs[instruction->b];
                 break;
-            }
-            case OP_BINARY_DIV: {
-                long right = atol((char*)pop(runtime));
-                long left = atol((char*)pop(runtime));
-                if (right == 0) {
-                    fprintf(stderr, "Error: Division by zero\n");
-                    return;
+
+            // --- BINARY OPERATIONS ---
+            case REG_ADD:
+            case REG_SUB:
+            case REG_MUL:
+            case REG_DIV: {
+                static const OpCode stack_opcodes[] = {OP_BINARY_ADD, OP_BINARY_SUB, OP_BINARY_MUL, OP_BINARY_DIV};
+                Value left = regs[instruction->b];
+                Value right = regs[instruction->c];
+                // Small ints cannot overflow a long when added or subtracted
+                if (instruction->opcode == REG_ADD && value_is_int(left) && value_is_int(right)) {
+                    regs[instruction->a] = value_from_int(value_as_int(left) + value_as_int(right));
+                    break;
                 }
-                push(runtime, (void*)(left / right));
+                if (instruction->opcode == REG_SUB && value_is_int(left) && value_is_int(right)) {
+                    regs[instruction->a] = value_from_int(value_as_int(left) - value_as_int(right));
+                    break;
+                }
+                Value result;
+                if (!binary_operation(runtime, stack_opcodes[instruction->opcode - REG_ADD], left, right, &result)) return -1;
+                regs[instruction->a] = result;
                 break;
             }
-            // --- COMPARISON OPERATIONS ---
-            case OP_COMPARE_EQ: {
-                void* right = pop(runtime);
-                void* left = pop(runtime);
-                push(runtime, (void*)((long)left == (long)right));
+            case REG_EQ:
+                regs[instruction->a] = value_from_bool(values_equal(regs[instruction->b], regs[instruction->c]));
+                break;
+            case REG_NEQ:
+            case REG_GT:
+            case REG_LT: {
+                static const OpCode stack_opcodes[] = {OP_COMPARE_NEQ, OP_COMPARE_GT, OP_COMPARE_LT};
+                int truth;
+                if (!compare_operation(stack_opcodes[instruction->opcode - REG_NEQ],
+                                       regs[instruction->b], regs[instruction->c], &truth)) return -1;
+                regs[instruction->a] = value_from_bool(truth);
                 break;
             }
+
             // --- JUMP OPERATIONS ---
-            case OP_JUMP_IF_FALSE: {
-                void* condition = pop(runtime);
-                if (!(long)condition) {
-                    runtime->pc = instruction.operand;
-                }
+            case REG_JUMP:
+                pc = (size_t)instruction->a;
                 break;
-            }
-            case OP_JUMP:
-                runtime->pc = instruction.operand;
+            case REG_JUMP_IF_FALSE:
+                if (!value_truthy(regs[instruction->a])) pc = (size_t)instruction->b;
                 break;
-            
+
             // --- FUNCTION OPERATIONS ---
-            case OP_CALL_FUNCTION: {
-                if (runtime->frame_count >= runtime->frame_capacity) {
-                    fprintf(stderr, "Error: Call stack overflow\n");
-                    return;
-                }
-                // Push a new call frame
-                CallFrame* frame = &runtime->call_frames[runtime->frame_count++];
-                frame->return_address = runtime->pc;
+            case REG_CALL: {
+                const RegFunction* func = &program->functions[instruction->b];
+                CallFrame* frame = push_frame(runtime);
+                if (!frame) return -1;
+                frame->return_address = pc;
+                frame->base = base;
+                frame->frame_size = frame_size;
+                frame->result_register = instruction->a;
+
+                // The callee's window starts after ours; arguments become
+                // its first registers
+                size_t callee_base = base + frame_size;
+                size_t arity = runtime->functions[instruction->b].arity;
+                reserve_registers(runtime, callee_base + (size_t)func->register_count);
+                Value* callee = runtime->registers + callee_base;
+                memcpy(callee, runtime->registers + base + instruction->c, arity * sizeof(Value));
+                for (size_t i = arity; i < (size_t)func->register_count; i++) callee[i] = VALUE_NONE;
 
-                // Jump to the function's bytecode
-                runtime->pc = runtime->functions[instruction.operand].address;
+                base = callee_base;
+                frame_size = (size_t)func->register_count;
+                regs = callee;
+                pc = func->address;
                 break;
             }
-            case OP_RETURN_VALUE: {
+            case REG_RETURN: {
+                Value result = regs[instruction->a];
                 if (runtime->frame_count == 0) {
                     // Returning from top-level script, so we are done
-                    return;
+                    return 0;
                 }
-                // Pop the call frame
                 CallFrame* frame = &runtime->call_frames[--runtime->frame_count];
-                
-                // Jump back to where we were before the call
-                runtime->pc = frame->return_address;
+                base = frame->base;
+                frame_size = frame->frame_size;
+                regs = runtime->registers + base;
+                regs[frame->result_register] = result;
+                pc = frame->return_address;
                 break;
             }
-            case OP_CALL_C_FUNCTION: {
-                if ((size_t)instruction.operand >= runtime->c_function_count) {
+            case REG_CALL_NATIVE: {
+                if ((size_t)instruction->b >= runtime->c_function_count) {
                     fprintf(stderr, "Error: C function index out of bounds\n");
-                    return;
+                    return -1;
                 }
-                CFunctionPtr func = runtime->c_functions[instruction.operand];
-                
-                // Simple argument handling for one argument
-                void* args[1];
-                args[0] = pop(runtime);
-
-                void* result = func(args);
-                push(runtime, result);
+                // Arguments are read straight from the frame
+                const HostFunction* host = &runtime->c_functions[instruction->b];
+                if (host->typed && check_native_arguments(host, &regs[instruction->c]) != 0) return -1;
+                regs[instruction->a] = host->trampoline(host->function, &regs[instruction->c]);
                 break;
             }
+            case REG_HALT:
+                return 0;
             default:
-                fprintf(stderr, "Error: Unknown opcode: %d\n", instruction.opcode);
-                return;
+                fprintf(stderr, "Error: Unknown register opcode: %d\n", instruction->opcode);
+                return -1;
         }
     }
 }
@@ -0,0 +1,270 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * Language Server - Incremental re-lex/re-parse loop for editor integration
+ *
+ * The document is kept as an array of lines, tiled into segments: every
+ * line that starts a top-level statement (a non-blank line at column 0
+ * that is not a comment, `elif` or `else`) opens a new segment, and the
+ * segment runs until the next one. Whether a line starts a segment depends
+ * only on its own text, so an edit can only change the segments that
+ * overlap it (and the one before, which inserted or orphaned lines may
+ * join). Those are re-lexed and re-parsed; every other segment keeps its
+ * tokens and AST arena and only has its line offset shifted.
+ *
+ * Protocol (one command per line on stdin):
+ *   open <n>                  followed by n lines: replace the document
+ *   change <start> <end> <n>  followed by n lines: replace lines
+ *                             [start, end) (0-based) with the n lines
+ *   diagnostics               report the current diagnostics again
+ *   shutdown                  exit
+ * Every command except shutdown is answered with
+ *   diagnostics <count> reparsed=<k>/<segments> time_us=<t>
+ *   <line>:<column>: error: <message>     (count times)
+ *   end
+ */
+
+#include <time.h>
+#include "flipscript.h"
+#include "flipscript_types.h"
+#include "trace.h"
+
+// One top-level statement (plus trailing blank and comment lines)
+typedef struct {
+    size_t first_line;          // 0-based line in the document
+    size_t line_count;
+    char* text;                 // Segment source; tokens and AST point into it
+    size_t length;
+    Lexer* lexer;
+    TokenStream* tokens;
+    Ast* ast;                   // Arena holding the segment's statements
+    NodeId* statements;
+    size_t statement_count;
+    size_t statement_capacity;
+    ParseDiagnostic* diagnostics;   // Lines are 1-based, relative to the segment
+    size_t diagnostic_count;
+} Segment;
+
+typedef struct {
+    char** lines;
+    size_t line_count;
+    size_t line_capacity;
+    Segment* segments;
+    size_t segment_count;
+    size_t segment_capacity;
+} Document;
+
+// Does this line start a new top-level statement?
+static int starts_segment(const char* line) {
+    unsigned char c = (unsigned char)line[0];
+    if (c == '\0' || c == '#' || (char_class[c] & CHAR_SPACE)) return 0;
+    // `elif`/`else` continue the `if` statement above them
+    size_t word = scan_identifier(line, 0, strlen(line));
+    if ((word == 4 && strncmp(line, "elif", 4) == 0) || (word == 4 && strncmp(line, "else", 4) == 0)) return 0;
+    return 1;
+}
+
+static void free_segment(Segment* segment) {
+    free_ast(segment->ast);
+    free(segment->statements);
+    free(segment->diagnostics);
+    free_token_stream(segment->tokens);
+    free(segment->lexer);
+    free(segment->text);
+}
+
+// Lex and parse one segment, collecting its syntax errors
+static void parse_segment(Document* document, Segment* segment) {
+    size_t length = 0;
+    for (size_t i = 0; i < segment->line_count; i++) length += strlen(document->lines[segment->first_line + i]) + 1;
+    segment->text = (char*)malloc(length + 1);
+    segment->length = 0;
+    for (size_t i = 0; i < segment->line_count; i++) {
+        const char* line = document->lines[segment->first_line + i];
+        size_t line_length = strlen(line);
+        memcpy(segment->text + segment->length, line, line_length);
+        segment->length += line_length;
+        segment->text[segment->length++] = '\n';
+    }
+
+    segment->lexer = init_lexer(segment->text, segment->length);
+    segment->tokens = tokenize_all(segment->lexer);
+    segment->statements = NULL;
+    segment->statement_count = 0;
+    segment->statement_capacity = 0;
+
+    Parser* parser = init_parser_with_tokens(segment->lexer, segment->tokens);
+    while (parser->current_token.type != TOKEN_EOF) {
+        NodeId statement = parse_statement(parser);
+        if (statement == NULL_NODE) continue;
+        if (segment->statement_count >= segment->statement_capacity) {
+            segment->statement_capacity = segment->statement_capacity ? segment->statement_capacity * 2 : 4;
+            segment->statements = (NodeId*)realloc(segment->statements, segment->statement_capacity * sizeof(NodeId));
+        }
+        segment->statements[segment->statement_count++] = statement;
+    }
+    // Statements that failed to parse leave unreferenced nodes in the
+    // arena; they are released with it.
+    segment->ast = parser->ast;
+    segment->diagnostics = parser->diagnostics;
+    segment->diagnostic_count = parser->diagnostic_count;
+    parser->ast = NULL;
+    parser->diagnostics = NULL;
+    free_parser(parser);
+}
+
+// Split lines [first, last) into segments and parse them into `out`.
+// Returns the number of segments produced.
+static size_t build_segments(Document* document, size_t first, size_t last, Segment** out) {
+    size_t count = 0;
+    for (size_t line = first; line < last; line++) {
+        if (line == first || starts_segment(document->lines[line])) count++;
+    }
+    *out = (Segment*)calloc(count ? count : 1, sizeof(Segment));
+    size_t index = 0;
+    for (size_t line = first; line < last; line++) {
+        if (line == first || starts_segment(document->lines[line])) {
+            (*out)[index].first_line = line;
+            if (index > 0) (*out)[index - 1].line_count = line - (*out)[index - 1].first_line;
+            index++;
+        }
+    }
+    if (count) (*out)[count - 1].line_count = last - (*out)[count - 1].first_line;
+    for (size_t i = 0; i < count; i++) parse_segment(document, &(*out)[i]);
+    return count;
+}
+
+// Replace segments [from, to) with `count` new ones
+static void splice_segments(Document* document, size_t from, size_t to, Segment* replacement, size_t count) {
+    for (size_t i = from; i < to; i++) free_segment(&document->segments[i]);
+    size_t new_count = document->segment_count - (to - from) + count;
+    if (new_count > document->segment_capacity) {
+        document->segment_capacity = new_count * 2;
+        document->segments = (Segment*)realloc(document->segments, document->segment_capacity * sizeof(Segment));
+    }
+    memmove(&document->segments[from + count], &document->segments[to],
+            (document->segment_count - to) * sizeof(Segment));
+    memcpy(&document->segments[from], replacement, count * sizeof(Segment));
+    document->segment_count = new_count;
+}
+
+// Replace lines [start, end) with `new_lines`, taking ownership of them.
+// Returns the number of segments that were re-parsed.
+static size_t apply_change(Document* document, size_t start, size_t end, char** new_lines, size_t new_count) {
+    if (end > document->line_count) end = document->line_count;
+    if (start > end) start = end;
+
+    // Affected segments: the ones overlapping [start, end), plus the one
+    // before, which lines inserted at its end or left orphaned may join
+    size_t from = 0;
+    while (from + 1 < document->segment_count && document->segments[from + 1].first_line <= start) from++;
+    if (from > 0) from--;
+    size_t to = from;
+    while (to < document->segment_count &&
+           (to == from || document->segments[to].first_line < end || document->segments[to].first_line <= start)) {
+        to++;
+    }
+    size_t region_first = document->segment_count ? document->segments[from].first_line : 0;
+    size_t region_last = to < document->segment_count ? document->segments[to].first_line : document->line_count;
+
+    // Edit the line array
+    long delta = (long)new_count - (long)(end - start);
+    for (size_t i = start; i < end; i++) free(document->lines[i]);
+    size_t needed = document->line_count + new_count;
+    if (needed > document->line_capacity) {
+        document->line_capacity = needed * 2;
+        document->lines = (char**)realloc(document->lines, document->line_capacity * sizeof(char*));
+    }
+    memmove(&document->lines[start + new_count], &document->lines[end], (document->line_count - end) * sizeof(char*));
+    memcpy(&document->lines[start], new_lines, new_count * sizeof(char*));
+    document->line_count = (size_t)((long)document->line_count + delta);
+
+    // Re-split the affected region, shift everything after it
+    Segment* replacement;
+    size_t count = build_segments(document, region_first, (size_t)((long)region_last + delta), &replacement);
+    for (size_t i = to; i < document->segment_count; i++) {
+        document->segments[i].first_line = (size_t)((long)document->segments[i].first_line + delta);
+    }
+    splice_segments(document, from, to, replacement, count);
+    free(replacement);
+    return count;
+}
+
+static void report_diagnostics(Document* document, FILE* out, size_t reparsed, long elapsed_us) {
+    size_t count = 0;
+    for (size_t i = 0; i < document->segment_count; i++) count += document->segments[i].diagnostic_count;
+    fprintf(out, "diagnostics %zu reparsed=%zu/%zu time_us=%ld\n", count, reparsed, document->segment_count, elapsed_us);
+    for (size_t i = 0; i < document->segment_count; i++) {
+        Segment* segment = &document->segments[i];
+        for (size_t j = 0; j < segment->diagnostic_count; j++) {
+            const ParseDiagnostic* diagnostic = &segment->diagnostics[j];
+            fprintf(out, "%zu:%d: error: %s\n", segment->first_line + diagnostic->line,
+                    diagnostic->column, diagnostic->message);
+        }
+    }
+    fprintf(out, "end\n");
+    fflush(out);
+}
+
+// Read `count` protocol lines, stripping the trailing newline
+static char** read_lines(FILE* in, size_t count) {
+    char** lines = (char**)malloc((count ? count : 1) * sizeof(char*));
+    for (size_t i = 0; i < count; i++) {
+        char* line = NULL;
+        size_t capacity = 0;
+        ssize_t length = getline(&line, &capacity, in);
+        if (length < 0) {
+            free(line);
+            line = strdup("");
+        } else if (length > 0 && line[length - 1] == '\n') {
+            line[length - 1] = '\0';
+        }
+        lines[i] = line;
+    }
+    return lines;
+}
+
+static long elapsed_microseconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+// Serve incremental diagnostics until `shutdown` or EOF
+int run_language_server(FILE* in, FILE* out) {
+    Document document = {0};
+    char* command = NULL;
+    size_t command_capacity = 0;
+
+    while (getline(&command, &command_capacity, in) >= 0) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t first, last, count;
+        size_t reparsed = 0;
+
+        if (sscanf(command, "open %zu", &count) == 1) {
+            char** lines = read_lines(in, count);
+            reparsed = apply_change(&document, 0, document.line_count, lines, count);
+            free(lines);
+        } else if (sscanf(command, "change %zu %zu %zu", &first, &last, &count) == 3) {
+            char** lines = read_lines(in, count);
+            reparsed = apply_change(&document, first, last, lines, count);
+            free(lines);
+        } else if (strncmp(command, "shutdown", 8) == 0) {
+            break;
+        } else if (strncmp(command, "diagnostics", 11) != 0) {
+            fprintf(out, "error unknown command\n");
+            fflush(out);
+            continue;
+        }
+        long elapsed = elapsed_microseconds(&start);
+        TRACE(TRACE_PARSER, 1, "server: re-parsed %zu of %zu segments in %ld us", reparsed, document.segment_count, elapsed);
+        report_diagnostics(&document, out, reparsed, elapsed);
+    }
+
+    for (size_t i = 0; i < document.segment_count; i++) free_segment(&document.segments[i]);
+    free(document.segments);
+    for (size_t i = 0; i < document.line_count; i++) free(document.lines[i]);
+    free(document.lines);
+    free(command);
+    return 0;
+}
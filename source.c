@@ -0,0 +1,134 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * Source Loading - Maps or streams script sources into memory
+ *
+ * Regular files are memory-mapped read-only, so large inputs are neither
+ * copied nor scanned before lexing. Pipes, character devices and stdin
+ * ("-") cannot be mapped and are read in fixed-size chunks into a
+ * growable buffer instead. Either way the lexer gets a pointer and a
+ * length; the buffer is not NUL-terminated.
+ */
+
+#include "flipscript.h"
+#include "flipscript_types.h"
+#include "trace.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FLIPSCRIPT_HAVE_MMAP 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define SOURCE_CHUNK_SIZE (64 * 1024)
+
+// Read a stream to EOF in chunks, growing the buffer geometrically
+static int read_stream(FILE* file, SourceBuffer* buffer) {
+    size_t capacity = SOURCE_CHUNK_SIZE;
+    size_t length = 0;
+    char* data = (char*)malloc(capacity);
+    if (!data) return -1;
+
+    for (;;) {
+        if (capacity - length < SOURCE_CHUNK_SIZE) {
+            capacity *= 2;
+            char* grown = (char*)realloc(data, capacity);
+            if (!grown) {
+                free(data);
+                return -1;
+            }
+            data = grown;
+        }
+        size_t read = fread(data + length, 1, SOURCE_CHUNK_SIZE, file);
+        length += read;
+        if (read < SOURCE_CHUNK_SIZE) break;
+    }
+
+    if (ferror(file)) {
+        free(data);
+        return -1;
+    }
+    buffer->data = data;
+    buffer->length = length;
+    buffer->is_mapped = 0;
+    return 0;
+}
+
+#ifdef FLIPSCRIPT_HAVE_MMAP
+// Map a regular file. Returns 1 when mapped, 0 when the file is not a
+// regular (or non-empty) file and should be streamed, -1 on error.
+static int map_file(const char* filename, SourceBuffer* buffer) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return 0;
+#ifdef MADV_SEQUENTIAL
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+
+    buffer->data = (const char*)data;
+    buffer->length = (size_t)st.st_size;
+    buffer->is_mapped = 1;
+    return 1;
+}
+#endif
+
+// Load a script source. A filename of "-" reads standard input.
+SourceBuffer* load_source(const char* filename) {
+    SourceBuffer* buffer = (SourceBuffer*)malloc(sizeof(SourceBuffer));
+    if (!buffer) return NULL;
+
+    if (strcmp(filename, "-") == 0) {
+        if (read_stream(stdin, buffer) != 0) {
+            free(buffer);
+            return NULL;
+        }
+        TRACE(TRACE_LEXER, 1, "read %zu bytes from standard input", buffer->length);
+        return buffer;
+    }
+
+#ifdef FLIPSCRIPT_HAVE_MMAP
+    int mapped = map_file(filename, buffer);
+    if (mapped < 0) {
+        free(buffer);
+        return NULL;
+    }
+    if (mapped) {
+        TRACE(TRACE_LEXER, 1, "mapped %zu bytes from input file: %s", buffer->length, filename);
+        return buffer;
+    }
+#endif
+
+    FILE* file = fopen(filename, "rb");
+    if (!file || read_stream(file, buffer) != 0) {
+        if (file) fclose(file);
+        free(buffer);
+        return NULL;
+    }
+    fclose(file);
+    TRACE(TRACE_LEXER, 1, "read %zu bytes from input file: %s", buffer->length, filename);
+    return buffer;
+}
+
+// Release a source buffer and its contents
+void free_source(SourceBuffer* buffer) {
+    if (!buffer) return;
+#ifdef FLIPSCRIPT_HAVE_MMAP
+    if (buffer->is_mapped) {
+        munmap((void*)buffer->data, buffer->length);
+        free(buffer);
+        return;
+    }
+#endif
+    free((void*)buffer->data);
+    free(buffer);
+}
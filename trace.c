@@ -0,0 +1,129 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * Trace Facility Implementation
+ *
+ * Trace lines are formatted into a ring buffer and written to stderr in
+ * large chunks, either when the ring fills up or when trace_flush() is
+ * called (registered with atexit), so tracing every token does not cost a
+ * write per token. Lines from concurrent threads are serialized by a lock.
+ */
+
+#include <stdarg.h>
+#include <pthread.h>
+#include "flipscript.h"
+#include "trace.h"
+
+#define TRACE_RING_SIZE (64 * 1024)
+#define TRACE_LINE_MAX 512
+
+int trace_levels[TRACE_PHASE_COUNT];
+
+static const char* phase_names[TRACE_PHASE_COUNT] = {
+    "lexer", "parser", "optimizer", "compiler", "codegen", "vm"
+};
+
+// Ring buffer state. `head` is where the next byte is written, `tail` is
+// the oldest byte not yet written out; `used` disambiguates full/empty.
+static char trace_ring[TRACE_RING_SIZE];
+static size_t trace_head = 0;
+static size_t trace_tail = 0;
+static size_t trace_used = 0;
+static int trace_registered = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Write out everything currently held in the ring. Caller holds trace_lock.
+static void trace_drain(void) {
+    while (trace_used > 0) {
+        size_t chunk = trace_tail < trace_head ? trace_head - trace_tail : TRACE_RING_SIZE - trace_tail;
+        fwrite(trace_ring + trace_tail, 1, chunk, stderr);
+        trace_tail = (trace_tail + chunk) % TRACE_RING_SIZE;
+        trace_used -= chunk;
+    }
+    fflush(stderr);
+}
+
+void trace_flush(void) {
+    pthread_mutex_lock(&trace_lock);
+    trace_drain();
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// Append bytes to the ring, draining it first if there is not enough room
+static void trace_write(const char* data, size_t length) {
+    if (trace_used + length > TRACE_RING_SIZE) trace_drain();
+    size_t first = TRACE_RING_SIZE - trace_head;
+    if (first > length) first = length;
+    memcpy(trace_ring + trace_head, data, first);
+    memcpy(trace_ring, data + first, length - first);
+    trace_head = (trace_head + length) % TRACE_RING_SIZE;
+    trace_used += length;
+}
+
+void trace_printf(TracePhase phase, const char* format, ...) {
+    char line[TRACE_LINE_MAX];
+    int length = snprintf(line, sizeof(line), "[%s] ", phase_names[phase]);
+
+    va_list args;
+    va_start(args, format);
+    int body = vsnprintf(line + length, sizeof(line) - length - 1, format, args);
+    va_end(args);
+
+    // Clamp truncated lines and terminate every line with a newline
+    if (body < 0) body = 0;
+    length += body;
+    if (length > TRACE_LINE_MAX - 2) length = TRACE_LINE_MAX - 2;
+    line[length++] = '\n';
+
+    pthread_mutex_lock(&trace_lock);
+    trace_write(line, length);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// Make sure buffered trace output survives exit(), including error exits
+static void trace_enable(void) {
+    if (!trace_registered) {
+        atexit(trace_flush);
+        trace_registered = 1;
+    }
+}
+
+// Set every phase to the same level (used by -v, -vv, ...)
+void trace_set_all(int level) {
+    for (int i = 0; i < TRACE_PHASE_COUNT; i++) trace_levels[i] = level;
+    if (level > 0) trace_enable();
+}
+
+// Parse a --trace= specification: a comma separated list of
+// `phase[:level]` items, where phase is a phase name or "all" and level
+// defaults to 1. Returns 0 on success, -1 on a malformed spec.
+int trace_configure(const char* spec) {
+    while (*spec) {
+        size_t name_length = strcspn(spec, ":,");
+        int level = 1;
+        const char* next = spec + name_length;
+        if (*next == ':') {
+            char* end;
+            level = (int)strtol(next + 1, &end, 10);
+            if (end == next + 1 || level < 0) return -1;
+            next = end;
+        }
+        if (*next != ',' && *next != '\0') return -1;
+
+        if (name_length == 3 && strncmp(spec, "all", 3) == 0) {
+            for (int i = 0; i < TRACE_PHASE_COUNT; i++) trace_levels[i] = level;
+        } else {
+            int found = 0;
+            for (int i = 0; i < TRACE_PHASE_COUNT; i++) {
+                if (strlen(phase_names[i]) == name_length && strncmp(spec, phase_names[i], name_length) == 0) {
+                    trace_levels[i] = level;
+                    found = 1;
+                }
+            }
+            if (!found) return -1;
+        }
+
+        spec = *next == ',' ? next + 1 : next;
+    }
+    trace_enable();
+    return 0;
+}
@@ -0,0 +1,46 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * Trace Facility - Per-phase diagnostic output
+ */
+
+#ifndef FLIPSCRIPT_TRACE_H
+#define FLIPSCRIPT_TRACE_H
+
+// Compiler phases that can be traced independently
+typedef enum {
+    TRACE_LEXER,
+    TRACE_PARSER,
+    TRACE_OPTIMIZER,
+    TRACE_COMPILER,
+    TRACE_CODEGEN,
+    TRACE_VM,
+    TRACE_PHASE_COUNT
+} TracePhase;
+
+// Current trace level of each phase (0 = off, 1 = summaries, 2+ = detail)
+extern int trace_levels[TRACE_PHASE_COUNT];
+
+// Configuration, used by the command line front end
+void trace_set_all(int level);
+int trace_configure(const char* spec);
+void trace_flush(void);
+
+// Record one trace line. Call through TRACE() rather than directly.
+void trace_printf(TracePhase phase, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// TRACE(phase, level, format, ...) emits a line when the phase is traced at
+// `level` or above. Release builds (no FLIPSCRIPT_TRACE) compile every call
+// site down to nothing, including the evaluation of its arguments.
+#ifdef FLIPSCRIPT_TRACE
+#define TRACE_ENABLED(phase, level) (trace_levels[(phase)] >= (level))
+#define TRACE(phase, level, ...) \
+    do { \
+        if (TRACE_ENABLED(phase, level)) trace_printf((phase), __VA_ARGS__); \
+    } while (0)
+#else
+#define TRACE_ENABLED(phase, level) 0
+#define TRACE(phase, level, ...) do { } while (0)
+#endif
+
+#endif /* FLIPSCRIPT_TRACE_H */
@@ -0,0 +1,96 @@
+/**
+ * FlipScript - A Python-like language for Flipper Zero with C library binding
+ * Values - NaN-boxed representation used by the VM
+ *
+ * Every VM value is one 64-bit word. Ordinary doubles are stored as
+ * themselves. Everything else hides in the payload of a quiet NaN, which
+ * no arithmetic produces:
+ *
+ *   sign | quiet NaN | 48-bit pointer       string (heap reference)
+ *          quiet NaN | tag 1 | 48-bit int   small integer
+ *          quiet NaN | tag 0 | 1, 2 or 3    None, False, True
+ *
+ * Integers that do not fit in 48 bits become floats.
+ */
+
+#ifndef FLIPSCRIPT_VALUE_H
+#define FLIPSCRIPT_VALUE_H
+
+#include <stdint.h>
+#include <string.h>
+
+typedef uint64_t Value;
+
+#define VALUE_SIGN_BIT  0x8000000000000000ull
+#define VALUE_QNAN      0x7FFC000000000000ull
+#define VALUE_TAG_MASK  0x0003000000000000ull
+#define VALUE_TAG_INT   0x0001000000000000ull
+#define VALUE_PAYLOAD   0x0000FFFFFFFFFFFFull
+
+#define VALUE_NONE      (VALUE_QNAN | 1)
+#define VALUE_FALSE     (VALUE_QNAN | 2)
+#define VALUE_TRUE      (VALUE_QNAN | 3)
+
+#define VALUE_INT_MIN   (-(1L << 47))
+#define VALUE_INT_MAX   ((1L << 47) - 1)
+
+static inline int value_is_float(Value value) {
+    return (value & VALUE_QNAN) != VALUE_QNAN;
+}
+
+static inline int value_is_int(Value value) {
+    return (value & (VALUE_SIGN_BIT | VALUE_QNAN | VALUE_TAG_MASK)) == (VALUE_QNAN | VALUE_TAG_INT);
+}
+
+static inline int value_is_string(Value value) {
+    return (value & (VALUE_SIGN_BIT | VALUE_QNAN)) == (VALUE_SIGN_BIT | VALUE_QNAN);
+}
+
+static inline int value_is_bool(Value value) {
+    return value == VALUE_TRUE || value == VALUE_FALSE;
+}
+
+static inline int value_is_number(Value value) {
+    return value_is_int(value) || value_is_float(value);
+}
+
+static inline Value value_from_float(double number) {
+    Value value;
+    memcpy(&value, &number, sizeof(value));
+    return value;
+}
+
+static inline Value value_from_int(long integer) {
+    if (integer < VALUE_INT_MIN || integer > VALUE_INT_MAX) return value_from_float((double)integer);
+    return VALUE_QNAN | VALUE_TAG_INT | ((uint64_t)integer & VALUE_PAYLOAD);
+}
+
+static inline Value value_from_bool(int truth) {
+    return truth ? VALUE_TRUE : VALUE_FALSE;
+}
+
+static inline Value value_from_string(const char* text) {
+    return VALUE_SIGN_BIT | VALUE_QNAN | ((uint64_t)(uintptr_t)text & VALUE_PAYLOAD);
+}
+
+static inline double value_as_float(Value value) {
+    double number;
+    memcpy(&number, &value, sizeof(number));
+    return number;
+}
+
+static inline long value_as_int(Value value) {
+    // Sign-extend the 48-bit payload
+    return (long)((int64_t)(value << 16) >> 16);
+}
+
+static inline const char* value_as_string(Value value) {
+    return (const char*)(uintptr_t)(value & VALUE_PAYLOAD);
+}
+
+// Numeric value of an int or float
+static inline double value_to_float(Value value) {
+    return value_is_int(value) ? (double)value_as_int(value) : value_as_float(value);
+}
+
+#endif /* FLIPSCRIPT_VALUE_H */